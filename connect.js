@@ -1,8 +1,18 @@
 // UUID Bluetooth
 const SERVICE_UUID = "4fafc201-1fb5-459e-8fcc-c5c9c331914b";
-const CHARACTERISTIC_UUID = "beb5483e-36e1-4688-b7f5-ea07361b26a8";
+const CHARACTERISTIC_UUID = "beb5483e-36e1-4688-b7f5-ea07361b26a8"; // Legacy: tutto su una
+const CMD_CHAR_UUID = "beb5483e-36e1-4688-b7f5-ea07361b26a9";
+const STREAM_UUIDS = [
+    "beb5483e-36e1-4688-b7f5-ea07361b26aa", // Stato e impostazioni
+    "beb5483e-36e1-4688-b7f5-ea07361b26ab", // Vicini, amici, richieste
+    "beb5483e-36e1-4688-b7f5-ea07361b26ac", // Debug, memoria, storico
+];
+const OTA_CHAR_UUID = "beb5483e-36e1-4688-b7f5-ea07361b26ad"; // Aggiornamento firmware
 
-let mochiCharacteristic = null;
+let mochiCharacteristic = null;   // Dove si scrivono i comandi
+let replyCharacteristic = null;   // Dove si rilegge la risposta (write + read)
+let otaCharacteristic = null;     // Aggiornamento firmware (solo firmware recenti)
+let splitChannels = false;        // Firmware con caratteristiche separate
 let connectedDevice = null;
 
 let mochiSettings = {
@@ -25,7 +35,12 @@ const requestsListEl = document.getElementById('requests-list');
 const friendsListEl = document.getElementById('friends-list');
 const btnRefreshSocial = document.getElementById('btn-refresh-social');
 let lastArrayRequest = null;   // 'nearby' | 'friends' | 'requests' (disambigua gli array vuoti)
+let friendsPages = [];          // Pagine di get_friends gia' arrivate (liste lunghe, solo testo)
 let socialPollTimer = null;
+let presenceTimer = null;
+let remotePresence = new Map(); // id -> { hops, age }: Mochi fuori portata saputi dal gossip
+let lastFriends = [];           // Ultima lista amici, per ridisegnarla quando cambia la presenza
+let historyRows = [];           // Campioni ricevuti dall'ultima get_history
 
 // Stato amicizia lato app
 let incomingRequests = [];     // id dei Mochi che ci hanno chiesto l'amicizia
@@ -37,6 +52,7 @@ const settingsPanel = document.getElementById('settings-panel');
 const settingsBackdrop = document.getElementById('settings-backdrop');
 const btnSaveSettings = document.getElementById('btn-save-settings');
 const btnCloseSettings = document.getElementById('btn-close-settings');
+const btnOta = document.getElementById('btn-ota');
 const tzSelector = document.getElementById('tz-selector');
 const colorTopPicker = document.getElementById('color-top');       
 const colorBottomPicker = document.getElementById('color-bottom');
@@ -69,6 +85,12 @@ btnSaveSettings.onclick = () => {
     saveAndUploadSettings();
 };
 
+btnOta.onclick = async () => {
+    btnOta.setAttribute('disabled', 'true');
+    try { await otaUpdate(); }
+    finally { btnOta.removeAttribute('disabled'); }
+};
+
 // 3. API Timezones & Sync
 async function loadTimezones() {
     try {
@@ -140,10 +162,38 @@ async function connectToMochi() {
         
         const server = await device.gatt.connect();
         const service = await server.getPrimaryService(SERVICE_UUID);
-        mochiCharacteristic = await service.getCharacteristic(CHARACTERISTIC_UUID);
-		
-		await mochiCharacteristic.startNotifications();
-		mochiCharacteristic.addEventListener('characteristicvaluechanged', handleNotifications);
+        const legacy = await service.getCharacteristic(CHARACTERISTIC_UUID);
+
+        // Firmware recenti: comandi su una caratteristica, risposte su flussi
+        // separati (stato, social, diagnostica). I pacchetti si riconoscono dal
+        // contenuto, quindi basta lo stesso handleNotifications per tutti.
+        try {
+            const streams = [];
+            for (const uuid of STREAM_UUIDS) streams.push(await service.getCharacteristic(uuid));
+            mochiCharacteristic = await service.getCharacteristic(CMD_CHAR_UUID);
+            replyCharacteristic = streams[0];
+            for (const c of streams) {
+                await c.startNotifications();
+                c.addEventListener('characteristicvaluechanged', handleNotifications);
+            }
+            splitChannels = true;
+        } catch (e) {
+            console.log("[BLE] caratteristica unica (firmware vecchio)");
+            mochiCharacteristic = legacy;
+            replyCharacteristic = legacy;
+            splitChannels = false;
+            await legacy.startNotifications();
+            legacy.addEventListener('characteristicvaluechanged', handleNotifications);
+        }
+
+        // Aggiornamento firmware: caratteristica a parte, assente nei firmware vecchi
+        try {
+            otaCharacteristic = await service.getCharacteristic(OTA_CHAR_UUID);
+            await otaCharacteristic.startNotifications();
+            otaCharacteristic.addEventListener('characteristicvaluechanged', handleOtaNotification);
+        } catch (e) {
+            otaCharacteristic = null;
+        }
         
         onConnected(device.name);
     } catch (e) {
@@ -162,14 +212,22 @@ function updateStatsUI(data) {
 }
 
 async function downloadState() {
+    if (binaryProto) return sendFrame(PT.GET_STATE);
     await sendCmd("get_state");
     // handleNotifications receives the response and calls updateStatsUI
 }
 
+// Storico delle statistiche: i campioni arrivano a pacchetti in handleNotifications.
+function downloadHistory(fromUnix = 0, toUnix = 4294967295, stepS = 3600) {
+    historyRows = [];
+    return sendCmd(`get_history:${fromUnix},${toUnix},${stepS}`);
+}
+
 async function onConnected(name) {
 
+    await negotiateProtocol();
     await downloadSettings();
-    await downloadState();
+    if (!await subscribeState()) await downloadState();
 
     statusText.innerHTML = `<span class="status-dot online"></span> Connesso: ${name}`;
     // Le notifiche sono già attivate e gestite da handleNotifications (in
@@ -184,10 +242,18 @@ async function onConnected(name) {
     await new Promise(r => setTimeout(r, 1000));
     syncMochiTime();
 
-    // Avvia il polling di vicini e amici
-    pollSocial();
+    // Liste social: iscrizione se il Mochi la supporta, altrimenti polling
     if (socialPollTimer) clearInterval(socialPollTimer);
-    socialPollTimer = setInterval(pollSocial, 5000);
+    if (!await subscribeSocial()) {
+        pollSocial();
+        socialPollTimer = setInterval(pollSocial, 5000);
+    }
+    // Amici fuori portata: cambia lentamente (annunci), basta un giro ogni tanto
+    if (presenceTimer) clearInterval(presenceTimer);
+    if (binaryProto && (deviceCaps & CAP_PRESENCE)) {
+        pollPresence();
+        presenceTimer = setInterval(pollPresence, PRESENCE_POLL_MS);
+    }
 }
 
 sliderBrightness.addEventListener('input', (e) => {
@@ -248,12 +314,24 @@ async function downloadSettings() {
 function onDisconnected() {
     statusText.innerHTML = `<span class="status-dot"></span> Disconnesso`;
     mochiCharacteristic = null;
+    replyCharacteristic = null;
+    otaCharacteristic = null;
+    if (otaWake) otaWake(); // l'aggiornamento in corso si ferma (riprende alla riconnessione)
+    binaryProto = false;
+    deviceCaps = 0;
+    socialSubscribed = false;
+    fragments.forEach(m => clearTimeout(m.timer));
+    fragments.clear();
+    friendsPages = [];
     btnConnect.style.display = "block";
     btnDisconnect.style.display = "none";
     cmdButtons.forEach(b => b.setAttribute('disabled', 'true'));
 
     // Ferma il polling social e svuota le liste
     if (socialPollTimer) { clearInterval(socialPollTimer); socialPollTimer = null; }
+    if (presenceTimer) { clearInterval(presenceTimer); presenceTimer = null; }
+    remotePresence.clear();
+    lastFriends = [];
     incomingRequests = [];
     sentRequests.clear();
     nearbyListEl.innerHTML = '<p class="social-empty">Nessun Mochi vicino</p>';
@@ -287,11 +365,470 @@ function sendCmd(action) {
     });
 }
 
+// --- PROTOCOLLO BINARIO (v1, vedi MochiProto.h) ---
+// [0xB1][tipo][reqId][len LE16][TLV...], TLV = [tag][lunghezza][valore].
+// Si usa solo se il Mochi risponde all'HELLO; altrimenti restano i verbi testuali.
+const PROTO_MAGIC = 0xB1;
+const PROTO_REPLY = 0x80;
+const PT = { HELLO: 0x01, GET_STATE: 0x02, GET_SETTINGS: 0x03, GET_NEARBY: 0x04,
+             GET_FRIENDS: 0x05, GET_REQUESTS: 0x06, GET_DEBUG: 0x07,
+             SUB_STATE: 0x08, STATE_EVENT: 0x09, SUB_SOCIAL: 0x0A, SOCIAL_EVENT: 0x0B,
+             GET_PRESENCE: 0x0C, GET_LINK: 0x0D, RESET_LINK: 0x0E, RESEND: 0x0F, ERROR: 0x7F };
+const TAG = { VERSION: 0x01, CAPS: 0x02, MTU: 0x03, FIRMWARE: 0x04, SELF_ID: 0x05, INTERVAL: 0x06,
+              FRAG_MSG: 0x07, FRAG_OFFSET: 0x08,
+              HUNGER: 0x10, HAPPY: 0x11, STR: 0x12, SPD: 0x13, INT: 0x14, CHR: 0x15, AGE: 0x16, KEYFRAME: 0x17,
+              PEER: 0x30, FRIEND: 0x31, REQUEST: 0x32,
+              NEARBY_VER: 0x33, FRIENDS_VER: 0x34, REQUESTS_VER: 0x35,
+              PEER_GONE: 0x36, FRIEND_GONE: 0x37, REQUEST_GONE: 0x38, LIST_RESET: 0x39, REMOTE: 0x3A,
+              ANNOUNCES: 0x40, RECEIVED: 0x41, LAST_SEND: 0x42, LAST_FROM: 0x43,
+              CHANNEL: 0x44, FREE_HEAP: 0x45, AWAY: 0x46, HOSTING: 0x47,
+              LINK_TYPE: 0x48, LINK_RTT: 0x49, VISIT_RTT: 0x4A, LINK_PEER: 0x4B, ERROR_CODE: 0x7F };
+const APP_CAPS = 0x1 | 0x2 | 0x4 | 0x8 | 0x10 | 0x20 | 0x40 | 0x80 | 0x100 | 0x200 | 0x400; // BINARY | HISTORY | MEM | STATE_SUB | FRAGMENT | BATCH | SOCIAL_SUB | OTA | PRESENCE | LINK_STATS | RESEND
+const CAP_BATCH = 0x20;
+const CAP_SOCIAL_SUB = 0x40;
+const CAP_OTA = 0x80;
+const CAP_PRESENCE = 0x100;
+const CAP_LINK_STATS = 0x200;
+const CAP_RESEND = 0x400;
+const PKT_NAMES = ['annuncio', 'visita', 'ack visita', 'richiesta', 'accetta', 'rimuovi', 'fine visita', 'ack link'];
+const PRESENCE_POLL_MS = 15000;
+const SOCIAL_SUB_MS = 1000;        // Al massimo un evento social al secondo
+const CAP_STATE_SUB = 0x8;
+const STATE_SUB_MS = 1000;         // Al massimo una notifica di stato al secondo
+const PE_BUSY = 3;                 // Coda comandi del Mochi piena
+const FRAME_TIMEOUT_MS = 1500;
+
+let binaryProto = false;           // true dopo un HELLO andato a buon fine
+let deviceCaps = 0;
+let deviceMtu = 23;                // MTU negoziato, dall'HELLO
+let protoReqId = 0;
+const pendingFrames = new Map();   // reqId -> resolve della risposta
+
+function le(v, n) { return Array.from({ length: n }, (_, i) => (v >>> (8 * i)) & 0xFF); }
+function leRead(b) { let v = 0; for (let i = b.length - 1; i >= 0; i--) v = (v * 256) + b[i]; return v; }
+function idToString(b) { return 'MOCHI-' + leRead(b.subarray(0, 3)).toString(16).toUpperCase(); }
+
+function encodeFrame(type, reqId, tlvs) {
+    const body = [];
+    for (const [tag, bytes] of tlvs) body.push(tag, bytes.length, ...bytes);
+    return new Uint8Array([PROTO_MAGIC, type, reqId, ...le(body.length, 2), ...body]);
+}
+
+function decodeFrame(bytes) {
+    if (bytes.length < 5 || bytes[0] !== PROTO_MAGIC) return null;
+    const len = bytes[3] | (bytes[4] << 8);
+    if (bytes.length < 5 + len) return null;
+    const tlvs = [];
+    for (let i = 5; i + 2 <= 5 + len;) {
+        const n = bytes[i + 1];
+        if (i + 2 + n > 5 + len) break;
+        tlvs.push({ tag: bytes[i], val: bytes.subarray(i + 2, i + 2 + n) });
+        i += 2 + n;
+    }
+    return { type: bytes[1], reqId: bytes[2], tlvs, size: 5 + len };
+}
+
+// Invia un frame e aspetta la risposta con lo stesso reqId (null se scade).
+// Se la coda comandi del Mochi e' piena (PE_BUSY) riprova dopo una pausa.
+async function sendFrame(type, tlvs = [], retries = 2) {
+    const r = await sendFrameOnce(type, tlvs);
+    if (r && r.type === (PT.ERROR | PROTO_REPLY) && retries > 0) {
+        const code = r.tlvs.find(t => t.tag === TAG.ERROR_CODE);
+        if (code && code.val[0] === PE_BUSY) {
+            await new Promise(res => setTimeout(res, 100));
+            return sendFrame(type, tlvs, retries - 1);
+        }
+    }
+    return r;
+}
+
+function sendFrameOnce(type, tlvs) {
+    return sendBatch([[type, tlvs]]).then(r => r[0]);
+}
+
+// Piu' frame in una sola write (CAP_BATCH): una operazione GATT invece di una
+// per richiesta. Le risposte arrivano concatenate e ognuna risolve la sua promessa.
+function sendBatch(requests) {
+    if (!mochiCharacteristic) return Promise.resolve(requests.map(() => null));
+    const frames = [];
+    const replies = requests.map(([type, tlvs = []]) => {
+        protoReqId = (protoReqId % 255) + 1; // 0 e' riservato agli eventi del Mochi
+        const reqId = protoReqId;
+        frames.push(...encodeFrame(type, reqId, tlvs));
+        return new Promise(resolve => {
+            pendingFrames.set(reqId, resolve);
+            setTimeout(() => { if (pendingFrames.delete(reqId)) resolve(null); }, FRAME_TIMEOUT_MS);
+        });
+    });
+    enqueueGatt(async () => {
+        if (!mochiCharacteristic) return;
+        try { await mochiCharacteristic.writeValue(new Uint8Array(frames)); }
+        catch (e) { console.error("Errore invio frame:", e); }
+    });
+    return Promise.all(replies);
+}
+
+// HELLO: se il firmware non conosce i frame non risponde e si resta sul testo.
+async function negotiateProtocol() {
+    const hello = await sendFrame(PT.HELLO, [[TAG.CAPS, le(APP_CAPS, 4)]]);
+    binaryProto = !!hello && hello.type === (PT.HELLO | PROTO_REPLY);
+    if (binaryProto) {
+        const caps = hello.tlvs.find(t => t.tag === TAG.CAPS);
+        const mtu = hello.tlvs.find(t => t.tag === TAG.MTU);
+        deviceCaps = caps ? leRead(caps.val) : 0;
+        if (mtu) deviceMtu = leRead(mtu.val);
+        console.log(`[BLE PROTO] binario v1, capacità 0x${deviceCaps.toString(16)}, MTU ${mtu ? leRead(mtu.val) : '?'}`);
+    } else {
+        console.log("[BLE PROTO] firmware senza frame binari, uso i comandi testuali");
+    }
+}
+
+// --- AGGIORNAMENTO FIRMWARE (vedi MochiOta.h e OTA_OP_* in MochiProto.h) ---
+// bin/firmware.ota (tools/pack_ota.py): "MOTA", rawSize, compSize, sha256 e lo
+// stream zlib. I pezzi partono in write senza risposta, al massimo OTA_WINDOW
+// oltre l'ultima conferma; se una conferma non arriva si riparte da li', se
+// il Mochi segnala un buco si riparte da dove dice lui. Dopo una
+// disconnessione basta rilanciare: BEGIN con lo stesso hash riprende.
+const OTA_OP = { BEGIN: 0x01, DATA: 0x02, END: 0x03, ABORT: 0x04 };
+const OTA_OK = 0;
+const OTA_BAD_OFFSET = 1;
+const OTA_ERRORS = ["ok", "offset errato", "nessuna sessione", "errore di scrittura", "immagine corrotta",
+                    "hash diverso", "immagine troppo grande", "immagine incompleta", "memoria esaurita",
+                    "richiesta errata"];
+const OTA_HEADER_SIZE = 44;
+const OTA_WINDOW = 12;             // Pezzi in volo (coda del Mochi: 16)
+const OTA_TIMEOUT_MS = 2000;
+const OTA_END_TIMEOUT_MS = 15000;  // END verifica hash e immagine prima di rispondere
+
+const otaReplies = [];
+let otaWake = null;
+
+function handleOtaNotification(event) {
+    const v = event.target.value;
+    const b = new Uint8Array(v.buffer, v.byteOffset, v.byteLength);
+    if (b.length < 6) return;
+    otaReplies.push({ op: b[0] & 0x7F, status: b[1], offset: leRead(b.subarray(2, 6)) });
+    if (otaWake) otaWake();
+}
+
+// Prossima risposta del Mochi, null se scade (o se la connessione cade).
+function nextOtaReply(timeoutMs) {
+    if (otaReplies.length) return Promise.resolve(otaReplies.shift());
+    return new Promise(resolve => {
+        const t = setTimeout(() => { otaWake = null; resolve(null); }, timeoutMs);
+        otaWake = () => { otaWake = null; clearTimeout(t); resolve(otaReplies.shift() || null); };
+    });
+}
+
+function otaWrite(bytes) {
+    return enqueueGatt(async () => {
+        if (!otaCharacteristic) return;
+        try { await otaCharacteristic.writeValueWithoutResponse(new Uint8Array(bytes)); }
+        catch (e) { console.error("Errore invio firmware:", e); }
+    });
+}
+
+function otaStatus(text) {
+    statusText.innerHTML = `<span class="status-dot online"></span> ${text}`;
+}
+
+async function otaUpdate() {
+    if (!otaCharacteristic || !(deviceCaps & CAP_OTA)) {
+        alert("Questo Mochi non si aggiorna via Bluetooth: serve il flash via USB.");
+        return;
+    }
+    let img;
+    try {
+        img = new Uint8Array(await (await fetch(`bin/firmware.ota?v=${Date.now()}`)).arrayBuffer());
+    } catch (e) {
+        alert("Firmware non trovato");
+        return;
+    }
+    const magic = String.fromCharCode(...img.subarray(0, 4));
+    const rawSize = leRead(img.subarray(4, 8));
+    const compSize = leRead(img.subarray(8, 12));
+    if (magic !== "MOTA" || img.length < OTA_HEADER_SIZE + compSize) {
+        alert("File firmware non valido");
+        return;
+    }
+    const sha = img.subarray(12, OTA_HEADER_SIZE);
+    const data = img.subarray(OTA_HEADER_SIZE, OTA_HEADER_SIZE + compSize);
+    // Una write intera per pezzo: MTU - 3 di ATT, meno op e offset
+    const chunk = Math.max(20, Math.min(512, deviceMtu - 3)) - 5;
+
+    const t0 = performance.now();
+    otaReplies.length = 0;
+    // La caratteristica OTA vuole un link abbinato: alla prima write il
+    // telefono chiede il codice che il Mochi mostra sullo schermo.
+    otaStatus("Se richiesto, digita il codice mostrato dal Mochi");
+    await otaWrite([OTA_OP.BEGIN, ...le(rawSize, 4), ...le(compSize, 4), ...sha]);
+    let r = await nextOtaReply(OTA_TIMEOUT_MS * 2);
+    if (!r || r.op !== OTA_OP.BEGIN || r.status !== OTA_OK) {
+        alert(`Aggiornamento rifiutato: ${r ? OTA_ERRORS[r.status] : "nessuna risposta (abbinamento non riuscito?)"}`);
+        return;
+    }
+    let acked = r.offset, sent = acked;
+    if (acked) console.log(`[OTA] ripresa da ${acked}/${compSize} byte`);
+
+    while (acked < compSize) {
+        if (!otaCharacteristic) { otaStatus("Aggiornamento interrotto: riconnetti e riprova"); return; }
+        while (sent < compSize && sent - acked < OTA_WINDOW * chunk) {
+            const n = Math.min(chunk, compSize - sent);
+            await otaWrite([OTA_OP.DATA, ...le(sent, 4), ...data.subarray(sent, sent + n)]);
+            sent += n;
+        }
+        r = await nextOtaReply(OTA_TIMEOUT_MS);
+        if (!r) { sent = acked; continue; } // Conferma persa: si rimanda dall'ultima
+        if (r.op !== OTA_OP.DATA) continue;
+        if (r.status === OTA_BAD_OFFSET) {
+            acked = sent = r.offset;
+            continue;
+        }
+        if (r.status !== OTA_OK) {
+            alert(`Aggiornamento fallito: ${OTA_ERRORS[r.status] || r.status}`);
+            return;
+        }
+        acked = Math.max(acked, r.offset);
+        sent = Math.max(sent, acked);
+        otaStatus(`Aggiornamento ${Math.floor(acked * 100 / compSize)}%`);
+    }
+
+    await otaWrite([OTA_OP.END]);
+    do { r = await nextOtaReply(OTA_END_TIMEOUT_MS); } while (r && r.op !== OTA_OP.END);
+    const secs = (performance.now() - t0) / 1000;
+    console.log(`[OTA] ${compSize} byte (${rawSize} decompressi) in ${secs.toFixed(1)}s, ${(compSize / 1024 / secs).toFixed(1)} KB/s`);
+    if (!r || r.status !== OTA_OK) {
+        alert(`Aggiornamento fallito: ${r ? OTA_ERRORS[r.status] : "nessuna risposta"}`);
+        return;
+    }
+    otaStatus("Aggiornato: il Mochi si riavvia...");
+}
+
+// Frammenti delle risposte piu' lunghe dell'MTU (vedi MochiProto.h):
+// [0xBF][msgId][seq][totale LE16][dati]. Le notify non hanno conferma: a un
+// buco nella sequenza (o se il resto non arriva) si chiede al Mochi di
+// rimandare dal primo byte mancante (PT_RESEND). I frammenti fuori ordine nel
+// frattempo si scartano, tanto tornano con il resend.
+const FRAG_MAGIC = 0xBF;
+const FRAG_HEADER_SIZE = 5;
+const FRAG_RESEND_MS = 300;        // Niente frammenti nuovi per tanto: si chiede il resto
+const FRAG_MAX_RESENDS = 3;
+const fragments = new Map();       // msgId -> { buf, size, next, asked, resends, timer }
+
+function reassemble(bytes) {
+    const msgId = bytes[1], seq = bytes[2], total = bytes[3] | (bytes[4] << 8);
+    const data = bytes.subarray(FRAG_HEADER_SIZE);
+    let m = fragments.get(msgId);
+    if (!m || m.buf.length !== total || (seq === 0 && m.next > 0)) {
+        // Messaggio nuovo (gli msgId ricominciano dopo 255)
+        if (m) clearTimeout(m.timer);
+        m = { buf: new Uint8Array(total), size: 0, next: 0, asked: -1, resends: 0, timer: null };
+        fragments.set(msgId, m);
+    }
+    if (seq !== m.next || m.size + data.length > total) {
+        if (seq > m.next && m.asked !== m.next) requestResend(msgId, m);
+        return null;
+    }
+    m.buf.set(data, m.size);
+    m.size += data.length;
+    m.next++;
+    clearTimeout(m.timer);
+    if (m.size < total) {
+        m.timer = setTimeout(() => requestResend(msgId, m), FRAG_RESEND_MS);
+        return null;
+    }
+    fragments.delete(msgId);
+    return m.buf;
+}
+
+// Una richiesta per buco: i frammenti gia' in volo dopo quello perso arrivano
+// tutti fuori ordine. Se nemmeno il resend completa il messaggio si rinuncia
+// (le richieste a frame scadono e vengono ripetute da chi le ha fatte).
+function requestResend(msgId, m) {
+    clearTimeout(m.timer);
+    if (fragments.get(msgId) !== m) return;
+    if (!binaryProto || !(deviceCaps & CAP_RESEND) || !mochiCharacteristic || m.resends >= FRAG_MAX_RESENDS) {
+        fragments.delete(msgId);
+        console.warn(`[BLE FRAG] messaggio ${msgId} incompleto, scartato`);
+        return;
+    }
+    m.resends++;
+    m.asked = m.next;
+    m.timer = setTimeout(() => requestResend(msgId, m), FRAG_RESEND_MS);
+    console.log(`[BLE FRAG] messaggio ${msgId}: richiesti i frammenti dal byte ${m.size}`);
+    protoReqId = (protoReqId % 255) + 1;
+    const frame = encodeFrame(PT.RESEND, protoReqId, [[TAG.FRAG_MSG, [msgId]], [TAG.FRAG_OFFSET, le(m.size, 2)]]);
+    enqueueGatt(async () => {
+        if (!mochiCharacteristic) return;
+        try { await mochiCharacteristic.writeValue(frame); }
+        catch (e) { console.error("Errore invio resend:", e); }
+    });
+}
+
+// Iscrizione allo stato: il Mochi manda da solo i campi che cambiano (niente
+// polling di get_state). Senza supporto resta il vecchio get_state + pushState.
+async function subscribeState() {
+    if (!binaryProto || !(deviceCaps & CAP_STATE_SUB)) return false;
+    const r = await sendFrame(PT.SUB_STATE, [[TAG.INTERVAL, le(STATE_SUB_MS, 2)]]);
+    return !!r;
+}
+
+// Una notify puo' contenere piu' frame in fila (risposta a un batch).
+function handleFrames(bytes) {
+    while (bytes.length > 0 && bytes[0] === PROTO_MAGIC) {
+        const f = decodeFrame(bytes);
+        if (!f) { console.warn("[BLE PROTO] frame non valido"); return; }
+        handleFrame(f);
+        bytes = bytes.subarray(f.size);
+    }
+}
+
+// Iscrizione alle liste social: il Mochi manda solo le voci che cambiano, la
+// app tiene la sua copia. Le versioni restano anche dopo una disconnessione:
+// riconnettendosi allo stesso Mochi le liste invariate non vengono rimandate.
+let socialSubscribed = false;
+let socialCache = newSocialCache(null);
+
+function newSocialCache(device) {
+    return { device, ver: [0, 0, 0], nearby: new Map(), friends: new Set(), requests: new Set() };
+}
+
+async function subscribeSocial(forceFull = false) {
+    if (!binaryProto || !(deviceCaps & CAP_SOCIAL_SUB)) return false;
+    const device = connectedDevice ? connectedDevice.name : null;
+    if (forceFull || socialCache.device !== device) socialCache = newSocialCache(device);
+    const r = await sendFrame(PT.SUB_SOCIAL, [[TAG.INTERVAL, le(SOCIAL_SUB_MS, 2)],
+        ...socialCache.ver.map((v, i) => [TAG.NEARBY_VER + i, le(v, 4)])]);
+    socialSubscribed = !!r && r.type === (PT.SUB_SOCIAL | PROTO_REPLY);
+    if (socialSubscribed) renderSocialCache(); // le liste gia' allineate non arrivano
+    return socialSubscribed;
+}
+
+function applySocialEvent(f) {
+    const c = socialCache;
+    const reset = f.tlvs.find(t => t.tag === TAG.LIST_RESET);
+    if (reset) {
+        if (reset.val[0] & 1) c.nearby.clear();
+        if (reset.val[0] & 2) c.friends.clear();
+        if (reset.val[0] & 4) c.requests.clear();
+    }
+    for (const t of f.tlvs) {
+        switch (t.tag) {
+            case TAG.NEARBY_VER: case TAG.FRIENDS_VER: case TAG.REQUESTS_VER:
+                c.ver[t.tag - TAG.NEARBY_VER] = leRead(t.val); break;
+            case TAG.PEER:
+                c.nearby.set(idToString(t.val), { rssi: (t.val[3] << 24) >> 24, isFriend: !!(t.val[4] & 1) }); break;
+            case TAG.PEER_GONE:    c.nearby.delete(idToString(t.val)); break;
+            case TAG.FRIEND:       c.friends.add(idToString(t.val)); break;
+            case TAG.FRIEND_GONE:  c.friends.delete(idToString(t.val)); break;
+            case TAG.REQUEST:      c.requests.add(idToString(t.val)); break;
+            case TAG.REQUEST_GONE: c.requests.delete(idToString(t.val)); break;
+        }
+    }
+    renderSocialCache();
+}
+
+function renderSocialCache() {
+    const c = socialCache;
+    renderRequests([...c.requests].map(id => ({ id, pending: true })));
+    renderFriends([...c.friends].map(id => ({ id })));
+    renderNearby([...c.nearby].map(([id, m]) => ({ id, ...m })));
+}
+
+// Smista un frame di risposta sulle stesse funzioni usate per il JSON.
+function handleFrame(f) {
+    const resolve = pendingFrames.get(f.reqId);
+    if (resolve) { pendingFrames.delete(f.reqId); resolve(f); }
+
+    switch (f.type & ~PROTO_REPLY) {
+        case PT.GET_STATE:
+        case PT.STATE_EVENT: { // evento: solo i campi cambiati (tutti se KEYFRAME)
+            const keys = { [TAG.STR]: 'str', [TAG.SPD]: 'spd', [TAG.INT]: 'int', [TAG.CHR]: 'chr' };
+            const data = {};
+            for (const t of f.tlvs) if (keys[t.tag]) data[keys[t.tag]] = t.val[0];
+            updateStatsUI(data);
+            break;
+        }
+        case PT.SOCIAL_EVENT:
+            applySocialEvent(f);
+            break;
+        case PT.GET_NEARBY:
+            renderNearby(f.tlvs.filter(t => t.tag === TAG.PEER).map(t => ({
+                id: idToString(t.val), rssi: (t.val[3] << 24) >> 24, isFriend: !!(t.val[4] & 1) })));
+            break;
+        case PT.GET_PRESENCE:
+            remotePresence = new Map(f.tlvs.filter(t => t.tag === TAG.REMOTE).map(t => [
+                idToString(t.val), { hops: t.val[3], age: t.val[4] | (t.val[5] << 8) }]));
+            renderFriends(lastFriends);
+            break;
+        case PT.GET_FRIENDS:
+            renderFriends(f.tlvs.filter(t => t.tag === TAG.FRIEND).map(t => ({ id: idToString(t.val) })));
+            break;
+        case PT.GET_REQUESTS:
+            renderRequests(f.tlvs.filter(t => t.tag === TAG.REQUEST).map(t => ({ id: idToString(t.val), pending: true })));
+            break;
+        case PT.GET_DEBUG: {
+            const lines = [];
+            for (const t of f.tlvs) {
+                if (t.tag === TAG.FIRMWARE) lines.push(`build: ${new TextDecoder().decode(t.val)}`);
+                else if (t.tag === TAG.SELF_ID) lines.push(`id: ${idToString(t.val)}`);
+                else if (t.tag === TAG.CHANNEL) lines.push(`espnow: ${t.val[0] ? 'ch' + t.val[0] : 'OFF'}`);
+                else if (t.tag === TAG.ANNOUNCES) lines.push(`annunci inviati: ${leRead(t.val)}`);
+                else if (t.tag === TAG.RECEIVED) lines.push(`pacchetti ricevuti: ${leRead(t.val)}`);
+                else if (t.tag === TAG.LAST_SEND) lines.push(`ultimo invio: ${['mai', 'OK', 'FALLITO'][((t.val[0] << 24) >> 24) + 1]}`);
+                else if (t.tag === TAG.LAST_FROM) lines.push(`ultimo da: ${idToString(t.val)}`);
+                else if (t.tag === TAG.PEER) lines.push(`  ${idToString(t.val)} ${(t.val[3] << 24) >> 24}dBm${t.val[4] & 1 ? ' (amico)' : ''}`);
+                else if (t.tag === TAG.AWAY) lines.push(`in visita: ${t.val[0] ? 'si' : 'no'}`);
+                else if (t.tag === TAG.HOSTING) lines.push(`ospite: ${t.val[0] ? 'si' : 'no'}`);
+                else if (t.tag === TAG.FREE_HEAP) lines.push(`heap libero: ${leRead(t.val)}`);
+            }
+            const lat = socialLatencyText();
+            if (lat) lines.push(lat);
+            const out = document.getElementById('debug-output');
+            if (out) out.textContent = lines.join('\n') || '(vuoto)';
+            console.log("[BLE DEBUG]\n" + lines.join('\n'));
+            break;
+        }
+        case PT.GET_LINK: {
+            const u16 = (v, i) => v[i] | (v[i + 1] << 8);
+            const u32 = (v, i) => leRead(v.subarray(i, i + 4));
+            const i8 = (v, i) => (v[i] << 24) >> 24;
+            const lines = ['tipo: inviati/confermati/falliti/ritrasmessi ricevuti (doppioni)'];
+            for (const t of f.tlvs) {
+                const v = t.val;
+                if (t.tag === TAG.LINK_TYPE) {
+                    lines.push(`${PKT_NAMES[v[0]] || v[0]}: ${u32(v, 1)}/${u32(v, 5)}/${u32(v, 9)}/${u32(v, 13)} ${u32(v, 17)} (${u32(v, 21)})`);
+                } else if (t.tag === TAG.LINK_RTT) {
+                    const hist = [];
+                    for (let i = 8; i + 1 < v.length; i += 2) hist.push(u16(v, i));
+                    lines.push(`conferma: ${u16(v, 0)}/${u16(v, 2)}/${u16(v, 4)} ms (${u16(v, 6)}) [${hist.join(' ')}]`);
+                } else if (t.tag === TAG.VISIT_RTT) {
+                    lines.push(`visita->ack: ${u16(v, 0)}/${u16(v, 2)}/${u16(v, 4)} ms (${u16(v, 6)})`);
+                } else if (t.tag === TAG.LINK_PEER) {
+                    const gaps = [];
+                    for (let i = 20; i + 1 < v.length; i += 2) gaps.push(u16(v, i));
+                    lines.push(`  ${idToString(v)} ${u16(v, 3)}/${u16(v, 5)}/${u16(v, 7)}/${u16(v, 9)} ${u16(v, 11)} (${u16(v, 13)})` +
+                               ` rssi ${i8(v, 15)}/${i8(v, 16)}/${i8(v, 17)} conferma ${u16(v, 18)}ms annunci [${gaps.join(' ')}]`);
+                }
+            }
+            const out = document.getElementById('debug-output');
+            if (out) out.textContent = lines.join('\n');
+            console.log("[BLE LINK]\n" + lines.join('\n'));
+            break;
+        }
+        case PT.ERROR: {
+            const code = f.tlvs.find(t => t.tag === TAG.ERROR_CODE);
+            console.warn(`[BLE PROTO] errore ${code ? code.val[0] : '?'} (reqId ${f.reqId})`);
+            break;
+        }
+    }
+}
+
 // Lettura serializzata della caratteristica (passa per la stessa coda).
 function readCmd() {
     return enqueueGatt(async () => {
-        if (!mochiCharacteristic) return null;
-        try { return await mochiCharacteristic.readValue(); }
+        if (!replyCharacteristic) return null;
+        try { return await replyCharacteristic.readValue(); }
         catch (e) { console.error("Errore lettura:", e); return null; }
     });
 }
@@ -342,6 +879,8 @@ cmdButtons.forEach(btn => {
         if (cmd.startsWith('queue:')) {
             setActiveAction(btn);
         }
+        if (cmd === 'get_debug' && binaryProto) { sendFrame(PT.GET_DEBUG); return; }
+        if (cmd === 'get_link' && binaryProto && (deviceCaps & CAP_LINK_STATS)) { sendFrame(PT.GET_LINK); return; }
         sendCmd(cmd);
     };
 });
@@ -351,32 +890,111 @@ if (btnRefreshSocial) btnRefreshSocial.onclick = pollSocial;
 
 // --- AMICI ---
 
+// Mochi fuori portata radio (gossip degli annunci): solo col protocollo binario.
+async function pollPresence() {
+    if (!mochiCharacteristic || !binaryProto || !(deviceCaps & CAP_PRESENCE)) return;
+    await sendFrame(PT.GET_PRESENCE);
+}
+
+// --- Latenza di un refresh social completo ---
+// Dalla prima write all'arrivo dell'ultima lista (i vicini), per modalita':
+// caratteristica unica / canali separati x testo / binario / batch. Gli ultimi
+// SOCIAL_LAT_SAMPLES giri per modalita'; i giri senza risposta contano a parte.
+const SOCIAL_LAT_SAMPLES = 50;
+const socialLatency = new Map();    // modalita' -> { samples: [ms], timeouts }
+const textListWaiters = new Map();  // 'nearby' | ... -> resolve, per il protocollo testuale
+
+function socialMode() {
+    return `${splitChannels ? 'canali separati' : 'caratteristica unica'}, ` +
+           `${binaryProto ? ((deviceCaps & CAP_BATCH) ? 'binario, batch' : 'binario') : 'testo'}`;
+}
+
+function recordSocialLatency(ms) {
+    const mode = socialMode();
+    if (!socialLatency.has(mode)) socialLatency.set(mode, { samples: [], timeouts: 0 });
+    const e = socialLatency.get(mode);
+    if (ms === null) { e.timeouts++; return; }
+    e.samples.push(ms);
+    if (e.samples.length > SOCIAL_LAT_SAMPLES) e.samples.shift();
+}
+
+// Riassunto per modalita' (anche da console: mochiLatency()).
+function socialLatencyReport() {
+    const rows = {};
+    for (const [mode, e] of socialLatency) {
+        const s = [...e.samples].sort((a, b) => a - b);
+        const at = q => s.length ? Math.round(s[Math.min(s.length - 1, Math.floor(q * s.length))]) : null;
+        rows[mode] = { giri: s.length, min: at(0), mediana: at(0.5), p95: at(0.95),
+                       max: s.length ? Math.round(s[s.length - 1]) : null, persi: e.timeouts };
+    }
+    return rows;
+}
+window.mochiLatency = () => { console.table(socialLatencyReport()); return socialLatencyReport(); };
+
+function socialLatencyText() {
+    return Object.entries(socialLatencyReport()).map(([mode, r]) =>
+        `refresh social (${mode}): mediana ${r.mediana} ms, p95 ${r.p95} ms, ` +
+        `min ${r.min} max ${r.max} su ${r.giri} giri, ${r.persi} persi`).join('\n');
+}
+
+// Protocollo testuale: la risposta arriva come array in handleNotifications.
+function waitTextList(kind) {
+    return new Promise(resolve => {
+        textListWaiters.set(kind, resolve);
+        setTimeout(() => { if (textListWaiters.delete(kind)) resolve(false); }, FRAME_TIMEOUT_MS);
+    });
+}
+
 // Chiede al Mochi sia la lista amici che i vicini (separati nel tempo per
 // non far interleavare le notifiche).
 let socialPolling = false;
 async function pollSocial() {
     if (!mochiCharacteristic) return;
     if (socialPolling) return; // evita che un poll si accavalli sul precedente
+    if (socialSubscribed) return subscribeSocial(true); // "Cerca vicini": resync completo
     socialPolling = true;
+    const t0 = performance.now();
+    let ok = false;
     try {
     // Le richieste vanno chieste prima dei vicini: così quando arriva la lista
     // vicini `incomingRequests` è già aggiornata e i bottoni mostrano "Accetta".
+    if (binaryProto && (deviceCaps & CAP_BATCH)) {
+        // Una sola write, le tre liste tornano insieme nello stesso ordine.
+        const r = await sendBatch([[PT.GET_REQUESTS], [PT.GET_FRIENDS], [PT.GET_NEARBY]]);
+        ok = r.every(f => f);
+        return;
+    }
+    if (binaryProto) {
+        // Ogni risposta porta il suo reqId: niente pause né lastArrayRequest.
+        const r = [await sendFrame(PT.GET_REQUESTS), await sendFrame(PT.GET_FRIENDS),
+                   await sendFrame(PT.GET_NEARBY)];
+        ok = r.every(f => f);
+        return;
+    }
     lastArrayRequest = 'requests';
     await sendCmd('get_requests');
     await new Promise(r => setTimeout(r, 250));
     lastArrayRequest = 'friends';
+    friendsPages = [];
     await sendCmd('get_friends');
     await new Promise(r => setTimeout(r, 250));
     lastArrayRequest = 'nearby';
+    const nearby = waitTextList('nearby');
     await sendCmd('get_nearby');
+    ok = await nearby;
     } finally {
         socialPolling = false;
+        const ms = performance.now() - t0;
+        recordSocialLatency(ok ? ms : null);
+        console.log(ok ? `[BLE SOCIAL] refresh in ${Math.round(ms)} ms (${socialMode()})`
+                       : `[BLE SOCIAL] refresh incompleto (${socialMode()})`);
     }
 }
 
 // Invia un comando amico e poi ricarica le liste.
 async function socialAction(cmd) {
     await sendCmd(cmd);
+    if (socialSubscribed) return; // il cambiamento arriva come evento
     await new Promise(r => setTimeout(r, 250));
     pollSocial();
 }
@@ -450,6 +1068,7 @@ function renderRequests(arr) {
 }
 
 function renderFriends(arr) {
+    lastFriends = arr;
     friendsListEl.innerHTML = '';
     if (!arr.length) {
         friendsListEl.innerHTML = '<p class="social-empty">Nessun amico</p>';
@@ -463,6 +1082,15 @@ function renderFriends(arr) {
         const row = document.createElement('div');
         row.className = 'social-row';
         row.innerHTML = `<span class="social-name">${f.id}</span>`;
+        // Fuori portata ma saputo dal gossip: e' nell'edificio, qualche stanza piu' in la'
+        const far = remotePresence.get(f.id);
+        if (far) {
+            const tag = document.createElement('span');
+            tag.className = 'social-far';
+            tag.textContent = `nell'edificio (${far.hops} salti)`;
+            tag.title = `visto ${far.age}s fa`;
+            row.firstChild.appendChild(tag);
+        }
 
         // DEBUG (temporaneo): forza una visita verso questo amico (dev'essere vicino).
         const visitBtn = document.createElement('button');
@@ -481,19 +1109,50 @@ function renderFriends(arr) {
 }
 
 function handleNotifications(event) {
-    let receivedString = new TextDecoder().decode(event.target.value);
+    const v = event.target.value;
+    let bytes = new Uint8Array(v.buffer, v.byteOffset, v.byteLength);
+    if (bytes[0] === FRAG_MAGIC) {
+        // Copia: il buffer della notify viene riusato dal browser
+        bytes = reassemble(bytes.slice());
+        if (!bytes) return; // mancano ancora frammenti
+    }
+    if (bytes[0] === PROTO_MAGIC) { handleFrames(bytes); return; }
+
+    let receivedString = new TextDecoder().decode(bytes);
 
     if (receivedString.startsWith("DBG")) {
         const text = receivedString.replace(/^DBG\n?/, '');
         const out = document.getElementById('debug-output');
-        if (out) out.textContent = text || '(vuoto)';
+        const lat = socialLatencyText();
+        if (out) out.textContent = (text || '(vuoto)') + (lat ? '\n' + lat : '');
         console.log("[BLE DEBUG]\n" + text);
         return;
     }
 
+    // Comando non riconosciuto dal firmware (es. app piu' nuova del Mochi)
+    if (receivedString.startsWith("ERR")) {
+        console.warn("[BLE] " + receivedString);
+        return;
+    }
+
+    // Storico a pacchetti: "HIST\n" + righe "t,hunger,happy,str,spd,int,chr,age",
+    // chiuso da "HIST END n" (richiesto con get_history:da,a,passo).
+    if (receivedString.startsWith("HIST")) {
+        if (receivedString.startsWith("HIST END")) {
+            console.log(`[BLE HISTORY] ${historyRows.length} campioni`, historyRows);
+            return;
+        }
+        for (const line of receivedString.split('\n').slice(1)) {
+            if (!line) continue;
+            const [t, hunger, happy, str, spd, int, chr, age] = line.split(',').map(Number);
+            historyRows.push({ t, hunger, happy, str, spd, int, chr, age });
+        }
+        return;
+    }
+
     if (receivedString.startsWith("[")) {
         try {
-            const arr = JSON.parse(receivedString);
+            let arr = JSON.parse(receivedString);
             // Distinzione per contenuto: i vicini hanno "rssi", le richieste hanno
             // "pending", gli amici solo "id". Per gli array vuoti ci affidiamo a
             // quale richiesta è stata appena inviata (lastArrayRequest).
@@ -505,9 +1164,21 @@ function handleNotifications(event) {
             } else {
                 kind = lastArrayRequest || 'friends';
             }
+            if (kind === 'friends' && arr.length && arr[arr.length - 1].next) {
+                // Lista lunga: il Mochi la manda a pagine, si chiede quella dopo
+                friendsPages.push(...arr.slice(0, -1));
+                sendCmd('get_friends:' + arr[arr.length - 1].next);
+                return;
+            }
+            if (kind === 'friends' && friendsPages.length) {
+                arr = friendsPages.concat(arr);
+                friendsPages = [];
+            }
             if (kind === 'nearby') renderNearby(arr);
             else if (kind === 'requests') renderRequests(arr);
             else renderFriends(arr);
+            const waiter = textListWaiters.get(kind);
+            if (waiter) { textListWaiters.delete(kind); waiter(true); }
         } catch (error) {
             console.error("Errore parsing array social:", error);
         }
@@ -0,0 +1,130 @@
+#include "MochiAssets.h"
+#include "Settings.h"
+
+#include <esp_partition.h>
+#ifndef ARDUINO
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define ASSETS_MAGIC 0x3153414DUL // "MAS1"
+
+struct AssetPackHeader {
+  uint32_t magic;
+  uint16_t count;
+  uint16_t reserved;
+  uint32_t totalSize;
+};
+
+struct AssetEntry {
+  uint16_t id;
+  uint8_t  format;
+  uint8_t  reserved;
+  uint16_t w, h;
+  uint32_t offset;
+  uint32_t size;
+};
+
+static const uint8_t* s_pack = nullptr; // Pack mappato (nullptr = nessun asset)
+#ifndef ARDUINO
+static void*  s_file = nullptr;         // mmap POSIX di mochiAssetsBeginFile
+static size_t s_fileLen = 0;
+#endif
+
+// Dimentica il pack attuale (e sul PC libera la mappatura del file).
+static void forget() {
+  s_pack = nullptr;
+#ifndef ARDUINO
+  if (s_file) munmap(s_file, s_fileLen);
+  s_file = nullptr;
+#endif
+}
+
+// Controlla che intestazione e tabella stiano nel pack e che ogni voce punti
+// dentro i dati: dopo, mochiAssetGet puo' fidarsi degli offset.
+static bool validate(const uint8_t* pack, uint32_t size) {
+  if (size < sizeof(AssetPackHeader)) return false;
+  const AssetPackHeader* h = (const AssetPackHeader*)pack;
+  if (h->magic != ASSETS_MAGIC || h->totalSize > size) return false;
+  uint32_t tableEnd = sizeof(AssetPackHeader) + (uint32_t)h->count * sizeof(AssetEntry);
+  if (tableEnd > h->totalSize) return false;
+  const AssetEntry* e = (const AssetEntry*)(pack + sizeof(AssetPackHeader));
+  for (uint16_t i = 0; i < h->count; i++) {
+    if (e[i].offset < tableEnd || e[i].offset > h->totalSize || e[i].size > h->totalSize - e[i].offset) return false;
+  }
+  return true;
+}
+
+bool mochiAssetsBegin() {
+  forget();
+  const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)ASSETS_SUBTYPE, ASSETS_PARTITION);
+  if (!part) {
+    Serial.println("[ASSET] Partizione assets assente: disegno a runtime.");
+    return false;
+  }
+  AssetPackHeader h;
+  if (esp_partition_read(part, 0, &h, sizeof(h)) != ESP_OK || h.magic != ASSETS_MAGIC || h.totalSize > part->size) {
+    Serial.println("[ASSET] Pack non valido: disegno a runtime.");
+    return false;
+  }
+  // Si mappa solo la parte occupata (arrotondata alla pagina MMU da 64 KB).
+  uint32_t len = (h.totalSize + 0xFFFF) & ~0xFFFFUL;
+  if (len > part->size) len = part->size;
+  const void* ptr;
+  esp_partition_mmap_handle_t handle;
+  if (esp_partition_mmap(part, 0, len, ESP_PARTITION_MMAP_DATA, &ptr, &handle) != ESP_OK) {
+    Serial.println("[ASSET] mmap fallita: disegno a runtime.");
+    return false;
+  }
+  if (!validate((const uint8_t*)ptr, len)) {
+    esp_partition_munmap(handle);
+    Serial.println("[ASSET] Tabella non valida: disegno a runtime.");
+    return false;
+  }
+  s_pack = (const uint8_t*)ptr;
+  Serial.printf("[ASSET] %u asset mappati (%lu byte)\n", h.count, (unsigned long)h.totalSize);
+  return true;
+}
+
+#ifndef ARDUINO
+// Stesso controllo della partizione, sul file scritto da tools/pack_assets.py.
+bool mochiAssetsBeginFile(const char* path) {
+  forget();
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) return false;
+  if (!validate((const uint8_t*)ptr, st.st_size)) {
+    munmap(ptr, st.st_size);
+    return false;
+  }
+  s_file    = ptr;
+  s_fileLen = st.st_size;
+  s_pack    = (const uint8_t*)ptr;
+  return true;
+}
+#endif
+
+bool mochiAssetGet(uint16_t id, MochiAsset* out) {
+  if (!s_pack) return false;
+  const AssetPackHeader* h = (const AssetPackHeader*)s_pack;
+  const AssetEntry* e = (const AssetEntry*)(s_pack + sizeof(AssetPackHeader));
+  for (uint16_t i = 0; i < h->count; i++) {
+    if (e[i].id != id) continue;
+    out->data   = s_pack + e[i].offset;
+    out->size   = e[i].size;
+    out->w      = e[i].w;
+    out->h      = e[i].h;
+    out->format = e[i].format;
+    return true;
+  }
+  return false;
+}
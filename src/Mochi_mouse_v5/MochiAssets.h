@@ -0,0 +1,47 @@
+#ifndef MOCHI_ASSETS_H
+#define MOCHI_ASSETS_H
+
+#include <Arduino.h>
+
+// ================================================================
+// ASSET IN FLASH (partizione "assets")
+// ----------------------------------------------------------------
+// Sprite pre-renderizzati e tabelle generati da tools/pack_assets.py e
+// mappati in memoria con esp_partition_mmap: si leggono direttamente dalla
+// flash (con la cache), senza copiarli in heap. Se la partizione manca o il
+// pack non e' valido la view torna a disegnare tutto a runtime.
+//
+// Formato del pack (little endian):
+//   "MAS1", u16 numero voci, u16 riservato, u32 dimensione totale
+//   voci: u16 id, u8 formato, u8 riservato, u16 w, u16 h, u32 offset, u32 size
+//   dati (allineati a 4 byte)
+// ================================================================
+
+// ID degli asset: tenere allineato con tools/pack_assets.py
+enum AssetId : uint16_t {
+  ASSET_EGG_0     = 1,  // Uovo intero
+  ASSET_EGG_1     = 2,  // Prima crepa (crackProgress > 0.1)
+  ASSET_EGG_2     = 3,  // Seconda crepa (> 0.4)
+  ASSET_EGG_3     = 4,  // Terza crepa (> 0.7)
+  ASSET_EASE_BG   = 16, // Curva a coseno del gradiente di sfondo (172 x u16, 0..65535)
+};
+
+enum AssetFormat : uint8_t {
+  ASSET_FMT_RGB565_SWAPPED = 1, // Pixel RGB565 big endian, come il buffer di LGFX_Sprite
+  ASSET_FMT_U16_TABLE      = 2,
+};
+
+struct MochiAsset {
+  const void* data;   // Punta nella flash mappata: sola lettura
+  uint32_t    size;
+  uint16_t    w, h;   // Per le tabelle: w = numero di elementi, h = 1
+  uint8_t     format;
+};
+
+bool mochiAssetsBegin();                          // Mappa la partizione
+#ifndef ARDUINO
+bool mochiAssetsBeginFile(const char* path);      // Build host: mmap POSIX del pack
+#endif
+bool mochiAssetGet(uint16_t id, MochiAsset* out);
+
+#endif // MOCHI_ASSETS_H
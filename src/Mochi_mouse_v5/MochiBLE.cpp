@@ -1,11 +1,142 @@
 #include "MochiBLE.h"
 #include "MochiNow.h"
+#include "MochiMem.h"
+#include "MochiProto.h"
+#include "MochiRing.h"
+#include <BLESecurity.h>
+
+#ifndef MOCHI_VERSION
+  #define MOCHI_VERSION "0.0.0-dev"
+#endif
 
 #define SERVICE_UUID        "4fafc201-1fb5-459e-8fcc-c5c9c331914b"
-#define CHARACTERISTIC_UUID "beb5483e-36e1-4688-b7f5-ea07361b26a8"
+#define CHARACTERISTIC_UUID "beb5483e-36e1-4688-b7f5-ea07361b26a8" // Legacy: tutto su una
+#define CMD_CHAR_UUID       "beb5483e-36e1-4688-b7f5-ea07361b26a9" // Comandi (write)
+#define STATE_CHAR_UUID     "beb5483e-36e1-4688-b7f5-ea07361b26aa" // Stato e impostazioni
+#define SOCIAL_CHAR_UUID    "beb5483e-36e1-4688-b7f5-ea07361b26ab" // Vicini, amici, richieste
+#define DIAG_CHAR_UUID      "beb5483e-36e1-4688-b7f5-ea07361b26ac" // Debug, memoria, storico
+#define OTA_CHAR_UUID       "beb5483e-36e1-4688-b7f5-ea07361b26ad" // Aggiornamento firmware
+#define SERVICE_HANDLES     32 // 6 caratteristiche (+ descrittori): i 15 di default non bastano
 
 // Modulo social (ESP-NOW): la companion app legge i vicini tramite questo.
 static MochiNow* g_social = nullptr;
+static BLEServer* g_server = nullptr;
+
+// Capacita' dichiarate dalla app nell'HELLO (0 = app testuale).
+static uint32_t g_peerCaps = 0;
+
+// Codice dell'abbinamento in corso, da mostrare sul display (0 = nessuno).
+// Lo scrive il task Bluedroid, lo legge il loop.
+static volatile uint32_t g_passkey = 0;
+
+// Flussi di notify: la caratteristica legacy piu' uno per tipo di risposta.
+// Ognuno ha il suo buffer, in cui le risposte vengono serializzate e consegnate
+// alla caratteristica senza passare da una String. Usati solo dal loop (che
+// esegue i comandi), una risposta alla volta per flusso.
+enum BleChannelId : uint8_t { CH_LEGACY, CH_STATE, CH_SOCIAL, CH_DIAG, CH_COUNT };
+
+struct BleChannel {
+    BLECharacteristic* chr;
+    char buf[BLE_REPLY_BUF_SIZE + 1];
+};
+
+static BleChannel g_channels[CH_COUNT];
+static BleReplyStats g_replyStats;
+
+// Ultima risposta frammentata di ogni flusso, per PT_RESEND. I dati restano nel
+// buffer da cui sono partiti (quello del flusso o socialBuf) finche' la
+// risposta dopo non lo riscrive: il checksum se ne accorge.
+struct BleFragMemo {
+    BLECharacteristic* chr;
+    const uint8_t* data;
+    uint16_t len;
+    uint16_t chunk;    // Payload delle notify quando e' partita
+    uint16_t sum;
+    uint8_t  msgId;
+};
+
+static BleFragMemo g_fragMemo[CH_COUNT];
+static uint8_t g_fragMsgId = 0;
+
+// Un comando arrivato sulla caratteristica legacy risponde li' (app vecchie);
+// dal canale comandi la risposta va sul suo flusso dedicato.
+static BleChannel& channelFor(BLECharacteristic* from, BleChannelId ch) {
+    if (from == g_channels[CH_LEGACY].chr || !g_channels[ch].chr) return g_channels[CH_LEGACY];
+    return g_channels[ch];
+}
+
+static BleChannelId cmdChannel(uint8_t id) {
+    switch (id) {
+        case CMD_GET_NEARBY: case CMD_GET_FRIENDS: case CMD_GET_REQUESTS:
+            return CH_SOCIAL;
+        case CMD_GET_DEBUG: case CMD_GET_MEM: case CMD_GET_HISTORY: case CMD_GET_LINK: case CMD_RESET_LINK:
+            return CH_DIAG;
+        default:
+            return CH_STATE;
+    }
+}
+
+static BleChannelId frameChannel(uint8_t type) {
+    switch (type) {
+        case PT_GET_NEARBY: case PT_GET_FRIENDS: case PT_GET_REQUESTS: case PT_SUB_SOCIAL: case PT_GET_PRESENCE:
+            return CH_SOCIAL;
+        case PT_GET_STATE: case PT_GET_SETTINGS: case PT_SUB_STATE:
+            return CH_STATE;
+        default: // HELLO, debug, errori
+            return CH_DIAG;
+    }
+}
+
+// Comandi ricevuti: onWrite (task Bluedroid) copia i byte in coda e torna
+// subito; il loop li esegue in tick(). Cosi' le scritture NVS non bloccano lo
+// stack BLE e MochiState viene toccato da un solo task.
+struct BleCmdSlot {
+    BLECharacteristic* from;
+    uint16_t len;
+    uint8_t  data[BLE_CMD_MAX_LEN];
+};
+
+static MochiRing<BleCmdSlot, BLE_CMD_QUEUE_LEN> g_cmdQueue;
+
+// Frame scartati a coda piena: il loop risponde PE_BUSY al posto loro. La
+// notify non parte da onWrite perche' setValue/notify sulla stessa
+// caratteristica correrebbero con reply() del loop.
+struct BleBusySlot {
+    BLECharacteristic* from;
+    uint8_t reqId;
+};
+
+static MochiRing<BleBusySlot, BLE_BUSY_QUEUE_LEN> g_busyQueue;
+
+// Pezzi del firmware: stessa strada dei comandi, coda propria perche' arrivano
+// a raffica (write senza risposta) e non devono far scartare i comandi.
+struct OtaSlot {
+    uint16_t len;
+    uint8_t  data[BLE_CMD_MAX_LEN];
+};
+
+static MochiRing<OtaSlot, OTA_QUEUE_LEN> g_otaQueue;
+static BLECharacteristic* g_otaChr = nullptr;
+
+// Richiesta di storico, avviata dal loop in tick() dopo i comandi (il loop e'
+// l'unico a toccare la partizione dello storico).
+static volatile bool g_historyRequested = false;
+static uint32_t g_historyFrom, g_historyTo, g_historyStep;
+static BLECharacteristic* g_historyChr = nullptr; // Dove inviare i pacchetti
+
+// Iscrizione allo stato: impostata dal task BLE (PT_SUB_STATE), servita dal loop.
+static volatile uint16_t g_stateSubMs = 0;         // 0 = nessuna iscrizione
+static volatile bool g_stateSubKeyframe = false;   // Il prossimo evento porta tutto
+static BLECharacteristic* g_stateSubChr = nullptr;
+static uint32_t g_stateSubEvents = 0, g_stateSubBytes = 0;
+
+// Iscrizione alle liste social, come quella dello stato. Con la richiesta la app
+// manda le versioni che conosce: le liste gia' allineate non vengono rimandate.
+static uint16_t g_socialSubMs = 0;                 // 0 = nessuna iscrizione
+static bool g_socialResync = false;                // Confronta con g_socialAppVer
+static uint32_t g_socialAppVer[SL_COUNT];
+static BLECharacteristic* g_socialSubChr = nullptr;
+static uint32_t g_socialSubEvents = 0, g_socialSubBytes = 0;
 
 // ================================================================
 // CLASSI CALLBACK
@@ -30,107 +161,516 @@ public:
             led->show();
         }
         pServer->getAdvertising()->start();
+        g_peerCaps = 0; // la prossima app rinegozia con HELLO
+        g_stateSubMs = 0;
+        g_socialSubMs = 0;
+        memset(g_fragMemo, 0, sizeof(g_fragMemo)); // gli msgId valgono per una connessione
+        g_passkey = 0;
         Serial.println("BLE: Device Disconnesso - Advertising riavviato");
     }
 };
 
+// Abbinamento con passkey: il Mochi ha solo il display (IO_CAP_OUT), quindi
+// mostra il codice e l'utente lo digita sul telefono. Serve solo per il
+// firmware: chiunque nel raggio puo' mandare comandi, non installare un'app.
+class MySecurityCallbacks: public BLESecurityCallbacks {
+public:
+    uint32_t onPassKeyRequest() { return 0; } // Niente tastiera
+    bool onConfirmPIN(uint32_t) { return false; } // Niente conferma a due schermi
+    bool onSecurityRequest() { return true; }
+
+    void onPassKeyNotify(uint32_t passKey) {
+        g_passkey = passKey;
+        Serial.printf("BLE: Abbinamento richiesto, codice %06lu\n", (unsigned long)passKey);
+    }
+
+    void onAuthenticationComplete(esp_ble_auth_cmpl_t cmpl) {
+        g_passkey = 0;
+        if (cmpl.success) Serial.println("BLE: Abbinamento riuscito");
+        else Serial.printf("BLE: Abbinamento fallito (%u)\n", cmpl.fail_reason);
+    }
+};
+
+// Payload di una notify con l'MTU davvero negoziato (non quello chiesto).
+static size_t peerNotifySize() {
+    uint16_t mtu = g_server ? g_server->getPeerMTU(g_server->getConnId()) : 0;
+    if (mtu < BLE_MIN_MTU) mtu = BLE_MIN_MTU;
+    if (mtu > BLE_MTU) mtu = BLE_MTU;
+    return mtu - 3;
+}
+
+// Unico punto in cui una risposta viene copiata fuori dal buffer del writer:
+// ogni byte passato a setValue si conta una volta sola.
+static void setReplyValue(BLECharacteristic* c, const uint8_t* data, size_t len) {
+    c->setValue((uint8_t*)data, len);
+    g_replyStats.copies += len;
+}
+
+// Risposta piu' lunga di una notify: frammenti uno dietro l'altro (notify non
+// aspetta conferme, quindi restano tutti in volo insieme), da firstSeq in poi.
+static void notifyFragments(BLECharacteristic* c, const uint8_t* data, size_t len, size_t chunk,
+                            uint8_t msgId, uint8_t firstSeq = 0) {
+    static uint8_t frag[BLE_NOTIFY_SIZE];
+    size_t body = chunk - FRAG_HEADER_SIZE;
+    uint8_t seq = firstSeq;
+    for (size_t off = (size_t)firstSeq * body; off < len; off += body, seq++) {
+        size_t n = len - off < body ? len - off : body;
+        frag[0] = FRAG_MAGIC;
+        frag[1] = msgId;
+        frag[2] = seq;
+        frag[3] = len & 0xFF;
+        frag[4] = len >> 8;
+        memcpy(frag + FRAG_HEADER_SIZE, data + off, n);
+        setReplyValue(c, frag, n + FRAG_HEADER_SIZE);
+        c->notify();
+    }
+    g_replyStats.fragments += seq - firstSeq;
+}
+
+static uint16_t fletcher16(const uint8_t* p, size_t n) {
+    uint16_t a = 0, b = 0;
+    while (n--) {
+        a = (a + *p++) % 255;
+        b = (b + a) % 255;
+    }
+    return (b << 8) | a;
+}
+
+static BleFragMemo* fragMemoFor(BLECharacteristic* c) {
+    for (int i = 0; i < CH_COUNT; i++) {
+        if (g_channels[i].chr == c) return &g_fragMemo[i];
+    }
+    return nullptr;
+}
+
+// Invia il contenuto del writer sulla caratteristica (notify) e lo lascia anche
+// come valore leggibile, per la app che fa write + read. setValue e' l'unica
+// copia: il valore dell'attributo deve restare valido dopo questa chiamata.
+// Oltre l'MTU: frammenti se la app li sa riunire, altrimenti notify troncata
+// dallo stack come prima (il valore completo resta comunque leggibile).
+static void reply(BLECharacteristic* c, const MochiWriter& w, const char* what) {
+    size_t chunk = peerNotifySize();
+    if (w.length() > chunk && (g_peerCaps & CAP_FRAGMENT)) {
+        const uint8_t* data = (const uint8_t*)w.data();
+        uint8_t msgId = ++g_fragMsgId;
+        notifyFragments(c, data, w.length(), chunk, msgId);
+        setReplyValue(c, data, w.length());
+        g_replyStats.fragmented++;
+        if (BleFragMemo* m = fragMemoFor(c)) {
+            *m = { c, data, (uint16_t)w.length(), (uint16_t)chunk, fletcher16(data, w.length()), msgId };
+        }
+    } else {
+        setReplyValue(c, (const uint8_t*)w.data(), w.length());
+        c->notify();
+        if (w.length() > chunk) g_replyStats.clipped++;
+    }
+    g_replyStats.replies++;
+    g_replyStats.bytes  += w.length();
+    if (w.overflowed()) {
+        g_replyStats.overflows++;
+        Serial.printf("[BLE] %s troncato a %u byte!\n", what, (unsigned)w.length());
+    }
+    Serial.printf("[BLE] %s inviato al browser!\n", what);
+}
+
+// Contatori delle risposte in coda al report di debug.
+static void writeReplyStats(MochiWriter& w) {
+    w.printf("\nble: %lu risposte | %lu byte | %lu copiati | %lu troncate | %lu alloc",
+             (unsigned long)g_replyStats.replies, (unsigned long)g_replyStats.bytes,
+             (unsigned long)g_replyStats.copies, (unsigned long)g_replyStats.overflows,
+             (unsigned long)g_replyStats.heapAllocs);
+    w.printf("\nmtu: %u | %lu frammentate (%lu frammenti, %lu rimandate) | %lu tagliate",
+             (unsigned)(peerNotifySize() + 3), (unsigned long)g_replyStats.fragmented,
+             (unsigned long)g_replyStats.fragments, (unsigned long)g_replyStats.resent,
+             (unsigned long)g_replyStats.clipped);
+    w.printf("\ncoda: %u/%u | picco %u | %lu scartati (%lu senza PE_BUSY)",
+             (unsigned)g_cmdQueue.size(), (unsigned)g_cmdQueue.capacity(),
+             (unsigned)g_cmdQueue.highWater(), (unsigned long)g_cmdQueue.dropped(),
+             (unsigned long)g_busyQueue.dropped());
+    w.printf("\nstato: %s | %lu eventi | %lu byte",
+             g_stateSubMs ? "iscritto" : "polling",
+             (unsigned long)g_stateSubEvents, (unsigned long)g_stateSubBytes);
+    w.printf("\nsocial: %s | %lu eventi | %lu byte",
+             g_socialSubMs ? "iscritto" : "polling",
+             (unsigned long)g_socialSubEvents, (unsigned long)g_socialSubBytes);
+    w.printf("\nota: coda %u/%u | picco %u | %lu scartati",
+             (unsigned)g_otaQueue.size(), (unsigned)g_otaQueue.capacity(),
+             (unsigned)g_otaQueue.highWater(), (unsigned long)g_otaQueue.dropped());
+}
+
 class MyCallbacks: public BLECharacteristicCallbacks {
     MochiState* statePtr;
 public:
     MyCallbacks(MochiState* s) : statePtr(s) {}
 
+    // Task Bluedroid: solo copia in coda. Con la coda piena il comando si
+    // perde (contato negli scarti); ai frame binari il loop risponde PE_BUSY
+    // cosi' la app sa che deve riprovare invece di aspettare il timeout.
     void onWrite(BLECharacteristic *pCharacteristic) {
-        String cmd = pCharacteristic->getValue();
-
-        if (cmd.length() > 0) {
-            Serial.println("Ricevuto BLE: " + cmd);
-
-            if (cmd.startsWith("unix:")) {
-                long timestamp = atol(cmd.substring(5).c_str());
-                statePtr->syncTime(timestamp);
-            } else if (cmd.startsWith("set_json:")) {
-                String json = cmd.substring(9);
-                statePtr->saveSettings(json);
-                statePtr->saveState();
-                Serial.println("Settings salvati.");
-            } else if (cmd == "get_json") {
+        const uint8_t* data = pCharacteristic->getData();
+        size_t len = pCharacteristic->getLength();
+        if (len == 0) return;
+        if (len > BLE_CMD_MAX_LEN) {
+            Serial.printf("[BLE] Comando di %u byte troppo lungo, ignorato.\n", (unsigned)len);
+            return;
+        }
+
+        BleCmdSlot* slot = g_cmdQueue.beginPush();
+        if (!slot) {
+            Serial.println("[BLE] Coda comandi piena, comando scartato.");
+            if (data[0] == PROTO_MAGIC && len > 2) g_busyQueue.push({ pCharacteristic, data[2] });
+            return;
+        }
+        slot->from = pCharacteristic;
+        slot->len = len;
+        memcpy(slot->data, data, len);
+        g_cmdQueue.endPush();
+    }
+
+    // Loop: il verbo viene riconosciuto direttamente sui byte ricevuti (niente
+    // copia in una String), l'argomento arriva ai gestori gia' tipizzato. Le
+    // new fatte da questo task nel frattempo finiscono in heapAllocs.
+    void execute(BLECharacteristic* from, const uint8_t* data, size_t len) {
+        MochiMemScope mem(MEM_BLE);
+        uint32_t allocsBefore = mochiMemThreadAllocs();
+        executeCmd(from, data, len);
+        g_replyStats.heapAllocs += mochiMemThreadAllocs() - allocsBefore;
+    }
+
+    // Errore a un frame fuori dal dispatch (PE_BUSY da g_busyQueue, PE_GONE):
+    // buffer proprio, cosi' non tocca la risposta che un PT_RESEND potrebbe
+    // ancora chiedere.
+    void replyError(BLECharacteristic* from, uint8_t reqId, uint8_t code) {
+        static char buf[PROTO_HEADER_SIZE + 3 + 1]; // +1: il terminatore del writer
+        MochiWriter w(buf, sizeof(buf));
+        writeError(w, reqId, code);
+        BLECharacteristic* c = channelFor(from, CH_DIAG).chr;
+        c->setValue((uint8_t*)w.data(), w.length());
+        c->notify();
+    }
+
+private:
+    // Comando di testo o frame binari, gia' fuori dalla coda.
+    void executeCmd(BLECharacteristic* from, const uint8_t* data, size_t len) {
+        if (data[0] == PROTO_MAGIC) {
+            dispatchFrame(from, data, len);
+            return;
+        }
+
+        Serial.printf("Ricevuto BLE: %.*s\n", (int)len, (const char*)data);
+
+        MochiCmd cmd;
+        if (!mochiCmdParse(data, len, &cmd)) {
+            replyUnknown(from, (const char*)data, len);
+            return;
+        }
+        dispatch(from, cmd);
+    }
+
+    // "ERR comando sconosciuto: <verbo>" sul flusso diagnostico, cosi' la app
+    // non aspetta una risposta che non arrivera'.
+    void replyUnknown(BLECharacteristic* from, const char* data, size_t len) {
+        size_t verbLen = 0;
+        while (verbLen < len && data[verbLen] != ':') verbLen++;
+        Serial.printf("[BLE] Comando sconosciuto: %.*s\n", (int)verbLen, data);
+        BleChannel& ch = channelFor(from, CH_DIAG);
+        MochiWriter w(ch.buf, sizeof(ch.buf));
+        w.raw("ERR comando sconosciuto: ");
+        w.raw(data, verbLen < 32 ? verbLen : 32);
+        reply(ch.chr, w, "Errore comando");
+    }
+
+    // PT_RESEND: i frammenti di msgId dal byte indicato in poi, con la stessa
+    // dimensione di allora (la posizione si ricava da seq). Non tocca i buffer
+    // dei flussi: la risposta da rimandare potrebbe stare proprio li'. Se nel
+    // frattempo il buffer e' stato riscritto la app riceve PE_GONE.
+    void resendFragments(BLECharacteristic* from, uint8_t reqId, MochiTlvReader body) {
+        uint8_t tag, tlen;
+        const uint8_t* val;
+        int msgId = -1;
+        uint16_t offset = 0;
+        while (body.next(&tag, &val, &tlen)) {
+            if (tag == TAG_FRAG_MSG && tlen) msgId = val[0];
+            else if (tag == TAG_FRAG_OFFSET) offset = mochiTlvU16(val, tlen);
+        }
+        BleFragMemo* m = nullptr;
+        for (int i = 0; i < CH_COUNT; i++) {
+            if (g_fragMemo[i].data && g_fragMemo[i].msgId == msgId) m = &g_fragMemo[i];
+        }
+        if (m && offset < m->len && fletcher16(m->data, m->len) == m->sum) {
+            uint8_t firstSeq = offset / (m->chunk - FRAG_HEADER_SIZE);
+            notifyFragments(m->chr, m->data, m->len, m->chunk, m->msgId, firstSeq);
+            setReplyValue(m->chr, m->data, m->len);
+            g_replyStats.resent++;
+            Serial.printf("[BLE] Frammenti di %u rimandati dal byte %u\n", (unsigned)msgId, (unsigned)offset);
+            return;
+        }
+        replyError(from, reqId, PE_GONE);
+        Serial.printf("[BLE] Frammenti di %d non piu' disponibili\n", msgId);
+    }
+
+    // Frame binari: la risposta e' un frame con lo stesso reqId. Una write puo'
+    // contenere piu' frame in fila (batch): le risposte vengono accodate nello
+    // stesso buffer, nello stesso ordine, e partono in un'unica notify (o
+    // un'unica raffica di frammenti) sul flusso del primo frame.
+    void dispatchFrame(BLECharacteristic* from, const uint8_t* data, size_t len) {
+        uint8_t type, reqId;
+        MochiTlvReader body;
+        bool ok = mochiProtoParse(data, len, &type, &reqId, &body);
+        if (ok && type == PT_RESEND && PROTO_HEADER_SIZE + body.n == len) {
+            resendFragments(from, reqId, body);
+            return;
+        }
+        BleChannel& ch = channelFor(from, ok ? frameChannel(type) : CH_DIAG);
+        MochiWriter w(ch.buf, sizeof(ch.buf));
+        const char* what = "Errore frame";
+        int frames = 0;
+        while (len > 0) {
+            ok = mochiProtoParse(data, len, &type, &reqId, &body);
+            if (!ok) {
+                writeError(w, len > 2 ? data[2] : 0, PE_BAD_FRAME);
+                break; // senza lunghezza valida non si trova il frame dopo
+            }
+            what = answerFrame(w, ch.chr, type, reqId, body);
+            size_t used = PROTO_HEADER_SIZE + body.n;
+            data += used;
+            len  -= used;
+            frames++;
+        }
+        if (frames > 1) what = "Batch (bin)";
+        reply(ch.chr, w, what);
+    }
+
+    static void writeError(MochiWriter& w, uint8_t reqId, uint8_t code) {
+        MochiFrame err(w, PT_ERROR | PROTO_REPLY, reqId);
+        err.u8(TAG_ERROR_CODE, code);
+        err.end();
+    }
+
+    // Accoda al writer la risposta a un frame; ritorna cosa e' stato risposto.
+    const char* answerFrame(MochiWriter& w, BLECharacteristic* c, uint8_t type, uint8_t reqId, MochiTlvReader body) {
+        // Gli eventi vanno solo dal Mochi alla app; PT_RESEND solo da solo
+        // (dentro un batch la risposta riscriverebbe il buffer da rimandare).
+        if (type < PT_HELLO || type > PT_RESET_LINK || type == PT_STATE_EVENT || type == PT_SOCIAL_EVENT) {
+            writeError(w, reqId, PE_UNKNOWN_TYPE);
+            return "Errore frame";
+        }
+        MochiFrame f(w, type | PROTO_REPLY, reqId);
+        const char* what = "Frame";
+        switch (type) {
+            case PT_HELLO: {
+                uint8_t tag, tlen;
+                const uint8_t* val;
+                while (body.next(&tag, &val, &tlen)) {
+                    if (tag == TAG_CAPS) g_peerCaps = mochiTlvU32(val, tlen);
+                }
+                f.u8(TAG_VERSION, PROTO_VERSION);
+                f.u32(TAG_CAPS, PROTO_DEVICE_CAPS & (g_peerCaps | CAP_BINARY));
+                f.u16(TAG_MTU, g_server ? g_server->getPeerMTU(g_server->getConnId()) : BLE_MTU);
+                f.str(TAG_FIRMWARE, MOCHI_VERSION);
+                f.id(TAG_SELF_ID, mochiIdSelf());
+                what = "Hello";
+                Serial.printf("[BLE] Hello: capacita' app 0x%08lx\n", (unsigned long)g_peerCaps);
+                break;
+            }
+            case PT_GET_STATE:    statePtr->writeStateTlv(f);    what = "Stato (bin)"; break;
+            case PT_SUB_STATE: {
+                uint16_t ms = STATE_SUB_DEFAULT_MS;
+                uint8_t tag, tlen;
+                const uint8_t* val;
+                while (body.next(&tag, &val, &tlen)) {
+                    if (tag == TAG_INTERVAL) ms = mochiTlvU16(val, tlen);
+                }
+                if (ms && ms < STATE_SUB_MIN_MS) ms = STATE_SUB_MIN_MS;
+                g_stateSubChr = c;
+                g_stateSubKeyframe = true; // si riparte sempre da uno stato completo
+                g_stateSubMs = ms;
+                f.u16(TAG_INTERVAL, ms);
+                what = ms ? "Iscrizione stato" : "Disiscrizione stato";
+                break;
+            }
+            case PT_SUB_SOCIAL: {
+                uint16_t ms = SOCIAL_SUB_DEFAULT_MS;
+                uint8_t tag, tlen;
+                const uint8_t* val;
+                for (int i = 0; i < SL_COUNT; i++) g_socialAppVer[i] = 0; // 0 = "non so"
+                while (body.next(&tag, &val, &tlen)) {
+                    if (tag == TAG_INTERVAL) ms = mochiTlvU16(val, tlen);
+                    else if (tag >= TAG_NEARBY_VER && tag < TAG_NEARBY_VER + SL_COUNT)
+                        g_socialAppVer[tag - TAG_NEARBY_VER] = mochiTlvU32(val, tlen);
+                }
+                if (ms && ms < SOCIAL_SUB_MIN_MS) ms = SOCIAL_SUB_MIN_MS;
+                g_socialSubChr = c;
+                g_socialResync = true;
+                g_socialSubMs = ms;
+                f.u16(TAG_INTERVAL, ms);
+                what = ms ? "Iscrizione social" : "Disiscrizione social";
+                break;
+            }
+            case PT_GET_SETTINGS: statePtr->writeSettingsTlv(f); what = "Settings (bin)"; break;
+            case PT_GET_FRIENDS:  statePtr->writeFriendsTlv(f);  what = "Lista amici (bin)"; break;
+            case PT_GET_REQUESTS: statePtr->writeRequestsTlv(f); what = "Richieste (bin)"; break;
+            case PT_GET_NEARBY:
+                if (g_social) g_social->writeNearbyTlv(f);
+                what = "Lista vicini (bin)";
+                break;
+            case PT_GET_PRESENCE:
+                if (g_social) g_social->writePresenceTlv(f);
+                what = "Presenza (bin)";
+                break;
+            case PT_GET_LINK:
+                if (g_social) g_social->writeLinkTlv(f);
+                what = "Statistiche link (bin)";
+                break;
+            case PT_RESET_LINK:
+                if (g_social) g_social->resetLinkStats();
+                what = "Azzeramento link";
+                break;
+            case PT_GET_DEBUG:
+                if (g_social) g_social->writeDebugTlv(f);
+                what = "Report debug (bin)";
+                break;
+        }
+        f.end();
+        return what;
+    }
+
+    void dispatch(BLECharacteristic* from, const MochiCmd& cmd) {
+        BleChannel& ch = channelFor(from, cmdChannel(cmd.id));
+        BLECharacteristic* c = ch.chr;
+        MochiWriter w(ch.buf, sizeof(ch.buf));
+        const char* what = nullptr; // != nullptr: c'e' una risposta da inviare
+        MochiId id;
+        switch (cmd.id) {
+            case CMD_UNIX: {
+                long timestamp;
+                if (cmd.arg.toLong(&timestamp)) statePtr->syncTime(timestamp);
+                break;
+            }
+            case CMD_SET_JSON:
+                statePtr->saveSettings(cmd.arg.data, cmd.arg.len);
+                break;
+            case CMD_GET_JSON:
                 // Sempre con i colori reali del Mochi, così la pagina adotta lo
                 // schema colore del device appena connesso.
-                String reply = statePtr->getSettingsJson();
-                pCharacteristic->setValue(reply.c_str());
-                pCharacteristic->notify();
-                Serial.println("Settings inviati al browser.");
-            } else if (cmd == "get_settings") {
-                String reply = statePtr->settingsBlob;
-                pCharacteristic->setValue(reply.c_str());
-                pCharacteristic->notify();
-                Serial.println("[BLE] Impostazioni inviate al browser!");
-                return;
-            } else if (cmd == "get_state") {
-                String reply = statePtr->getStateJson();
-                pCharacteristic->setValue(reply.c_str());
-                pCharacteristic->notify();
-                Serial.println("[BLE] Stato inviato al browser!");
-                return;
-            } else if (cmd == "get_nearby") {
+                statePtr->writeSettingsJson(w);
+                what = "Settings";
+                break;
+            case CMD_GET_SETTINGS:
+                statePtr->writeSettingsJson(w);
+                what = "Impostazioni";
+                break;
+            case CMD_GET_STATE:
+                statePtr->writeStateJson(w);
+                what = "Stato";
+                break;
+            case CMD_GET_NEARBY:
                 // I vicini ora arrivano da ESP-NOW (modulo MochiNow).
-                String reply = g_social ? g_social->getNearbyJson() : "[]";
-                pCharacteristic->setValue(reply.c_str());
-                pCharacteristic->notify();
-                Serial.println("[BLE] Lista vicini inviata al browser!");
-                return;
-            } else if (cmd == "get_friends") {
-                String reply = statePtr->getFriendsJson();
-                pCharacteristic->setValue(reply.c_str());
-                pCharacteristic->notify();
-                Serial.println("[BLE] Lista amici inviata al browser!");
-                return;
-            } else if (cmd == "get_requests") {
-                String reply = statePtr->getRequestsJson();
-                pCharacteristic->setValue(reply.c_str());
-                pCharacteristic->notify();
-                Serial.println("[BLE] Richieste di amicizia inviate al browser!");
-                return;
-            } else if (cmd.startsWith("add_friend:")) {
+                if (g_social) g_social->writeNearbyJson(w);
+                else w.raw("[]");
+                what = "Lista vicini";
+                break;
+            case CMD_GET_FRIENDS:
+                // get_friends[:id]: la pagina dopo l'id (vedi writeFriendsJson)
+                if (!cmd.arg.len || !cmd.arg.toId(&id)) id = MOCHI_ID_NONE;
+                statePtr->writeFriendsJson(w, id);
+                what = "Lista amici";
+                break;
+            case CMD_GET_REQUESTS:
+                statePtr->writeRequestsJson(w);
+                what = "Richieste di amicizia";
+                break;
+            case CMD_ADD_FRIEND:
                 // Non aggiunge subito: invia una RICHIESTA di amicizia via ESP-NOW.
                 // L'amicizia nasce solo quando l'altro Mochi accetta.
-                if (g_social) g_social->sendFriendRequest(cmd.substring(11));
-                return;
-            } else if (cmd.startsWith("accept_friend:")) {
+                if (g_social && cmd.arg.toId(&id)) g_social->sendFriendRequest(id);
+                break;
+            case CMD_ACCEPT_FRIEND:
                 // Accetta una richiesta in arrivo: diventiamo amici e avvisiamo
                 // l'altro Mochi (che a sua volta ci aggiungerà → amicizia mutua).
-                String id = cmd.substring(14);
+                if (!cmd.arg.toId(&id)) break;
                 statePtr->addFriend(id);
                 statePtr->removePendingRequest(id);
                 if (g_social) g_social->sendFriendAccept(id);
-                return;
-            } else if (cmd.startsWith("decline_friend:")) {
-                statePtr->removePendingRequest(cmd.substring(15));
-                return;
-            } else if (cmd.startsWith("del_friend:")) {
+                break;
+            case CMD_DECLINE_FRIEND:
+                if (cmd.arg.toId(&id)) statePtr->removePendingRequest(id);
+                break;
+            case CMD_DEL_FRIEND:
                 // Rimuove l'amico e avvisa l'altro device (unfriend mutuo).
-                String id = cmd.substring(11);
+                if (!cmd.arg.toId(&id)) break;
                 statePtr->removeFriend(id);
                 if (g_social) g_social->sendUnfriend(id);
-                return;
-            } else if (cmd.startsWith("force_visit:")) {
+                break;
+            case CMD_FORCE_VISIT:
                 // DEBUG (temporaneo): forza la partenza in visita verso l'amico.
-                if (g_social) g_social->forceVisit(cmd.substring(12));
-                return;
-            } else if (cmd == "force_home") {
+                if (g_social && cmd.arg.toId(&id)) g_social->forceVisit(id);
+                break;
+            case CMD_FORCE_HOME:
                 // DEBUG (temporaneo): forza il rientro a casa anticipato.
                 if (g_social) g_social->forceHome();
-                return;
-            } else if (cmd == "get_debug") {
-                String reply = g_social ? g_social->getDebugReport() : "DBG\nsocial non collegato";
-                pCharacteristic->setValue(reply.c_str());
-                pCharacteristic->notify();
-                Serial.println("[BLE] Report debug inviato al browser!");
-                return;
-            } else {
-                statePtr->applyCommand(cmd);
+                break;
+            case CMD_GET_DEBUG:
+                if (g_social) g_social->writeDebugReport(w);
+                else w.raw("DBG\nsocial non collegato");
+                writeReplyStats(w);
+                what = "Report debug";
+                break;
+            case CMD_GET_LINK:
+                if (g_social) g_social->writeLinkReport(w);
+                else w.raw("DBG\nsocial non collegato");
+                what = "Statistiche link";
+                break;
+            case CMD_RESET_LINK:
+                if (g_social) g_social->resetLinkStats();
+                break;
+            case CMD_GET_MEM:
+                mochiMemWriteJson(w);
+                what = "Memoria";
+                break;
+            case CMD_GET_HISTORY: {
+                // get_history[:da,a,passo] (Unix, Unix, secondi). Senza argomento:
+                // tutto lo storico, un campione all'ora.
+                char buf[40];
+                size_t n = cmd.arg.len < sizeof(buf) - 1 ? cmd.arg.len : sizeof(buf) - 1;
+                memcpy(buf, cmd.arg.data, n);
+                buf[n] = '\0';
+                unsigned long from = 0, to = 0xFFFFFFFFUL, step = 3600;
+                sscanf(buf, "%lu,%lu,%lu", &from, &to, &step);
+                g_historyFrom = from;
+                g_historyTo   = to;
+                g_historyStep = step;
+                g_historyChr  = c;
+                g_historyRequested = true;
+                break;
             }
+            case CMD_QUEUE:
+                statePtr->queueAction(MochiState::actionFromName(cmd.arg));
+                break;
+            default:
+                // FEED, PLAY, KILL, GROW, prev, next
+                statePtr->applyCommand(cmd.id);
+                break;
         }
+        if (!what) return;
+        reply(c, w, what);
+    }
+};
+
+static MyCallbacks* g_callbacks = nullptr; // Esegue dal loop i comandi in coda
+
+// Task Bluedroid: solo copia in coda. Un pezzo scartato qui diventa un buco
+// nella sequenza: il loop risponde BAD_OFFSET e la app riparte da li'.
+class OtaCallbacks: public BLECharacteristicCallbacks {
+public:
+    void onWrite(BLECharacteristic *pCharacteristic) {
+        size_t len = pCharacteristic->getLength();
+        if (len == 0 || len > BLE_CMD_MAX_LEN) return;
+        OtaSlot* slot = g_otaQueue.beginPush();
+        if (!slot) return; // Contato in dropped()
+        slot->len = len;
+        memcpy(slot->data, pCharacteristic->getData(), len);
+        g_otaQueue.endPush();
     }
 };
 
@@ -144,24 +684,41 @@ MochiBLE::MochiBLE(MochiState* m, Adafruit_NeoPixel* led) {
     pServer = nullptr;
     pCharacteristic = nullptr;
 
-    uint32_t chipId = 0;
-    for(int i=0; i<17; i=i+8) { chipId |= ((ESP.getEfuseMac() >> (40 - i)) & 0xff) << i; }
-    String deviceName = "Mochi-" + String(chipId, HEX);
-    deviceName.toUpperCase();
-    bleName = deviceName;
+    // Stesso ID usato da ESP-NOW e nella lista amici (es. "MOCHI-ABCDEF").
+    bleName = mochiIdToString(mochiIdSelf());
+}
+
+// Flusso in sola lettura/notify (il valore resta leggibile per write + read).
+static BLECharacteristic* addStream(BLEService* s, const char* uuid) {
+    BLECharacteristic* c = s->createCharacteristic(
+                        uuid,
+                        BLECharacteristic::PROPERTY_READ |
+                        BLECharacteristic::PROPERTY_NOTIFY
+                      );
+    c->addDescriptor(new BLE2902());
+    return c;
 }
 
 void MochiBLE::begin() {
     Serial.println("Inizializzazione BLE...");
     BLEDevice::init(bleName.c_str());
-    BLEDevice::setMTU(512); // FONDAMENTALE PER I JSON LUNGHI!
+    BLEDevice::setMTU(BLE_MTU); // FONDAMENTALE PER I JSON LUNGHI!
+
+    BLEDevice::setSecurityCallbacks(new MySecurityCallbacks());
+    BLESecurity* security = new BLESecurity();
+    security->setAuthenticationMode(ESP_LE_AUTH_REQ_SC_MITM_BOND);
+    security->setCapability(ESP_IO_CAP_OUT);
+    security->setInitEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
 
     pServer = BLEDevice::createServer();
+    g_server = pServer;
     pServer->setCallbacks(new MyServerCallbacks(statusLed));
 
-    BLEService *pService = pServer->createService(SERVICE_UUID);
+    BLEService *pService = pServer->createService(SERVICE_UUID, SERVICE_HANDLES);
+    MyCallbacks* callbacks = new MyCallbacks(mochi);
+    g_callbacks = callbacks;
 
-    // Singola caratteristica tuttofare (come nel tuo codice originale)
+    // Caratteristica tuttofare originale, tenuta per le app vecchie
     pCharacteristic = pService->createCharacteristic(
                         CHARACTERISTIC_UUID,
                         BLECharacteristic::PROPERTY_READ   |
@@ -170,8 +727,34 @@ void MochiBLE::begin() {
                         BLECharacteristic::PROPERTY_NOTIFY
                       );
 
-    pCharacteristic->setCallbacks(new MyCallbacks(mochi));
+    pCharacteristic->setCallbacks(callbacks);
     pCharacteristic->addDescriptor(new BLE2902());
+    g_channels[CH_LEGACY].chr = pCharacteristic;
+
+    // Canali separati: i comandi entrano da una parte, le risposte escono su
+    // flussi diversi cosi' una lista lunga non blocca stato o diagnostica.
+    BLECharacteristic* cmdChar = pService->createCharacteristic(
+                        CMD_CHAR_UUID,
+                        BLECharacteristic::PROPERTY_WRITE |
+                        BLECharacteristic::PROPERTY_WRITE_NR
+                      );
+    cmdChar->setCallbacks(callbacks);
+    g_channels[CH_STATE].chr  = addStream(pService, STATE_CHAR_UUID);
+    g_channels[CH_SOCIAL].chr = addStream(pService, SOCIAL_CHAR_UUID);
+    g_channels[CH_DIAG].chr   = addStream(pService, DIAG_CHAR_UUID);
+
+    // Firmware: pezzi in write senza risposta, conferme in notify. Scrivere
+    // richiede un link abbinato con passkey (il telefono chiede il codice alla
+    // prima write).
+    g_otaChr = pService->createCharacteristic(
+                        OTA_CHAR_UUID,
+                        BLECharacteristic::PROPERTY_WRITE    |
+                        BLECharacteristic::PROPERTY_WRITE_NR |
+                        BLECharacteristic::PROPERTY_NOTIFY
+                      );
+    g_otaChr->setAccessPermissions(ESP_GATT_PERM_WRITE_ENC_MITM);
+    g_otaChr->setCallbacks(new OtaCallbacks());
+    g_otaChr->addDescriptor(new BLE2902());
 
     pService->start();
 
@@ -196,9 +779,331 @@ bool MochiBLE::isConnected() {
     return false;
 }
 
+size_t MochiBLE::notifySize() {
+    return peerNotifySize();
+}
+
+uint32_t MochiBLE::pairingPasskey() const {
+    return g_passkey;
+}
+
+void MochiBLE::tick() {
+    // Prima i PE_BUSY: la app aspetta una risposta per quei reqId
+    for (BleBusySlot* b; g_callbacks && (b = g_busyQueue.front()); g_busyQueue.pop()) {
+        g_callbacks->replyError(b->from, b->reqId, PE_BUSY);
+    }
+
+    // Comandi della app: pochi per giro, cosi' una raffica non ferma il display
+    for (int i = 0; i < BLE_CMD_PER_TICK && g_callbacks; i++) {
+        BleCmdSlot* slot = g_cmdQueue.front();
+        if (!slot) break;
+        g_callbacks->execute(slot->from, slot->data, slot->len);
+        g_cmdQueue.pop();
+    }
+
+    pumpOta();
+    pumpStateEvents();
+    pumpSocialEvents();
+    if (g_historyRequested) {
+        g_historyRequested = false;
+        mochi->history.startQuery(g_historyFrom, g_historyTo, g_historyStep);
+        Serial.printf("[BLE] Storico richiesto: %lu..%lu passo %lus\n",
+                      (unsigned long)g_historyFrom, (unsigned long)g_historyTo, (unsigned long)g_historyStep);
+        pumpHistory(); // anche a storico vuoto la app riceve "HIST END 0"
+        return;
+    }
+    if (mochi->history.queryActive()) pumpHistory();
+}
+
+// Pezzi del firmware arrivati dalla app. La sessione resta aperta anche se la
+// app si disconnette: riconnessa, rimanda BEGIN e riprende dall'offset.
+void MochiBLE::pumpOta() {
+    for (int i = 0; i < OTA_PER_TICK; i++) {
+        OtaSlot* slot = g_otaQueue.front();
+        if (!slot) break;
+        handleOta(slot->data, slot->len);
+        g_otaQueue.pop();
+    }
+    // BAD_OFFSET perso o ignorato: finche' il buco resta aperto lo si ripete,
+    // invece di lasciare la app ferma fino al suo timeout.
+    if (otaNakAt != UINT32_MAX) {
+        if (!isConnected() || otaNaks >= OTA_NAK_REPEATS) otaNakAt = UINT32_MAX; // Dopo decide la app
+        else if (millis() - otaNakMs >= OTA_NAK_REPEAT_MS) nakOta();
+    }
+    if (otaRestartAt && (long)(millis() - otaRestartAt) >= 0) {
+        Serial.println("[OTA] Riavvio sul nuovo firmware...");
+        ESP.restart();
+    }
+}
+
+void MochiBLE::handleOta(const uint8_t* data, size_t len) {
+    uint8_t op = data[0];
+    switch (op) {
+        case OTA_OP_BEGIN: {
+            if (len < OTA_BEGIN_SIZE) break;
+            OtaStatus st = ota.begin(mochiTlvU32(data + 1, 4), mochiTlvU32(data + 5, 4), data + 9);
+            otaAckedAt = ota.received();
+            otaUnacked = 0;
+            otaNakAt = UINT32_MAX;
+            otaReply(op, st);
+            return;
+        }
+        case OTA_OP_DATA: {
+            if (len < OTA_DATA_HEADER) break;
+            OtaStatus st = ota.write(mochiTlvU32(data + 1, 4), data + OTA_DATA_HEADER, len - OTA_DATA_HEADER);
+            if (st == OTA_BAD_OFFSET) {
+                // I pezzi gia' in volo dopo quello perso arrivano tutti fuori
+                // sequenza: il buco si segnala subito una volta, poi ci pensa
+                // pumpOta a ripeterlo ogni OTA_NAK_REPEAT_MS.
+                if (otaNakAt != ota.received()) {
+                    otaNakAt = ota.received();
+                    otaNaks = 0;
+                    nakOta();
+                }
+                return;
+            }
+            if (st != OTA_OK) {
+                otaReply(op, st);
+                return;
+            }
+            otaNakAt = UINT32_MAX;
+            // La app tiene in volo pochi pezzi oltre l'ultima conferma: con
+            // pezzi piccoli contano i pezzi, non i byte.
+            if (++otaUnacked >= OTA_ACK_CHUNKS || ota.received() - otaAckedAt >= OTA_ACK_BYTES ||
+                ota.received() == ota.compressedSize()) {
+                otaAckedAt = ota.received();
+                otaUnacked = 0;
+                otaReply(op, OTA_OK);
+            }
+            return;
+        }
+        case OTA_OP_END: {
+            OtaStatus st = ota.finish();
+            otaReply(op, st);
+            if (st == OTA_OK) {
+                mochi->saveState();
+                otaRestartAt = millis() + OTA_RESTART_DELAY_MS;
+                if (!otaRestartAt) otaRestartAt = 1;
+            }
+            return;
+        }
+        case OTA_OP_ABORT:
+            ota.abort();
+            otaReply(op, OTA_OK);
+            return;
+    }
+    otaReply(op, OTA_BAD_REQUEST);
+}
+
+void MochiBLE::nakOta() {
+    otaNaks++;
+    otaNakMs = millis();
+    otaReply(OTA_OP_DATA, OTA_BAD_OFFSET);
+}
+
+void MochiBLE::otaReply(uint8_t op, OtaStatus st) {
+    if (!g_otaChr || !isConnected()) return;
+    uint32_t off = ota.received();
+    uint8_t r[OTA_REPLY_SIZE] = { (uint8_t)(op | PROTO_REPLY), st,
+                                  (uint8_t)off, (uint8_t)(off >> 8), (uint8_t)(off >> 16), (uint8_t)(off >> 24) };
+    g_otaChr->setValue(r, sizeof(r));
+    g_otaChr->notify();
+}
+
+// Un pacchetto per giro di loop: "HIST\n" + righe CSV, e alla fine "HIST END n".
+void MochiBLE::pumpHistory() {
+    BLECharacteristic* c = g_historyChr ? g_historyChr : pCharacteristic;
+    if (!isConnected() || !c) {
+        mochi->history.cancelQuery();
+        return;
+    }
+    // Pacchetti grandi quanto una notify: righe intere, mai spezzate
+    size_t cap = notifySize() + 1;
+    MochiWriter w(streamBuf, cap < sizeof(streamBuf) ? cap : sizeof(streamBuf));
+    w.raw("HIST\n");
+    size_t header = w.length();
+    bool more = mochi->history.pump(w);
+    if (w.length() > header) {
+        c->setValue((uint8_t*)w.data(), w.length());
+        c->notify();
+    }
+    if (!more) {
+        w.reset();
+        w.printf("HIST END %lu", (unsigned long)mochi->history.queryRows());
+        c->setValue((uint8_t*)w.data(), w.length());
+        c->notify();
+    }
+}
+
+// Delta dello stato per la app iscritta: solo i campi cambiati dall'ultimo
+// evento. I cambi ravvicinati si accumulano e partono insieme allo scadere
+// dell'intervallo; ogni STATE_KEYFRAME_MS si rimanda tutto per riallinearsi.
+void MochiBLE::pumpStateEvents() {
+    uint16_t minMs = g_stateSubMs;
+    BLECharacteristic* c = g_stateSubChr;
+    if (!minMs || !c || !isConnected()) return;
+
+    unsigned long now = millis();
+    bool key = g_stateSubKeyframe || now - subKeyMs >= STATE_KEYFRAME_MS;
+    if (!key && now - subSentMs < minMs) return;
+
+    uint8_t cur[STATE_FIELD_COUNT];
+    mochi->readStateFields(cur);
+    uint8_t changed = 0;
+    for (int i = 0; i < STATE_FIELD_COUNT; i++) {
+        if (key || cur[i] != subLast[i]) changed |= 1 << i;
+    }
+    if (!changed) return;
+
+    MochiWriter w(stateBuf, sizeof(stateBuf));
+    MochiFrame f(w, PT_STATE_EVENT | PROTO_REPLY, 0);
+    if (key) f.u8(TAG_KEYFRAME, 1);
+    for (int i = 0; i < STATE_FIELD_COUNT; i++) {
+        if (changed & (1 << i)) f.u8(TAG_HUNGER + i, cur[i]);
+    }
+    f.end();
+    c->setValue((uint8_t*)w.data(), w.length());
+    c->notify();
+
+    memcpy(subLast, cur, sizeof(subLast));
+    subSentMs = now;
+    if (key) {
+        subKeyMs = now;
+        g_stateSubKeyframe = false;
+    }
+    g_stateSubEvents++;
+    g_stateSubBytes += w.length();
+}
+
+// Liste social attuali, ordinate per id (amici e richieste lo sono gia').
+void MochiBLE::readSocialLists(SocialLists& l) {
+    l.ver[SL_NEARBY]   = g_social ? g_social->nearbyVersion() : 0;
+    l.ver[SL_FRIENDS]  = mochi->friendsVer;
+    l.ver[SL_REQUESTS] = mochi->requestsVer;
+    l.friendsLen  = mochi->friends.toSorted(l.friends);
+    l.requestsLen = mochi->pendingReqs.toSorted(l.requests);
+    l.nearbyLen = 0;
+    int n = g_social ? g_social->nearbyCount() : 0;
+    for (int i = 0; i < n && l.nearbyLen < MAX_NEARBY; i++) {
+        const NearbyMochi& m = g_social->nearbyAt(i);
+        // Inserimento ordinato: sono al massimo MAX_NEARBY
+        int j = l.nearbyLen++;
+        for (; j > 0 && l.nearby[j - 1] > m.id; j--) {
+            l.nearby[j] = l.nearby[j - 1];
+            l.nearbyRssi[j] = l.nearbyRssi[j - 1];
+            l.nearbyFlags[j] = l.nearbyFlags[j - 1];
+        }
+        l.nearby[j] = m.id;
+        l.nearbyRssi[j] = (int8_t)m.shownRssi;
+        l.nearbyFlags[j] = mochi->isFriend(m.id) ? 1 : 0;
+    }
+}
+
+// Differenza tra due liste ordinate: id nuovi con tagAdd, spariti con tagGone.
+static void writeIdDiff(MochiFrame& f, const MochiId* old, uint16_t oldLen,
+                        const MochiId* cur, uint16_t curLen, uint8_t tagAdd, uint8_t tagGone) {
+    uint16_t i = 0, j = 0;
+    while (i < oldLen || j < curLen) {
+        if (j >= curLen || (i < oldLen && old[i] < cur[j])) f.id(tagGone, old[i++]);
+        else if (i >= oldLen || cur[j] < old[i])            f.id(tagAdd, cur[j++]);
+        else { i++; j++; }
+    }
+}
+
+// Come writeIdDiff, ma un vicino gia' noto viene rimandato se RSSI o flag cambiano.
+static void writeNearbyDiff(MochiFrame& f, const SocialLists& old, const SocialLists& cur) {
+    uint8_t i = 0, j = 0;
+    while (i < old.nearbyLen || j < cur.nearbyLen) {
+        if (j >= cur.nearbyLen || (i < old.nearbyLen && old.nearby[i] < cur.nearby[j])) {
+            f.id(TAG_PEER_GONE, old.nearby[i++]);
+            continue;
+        }
+        bool same = i < old.nearbyLen && old.nearby[i] == cur.nearby[j];
+        if (!same || old.nearbyRssi[i] != cur.nearbyRssi[j] || old.nearbyFlags[i] != cur.nearbyFlags[j]) {
+            MochiId id = cur.nearby[j];
+            uint8_t e[5] = { (uint8_t)id, (uint8_t)(id >> 8), (uint8_t)(id >> 16),
+                             (uint8_t)cur.nearbyRssi[j], cur.nearbyFlags[j] };
+            f.bytes(TAG_PEER, e, sizeof(e));
+        }
+        if (same) i++;
+        j++;
+    }
+}
+
+// Eventi delle liste social per la app iscritta: per ogni lista cambiata la
+// nuova versione e solo le voci aggiunte, cambiate o sparite. Dopo l'iscrizione
+// le liste con versione diversa da quella della app partono per intero
+// (TAG_LIST_RESET). Rate limit come per lo stato.
+void MochiBLE::pumpSocialEvents() {
+    uint16_t minMs = g_socialSubMs;
+    BLECharacteristic* c = g_socialSubChr;
+    if (!minMs || !c || !isConnected()) return;
+
+    unsigned long now = millis();
+    if (!g_socialResync && now - socialSentMs < minMs) return;
+
+    // Controllo economico prima di rileggere le liste
+    uint32_t ver[SL_COUNT] = { g_social ? g_social->nearbyVersion() : 0, mochi->friendsVer, mochi->requestsVer };
+    uint8_t reset = 0;
+    if (g_socialResync) {
+        g_socialResync = false;
+        for (int i = 0; i < SL_COUNT; i++) {
+            if (g_socialAppVer[i] != ver[i]) reset |= 1 << i;
+        }
+        // I flag "amico" dei vicini dipendono dalla lista amici
+        if (reset & (1 << SL_FRIENDS)) reset |= 1 << SL_NEARBY;
+        readSocialLists(socialSent);
+        if (reset & (1 << SL_NEARBY))   socialSent.nearbyLen = 0;
+        if (reset & (1 << SL_FRIENDS))  socialSent.friendsLen = 0;
+        if (reset & (1 << SL_REQUESTS)) socialSent.requestsLen = 0;
+    }
+    uint8_t changed = reset;
+    for (int i = 0; i < SL_COUNT; i++) {
+        if (ver[i] != socialSent.ver[i]) changed |= 1 << i;
+    }
+    if (changed & (1 << SL_FRIENDS)) changed |= 1 << SL_NEARBY;
+    if (!changed) return;
+
+    readSocialLists(socialCur);
+    MochiWriter w(socialBuf, sizeof(socialBuf));
+    MochiFrame f(w, PT_SOCIAL_EVENT | PROTO_REPLY, 0);
+    if (reset) f.u8(TAG_LIST_RESET, reset);
+    if (changed & (1 << SL_REQUESTS)) {
+        f.u32(TAG_REQUESTS_VER, socialCur.ver[SL_REQUESTS]);
+        writeIdDiff(f, socialSent.requests, socialSent.requestsLen,
+                    socialCur.requests, socialCur.requestsLen, TAG_REQUEST, TAG_REQUEST_GONE);
+    }
+    if (changed & (1 << SL_FRIENDS)) {
+        f.u32(TAG_FRIENDS_VER, socialCur.ver[SL_FRIENDS]);
+        writeIdDiff(f, socialSent.friends, socialSent.friendsLen,
+                    socialCur.friends, socialCur.friendsLen, TAG_FRIEND, TAG_FRIEND_GONE);
+    }
+    if (changed & (1 << SL_NEARBY)) {
+        f.u32(TAG_NEARBY_VER, socialCur.ver[SL_NEARBY]);
+        writeNearbyDiff(f, socialSent, socialCur);
+    }
+    f.end();
+    reply(c, w, "Social (evento)");
+
+    socialSent = socialCur;
+    socialSentMs = now;
+    g_socialSubEvents++;
+    g_socialSubBytes += w.length();
+}
+
+const BleReplyStats& MochiBLE::replyStats() const {
+    return g_replyStats;
+}
+
 void MochiBLE::pushState() {
     if (!isConnected() || !pCharacteristic) return;
-    String state = mochi->getStateJson();
-    pCharacteristic->setValue(state.c_str());
-    pCharacteristic->notify();
+    MochiMemScope mem(MEM_BLE);
+    MochiWriter w(stateBuf, sizeof(stateBuf));
+    mochi->writeStateJson(w);
+    // Su entrambe: notify() non invia nulla se la app non si e' iscritta.
+    for (BLECharacteristic* c : { pCharacteristic, g_channels[CH_STATE].chr }) {
+        if (!c) continue;
+        c->setValue((uint8_t*)w.data(), w.length());
+        c->notify();
+    }
 }
@@ -8,9 +8,36 @@
 #include <BLE2902.h>
 #include <Adafruit_NeoPixel.h>
 #include "MochiState.h"
+#include "MochiOta.h"
 
 class MochiNow; // Forward declaration (discovery/visite ora su ESP-NOW)
 
+// Contatori delle risposte BLE, riportati nel report di debug.
+struct BleReplyStats {
+    uint32_t replies    = 0; // Risposte inviate
+    uint32_t bytes      = 0; // Byte serializzati nel buffer di notify
+    uint32_t copies     = 0; // Byte copiati nelle caratteristiche (setValue, frammenti compresi)
+    uint32_t heapAllocs = 0; // Allocazioni con new mentre un comando viene eseguito e risposto
+    uint32_t overflows  = 0; // Risposte troncate per buffer pieno
+    uint32_t fragmented = 0; // Risposte spezzate in frammenti
+    uint32_t fragments  = 0; // Frammenti inviati
+    uint32_t resent     = 0; // Richieste PT_RESEND servite
+    uint32_t clipped    = 0; // Risposte oltre l'MTU verso app senza frammenti
+};
+
+// Fotografia delle liste social (iscrizione): id ordinati per il diff.
+struct SocialLists {
+    uint32_t ver[SL_COUNT];
+    MochiId  nearby[MAX_NEARBY];
+    int8_t   nearbyRssi[MAX_NEARBY];
+    uint8_t  nearbyFlags[MAX_NEARBY]; // bit 0 = amico
+    uint8_t  nearbyLen;
+    MochiId  friends[MAX_FRIENDS];
+    uint16_t friendsLen;
+    MochiId  requests[MAX_PENDING_REQS];
+    uint16_t requestsLen;
+};
+
 class MochiBLE {
 private:
     MochiState* mochi;
@@ -18,13 +45,48 @@ private:
     String bleName;
     BLEServer* pServer;
     BLECharacteristic* pCharacteristic; // Ripristinato il puntatore
+    char stateBuf[BLE_STATE_BUF_SIZE];  // Buffer di pushState (gira nel loop, non nel task BLE)
+    char streamBuf[BLE_NOTIFY_SIZE + 1]; // Buffer dei pacchetti dello storico (loop)
+
+    // Iscrizione allo stato (solo loop): ultimo valore inviato e tempi
+    uint8_t subLast[STATE_FIELD_COUNT];
+    unsigned long subSentMs = 0;
+    unsigned long subKeyMs = 0;
+
+    // Iscrizione social (solo loop): liste gia' note alla app e liste attuali
+    SocialLists socialSent;
+    SocialLists socialCur;
+    unsigned long socialSentMs = 0;
+    char socialBuf[BLE_REPLY_BUF_SIZE + 1];
+
+    // Aggiornamento firmware (solo loop): pezzi presi dalla coda in pumpOta
+    MochiOta ota;
+    uint32_t otaAckedAt = 0;         // Ultimo offset confermato alla app
+    uint8_t  otaUnacked = 0;         // Pezzi accettati dopo l'ultima conferma
+    uint32_t otaNakAt = UINT32_MAX;  // Buco segnalato con BAD_OFFSET e ancora aperto
+    unsigned long otaNakMs = 0;      // Ultimo BAD_OFFSET inviato
+    uint8_t  otaNaks = 0;            // BAD_OFFSET inviati per questo buco
+    unsigned long otaRestartAt = 0;  // 0 = nessun riavvio in programma
+
+    void pumpOta();
+    void handleOta(const uint8_t* data, size_t len);
+    void nakOta();
+    void otaReply(uint8_t op, OtaStatus st);
+    void pumpHistory();
+    void pumpStateEvents();
+    void pumpSocialEvents();
+    void readSocialLists(SocialLists& l);
 
 public:
     MochiBLE(MochiState* m, Adafruit_NeoPixel* led);
     void begin();
 
     bool isConnected();
+    size_t notifySize(); // Payload massimo di una notify con l'MTU negoziato
+    uint32_t pairingPasskey() const; // Codice da mostrare mentre la app si abbina (0 = nessuno)
     void pushState();
+    const BleReplyStats& replyStats() const; // Contatori riportati da get_debug
+    void tick();       // Dal loop: comandi in coda, firmware, storico a pezzi e notifiche dello stato
 
     // Collega il modulo social (ESP-NOW) così la companion app può leggere i vicini.
     void attachSocial(MochiNow* now);
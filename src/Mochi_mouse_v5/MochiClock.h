@@ -0,0 +1,30 @@
+#ifndef MOCHI_CLOCK_H
+#define MOCHI_CLOCK_H
+
+#include <Arduino.h>
+
+// ================================================================
+// TEMPO E CASO DI UN MOCHI
+// ----------------------------------------------------------------
+// MochiState e MochiNow non chiamano millis() ne' random() direttamente:
+// passano da qui. Sul device e' l'orologio di sistema e il generatore
+// hardware; in un simulatore ogni nodo ha il suo orologio (sfasato, con
+// deriva) e il suo generatore con seme, cosi' una rete di cento Mochi si
+// ripete uguale a parita' di seme.
+// ================================================================
+
+class MochiClock {
+public:
+  virtual ~MochiClock() {}
+  virtual unsigned long now() { return millis(); }
+  virtual uint32_t random32() { return esp_random(); }
+  uint32_t random(uint32_t n) { return n ? random32() % n : 0; } // 0..n-1
+};
+
+// Orologio del device, quello di default.
+inline MochiClock* mochiSystemClock() {
+  static MochiClock c;
+  return &c;
+}
+
+#endif // MOCHI_CLOCK_H
@@ -0,0 +1,136 @@
+#include "MochiCmd.h"
+#include <limits.h>
+
+// ================================================================
+// TABELLA A HASH PERFETTO
+// ----------------------------------------------------------------
+// FNV-1a (con seme) sul verbo, 6 bit presi dalla parte alta: con questo seme
+// tutti i verbi cadono in slot diversi, e lo verifica lo static_assert qui
+// sotto. Se aggiungendo un verbo l'assert scatta, basta cambiare CMD_HASH_SEED.
+// Il lookup e' quindi un solo hash + un memcmp di conferma.
+// ================================================================
+
+#define CMD_TABLE_SIZE 64
+#define CMD_HASH_SEED  334
+
+struct VerbDef {
+  const char* name;
+  uint8_t     len;
+  MochiCmdId  id;
+};
+
+#define VERB(s, id) { s, sizeof(s) - 1, id }
+
+static constexpr VerbDef VERBS[] = {
+  VERB("unix",           CMD_UNIX),
+  VERB("set_json",       CMD_SET_JSON),
+  VERB("get_json",       CMD_GET_JSON),
+  VERB("get_settings",   CMD_GET_SETTINGS),
+  VERB("get_state",      CMD_GET_STATE),
+  VERB("get_nearby",     CMD_GET_NEARBY),
+  VERB("get_friends",    CMD_GET_FRIENDS),
+  VERB("get_requests",   CMD_GET_REQUESTS),
+  VERB("add_friend",     CMD_ADD_FRIEND),
+  VERB("accept_friend",  CMD_ACCEPT_FRIEND),
+  VERB("decline_friend", CMD_DECLINE_FRIEND),
+  VERB("del_friend",     CMD_DEL_FRIEND),
+  VERB("force_visit",    CMD_FORCE_VISIT),
+  VERB("force_home",     CMD_FORCE_HOME),
+  VERB("get_debug",      CMD_GET_DEBUG),
+  VERB("queue",          CMD_QUEUE),
+  VERB("FEED",           CMD_FEED),
+  VERB("PLAY",           CMD_PLAY),
+  VERB("KILL",           CMD_KILL),
+  VERB("GROW",           CMD_GROW),
+  VERB("prev",           CMD_PREV),
+  VERB("next",           CMD_NEXT),
+  VERB("get_mem",        CMD_GET_MEM),
+  VERB("get_history",    CMD_GET_HISTORY),
+  VERB("get_link",       CMD_GET_LINK),
+  VERB("reset_link",     CMD_RESET_LINK),
+};
+
+#define VERB_COUNT (sizeof(VERBS) / sizeof(VERBS[0]))
+static_assert(VERB_COUNT == CMD_COUNT - 1, "Ogni MochiCmdId deve avere il suo verbo");
+
+static constexpr uint8_t verbSlot(const char* s, size_t n) {
+  uint32_t h = 2166136261UL ^ CMD_HASH_SEED;
+  for (size_t i = 0; i < n; i++) {
+    h ^= (uint8_t)s[i];
+    h *= 16777619UL;
+  }
+  return (uint8_t)((h >> 16) & (CMD_TABLE_SIZE - 1));
+}
+
+static constexpr bool verbsCollisionFree() {
+  for (size_t i = 0; i < VERB_COUNT; i++) {
+    for (size_t j = i + 1; j < VERB_COUNT; j++) {
+      if (verbSlot(VERBS[i].name, VERBS[i].len) == verbSlot(VERBS[j].name, VERBS[j].len)) return false;
+    }
+  }
+  return true;
+}
+static_assert(verbsCollisionFree(), "Collisione nella tabella dei comandi: cambiare CMD_HASH_SEED");
+
+// slot -> indice in VERBS (0xFF = vuoto), costruita interamente a compile time.
+struct VerbTable {
+  uint8_t slot[CMD_TABLE_SIZE];
+  constexpr VerbTable() : slot() {
+    for (size_t i = 0; i < CMD_TABLE_SIZE; i++) slot[i] = 0xFF;
+    for (size_t k = 0; k < VERB_COUNT; k++) slot[verbSlot(VERBS[k].name, VERBS[k].len)] = (uint8_t)k;
+  }
+};
+static constexpr VerbTable TABLE;
+
+bool mochiCmdParse(const uint8_t* data, size_t len, MochiCmd* out) {
+  out->id = CMD_NONE;
+  out->arg.data = "";
+  out->arg.len = 0;
+  if (!data || len == 0) return false;
+
+  const char* s = (const char*)data;
+  size_t verbLen = 0;
+  while (verbLen < len && s[verbLen] != ':') verbLen++;
+
+  uint8_t k = TABLE.slot[verbSlot(s, verbLen)];
+  if (k == 0xFF || VERBS[k].len != verbLen || memcmp(VERBS[k].name, s, verbLen) != 0) return false;
+
+  out->id = VERBS[k].id;
+  if (verbLen < len) {
+    out->arg.data = s + verbLen + 1;
+    out->arg.len  = len - verbLen - 1;
+  }
+  return true;
+}
+
+const char* mochiCmdName(MochiCmdId id) {
+  for (size_t k = 0; k < VERB_COUNT; k++) {
+    if (VERBS[k].id == id) return VERBS[k].name;
+  }
+  return "?";
+}
+
+bool MochiArg::equals(const char* s) const {
+  size_t n = strlen(s);
+  return n == len && memcmp(data, s, n) == 0;
+}
+
+// Solo [-]cifre. Il limite e' quello di long sulla piattaforma (32 bit
+// sull'ESP32): un numero fuori scala e' un argomento non valido.
+bool MochiArg::toLong(long* out) const {
+  if (len == 0) return false;
+  size_t i = 0;
+  bool neg = data[0] == '-';
+  if (neg) i = 1;
+  if (i >= len) return false;
+  unsigned long limit = neg ? (unsigned long)LONG_MAX + 1 : (unsigned long)LONG_MAX;
+  unsigned long v = 0;
+  for (; i < len; i++) {
+    if (data[i] < '0' || data[i] > '9') return false;
+    unsigned d = data[i] - '0';
+    if (v > (limit - d) / 10) return false;
+    v = v * 10 + d;
+  }
+  *out = neg ? -(long)(v - 1) - 1 : (long)v;
+  return true;
+}
@@ -0,0 +1,67 @@
+#ifndef MOCHI_CMD_H
+#define MOCHI_CMD_H
+
+#include <Arduino.h>
+#include "MochiId.h"
+
+// ================================================================
+// COMANDI DELLA COMPANION APP
+// ----------------------------------------------------------------
+// Un comando e' "verbo" oppure "verbo:argomento". Il verbo viene riconosciuto
+// direttamente sui byte grezzi della caratteristica tramite una tabella di
+// hash perfetto calcolata a compile time; l'argomento resta una vista sui byte
+// originali (MochiArg), convertita in tipi (numero, id) solo da chi la usa.
+// Nessuna String, nessuna allocazione.
+// ================================================================
+
+enum MochiCmdId : uint8_t {
+  CMD_NONE = 0,
+  CMD_UNIX,
+  CMD_SET_JSON,
+  CMD_GET_JSON,
+  CMD_GET_SETTINGS,
+  CMD_GET_STATE,
+  CMD_GET_NEARBY,
+  CMD_GET_FRIENDS,
+  CMD_GET_REQUESTS,
+  CMD_ADD_FRIEND,
+  CMD_ACCEPT_FRIEND,
+  CMD_DECLINE_FRIEND,
+  CMD_DEL_FRIEND,
+  CMD_FORCE_VISIT,
+  CMD_FORCE_HOME,
+  CMD_GET_DEBUG,
+  CMD_QUEUE,
+  CMD_FEED,
+  CMD_PLAY,
+  CMD_KILL,
+  CMD_GROW,
+  CMD_PREV,
+  CMD_NEXT,
+  CMD_GET_MEM,
+  CMD_GET_HISTORY,
+  CMD_GET_LINK,
+  CMD_RESET_LINK,
+  CMD_COUNT
+};
+
+// Vista (non proprietaria) sull'argomento dopo i ':'. Non e' terminata da '\0'.
+struct MochiArg {
+  const char* data;
+  size_t      len;
+
+  bool equals(const char* s) const;
+  bool toLong(long* out) const;
+  bool toId(MochiId* out) const { return mochiIdParse(data, len, out); }
+};
+
+struct MochiCmd {
+  MochiCmdId id;
+  MochiArg   arg;
+};
+
+// Riconosce il verbo in `data`: ritorna false (id = CMD_NONE) se sconosciuto.
+bool        mochiCmdParse(const uint8_t* data, size_t len, MochiCmd* out);
+const char* mochiCmdName(MochiCmdId id);
+
+#endif // MOCHI_CMD_H
@@ -0,0 +1,70 @@
+#include "MochiEspNow.h"
+#include "Settings.h"
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+
+// Ponte verso il ricevitore per le callback C di ESP-NOW (task WiFi).
+static MochiRadioSink* g_sink = nullptr;
+
+static const uint8_t BCAST_MAC[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static void onRecvStatic(const esp_now_recv_info_t* info, const uint8_t* data, int len) {
+    if (g_sink && len > 0) g_sink->onRadioRecv(info->src_addr, info->rx_ctrl ? info->rx_ctrl->rssi : 0, data, len);
+}
+
+static void onSendStatic(const esp_now_send_info_t* tx_info, esp_now_send_status_t status) {
+    if (g_sink) g_sink->onRadioSent(status == ESP_NOW_SEND_SUCCESS);
+}
+
+bool MochiEspNow::begin(MochiRadioSink* sink) {
+    g_sink = sink;
+
+    // ESP-NOW richiede il WiFi in STA, senza connettersi ad alcun access point.
+    WiFi.mode(WIFI_STA);
+    WiFi.disconnect();
+    // CRUCIALE: senza disattivare il power-save il modem WiFi dorme e perde
+    // i pacchetti ESP-NOW in ricezione.
+    WiFi.setSleep(false);
+    esp_wifi_set_channel(ESPNOW_CHANNEL, WIFI_SECOND_CHAN_NONE);
+
+    if (esp_now_init() != ESP_OK) {
+        Serial.println("[NOW] esp_now_init FALLITO!");
+        return false;
+    }
+    esp_now_register_recv_cb(onRecvStatic);
+    esp_now_register_send_cb(onSendStatic);
+
+    // Peer broadcast per gli annunci di presenza.
+    ready = addPeer(BCAST_MAC);
+    return ready;
+}
+
+void MochiEspNow::macAddress(uint8_t mac[6]) {
+    WiFi.macAddress(mac);
+}
+
+uint8_t MochiEspNow::channel() {
+    if (!ready) return 0;
+    uint8_t primaryCh = 0; wifi_second_chan_t secondCh;
+    esp_wifi_get_channel(&primaryCh, &secondCh);
+    return primaryCh;
+}
+
+bool MochiEspNow::addPeer(const uint8_t* mac) {
+    if (esp_now_is_peer_exist(mac)) return true;
+    esp_now_peer_info_t peer = {};
+    memcpy(peer.peer_addr, mac, 6);
+    peer.channel = ESPNOW_CHANNEL;
+    peer.ifidx   = WIFI_IF_STA;
+    peer.encrypt = false;
+    return esp_now_add_peer(&peer) == ESP_OK;
+}
+
+void MochiEspNow::removePeer(const uint8_t* mac) {
+    esp_now_del_peer(mac);
+}
+
+bool MochiEspNow::send(const uint8_t* mac, const uint8_t* data, size_t len) {
+    return esp_now_send(mac, data, len) == ESP_OK;
+}
@@ -0,0 +1,21 @@
+#ifndef MOCHI_ESP_NOW_H
+#define MOCHI_ESP_NOW_H
+
+#include "MochiTransport.h"
+
+// Radio vera: WiFi in STA sul canale ESPNOW_CHANNEL e ESP-NOW. Una sola
+// istanza (le callback ESP-NOW sono globali).
+class MochiEspNow : public MochiTransport {
+public:
+  bool    begin(MochiRadioSink* sink) override;
+  void    macAddress(uint8_t mac[6]) override;
+  uint8_t channel() override;
+  bool    addPeer(const uint8_t* mac) override;
+  void    removePeer(const uint8_t* mac) override;
+  bool    send(const uint8_t* mac, const uint8_t* data, size_t len) override;
+
+private:
+  bool ready = false;
+};
+
+#endif // MOCHI_ESP_NOW_H
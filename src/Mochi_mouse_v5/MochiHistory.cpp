@@ -0,0 +1,274 @@
+#include "MochiHistory.h"
+
+#define HISTORY_SECTOR_SIZE 4096
+#define HISTORY_MAGIC       0x3153484DUL // "MHS1"
+#define HISTORY_MAX_RECORD  48           // maschera + 7 varint + intervallo + crc
+
+struct HistorySectorHeader {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t t0;                    // ora del primo campione del settore
+  uint32_t crc;                   // crc8 dei 12 byte precedenti
+};
+
+static uint8_t crc8(const uint8_t* p, size_t n) {
+  uint8_t crc = 0;
+  while (n--) {
+    crc ^= *p++;
+    for (int i = 0; i < 8; i++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+  }
+  return crc;
+}
+
+static size_t putVarint(uint8_t* out, uint32_t v) {
+  size_t n = 0;
+  while (v >= 0x80) { out[n++] = (v & 0x7F) | 0x80; v >>= 7; }
+  out[n++] = v;
+  return n;
+}
+
+// Legge un varint da p[0..n): ritorna i byte consumati, 0 se troncato.
+static size_t getVarint(const uint8_t* p, size_t n, uint32_t* v) {
+  uint32_t r = 0;
+  for (size_t i = 0; i < n && i < 5; i++) {
+    r |= (uint32_t)(p[i] & 0x7F) << (7 * i);
+    if (!(p[i] & 0x80)) { *v = r; return i + 1; }
+  }
+  return 0;
+}
+
+static inline uint32_t zigzag(int32_t v)   { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+static inline int32_t  unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+// ================================================================
+// AVVIO E RECUPERO
+// ================================================================
+
+bool MochiHistory::begin() {
+  part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)HISTORY_SUBTYPE, HISTORY_PARTITION);
+  if (!part) {
+    Serial.println("[HIST] Partizione storico assente, storico disattivato.");
+    return false;
+  }
+  sectors = part->size / HISTORY_SECTOR_SIZE;
+
+  // Il settore in scrittura e' quello valido con la sequenza piu' alta.
+  bool found = false;
+  uint32_t seq, t0, headT0 = 0;
+  for (uint16_t s = 0; s < sectors; s++) {
+    if (!readHeader(s, &seq, &t0)) continue;
+    if (!found || (int32_t)(seq - headSeq) > 0) {
+      found = true; head = s; headSeq = seq; headT0 = t0;
+    }
+  }
+  headOpen = false;
+  if (!found) {
+    Serial.printf("[HIST] Storico vuoto (%u settori).\n", sectors);
+    return true;
+  }
+
+  // Riscorre il settore per ritrovare il punto di scrittura e l'ultimo campione.
+  Cursor c;
+  resetCursor(c, head, headSeq, headT0);
+  HistorySample s;
+  int r;
+  uint32_t n = 0;
+  while ((r = readRecord(c, &s)) == 1) n++;
+  last     = c.prev;
+  writeOff = c.off;
+  headOpen = (r == 0); // record corrotto: si riparte dal settore successivo
+  Serial.printf("[HIST] Settore %u (seq %lu): %lu campioni%s\n", head, (unsigned long)headSeq,
+                (unsigned long)n, headOpen ? "" : ", coda corrotta scartata");
+  return true;
+}
+
+bool MochiHistory::readHeader(uint16_t sector, uint32_t* seq, uint32_t* t0) {
+  HistorySectorHeader h;
+  if (esp_partition_read(part, (size_t)sector * HISTORY_SECTOR_SIZE, &h, sizeof(h)) != ESP_OK) return false;
+  if (h.magic != HISTORY_MAGIC || h.crc != crc8((const uint8_t*)&h, 12)) return false;
+  *seq = h.seq;
+  *t0  = h.t0;
+  return true;
+}
+
+// Cancella il settore successivo e ci scrive l'intestazione: da qui si riparte
+// con un keyframe.
+void MochiHistory::openSector(uint32_t t0) {
+  if (headSeq != 0 || headOpen) head = (head + 1) % sectors;
+  headSeq++;
+  esp_partition_erase_range(part, (size_t)head * HISTORY_SECTOR_SIZE, HISTORY_SECTOR_SIZE);
+
+  HistorySectorHeader h = { HISTORY_MAGIC, headSeq, t0, 0 };
+  h.crc = crc8((const uint8_t*)&h, 12);
+  esp_partition_write(part, (size_t)head * HISTORY_SECTOR_SIZE, &h, sizeof(h));
+
+  memset(&last, 0, sizeof(last));
+  last.time = t0 - HISTORY_INTERVAL_S;
+  writeOff = sizeof(h);
+  headOpen = true;
+}
+
+// ================================================================
+// SCRITTURA
+// ================================================================
+
+void MochiHistory::append(const HistorySample& s) {
+  if (!part) return;
+
+  uint8_t  rec[HISTORY_MAX_RECORD];
+  size_t   n = 1;
+  uint8_t  mask = 0;
+  bool     fresh = !headOpen || s.time < last.time ||
+                   writeOff + HISTORY_MAX_RECORD > HISTORY_SECTOR_SIZE;
+
+  for (int pass = 0; pass < 2; pass++) {
+    if (fresh) openSector(s.time);
+    n = 1; mask = 0;
+    for (int i = 0; i < HISTORY_FIELDS; i++) {
+      int32_t d = (int32_t)s.v[i] - (int32_t)last.v[i];
+      if (d == 0) continue;
+      mask |= 1 << i;
+      n += putVarint(rec + n, zigzag(d));
+    }
+    uint32_t dt = s.time - last.time;
+    if (dt != HISTORY_INTERVAL_S) {
+      mask |= 0x80;
+      n += putVarint(rec + n, dt);
+    }
+    // 0xFF e' riservato allo spazio libero: succede solo se cambia tutto
+    // insieme a un intervallo anomalo, e in quel caso si apre un keyframe.
+    if (mask != 0xFF) break;
+    fresh = true;
+  }
+  rec[0] = mask;
+  rec[n] = crc8(rec, n);
+  n++;
+
+  esp_partition_write(part, (size_t)head * HISTORY_SECTOR_SIZE + writeOff, rec, n);
+  writeOff += n;
+  last = s;
+}
+
+// ================================================================
+// LETTURA
+// ================================================================
+
+void MochiHistory::resetCursor(Cursor& c, uint16_t sector, uint32_t seq, uint32_t t0) {
+  c.sector = sector;
+  c.seq    = seq;
+  c.off    = sizeof(HistorySectorHeader);
+  memset(&c.prev, 0, sizeof(c.prev));
+  c.prev.time = t0 - HISTORY_INTERVAL_S;
+}
+
+int MochiHistory::readRecord(Cursor& c, HistorySample* out) {
+  uint8_t buf[HISTORY_MAX_RECORD];
+  size_t avail = HISTORY_SECTOR_SIZE - c.off;
+  if (avail > sizeof(buf)) avail = sizeof(buf);
+  if (avail == 0) return 0;
+  if (esp_partition_read(part, (size_t)c.sector * HISTORY_SECTOR_SIZE + c.off, buf, avail) != ESP_OK) return -1;
+
+  uint8_t mask = buf[0];
+  if (mask == 0xFF) return 0;
+
+  HistorySample s = c.prev;
+  size_t n = 1;
+  uint32_t v;
+  for (int i = 0; i < HISTORY_FIELDS; i++) {
+    if (!(mask & (1 << i))) continue;
+    size_t k = getVarint(buf + n, avail - n, &v);
+    if (!k) return -1;
+    s.v[i] = (uint8_t)((int32_t)s.v[i] + unzigzag(v));
+    n += k;
+  }
+  uint32_t dt = HISTORY_INTERVAL_S;
+  if (mask & 0x80) {
+    size_t k = getVarint(buf + n, avail - n, &dt);
+    if (!k) return -1;
+    n += k;
+  }
+  if (n >= avail || buf[n] != crc8(buf, n)) return -1;
+  s.time = c.prev.time + dt;
+
+  c.off += n + 1;
+  c.prev = s;
+  *out = s;
+  return 1;
+}
+
+// Settore valido con la sequenza piu' bassa (il piu' vecchio ancora nel ring).
+bool MochiHistory::oldestSector(uint16_t* sector) {
+  bool found = false;
+  uint32_t best = 0, seq, t0;
+  for (uint16_t s = 0; s < sectors; s++) {
+    if (!readHeader(s, &seq, &t0)) continue;
+    if (!found || (int32_t)(seq - best) < 0) { found = true; best = seq; *sector = s; }
+  }
+  return found;
+}
+
+void MochiHistory::startQuery(uint32_t from, uint32_t to, uint32_t step) {
+  query.active   = false;
+  query.from     = from;
+  query.to       = to;
+  query.step     = step;
+  query.rows     = 0;
+  query.haveEmit = false;
+  uint16_t first;
+  if (!part || !oldestSector(&first)) return;
+
+  uint32_t seq, t0;
+  readHeader(first, &seq, &t0);
+  resetCursor(query.cur, first, seq, t0);
+  query.sectorsLeft = sectors;
+  query.active = true;
+}
+
+bool MochiHistory::pump(MochiWriter& w) {
+  if (!query.active) return false;
+  Cursor& c = query.cur;
+
+  // Tra un pacchetto e l'altro append() puo' aver riciclato il settore che
+  // stavamo leggendo (la sequenza cambia): in quel caso lo si salta.
+  uint32_t seq, t0;
+  bool sectorGone = !readHeader(c.sector, &seq, &t0) || seq != c.seq;
+
+  for (int budget = HISTORY_PUMP_RECORDS; budget > 0; budget--) {
+    Cursor before = c;
+    HistorySample s;
+    int r = sectorGone ? 0 : readRecord(c, &s);
+    sectorGone = false;
+
+    if (r != 1) {
+      // Settore finito (o corrotto): avanti col prossimo in sequenza.
+      bool next = false;
+      while (--query.sectorsLeft > 0) {
+        uint16_t ns = (c.sector + 1) % sectors;
+        c.sector = ns;
+        if (readHeader(ns, &seq, &t0) && (int32_t)(seq - c.seq) > 0) {
+          resetCursor(c, ns, seq, t0);
+          next = true;
+          break;
+        }
+      }
+      if (!next) { query.active = false; return false; }
+      continue;
+    }
+
+    if (s.time < query.from || s.time > query.to) continue;
+    if (query.haveEmit && s.time - query.lastEmit < query.step) continue;
+
+    char row[48];
+    int n = snprintf(row, sizeof(row), "%lu,%u,%u,%u,%u,%u,%u,%u\n", (unsigned long)s.time,
+                     s.v[0], s.v[1], s.v[2], s.v[3], s.v[4], s.v[5], s.v[6]);
+    if ((size_t)n > w.room()) {
+      c = before; // non ci sta: si riprende da questo campione al prossimo pacchetto
+      return true;
+    }
+    w.raw(row, n);
+    query.rows++;
+    query.lastEmit = s.time;
+    query.haveEmit = true;
+  }
+  return true;
+}
@@ -0,0 +1,90 @@
+#ifndef MOCHI_HISTORY_H
+#define MOCHI_HISTORY_H
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include "Settings.h"
+#include "MochiWriter.h"
+
+// ================================================================
+// STORICO DELLE STATISTICHE (partizione "history")
+// ----------------------------------------------------------------
+// Ring di settori da 4 KB. Ogni settore inizia con un'intestazione
+// (magic, numero di sequenza, ora del primo campione) seguita dai record:
+//
+//   [maschera][varint...][crc8]
+//
+// bit 0..6 della maschera = campo cambiato (hunger, happy, str, spd, int,
+// chr, age), seguito dalla differenza zigzag-varint rispetto al campione
+// precedente; bit 7 = intervallo diverso da HISTORY_INTERVAL_S, seguito dai
+// secondi trascorsi. Un campione senza variazioni costa 2 byte.
+// Ogni settore riparte da zero (il primo record e' un keyframe), quindi si
+// decodifica da solo. 0xFF come maschera = spazio libero.
+//
+// Recupero dopo un'interruzione di corrente: un'intestazione con crc errato
+// rende il settore vuoto; un record con crc errato chiude il settore e il
+// campione successivo apre quello dopo.
+// ================================================================
+
+#define HISTORY_FIELDS 7
+
+struct HistorySample {
+  uint32_t time;                  // Unix
+  uint8_t  v[HISTORY_FIELDS];     // hunger, happy, str, spd, int, chr, age
+};
+
+class MochiHistory {
+public:
+  bool begin();                   // false se la partizione non c'e'
+  void append(const HistorySample& s);
+
+  // --- Interrogazione a blocchi ---
+  // La query viene avviata e poi consumata un pacchetto alla volta dal loop,
+  // cosi' anche una settimana di campioni non blocca il rendering.
+  void startQuery(uint32_t from, uint32_t to, uint32_t step);
+  void cancelQuery() { query.active = false; }
+  bool queryActive() const { return query.active; }
+  // Scrive righe "t,hu,ha,st,sp,in,ch,ag\n" finche' c'e' spazio nel writer.
+  // Ritorna false quando la query e' finita (le ultime righe sono nel writer).
+  bool pump(MochiWriter& w);
+  uint32_t queryRows() const { return query.rows; }
+
+private:
+  struct Cursor {
+    uint16_t      sector;
+    uint32_t      seq;
+    uint32_t      off;
+    HistorySample prev;
+  };
+
+  struct Query {
+    bool     active = false;
+    uint32_t from, to, step;
+    uint32_t lastEmit;
+    uint32_t rows;
+    uint16_t sectorsLeft;         // settori ancora da visitare (dal piu' vecchio)
+    bool     haveEmit;
+    Cursor   cur;
+  };
+
+  const esp_partition_t* part = nullptr;
+  uint16_t sectors = 0;
+
+  // Settore in scrittura
+  bool     headOpen = false;      // false: il prossimo campione apre un settore nuovo
+  uint16_t head = 0;
+  uint32_t headSeq = 0;
+  uint32_t writeOff = 0;
+  HistorySample last;             // Ultimo campione scritto (base dei delta)
+
+  Query query;
+
+  bool readHeader(uint16_t sector, uint32_t* seq, uint32_t* t0);
+  void openSector(uint32_t t0);
+  void resetCursor(Cursor& c, uint16_t sector, uint32_t seq, uint32_t t0);
+  // 1 = campione letto, 0 = fine settore, -1 = record corrotto
+  int  readRecord(Cursor& c, HistorySample* out);
+  bool oldestSector(uint16_t* sector);
+};
+
+#endif // MOCHI_HISTORY_H
@@ -0,0 +1,53 @@
+#include "MochiId.h"
+
+static const char ID_PREFIX[] = "MOCHI-";
+#define ID_PREFIX_LEN 6
+
+// Stesso schema storico di MochiBLE/MochiNow: i 3 byte bassi del MAC efuse,
+// letti a rovescio, cosi' l'id resta coerente con gli amici gia' salvati.
+MochiId mochiIdSelf() {
+  uint32_t chipId = 0;
+  for (int i = 0; i < 17; i = i + 8) { chipId |= ((ESP.getEfuseMac() >> (40 - i)) & 0xff) << i; }
+  return chipId & MOCHI_ID_MASK;
+}
+
+bool mochiIdParse(const char* s, size_t len, MochiId* out) {
+  if (!s || len <= ID_PREFIX_LEN || len > ID_PREFIX_LEN + 6) return false;
+  for (int i = 0; i < ID_PREFIX_LEN; i++) {
+    char c = s[i];
+    if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+    if (c != ID_PREFIX[i]) return false;
+  }
+  uint32_t v = 0;
+  for (size_t i = ID_PREFIX_LEN; i < len; i++) {
+    char c = s[i];
+    uint8_t d;
+    if (c >= '0' && c <= '9')      d = c - '0';
+    else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+    else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+    else return false;
+    v = (v << 4) | d;
+  }
+  *out = v;
+  return true;
+}
+
+size_t mochiIdFormat(MochiId id, char* out, size_t cap) {
+  if (cap < MOCHI_ID_STR_SIZE) return 0;
+  memcpy(out, ID_PREFIX, ID_PREFIX_LEN);
+  static const char HEXDIG[] = "0123456789ABCDEF";
+  id &= MOCHI_ID_MASK;
+  int digits = 1;
+  while (digits < 6 && (id >> (digits * 4)) != 0) digits++;
+  for (int i = 0; i < digits; i++) {
+    out[ID_PREFIX_LEN + i] = HEXDIG[(id >> ((digits - 1 - i) * 4)) & 0xF];
+  }
+  out[ID_PREFIX_LEN + digits] = '\0';
+  return ID_PREFIX_LEN + digits;
+}
+
+String mochiIdToString(MochiId id) {
+  char buf[MOCHI_ID_STR_SIZE];
+  mochiIdFormat(id, buf, sizeof(buf));
+  return String(buf);
+}
@@ -0,0 +1,149 @@
+#ifndef MOCHI_ID_H
+#define MOCHI_ID_H
+
+#include <Arduino.h>
+#include <algorithm>
+
+// ================================================================
+// ID DEI MOCHI
+// ----------------------------------------------------------------
+// Ogni Mochi si presenta come "MOCHI-" + i 24 bit bassi del MAC efuse in
+// esadecimale (es. "MOCHI-A1B2C3"). Internamente teniamo solo quei 24 bit in
+// un intero: la stringa si costruisce/parsa solo ai bordi (BLE, JSON, log).
+// ================================================================
+
+typedef uint32_t MochiId;
+
+#define MOCHI_ID_NONE     0xFFFFFFFFUL // Slot vuoto / id non valido
+#define MOCHI_ID_MASK     0x00FFFFFFUL
+#define MOCHI_ID_STR_SIZE 13           // "MOCHI-" + 6 cifre hex + '\0'
+
+// ID di questo Mochi (stessa derivazione storica dal MAC efuse).
+MochiId mochiIdSelf();
+
+// Accetta "MOCHI-<hex>" (prefisso case-insensitive, 1..6 cifre). `len` e' la
+// lunghezza del testo, che non deve essere terminato da '\0'.
+bool    mochiIdParse(const char* s, size_t len, MochiId* out);
+inline bool mochiIdParse(const String& s, MochiId* out) { return mochiIdParse(s.c_str(), s.length(), out); }
+
+// Scrive "MOCHI-ABCDEF" (hex maiuscolo, senza zeri iniziali come String(x, HEX)).
+// Ritorna la lunghezza scritta, 0 se non c'e' spazio.
+size_t  mochiIdFormat(MochiId id, char* out, size_t cap);
+String  mochiIdToString(MochiId id);
+
+// Forma testuale su stack, per i log senza allocazioni:
+//   Serial.printf("amico %s\n", MochiIdStr(id).c_str());
+struct MochiIdStr {
+  char buf[MOCHI_ID_STR_SIZE];
+  explicit MochiIdStr(MochiId id) { mochiIdFormat(id, buf, sizeof(buf)); }
+  const char* c_str() const { return buf; }
+};
+
+// ================================================================
+// INSIEME DI ID A INDIRIZZAMENTO APERTO
+// ----------------------------------------------------------------
+// Hash set a sondaggio lineare con almeno il doppio degli slot rispetto al
+// massimo di elementi (carico <= 50%), cancellazione con backward-shift (niente
+// tombstone) e lookup O(1) atteso. Tutta la memoria e' statica.
+// ================================================================
+
+template <uint16_t MAX>
+class MochiIdSet {
+public:
+  // Potenza di due >= 2*MAX.
+  static constexpr uint16_t SLOTS = (MAX <= 4) ? 8 : (MAX <= 8) ? 16 : (MAX <= 16) ? 32 : (MAX <= 32) ? 64 :
+                                    (MAX <= 64) ? 128 : (MAX <= 128) ? 256 : (MAX <= 256) ? 512 : 1024;
+  static_assert(MAX <= 512, "MochiIdSet: troppi elementi");
+
+  MochiIdSet() { clear(); }
+
+  void clear() {
+    for (uint16_t i = 0; i < SLOTS; i++) slots[i] = MOCHI_ID_NONE;
+    count = 0;
+  }
+
+  uint16_t size() const { return count; }
+  bool     full() const { return count >= MAX; }
+
+  bool contains(MochiId id) const {
+    if (id == MOCHI_ID_NONE) return false;
+    for (uint16_t i = home(id);; i = (i + 1) & (SLOTS - 1)) {
+      if (slots[i] == id) return true;
+      if (slots[i] == MOCHI_ID_NONE) return false;
+    }
+  }
+
+  // true se l'id e' presente dopo la chiamata (gia' c'era o aggiunto).
+  bool add(MochiId id) {
+    if (id == MOCHI_ID_NONE) return false;
+    uint16_t i = home(id);
+    for (;; i = (i + 1) & (SLOTS - 1)) {
+      if (slots[i] == id) return true;
+      if (slots[i] == MOCHI_ID_NONE) break;
+    }
+    if (full()) return false;
+    slots[i] = id;
+    count++;
+    return true;
+  }
+
+  bool remove(MochiId id) {
+    if (id == MOCHI_ID_NONE) return false;
+    uint16_t i = home(id);
+    for (;; i = (i + 1) & (SLOTS - 1)) {
+      if (slots[i] == id) break;
+      if (slots[i] == MOCHI_ID_NONE) return false;
+    }
+    // Backward-shift: riporta indietro gli elementi della stessa catena che
+    // altrimenti resterebbero irraggiungibili dopo il buco.
+    uint16_t j = i;
+    for (;;) {
+      j = (j + 1) & (SLOTS - 1);
+      if (slots[j] == MOCHI_ID_NONE) break;
+      uint16_t k = home(slots[j]);
+      bool movable = (i <= j) ? (k <= i || k > j) : (k <= i && k > j);
+      if (movable) {
+        slots[i] = slots[j];
+        i = j;
+      }
+    }
+    slots[i] = MOCHI_ID_NONE;
+    count--;
+    return true;
+  }
+
+  // Accesso grezzo agli slot per l'iterazione (MOCHI_ID_NONE = vuoto).
+  MochiId slot(uint16_t i) const { return slots[i]; }
+
+  // Il piu' piccolo id maggiore di `after` (MOCHI_ID_NONE = dall'inizio), o
+  // MOCHI_ID_NONE se non ce ne sono: scorre l'insieme in ordine senza copiarlo
+  // in un array, al prezzo di un giro degli slot per elemento.
+  MochiId next(MochiId after = MOCHI_ID_NONE) const {
+    MochiId best = MOCHI_ID_NONE;
+    for (uint16_t i = 0; i < SLOTS; i++) {
+      MochiId v = slots[i];
+      if (v < best && (after == MOCHI_ID_NONE || v > after)) best = v;
+    }
+    return best;
+  }
+
+  // Copia gli id in `out` (almeno MAX elementi) in ordine crescente.
+  uint16_t toSorted(MochiId* out) const {
+    uint16_t n = 0;
+    for (uint16_t i = 0; i < SLOTS; i++) {
+      if (slots[i] != MOCHI_ID_NONE) out[n++] = slots[i];
+    }
+    std::sort(out, out + n); // Negli slot l'ordine e' quello dell'hash, cioe' a caso
+    return n;
+  }
+
+private:
+  MochiId  slots[SLOTS];
+  uint16_t count;
+
+  // Hash di Fibonacci: i 24 bit dell'id hanno i byte bassi del MAC, gia' ben
+  // distribuiti, ma moltiplicare evita cluster su MAC consecutivi.
+  static uint16_t home(MochiId id) { return (uint16_t)((uint32_t)(id * 2654435769UL) >> 16) & (SLOTS - 1); }
+};
+
+#endif // MOCHI_ID_H
@@ -0,0 +1,170 @@
+#include "MochiMem.h"
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include <stddef.h>
+
+static const char* const TAG_NAMES[MEM_TAG_COUNT] = {
+  "other", "view", "state", "ble", "espnow", "json"
+};
+
+static std::atomic<int32_t>  s_cur[MEM_TAG_COUNT];
+static std::atomic<int32_t>  s_peak[MEM_TAG_COUNT];
+static std::atomic<uint32_t> s_allocs[MEM_TAG_COUNT];
+static std::atomic<int32_t>  s_heapDelta[MEM_TAG_COUNT];
+
+static thread_local MemTag   t_tag = MEM_OTHER;
+static thread_local uint32_t t_allocs = 0; // Per task: chi misura se stesso non vede gli altri
+#if MOCHI_MEM_TRACK
+static thread_local MochiMemScope* t_scope = nullptr;
+#endif
+
+// ================================================================
+// new / delete con intestazione
+// ----------------------------------------------------------------
+// Davanti a ogni blocco c'e' un'intestazione con dimensione e tag, cosi'
+// delete scala il contatore giusto anche se libera da un altro sottosistema.
+// ================================================================
+
+struct MemHeader {
+  uint32_t size;
+  uint8_t  tag;
+};
+
+static constexpr size_t HEADER_SIZE =
+  (sizeof(MemHeader) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+static void* trackedAlloc(size_t size) {
+  uint8_t* raw = (uint8_t*)malloc(size + HEADER_SIZE);
+  if (!raw) return nullptr;
+  MemTag tag = t_tag;
+  MemHeader* h = (MemHeader*)raw;
+  h->size = size;
+  h->tag  = tag;
+
+  int32_t cur = s_cur[tag].fetch_add(size, std::memory_order_relaxed) + size;
+  s_allocs[tag].fetch_add(1, std::memory_order_relaxed);
+  t_allocs++;
+  int32_t peak = s_peak[tag].load(std::memory_order_relaxed);
+  while (cur > peak && !s_peak[tag].compare_exchange_weak(peak, cur, std::memory_order_relaxed)) {}
+  return raw + HEADER_SIZE;
+}
+
+static void trackedFree(void* p) {
+  if (!p) return;
+  uint8_t* raw = (uint8_t*)p - HEADER_SIZE;
+  MemHeader* h = (MemHeader*)raw;
+  if (h->tag < MEM_TAG_COUNT) s_cur[h->tag].fetch_sub(h->size, std::memory_order_relaxed);
+  free(raw);
+}
+
+static void* trackedAllocOrDie(size_t size) {
+  void* p = trackedAlloc(size);
+  if (!p) {
+#if __cpp_exceptions
+    throw std::bad_alloc();
+#else
+    abort();
+#endif
+  }
+  return p;
+}
+
+void* operator new(size_t size)                                  { return trackedAllocOrDie(size); }
+void* operator new[](size_t size)                                { return trackedAllocOrDie(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept   { return trackedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return trackedAlloc(size); }
+void operator delete(void* p) noexcept                            { trackedFree(p); }
+void operator delete[](void* p) noexcept                          { trackedFree(p); }
+void operator delete(void* p, size_t) noexcept                    { trackedFree(p); }
+void operator delete[](void* p, size_t) noexcept                  { trackedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept     { trackedFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept   { trackedFree(p); }
+
+// ================================================================
+// SCOPE
+// ================================================================
+
+MochiMemScope::MochiMemScope(MemTag tag) {
+  prevTag = t_tag;
+  t_tag   = tag;
+#if MOCHI_MEM_TRACK
+  parent      = t_scope;
+  heapAtStart = ESP.getFreeHeap();
+  childDelta  = 0;
+  t_scope     = this;
+#endif
+}
+
+MochiMemScope::~MochiMemScope() {
+#if MOCHI_MEM_TRACK
+  int32_t total = (int32_t)heapAtStart - (int32_t)ESP.getFreeHeap();
+  s_heapDelta[t_tag].fetch_add(total - childDelta, std::memory_order_relaxed);
+  if (parent) parent->childDelta += total;
+  t_scope = parent;
+#endif
+  t_tag = prevTag;
+}
+
+// ================================================================
+// LETTURA
+// ================================================================
+
+MemTag mochiMemTag() {
+  return t_tag;
+}
+
+MemTagStats mochiMemStats(MemTag tag) {
+  MemTagStats s;
+  s.cur       = s_cur[tag].load(std::memory_order_relaxed);
+  s.peak      = s_peak[tag].load(std::memory_order_relaxed);
+  s.allocs    = s_allocs[tag].load(std::memory_order_relaxed);
+  s.heapDelta = s_heapDelta[tag].load(std::memory_order_relaxed);
+  return s;
+}
+
+uint32_t mochiMemThreadAllocs() {
+  return t_allocs;
+}
+
+const char* mochiMemTagName(MemTag tag) {
+  return tag < MEM_TAG_COUNT ? TAG_NAMES[tag] : "?";
+}
+
+// {"free":..,"minFree":..,"largest":..,"tags":{"view":{"cur":..,"peak":..,"n":..,"heap":..},...}}
+// ("heap" solo con MOCHI_MEM_TRACK)
+void mochiMemWriteJson(MochiWriter& w) {
+  w.beginObject()
+   .field("free",    (long)ESP.getFreeHeap())
+   .field("minFree", (long)ESP.getMinFreeHeap())
+   .field("largest", (long)ESP.getMaxAllocHeap());
+  w.key("tags").beginObject();
+  for (int t = 0; t < MEM_TAG_COUNT; t++) {
+    MemTagStats s = mochiMemStats((MemTag)t);
+    w.key(TAG_NAMES[t]).beginObject()
+     .field("cur",  (long)s.cur)
+     .field("peak", (long)s.peak)
+     .field("n",    (long)s.allocs);
+#if MOCHI_MEM_TRACK
+    w.field("heap", (long)s.heapDelta);
+#endif
+    w.endObject();
+  }
+  w.endObject().endObject();
+}
+
+void mochiMemPrint() {
+  Serial.printf("[MEM] heap libero %lu | minimo %lu | blocco max %lu\n",
+                (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getMinFreeHeap(),
+                (unsigned long)ESP.getMaxAllocHeap());
+  for (int t = 0; t < MEM_TAG_COUNT; t++) {
+    MemTagStats s = mochiMemStats((MemTag)t);
+#if MOCHI_MEM_TRACK
+    Serial.printf("[MEM]   %-6s new %ld B (picco %ld, %lu alloc) | heap %+ld B\n",
+                  TAG_NAMES[t], (long)s.cur, (long)s.peak, (unsigned long)s.allocs, (long)s.heapDelta);
+#else
+    Serial.printf("[MEM]   %-6s new %ld B (picco %ld, %lu alloc)\n",
+                  TAG_NAMES[t], (long)s.cur, (long)s.peak, (unsigned long)s.allocs);
+#endif
+  }
+}
@@ -0,0 +1,69 @@
+#ifndef MOCHI_MEM_H
+#define MOCHI_MEM_H
+
+#include <Arduino.h>
+#include "Settings.h"
+#include "MochiWriter.h"
+
+// ================================================================
+// STRUMENTAZIONE DELLA MEMORIA
+// ----------------------------------------------------------------
+// Ogni allocazione fatta con `new` viene attribuita al sottosistema attivo
+// (tag) e contata: byte correnti, picco e numero di allocazioni. Il tag e'
+// per task (thread_local) e si imposta con uno scope:
+//
+//   MochiMemScope mem(MEM_NOW);   // da qui a fine blocco "conta" ESP-NOW
+//
+// I contatori sono sempre attivi: costano un'intestazione davanti a ogni
+// blocco (dimensione e tag) e tre operazioni atomiche per new/delete.
+//
+// malloc/String non passano da `new`: per quelli, con MOCHI_MEM_TRACK a 1
+// (Settings.h o -D), ogni scope misura anche la variazione dell'heap libero
+// (al netto degli scope annidati) e la somma al tag. E' una stima: un altro
+// task che alloca nello stesso momento sporca il dato, e getFreeHeap() prende
+// un lock, quindi resta una cosa da debug.
+// ================================================================
+
+enum MemTag : uint8_t {
+  MEM_OTHER = 0,
+  MEM_VIEW,
+  MEM_STATE,
+  MEM_BLE,
+  MEM_NOW,
+  MEM_JSON,
+  MEM_TAG_COUNT
+};
+
+struct MemTagStats {
+  int32_t  cur;       // Byte allocati con new e non ancora liberati
+  int32_t  peak;      // Massimo di cur
+  uint32_t allocs;    // Allocazioni totali con new
+  int32_t  heapDelta; // Heap trattenuto dagli scope del tag (solo con MOCHI_MEM_TRACK)
+};
+
+class MochiMemScope {
+public:
+  explicit MochiMemScope(MemTag tag);
+  ~MochiMemScope();
+
+private:
+  MemTag         prevTag;
+#if MOCHI_MEM_TRACK
+  MochiMemScope* parent;
+  uint32_t       heapAtStart;
+  int32_t        childDelta; // Variazione gia' attribuita agli scope annidati
+#endif
+
+  MochiMemScope(const MochiMemScope&) = delete;
+  MochiMemScope& operator=(const MochiMemScope&) = delete;
+};
+
+MemTag      mochiMemTag();                      // Tag attivo nel task corrente
+const char* mochiMemTagName(MemTag tag);
+MemTagStats mochiMemStats(MemTag tag);
+uint32_t    mochiMemThreadAllocs();             // Allocazioni con new fatte dal task corrente
+
+void mochiMemWriteJson(MochiWriter& w);         // Risposta a get_mem
+void mochiMemPrint();                           // Dump su seriale (comando "get_mem")
+
+#endif // MOCHI_MEM_H
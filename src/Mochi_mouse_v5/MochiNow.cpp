@@ -1,127 +1,289 @@
 #include "MochiNow.h"
-#include <WiFi.h>
-#include <esp_wifi.h>
+#include "MochiMem.h"
 
 #ifndef MOCHI_VERSION
   #define MOCHI_VERSION "0.0.0-dev"
 #endif
 
-// Ponte verso l'istanza per la callback C di ricezione ESP-NOW.
-static MochiNow* g_now = nullptr;
-
 static const uint8_t BCAST_MAC[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
 
 static bool macEqual(const uint8_t* a, const uint8_t* b) {
     return memcmp(a, b, 6) == 0;
 }
 
-static void onRecvStatic(const esp_now_recv_info_t* info, const uint8_t* data, int len) {
-    if (g_now) g_now->onRecv(info, data, len);
+// FNV-1a sui 6 byte del MAC.
+static uint16_t macHash(const uint8_t* mac) {
+    uint32_t h = 2166136261UL;
+    for (int i = 0; i < 6; i++) h = (h ^ mac[i]) * 16777619UL;
+    return (uint16_t)(h ^ (h >> 16));
+}
+
+static inline void bump(uint16_t& c) {
+    if (c != 0xFFFF) c++;
 }
 
-static void onSendStatic(const esp_now_send_info_t* tx_info, esp_now_send_status_t status) {
-    if (g_now) g_now->onSend(status == ESP_NOW_SEND_SUCCESS ? 0 : 1);
+// Istogrammi a scala logaritmica: first, 2*first, 4*first ... e l'ultimo aperto.
+static uint8_t logBucket(unsigned long v, unsigned long first, uint8_t n) {
+    uint8_t b = 0;
+    while (b < n - 1 && v >= (first << b)) b++;
+    return b;
 }
 
-MochiNow::MochiNow(MochiState* m) {
+static const char* const PKT_NAMES[] = {
+    "annuncio", "visita", "ack visita", "richiesta", "accetta", "rimuovi", "fine visita", "ack link"
+};
+static_assert(sizeof(PKT_NAMES) / sizeof(PKT_NAMES[0]) == PKT_TYPE_COUNT, "PKT_NAMES: un nome per ogni MochiPktType");
+
+MochiNow::MochiNow(MochiState* m, MochiTransport* t) {
     mochi = m;
-    g_now = this;
+    radio = t;
+    clock = t->clock();
     memset(selfMac, 0, 6);
     memset(pendingMac, 0, 6);
+    memset(nearbyIndex, NEARBY_EMPTY, sizeof(nearbyIndex));
+    memset(peers, 0, sizeof(peers));
+    memset(rxDedup, 0, sizeof(rxDedup));
+    memset(links, 0, sizeof(links));
+    memset(txQueue, 0, sizeof(txQueue));
+    memset(typeStats, 0, sizeof(typeStats));
+    memset(rttHist, 0, sizeof(rttHist));
+    memset(&visits, 0, sizeof(visits));
 }
 
 // Stesso schema di MochiBLE: ID stabile derivato dal MAC efuse, per restare
 // coerente con gli amici già salvati (es. "MOCHI-ABCDEF").
 void MochiNow::computeSelfId() {
-    uint32_t chipId = 0;
-    for (int i = 0; i < 17; i = i + 8) { chipId |= ((ESP.getEfuseMac() >> (40 - i)) & 0xff) << i; }
-    String name = "Mochi-" + String(chipId, HEX);
-    name.toUpperCase();
-    selfId = name;
+    selfKey = radio->localId();
+    selfId  = mochiIdToString(selfKey);
 }
 
 bool MochiNow::begin() {
     computeSelfId();
+    nearbyVer = clock->random32();
+    // Dopo un riavvio il seq riparte da un punto a caso, non da quello di prima
+    txSeq = (uint8_t)clock->random32();
 
-    // ESP-NOW richiede il WiFi in STA, senza connettersi ad alcun access point.
-    WiFi.mode(WIFI_STA);
-    WiFi.disconnect();
-    // CRUCIALE: senza disattivare il power-save il modem WiFi dorme e perde
-    // i pacchetti ESP-NOW in ricezione.
-    WiFi.setSleep(false);
-    esp_wifi_set_channel(ESPNOW_CHANNEL, WIFI_SECOND_CHAN_NONE);
-    WiFi.macAddress(selfMac);
-
-    if (esp_now_init() != ESP_OK) {
-        Serial.println("[NOW] esp_now_init FALLITO!");
-        return false;
-    }
-    esp_now_register_recv_cb(onRecvStatic);
-    esp_now_register_send_cb(onSendStatic);
+    // Dalla prima ricezione la radio chiama onRadioRecv/onRadioSent
+    if (!radio->begin(this)) return false;
+    radio->macAddress(selfMac);
 
-    // Peer broadcast per gli annunci di presenza.
-    esp_now_peer_info_t peer = {};
-    memcpy(peer.peer_addr, BCAST_MAC, 6);
-    peer.channel = ESPNOW_CHANNEL;
-    peer.ifidx   = WIFI_IF_STA;
-    peer.encrypt = false;
-    esp_now_add_peer(&peer);
+    // Primo annuncio entro ANNOUNCE_MIN_MS, poi l'intervallo si allunga
+    lastAnnounce = clock->now();
+    startAnnounceInterval(lastAnnounce);
 
     ready = true;
     Serial.println("[NOW] ESP-NOW pronto come: " + selfId);
     return true;
 }
 
-void MochiNow::ensurePeer(const uint8_t* mac) {
-    if (esp_now_is_peer_exist(mac)) return;
-    esp_now_peer_info_t peer = {};
-    memcpy(peer.peer_addr, mac, 6);
-    peer.channel = ESPNOW_CHANNEL;
-    peer.ifidx   = WIFI_IF_STA;
-    peer.encrypt = false;
-    esp_now_add_peer(&peer);
+// ESP-NOW registra pochi peer: teniamo solo quelli a cui abbiamo scritto di
+// recente (LRU) e li registriamo al momento dell'invio. Il broadcast e' fuori
+// dalla cache, registrato dalla radio.
+NowPeerSlot* MochiNow::ensurePeer(const uint8_t* mac) {
+    if (macEqual(mac, BCAST_MAC)) return nullptr;
+    unsigned long now = clock->now();
+    int lru = 0; // Slot libero, altrimenti quello usato meno di recente
+    for (int i = 0; i < NOW_PEER_CACHE; i++) {
+        if (peers[i].used && macEqual(peers[i].mac, mac)) {
+            peers[i].usedAt = now;
+            return &peers[i];
+        }
+        if (!peers[lru].used) continue;
+        if (!peers[i].used || now - peers[i].usedAt > now - peers[lru].usedAt) lru = i;
+    }
+    if (peers[lru].used) {
+        radio->removePeer(peers[lru].mac);
+        peerEvictions++;
+    }
+    NowPeerSlot& p = peers[lru];
+    memcpy(p.mac, mac, 6);
+    p.used = true;
+    p.usedAt = now;
+    radio->addPeer(mac);
+    return &p;
+}
+
+static_assert(NOW_TX_ACK_RESERVED < NOW_TX_QUEUE_LEN, "NOW_TX_ACK_RESERVED: non resta posto per gli altri pacchetti");
+
+// Tutti gli invii passano di qui: pacchetto v3 grande quanto serve, messo in
+// coda. Gli unicast (tranne gli ack) restano in coda finche' l'altro non li
+// conferma; con NOW_WIRE_LEGACY_TX partono in v1, una volta sola.
+bool MochiNow::sendPacket(const uint8_t* mac, uint8_t type, const void* payload, size_t n) {
+    bool legacy = NOW_WIRE_LEGACY_TX && type != PKT_LINK_ACK;
+    bool reliable = !legacy && mochiWireReliable(type) && !macEqual(mac, BCAST_MAC);
+
+    // Gli ultimi NOW_TX_ACK_RESERVED posti sono solo per gli ack: con la coda
+    // piena di pacchetti in attesa di conferma, le conferme devono poter uscire
+    NowTxSlot* s = nullptr;
+    int freeSlots = 0;
+    for (int i = 0; i < NOW_TX_QUEUE_LEN; i++) {
+        if (txQueue[i].used) continue;
+        if (!s) s = &txQueue[i];
+        freeSlots++;
+    }
+    if (!s || (type != PKT_LINK_ACK && freeSlots <= NOW_TX_ACK_RESERVED)) {
+        txQueueFull++;
+        Serial.printf("[NOW] Coda di invio piena, pacchetto %u scartato\n", type);
+        return false;
+    }
+
+    // Il seq si consuma solo se il pacchetto parte davvero: sono 256, e ogni
+    // seq bruciato avvicina il giro che la deduplica di chi riceve
+    // scambierebbe per un doppione
+    uint8_t seq = reliable ? txSeq : 0;
+    size_t len = mochiWireEncode(s->data, type, selfKey, seq, payload, n, legacy);
+    if (!len) {
+        Serial.printf("[NOW] Payload di %u byte troppo grande, pacchetto %u non inviato\n", (unsigned)n, type);
+        return false;
+    }
+    if (reliable) txSeq++;
+    s->used = true;
+    s->reliable = reliable;
+    memcpy(s->mac, mac, 6);
+    s->seq = seq;
+    s->tries = 0;
+    s->len = len;
+    s->nextAt = clock->now();
+    pumpTx(s->nextAt);
+    return true;
+}
+
+// Un pacchetto al driver solo quando il precedente e' stato consegnato (o
+// perso): niente code interne che si riempiono. Tra quelli pronti parte il
+// piu' vecchio; gli affidabili ripartono con attesa doppia a ogni tentativo.
+void MochiNow::pumpTx(unsigned long now) {
+    if (txBusy) {
+        if (now - txSentAt < NOW_TX_DONE_TIMEOUT_MS) return;
+        txBusy = false; // Callback persa: non bloccare la coda per sempre
+    }
+    NowTxSlot* s = nullptr;
+    for (int i = 0; i < NOW_TX_QUEUE_LEN; i++) {
+        NowTxSlot& t = txQueue[i];
+        if (!t.used || (long)(now - t.nextAt) < 0) continue;
+        if (!s || (long)(t.nextAt - s->nextAt) < 0) s = &t;
+    }
+    if (!s) return;
+
+    uint8_t type = s->data[0] & 0x0F; // Anche per la v1: il tipo e' il primo byte
+    NowLinkStats* link = linkFor(s->mac);
+    if (s->reliable && s->tries >= NOW_TX_MAX_TRIES) {
+        txFailed++;
+        typeStats[type].failed++;
+        if (link) bump(link->failed);
+        s->used = false;
+        Serial.printf("[NOW] Consegna fallita: pacchetto %u seq %u dopo %u tentativi\n",
+                      s->data[0] & 0x0F, s->seq, s->tries);
+        return;
+    }
+    ensurePeer(s->mac); // Puo' essere uscito dalla cache nel frattempo
+    txBusy = true;
+    txSentAt = now;
+    if (!radio->send(s->mac, s->data, s->len)) txBusy = false;
+    txBytes += s->len;
+    if (!s->tries) {
+        s->firstAt = now;
+        typeStats[type].sent++;
+        if (link) bump(link->sent);
+    }
+    if (!s->reliable) {
+        s->used = false;
+        return;
+    }
+    if (s->tries) {
+        txRetries++;
+        typeStats[type].retried++;
+        if (link) bump(link->retried);
+    }
+    s->nextAt = now + ((unsigned long)NOW_TX_RETRY_MS << s->tries);
+    s->tries++;
+}
+
+void MochiNow::onLinkAck(const uint8_t* mac, uint8_t seq) {
+    for (int i = 0; i < NOW_TX_QUEUE_LEN; i++) {
+        NowTxSlot& t = txQueue[i];
+        if (t.used && t.reliable && t.seq == seq && macEqual(t.mac, mac)) {
+            t.used = false;
+            NowLinkStats* link = linkFor(mac);
+            typeStats[t.data[0] & 0x0F].delivered++;
+            if (link) bump(link->delivered);
+            // Solo consegne al primo colpo: con una ritrasmissione non si sa a
+            // quale invio risponde l'ack (Karn)
+            if (t.tries == 1) noteRtt(link, clock->now() - t.firstAt);
+            return;
+        }
+    }
+}
+
+// Doppione se il seq e' fra gli ultimi NOW_RX_DEDUP di quel MAC, altrimenti lo
+// ricorda. Le ritrasmissioni finiscono entro NOW_RX_DEDUP_MS: un mittente zitto
+// da piu' tempo (riavviato, o con il seq che ha fatto il giro) riparte da zero.
+// Con la tabella piena si dimentica il mittente sentito meno di recente.
+bool MochiNow::isDuplicate(const uint8_t* mac, uint8_t seq, unsigned long now) {
+    NowRxDedup* d = nullptr;
+    int lru = 0;
+    for (int i = 0; i < NOW_RX_DEDUP_PEERS && !d; i++) {
+        if (rxDedup[i].used && macEqual(rxDedup[i].mac, mac)) d = &rxDedup[i];
+        else if (!rxDedup[lru].used) continue;
+        else if (!rxDedup[i].used || now - rxDedup[i].lastAt > now - rxDedup[lru].lastAt) lru = i;
+    }
+    if (!d) {
+        d = &rxDedup[lru];
+        memcpy(d->mac, mac, 6);
+        d->used = true;
+        d->seenLen = 0;
+    } else if (now - d->lastAt > NOW_RX_DEDUP_MS) {
+        d->seenLen = 0;
+    }
+    d->lastAt = now;
+    for (uint8_t i = 0; i < d->seenLen; i++) {
+        if (d->seen[i] == seq) return true;
+    }
+    if (d->seenLen < NOW_RX_DEDUP) d->seenLen++;
+    memmove(d->seen + 1, d->seen, d->seenLen - 1);
+    d->seen[0] = seq;
+    return false;
 }
 
+// Il digest viaggia solo con gli annunci, quindi ne segue il ritmo Trickle:
+// al massimo GOSSIP_DIGEST_MAX * 5 byte in piu' per annuncio.
 void MochiNow::sendAnnounce() {
-    MochiPacket pkt = {};
-    pkt.type = PKT_ANNOUNCE;
-    strncpy(pkt.id, selfId.c_str(), sizeof(pkt.id) - 1);
-    esp_now_send(BCAST_MAC, (const uint8_t*)&pkt, sizeof(pkt));
+    NowGossipEntry digest[GOSSIP_DIGEST_MAX];
+    size_t n = NOW_WIRE_LEGACY_TX ? 0 : buildGossip(digest, clock->now());
+    sendPacket(BCAST_MAC, PKT_ANNOUNCE, digest, n * sizeof(NowGossipEntry));
+    gossipBytes += n * sizeof(NowGossipEntry);
     announceCount++;
 }
 
-void MochiNow::onSend(int status) {
-    lastSendStatus = status;
+void MochiNow::onRadioSent(bool ok) {
+    lastSendStatus = ok ? 0 : 1;
+    txBusy = false;
 }
 
 void MochiNow::sendVisit(NearbyMochi& target) {
-    MochiPacket pkt = {};
-    pkt.type = PKT_VISIT;
-    strncpy(pkt.id, selfId.c_str(), sizeof(pkt.id) - 1);
-    String payload = mochi->getVisitPayloadJson(selfId);
-    strncpy(pkt.payload, payload.c_str(), sizeof(pkt.payload) - 1);
-
-    ensurePeer(target.mac);
-    esp_now_send(target.mac, (const uint8_t*)&pkt, sizeof(pkt));
+#if NOW_WIRE_LEGACY_TX
+    String payload = mochi->getVisitPayloadJson(selfKey);
+    if (!sendPacket(target.mac, PKT_VISIT, payload.c_str(), payload.length())) return;
+#else
+    uint8_t record[sizeof(NowVisitRecord)];
+    size_t n = mochi->writeVisitRecord(record, sizeof(record));
+    if (!sendPacket(target.mac, PKT_VISIT, record, n)) return;
+#endif
 
     // In attesa dell'ack: la partenza diventa effettiva solo se l'host accetta.
+    visits.asked++;
     awaitingAck = true;
     memcpy(pendingMac, target.mac, 6);
     pendingHostId = target.id;
-    pendingSentAt = millis();
-    Serial.println("[NOW] Richiesta di visita inviata a " + target.id);
+    pendingSentAt = clock->now();
+    Serial.printf("[NOW] Richiesta di visita inviata a %s\n", MochiIdStr(target.id).c_str());
 }
 
 void MochiNow::sendAck(const uint8_t* mac, bool ok) {
-    MochiPacket pkt = {};
-    pkt.type  = PKT_VISIT_ACK;
-    pkt.ackOk = ok ? 1 : 0;
-    strncpy(pkt.id, selfId.c_str(), sizeof(pkt.id) - 1);
-    ensurePeer(mac);
-    esp_now_send(mac, (const uint8_t*)&pkt, sizeof(pkt));
+    uint8_t ackOk = ok ? 1 : 0;
+    sendPacket(mac, PKT_VISIT_ACK, &ackOk, 1);
 }
 
-int MochiNow::findNearbyIndex(const String& id) {
+int MochiNow::findNearbyIndex(MochiId id) {
     for (int i = 0; i < nearbyLen; i++) {
         if (nearby[i].id == id) return i;
     }
@@ -129,33 +291,29 @@ int MochiNow::findNearbyIndex(const String& id) {
 }
 
 // Invio unicast di un pacchetto di amicizia (richiesta o accettazione) a un
-// vicino identificato per id. Ritorna false se il Mochi non è (più) nei paraggi.
-bool MochiNow::sendFriendPkt(const String& id, uint8_t type) {
+// vicino identificato per id. Ritorna false se il Mochi non è (più) nei paraggi
+// o se la coda di invio è piena.
+bool MochiNow::sendFriendPkt(MochiId id, uint8_t type) {
     int idx = findNearbyIndex(id);
     if (idx < 0) return false;
-    MochiPacket pkt = {};
-    pkt.type = type;
-    strncpy(pkt.id, selfId.c_str(), sizeof(pkt.id) - 1);
-    ensurePeer(nearby[idx].mac);
-    esp_now_send(nearby[idx].mac, (const uint8_t*)&pkt, sizeof(pkt));
-    return true;
+    return sendPacket(nearby[idx].mac, type);
 }
 
-bool MochiNow::sendFriendRequest(const String& id) {
+bool MochiNow::sendFriendRequest(MochiId id) {
     bool ok = sendFriendPkt(id, PKT_FRIEND_REQ);
-    Serial.println("[NOW] Richiesta di amicizia a " + id + (ok ? "" : " FALLITA (non vicino)"));
+    Serial.printf("[NOW] Richiesta di amicizia a %s%s\n", MochiIdStr(id).c_str(), ok ? "" : " FALLITA (non vicino)");
     return ok;
 }
 
-bool MochiNow::sendFriendAccept(const String& id) {
+bool MochiNow::sendFriendAccept(MochiId id) {
     bool ok = sendFriendPkt(id, PKT_FRIEND_ACCEPT);
-    Serial.println("[NOW] Accettazione amicizia a " + id + (ok ? "" : " FALLITA (non vicino)"));
+    Serial.printf("[NOW] Accettazione amicizia a %s%s\n", MochiIdStr(id).c_str(), ok ? "" : " FALLITA (non vicino)");
     return ok;
 }
 
-bool MochiNow::sendUnfriend(const String& id) {
+bool MochiNow::sendUnfriend(MochiId id) {
     bool ok = sendFriendPkt(id, PKT_FRIEND_REMOVE);
-    Serial.println("[NOW] Notifica rimozione amicizia a " + id + (ok ? "" : " (non vicino)"));
+    Serial.printf("[NOW] Notifica rimozione amicizia a %s%s\n", MochiIdStr(id).c_str(), ok ? "" : " (non vicino)");
     return ok;
 }
 
@@ -167,54 +325,89 @@ bool MochiNow::forceHome() {
         return false;
     }
     int idx = findNearbyIndex(mochi->awayHostId);
-    if (idx >= 0) {
-        MochiPacket pkt = {};
-        pkt.type = PKT_VISIT_END;
-        strncpy(pkt.id, selfId.c_str(), sizeof(pkt.id) - 1);
-        ensurePeer(nearby[idx].mac);
-        esp_now_send(nearby[idx].mac, (const uint8_t*)&pkt, sizeof(pkt));
-    }
+    if (idx >= 0) sendPacket(nearby[idx].mac, PKT_VISIT_END);
     Serial.println("[NOW] DEBUG forceHome: rientro a casa");
     mochi->returnHome();
     return true;
 }
 
 // DEBUG: forza una partenza in visita verso `id` se è vicino e siamo liberi.
-bool MochiNow::forceVisit(const String& id) {
+bool MochiNow::forceVisit(MochiId id) {
     if (mochi->isAway || mochi->isHostingGuest || awaitingAck) {
         Serial.println("[NOW] forceVisit ignorato: occupato");
         return false;
     }
     int idx = findNearbyIndex(id);
     if (idx < 0) {
-        Serial.println("[NOW] forceVisit: " + id + " non è vicino");
+        Serial.printf("[NOW] forceVisit: %s non è vicino\n", MochiIdStr(id).c_str());
         return false;
     }
-    Serial.println("[NOW] DEBUG forceVisit -> " + id);
+    Serial.printf("[NOW] DEBUG forceVisit -> %s\n", MochiIdStr(id).c_str());
     sendVisit(nearby[idx]);
     return true;
 }
 
-// Upsert di un vicino dalla ricezione di un annuncio.
-void MochiNow::reportNearby(const String& id, const uint8_t* mac, int rssi) {
-    unsigned long now = millis();
-    for (int i = 0; i < nearbyLen; i++) {
-        if (nearby[i].id == id) {
-            memcpy(nearby[i].mac, mac, 6);
-            nearby[i].rssi = rssi;
-            nearby[i].lastSeen = now;
-            return;
+// Posizione in nearby[] del vicino con quel MAC, -1 se non c'e'.
+int MochiNow::findNearbyByMac(const uint8_t* mac) {
+    for (uint16_t i = macHash(mac) & (NEARBY_SLOTS - 1);; i = (i + 1) & (NEARBY_SLOTS - 1)) {
+        uint8_t idx = nearbyIndex[i];
+        if (idx == NEARBY_EMPTY) return -1;
+        if (macEqual(nearby[idx].mac, mac)) return idx;
+    }
+}
+
+// Dopo il prune le posizioni cambiano: con al massimo MAX_NEARBY voci si fa
+// prima a ricostruire l'indice che a spostarlo.
+void MochiNow::rebuildNearbyIndex() {
+    memset(nearbyIndex, NEARBY_EMPTY, sizeof(nearbyIndex));
+    for (int n = 0; n < nearbyLen; n++) {
+        uint16_t i = macHash(nearby[n].mac) & (NEARBY_SLOTS - 1);
+        while (nearbyIndex[i] != NEARBY_EMPTY) i = (i + 1) & (NEARBY_SLOTS - 1);
+        nearbyIndex[i] = n;
+    }
+}
+
+// Upsert di un vicino dalla ricezione di un annuncio. Il peer ESP-NOW non si
+// registra qui: solo quando gli si scrive (ensurePeer).
+bool MochiNow::reportNearby(MochiId id, const uint8_t* mac, int rssi) {
+    unsigned long now = clock->now();
+    int i = findNearbyByMac(mac);
+    if (i >= 0) {
+        nearby[i].id = id;
+        nearby[i].rssi = rssi;
+        nearby[i].lastSeen = now;
+        // Il rumore dell'RSSI non conta: solo spostamenti di qualche dB
+        if (abs(rssi - nearby[i].shownRssi) >= NEARBY_RSSI_STEP) {
+            nearby[i].shownRssi = rssi;
+            nearbyVer++;
         }
+        return false;
     }
-    if (nearbyLen < MAX_NEARBY) {
-        nearby[nearbyLen].id = id;
-        memcpy(nearby[nearbyLen].mac, mac, 6);
-        nearby[nearbyLen].rssi = rssi;
-        nearby[nearbyLen].lastSeen = now;
-        nearbyLen++;
-        ensurePeer(mac); // così potremo poi inviargli una visita
-        Serial.println("[NOW] Mochi vicino: " + id + " (rssi " + String(rssi) + ")");
+    if (nearbyLen >= MAX_NEARBY) {
+        nearbyFull++;
+        return false;
     }
+    nearby[nearbyLen].id = id;
+    memcpy(nearby[nearbyLen].mac, mac, 6);
+    nearby[nearbyLen].rssi = rssi;
+    nearby[nearbyLen].shownRssi = rssi;
+    nearby[nearbyLen].lastSeen = now;
+    uint16_t s = macHash(mac) & (NEARBY_SLOTS - 1);
+    while (nearbyIndex[s] != NEARBY_EMPTY) s = (s + 1) & (NEARBY_SLOTS - 1);
+    nearbyIndex[s] = nearbyLen;
+    nearbyLen++;
+    nearbyVer++;
+    // Ora lo sentiamo direttamente: non e' piu' un Mochi lontano
+    for (int r = 0; r < remoteLen; r++) {
+        if (remote[r].id == id) {
+            remote[r] = remote[--remoteLen];
+            break;
+        }
+    }
+    // Il nuovo arrivato deve sentirci presto: annunci di nuovo fitti
+    resetAnnounce(now);
+    Serial.printf("[NOW] Mochi vicino: %s (rssi %d)\n", MochiIdStr(id).c_str(), rssi);
+    return true;
 }
 
 void MochiNow::pruneNearby(unsigned long now) {
@@ -223,47 +416,262 @@ void MochiNow::pruneNearby(unsigned long now) {
         if (now - nearby[i].lastSeen <= NEARBY_TIMEOUT_MS) {
             if (w != i) nearby[w] = nearby[i];
             w++;
-        } else {
-            esp_now_del_peer(nearby[i].mac); // libera il peer scaduto
         }
     }
+    if (w == nearbyLen) return;
     nearbyLen = w;
+    nearbyVer++;
+    rebuildNearbyIndex();
+    // Niente resetAnnounce: chi se n'e' andato non ha bisogno di sentirci
+}
+
+// ==========================================
+// GOSSIP (presenza a piu' salti)
+// ==========================================
+
+static uint8_t gossipAge(unsigned long ms) {
+    unsigned long units = ms / GOSSIP_AGE_UNIT_MS;
+    return units > 255 ? 255 : (uint8_t)units;
+}
+
+// Vicini diretti (hops 1) e Mochi lontani che restano entro GOSSIP_MAX_HOPS
+// anche con un salto in piu'. Con piu' candidati che posti si riparte ogni
+// volta da dove si era arrivati, cosi' in qualche annuncio passano tutti.
+size_t MochiNow::buildGossip(NowGossipEntry* out, unsigned long now) {
+    int total = nearbyLen + remoteLen;
+    if (total == 0) return 0;
+    size_t n = 0;
+    int k = 0;
+    for (; k < total && n < GOSSIP_DIGEST_MAX; k++) {
+        int i = (gossipCursor + k) % total;
+        MochiId id;
+        uint8_t hops;
+        unsigned long seen;
+        if (i < nearbyLen) {
+            id = nearby[i].id;
+            hops = 1;
+            seen = nearby[i].lastSeen;
+        } else {
+            const RemoteMochi& r = remote[i - nearbyLen];
+            if (r.hops >= GOSSIP_MAX_HOPS) continue;
+            id = r.id;
+            hops = r.hops;
+            seen = r.seenAt;
+        }
+        out[n].id[0] = (uint8_t)id;
+        out[n].id[1] = (uint8_t)(id >> 8);
+        out[n].id[2] = (uint8_t)(id >> 16);
+        out[n].hops  = hops;
+        out[n].age   = gossipAge(now - seen);
+        n++;
+    }
+    gossipCursor = (gossipCursor + k) % total;
+    return n;
 }
 
-void MochiNow::onRecv(const esp_now_recv_info_t* info, const uint8_t* data, int len) {
-    if (len < (int)sizeof(uint8_t)) return;
-    MochiPacket pkt = {};
-    memcpy(&pkt, data, min(len, (int)sizeof(pkt)));
-    pkt.id[sizeof(pkt.id) - 1] = '\0';
-    pkt.payload[sizeof(pkt.payload) - 1] = '\0';
+// L'eta' ricevuta si somma lungo il percorso: una voce ripetuta di nodo in
+// nodo non ringiovanisce, quindi un Mochi sparito scade ovunque entro
+// GOSSIP_TTL_MS e due vicini non si tengono in vita a vicenda la stessa voce.
+void MochiNow::mergeGossip(MochiId via, const uint8_t* data, size_t len, unsigned long now) {
+    const NowGossipEntry* e = (const NowGossipEntry*)data;
+    size_t n = min(len / sizeof(NowGossipEntry), (size_t)GOSSIP_DIGEST_MAX);
+    for (size_t j = 0; j < n; j++) {
+        MochiId id = (MochiId)e[j].id[0] | ((MochiId)e[j].id[1] << 8) | ((MochiId)e[j].id[2] << 16);
+        uint8_t hops = e[j].hops + 1;
+        unsigned long ageMs = (unsigned long)e[j].age * GOSSIP_AGE_UNIT_MS;
+        if (id == selfKey || id == via || id == MOCHI_ID_NONE) continue;
+        if (e[j].hops == 0 || hops > GOSSIP_MAX_HOPS || ageMs > GOSSIP_TTL_MS) continue;
+        if (findNearbyIndex(id) >= 0) continue;
+        unsigned long seenAt = now - ageMs;
+
+        int i = 0;
+        while (i < remoteLen && remote[i].id != id) i++;
+        if (i < remoteLen) {
+            RemoteMochi& r = remote[i];
+            // Notizia piu' recente: vale lei anche se il percorso e' piu' lungo
+            if ((long)(seenAt - r.seenAt) > GOSSIP_AGE_UNIT_MS) {
+                r.hops = hops;
+                r.via = via;
+                r.seenAt = seenAt;
+            } else if (hops < r.hops) {
+                r.hops = hops;
+                r.via = via;
+            }
+            continue;
+        }
+        if (remoteLen < GOSSIP_TABLE_SIZE) {
+            i = remoteLen++;
+        } else {
+            // Piena: si sostituisce il piu' lontano, a parita' il piu' vecchio,
+            // solo se la nuova voce e' migliore
+            int worst = 0;
+            for (int r = 1; r < remoteLen; r++) {
+                if (remote[r].hops > remote[worst].hops ||
+                    (remote[r].hops == remote[worst].hops && (long)(remote[r].seenAt - remote[worst].seenAt) < 0)) {
+                    worst = r;
+                }
+            }
+            const RemoteMochi& w = remote[worst];
+            if (hops > w.hops || (hops == w.hops && (long)(seenAt - w.seenAt) <= 0)) {
+                remoteFull++;
+                continue;
+            }
+            i = worst;
+        }
+        remote[i].id = id;
+        remote[i].via = via;
+        remote[i].hops = hops;
+        remote[i].seenAt = seenAt;
+    }
+}
 
+void MochiNow::pruneRemote(unsigned long now) {
+    int w = 0;
+    for (int i = 0; i < remoteLen; i++) {
+        if (now - remote[i].seenAt <= GOSSIP_TTL_MS) {
+            if (w != i) remote[w] = remote[i];
+            w++;
+        }
+    }
+    remoteLen = w;
+}
+
+// ==========================================
+// ANNUNCI (Trickle, RFC 6206 adattato)
+// ==========================================
+
+void MochiNow::startAnnounceInterval(unsigned long now) {
+    announceStart = now;
+    announceAt = announceI / 2 + clock->random(announceI / 2);
+    announceDone = false;
+    announceHeard = 0;
+}
+
+// Vicinato cambiato. Se siamo gia' all'intervallo minimo non si ricomincia:
+// una raffica di arrivi non deve tenerci fermi prima dell'istante scelto.
+void MochiNow::resetAnnounce(unsigned long now) {
+    if (announceI == ANNOUNCE_MIN_MS) return;
+    announceI = ANNOUNCE_MIN_MS;
+    startAnnounceInterval(now);
+}
+
+// Almeno tre annunci per NEARBY_TIMEOUT_MS: un annuncio perso non basta a sparire.
+static_assert(ANNOUNCE_MAX_SILENT_MS * 3 <= NEARBY_TIMEOUT_MS, "ANNOUNCE_MAX_SILENT_MS: al massimo NEARBY_TIMEOUT_MS / 3");
+static_assert(ANNOUNCE_MAX_MS <= ANNOUNCE_MAX_SILENT_MS, "ANNOUNCE_MAX_MS: oltre il silenzio massimo");
+
+// Il silenzio non supera mai ANNOUNCE_MAX_SILENT_MS, altrimenti gli altri ci
+// toglierebbero dai vicini (NEARBY_TIMEOUT_MS): soppressione e intervallo lungo
+// riducono le collisioni, ma la scoperta resta entro quel tempo.
+void MochiNow::tickAnnounce(unsigned long now) {
+    if (!announceDone && now - announceStart >= announceAt) {
+        announceDone = true;
+        if (announceHeard < ANNOUNCE_REDUNDANCY || now - lastAnnounce >= ANNOUNCE_MAX_SILENT_MS) {
+            sendAnnounce();
+            lastAnnounce = now;
+        } else {
+            announceSkipped++;
+        }
+    }
+    if (now - announceStart >= announceI) {
+        announceI = min(announceI * 2, (unsigned long)ANNOUNCE_MAX_MS);
+        startAnnounceInterval(now);
+    }
+    if (now - lastAnnounce >= ANNOUNCE_MAX_SILENT_MS) {
+        sendAnnounce();
+        lastAnnounce = now;
+    }
+}
+
+// Task WiFi: niente String, niente stato condiviso. Con la coda piena il
+// pacchetto si perde (contato in dropped()): annunci e richieste si ripetono.
+void MochiNow::onRadioRecv(const uint8_t* mac, int rssi, const uint8_t* data, size_t len) {
+    if (!mochiWireCheck(data, len)) {
+        rxInvalid++;
+        return;
+    }
+    NowRxSlot* slot = rxQueue.beginPush();
+    if (!slot) return;
+    memcpy(slot->mac, mac, 6);
+    slot->rssi = rssi;
+    slot->len  = min(len, sizeof(slot->data));
+    memcpy(slot->data, data, slot->len);
+    rxQueue.endPush();
+}
+
+// Statistiche del collegamento per ogni pacchetto valido, ack e doppioni
+// compresi: received conta tutto quello che arriva da quel MAC.
+void MochiNow::noteReceived(const uint8_t* mac, MochiId id, int rssi, uint8_t type) {
+    NowLinkStats* link = linkFor(mac, id);
+    if (!link) return;
+    bump(link->received);
+    if (!link->rssiN || rssi < link->rssiMin) link->rssiMin = rssi;
+    if (!link->rssiN || rssi > link->rssiMax) link->rssiMax = rssi;
+    if (link->rssiN != 0xFFFF) {
+        link->rssiSum += rssi;
+        link->rssiN++;
+    }
+    if (type == PKT_ANNOUNCE) {
+        unsigned long now = clock->now();
+        if (link->lastAnnounceAt) bump(link->gap[logBucket(now - link->lastAnnounceAt, LINK_GAP_FIRST_MS, LINK_GAP_BUCKETS)]);
+        link->lastAnnounceAt = now ? now : 1;
+    }
+}
+
+// Loop: un pacchetto tolto dalla coda, letto sul posto (v1, v2 o v3).
+void MochiNow::handlePacket(const uint8_t* mac, int rssi, const uint8_t* data, int len) {
     recvCount++;
 
-    String senderId = String(pkt.id);
-    if (senderId.length() == 0 || senderId == selfId) return;
+    NowPacketView pkt;
+    if (!mochiWireParse(data, len, &pkt) || pkt.sender == selfKey) return;
+    MochiId senderId = pkt.sender;
     lastRecvId = senderId;
+    typeStats[pkt.type].received++;
+    noteReceived(mac, senderId, rssi, pkt.type);
 
-    int rssi = (info->rx_ctrl) ? info->rx_ctrl->rssi : 0;
+    if (pkt.type == PKT_LINK_ACK) {
+        if (pkt.payloadLen >= 1) onLinkAck(mac, pkt.payload[0]);
+        return;
+    }
+    if (pkt.hasSeq) {
+        // Si conferma anche un doppione: vuol dire che il nostro ack si e' perso
+        sendPacket(mac, PKT_LINK_ACK, &pkt.seq, 1);
+        if (isDuplicate(mac, pkt.seq, clock->now())) {
+            rxDuplicates++;
+            typeStats[pkt.type].duplicates++;
+            if (NowLinkStats* link = linkFor(mac, senderId)) bump(link->duplicates);
+            return;
+        }
+    }
 
     switch (pkt.type) {
         case PKT_ANNOUNCE:
-            reportNearby(senderId, info->src_addr, rssi);
+            // Vicino gia' noto: un annuncio "coerente" che rende superfluo il nostro
+            if (!reportNearby(senderId, mac, rssi) && announceHeard < 255) announceHeard++;
+            mergeGossip(senderId, pkt.payload, pkt.payloadLen, clock->now());
             break;
 
         case PKT_VISIT: {
             // Un altro Mochi ci consegna il suo avatar: proviamo ad ospitarlo.
-            bool ok = mochi->receiveGuest(String(pkt.payload), VISIT_DURATION_MS);
-            sendAck(info->src_addr, ok);
+            bool ok = mochi->receiveGuest(senderId, pkt.payload, pkt.payloadLen, VISIT_DURATION_MS);
+            if (ok) visits.hosted++;
+            sendAck(mac, ok);
             break;
         }
 
         case PKT_VISIT_ACK:
-            if (awaitingAck && macEqual(info->src_addr, pendingMac)) {
-                if (pkt.ackOk) {
+            if (awaitingAck && macEqual(mac, pendingMac)) {
+                unsigned long rtt = min(clock->now() - pendingSentAt, 0xFFFFUL);
+                visitRttMin = min(visitRttMin, (uint16_t)rtt);
+                visitRttMax = max(visitRttMax, (uint16_t)rtt);
+                visitRttSum += rtt;
+                visitRttN++;
+                if (pkt.payloadLen && pkt.payload[0]) {
                     mochi->goAway(pendingHostId, VISIT_DURATION_MS);
-                    lastVisitDepart = millis();
+                    lastVisitDepart = clock->now();
+                    visits.accepted++;
                     Serial.println("[NOW] Visita accettata, parto!");
                 } else {
+                    visits.refused++;
                     Serial.println("[NOW] Host occupato, resto a casa.");
                 }
                 awaitingAck = false;
@@ -273,19 +681,21 @@ void MochiNow::onRecv(const esp_now_recv_info_t* info, const uint8_t* data, int
         case PKT_FRIEND_REQ:
             // Un altro Mochi chiede l'amicizia: la registriamo come richiesta in
             // sospeso. Diventerà amicizia solo se l'utente la accetta.
-            reportNearby(senderId, info->src_addr, rssi); // così potremo rispondergli
+            reportNearby(senderId, mac, rssi); // così potremo rispondergli
             mochi->addPendingRequest(senderId);
             break;
 
         case PKT_FRIEND_ACCEPT:
-            // La nostra richiesta è stata accettata: differiamo l'addFriend (NVS)
-            // al tick() del loop principale per non scrivere dalla callback WiFi.
-            inboundAcceptId = senderId;
+            // La nostra richiesta è stata accettata: amicizia mutua.
+            mochi->addFriend(senderId);
+            mochi->removePendingRequest(senderId);
+            Serial.printf("[NOW] Amicizia confermata con %s\n", MochiIdStr(senderId).c_str());
             break;
 
         case PKT_FRIEND_REMOVE:
-            // L'altro ci ha rimosso: rimuoviamo a sua volta (NVS → differito).
-            inboundRemoveId = senderId;
+            // L'altro ci ha rimosso: rimuoviamo a sua volta.
+            mochi->removeFriend(senderId);
+            Serial.printf("[NOW] Amicizia rimossa da remoto: %s\n", MochiIdStr(senderId).c_str());
             break;
 
         case PKT_VISIT_END:
@@ -304,6 +714,7 @@ void MochiNow::tickVisit(unsigned long now) {
     if (awaitingAck) {
         if (now - pendingSentAt > VISIT_ACK_TIMEOUT_MS) {
             awaitingAck = false; // Nessun ack: rinuncia, resta a casa
+            visits.noAck++;
             Serial.println("[NOW] Nessun ack, visita annullata.");
         }
         return;
@@ -322,70 +733,298 @@ void MochiNow::tickVisit(unsigned long now) {
     }
     if (best < 0) return;
 
-    if (random(1000) >= VISIT_CHANCE) return;
+    if (clock->random(1000) >= VISIT_CHANCE) return;
 
     sendVisit(nearby[best]);
 }
 
 void MochiNow::tick(unsigned long now) {
     if (!ready) return;
+    MochiMemScope mem(MEM_NOW);
 
-    // Accettazione amicizia arrivata: aggiungiamo l'amico qui (fuori dalla
-    // callback ESP-NOW) perché addFriend scrive in NVS.
-    if (inboundAcceptId.length() > 0) {
-        mochi->addFriend(inboundAcceptId);
-        mochi->removePendingRequest(inboundAcceptId);
-        Serial.println("[NOW] Amicizia confermata con " + inboundAcceptId);
-        inboundAcceptId = "";
-    }
-    if (inboundRemoveId.length() > 0) {
-        mochi->removeFriend(inboundRemoveId);
-        Serial.println("[NOW] Amicizia rimossa da remoto: " + inboundRemoveId);
-        inboundRemoveId = "";
+    // Pacchetti arrivati: pochi per giro, una raffica non ferma il display
+    for (int i = 0; i < NOW_RX_PER_TICK; i++) {
+        NowRxSlot* slot = rxQueue.front();
+        if (!slot) break;
+        handlePacket(slot->mac, slot->rssi, slot->data, slot->len);
+        rxQueue.pop();
     }
 
+    pumpTx(now);
     pruneNearby(now);
-    if (lastAnnounce == 0 || (now - lastAnnounce) >= ANNOUNCE_INTERVAL_MS) {
-        sendAnnounce();
-        lastAnnounce = now;
-    }
+    pruneRemote(now);
+    tickAnnounce(now);
     tickVisit(now);
 }
 
-String MochiNow::getNearbyJson() {
-    String out = "[";
+// ==========================================
+// STATISTICHE DEI COLLEGAMENTI
+// ==========================================
+
+// Voce di links[] per quel MAC, creata se manca. Con la tabella piena esce
+// quella sentita meno di recente, ma gli amici solo se sono tutti amici.
+NowLinkStats* MochiNow::linkFor(const uint8_t* mac, MochiId id) {
+    if (macEqual(mac, BCAST_MAC)) return nullptr;
+    unsigned long now = clock->now();
+    NowLinkEntry* e = nullptr;
+    int freeSlot = -1;
+    for (int i = 0; i < LINK_TABLE_SIZE && !e; i++) {
+        if (!links[i].used) {
+            if (freeSlot < 0) freeSlot = i;
+        } else if (macEqual(links[i].mac, mac)) {
+            e = &links[i];
+        }
+    }
+    if (!e) {
+        // Nuovo MAC: slot libero, altrimenti il meno recente (amici per ultimi).
+        // isFriend per voce solo qui, con la tabella piena.
+        int lru = freeSlot;
+        bool lruFriend = false;
+        if (lru < 0) {
+            for (int i = 0; i < LINK_TABLE_SIZE; i++) {
+                bool fr = mochi->isFriend(links[i].id);
+                if (lru < 0 || (lruFriend && !fr) || (fr == lruFriend && now - links[i].lastAt > now - links[lru].lastAt)) {
+                    lru = i;
+                    lruFriend = fr;
+                }
+            }
+        }
+        e = &links[lru];
+        memset(e, 0, sizeof(*e));
+        memcpy(e->mac, mac, 6);
+        e->used = true;
+        e->id = MOCHI_ID_NONE;
+    }
+    if (id == MOCHI_ID_NONE && e->id == MOCHI_ID_NONE) {
+        int n = findNearbyByMac(mac);
+        if (n >= 0) id = nearby[n].id;
+    }
+    if (id != MOCHI_ID_NONE) e->id = id;
+    e->lastAt = now;
+    return &e->stats;
+}
+
+const NowLinkStats* MochiNow::linkStats(MochiId id) const {
+    for (int i = 0; i < LINK_TABLE_SIZE; i++) {
+        if (links[i].used && links[i].id == id) return &links[i].stats;
+    }
+    return nullptr;
+}
+
+void MochiNow::noteRtt(NowLinkStats* link, unsigned long ms) {
+    uint16_t v = (uint16_t)min(ms, 0xFFFFUL);
+    rttHist[logBucket(v, LINK_RTT_FIRST_MS, LINK_RTT_BUCKETS)]++;
+    rttMin = min(rttMin, v);
+    rttMax = max(rttMax, v);
+    rttSum += v;
+    rttN++;
+    if (!link || link->rttN == 0xFFFF) return;
+    link->rttMax = max(link->rttMax, v);
+    link->rttSum += v;
+    link->rttN++;
+}
+
+void MochiNow::resetLinkStats() {
+    memset(typeStats, 0, sizeof(typeStats));
+    memset(rttHist, 0, sizeof(rttHist));
+    rttMin = visitRttMin = 0xFFFF;
+    rttMax = visitRttMax = 0;
+    rttSum = visitRttSum = 0;
+    rttN = visitRttN = 0;
+    memset(links, 0, sizeof(links));
+    Serial.println("[NOW] Statistiche dei collegamenti azzerate");
+}
+
+// Prefisso "DBG" come il report diagnostico: la app lo mostra nello stesso riquadro.
+void MochiNow::writeLinkReport(MochiWriter& w) {
+    w.raw("DBG\n");
+    w.printf("%-11s %6s %6s %5s %5s %6s %5s\n", "tipo", "inv", "ok", "fall", "rit", "ric", "dopp");
+    for (int t = 0; t < PKT_TYPE_COUNT; t++) {
+        const NowTypeStats& s = typeStats[t];
+        w.printf("%-11s %6lu %6lu %5lu %5lu %6lu %5lu\n", PKT_NAMES[t], (unsigned long)s.sent,
+                 (unsigned long)s.delivered, (unsigned long)s.failed, (unsigned long)s.retried,
+                 (unsigned long)s.received, (unsigned long)s.duplicates);
+    }
+    if (rttN) {
+        w.printf("conferma: %u/%lu/%u ms (min/media/max, %lu)\n", rttMin, (unsigned long)(rttSum / rttN), rttMax,
+                 (unsigned long)rttN);
+    } else {
+        w.raw("conferma: -\n");
+    }
+    w.raw(" ");
+    for (int b = 0; b < LINK_RTT_BUCKETS; b++) {
+        if (b < LINK_RTT_BUCKETS - 1) w.printf(" <%lums:%lu", (unsigned long)LINK_RTT_FIRST_MS << b, (unsigned long)rttHist[b]);
+        else w.printf(" oltre:%lu\n", (unsigned long)rttHist[b]);
+    }
+    if (visitRttN) {
+        w.printf("visita->ack: %u/%lu/%u ms (%lu)\n", visitRttMin, (unsigned long)(visitRttSum / visitRttN),
+                 visitRttMax, (unsigned long)visitRttN);
+    } else {
+        w.raw("visita->ack: -\n");
+    }
+    int used = 0;
+    for (int i = 0; i < LINK_TABLE_SIZE; i++) used += links[i].used;
+    w.printf("collegamenti (%d):", used);
+    unsigned long now = clock->now();
+    for (int i = 0; i < LINK_TABLE_SIZE; i++) {
+        if (!links[i].used) continue;
+        if (w.room() < 180) break;
+        const NowLinkStats& l = links[i].stats;
+        w.printf("\n%s", links[i].id != MOCHI_ID_NONE ? MochiIdStr(links[i].id).c_str() : "?");
+        if (findNearbyByMac(links[i].mac) < 0) w.printf(" (sparito da %lus)", (now - links[i].lastAt) / 1000);
+        w.printf(" inv %u ok %u fall %u rit %u | ric %u dopp %u", l.sent, l.delivered, l.failed, l.retried,
+                 l.received, l.duplicates);
+        if (l.rssiN) w.printf(" | rssi %d/%ld/%d", l.rssiMin, (long)(l.rssiSum / l.rssiN), l.rssiMax);
+        if (l.rttN) w.printf(" | conferma %lu/%u ms", (unsigned long)(l.rttSum / l.rttN), l.rttMax);
+        w.raw("\n  annunci ogni");
+        for (int b = 0; b < LINK_GAP_BUCKETS; b++) {
+            if (b < LINK_GAP_BUCKETS - 1) w.printf(" <%lus:%u", ((unsigned long)LINK_GAP_FIRST_MS << b) / 1000, l.gap[b]);
+            else w.printf(" oltre:%u", l.gap[b]);
+        }
+    }
+}
+
+// TAG_LINK_TYPE: [tipo][6 x u32] | TAG_LINK_RTT: [min][media][max][n u16][istogramma u16...]
+// TAG_VISIT_RTT: [min][media][max][n], u16 | TAG_LINK_PEER: [id][6 x u16][rssi min/media/max i8]
+// [conferma media u16][intervalli u16...]
+void MochiNow::writeLinkTlv(MochiFrame& f) {
+    uint8_t e[40];
+    for (int t = 0; t < PKT_TYPE_COUNT; t++) {
+        const NowTypeStats& s = typeStats[t];
+        const uint32_t v[6] = { s.sent, s.delivered, s.failed, s.retried, s.received, s.duplicates };
+        e[0] = t;
+        for (int k = 0; k < 6; k++) mochiTlvPutLe(e + 1 + 4 * k, v[k], 4);
+        f.bytes(TAG_LINK_TYPE, e, 25);
+    }
+    size_t n = 0;
+    mochiTlvPutLe(e + n, rttN ? rttMin : 0, 2); n += 2;
+    mochiTlvPutLe(e + n, rttN ? rttSum / rttN : 0, 2); n += 2;
+    mochiTlvPutLe(e + n, rttMax, 2); n += 2;
+    mochiTlvPutLe(e + n, min(rttN, (uint32_t)0xFFFF), 2); n += 2;
+    for (int b = 0; b < LINK_RTT_BUCKETS; b++, n += 2) mochiTlvPutLe(e + n, min(rttHist[b], (uint32_t)0xFFFF), 2);
+    f.bytes(TAG_LINK_RTT, e, n);
+    n = 0;
+    mochiTlvPutLe(e + n, visitRttN ? visitRttMin : 0, 2); n += 2;
+    mochiTlvPutLe(e + n, visitRttN ? visitRttSum / visitRttN : 0, 2); n += 2;
+    mochiTlvPutLe(e + n, visitRttMax, 2); n += 2;
+    mochiTlvPutLe(e + n, min(visitRttN, (uint32_t)0xFFFF), 2); n += 2;
+    f.bytes(TAG_VISIT_RTT, e, n);
+
+    for (int i = 0; i < LINK_TABLE_SIZE; i++) {
+        if (!links[i].used || links[i].id == MOCHI_ID_NONE) continue;
+        if (f.room() < 64) break; // Con tanti Mochi meglio una lista corta che un frame troncato
+        const NowLinkStats& l = links[i].stats;
+        const uint16_t c[6] = { l.sent, l.delivered, l.failed, l.retried, l.received, l.duplicates };
+        n = 0;
+        mochiTlvPutLe(e + n, links[i].id, 3); n += 3;
+        for (int k = 0; k < 6; k++, n += 2) mochiTlvPutLe(e + n, c[k], 2);
+        e[n++] = (uint8_t)l.rssiMin;
+        e[n++] = (uint8_t)(int8_t)(l.rssiN ? l.rssiSum / l.rssiN : 0);
+        e[n++] = (uint8_t)l.rssiMax;
+        mochiTlvPutLe(e + n, l.rttN ? l.rttSum / l.rttN : 0, 2); n += 2;
+        for (int b = 0; b < LINK_GAP_BUCKETS; b++, n += 2) mochiTlvPutLe(e + n, l.gap[b], 2);
+        f.bytes(TAG_LINK_PEER, e, n);
+    }
+}
+
+void MochiNow::writeNearbyJson(MochiWriter& w) {
+    w.beginArray();
     for (int i = 0; i < nearbyLen; i++) {
-        if (i > 0) out += ",";
+        // Con tanti vicini la lista si ferma prima di riempire il buffer: meglio
+        // una lista corta che un JSON troncato
+        if (w.room() < 64) break;
         bool fr = mochi && mochi->isFriend(nearby[i].id);
-        out += "{\"id\":\"" + nearby[i].id + "\",\"rssi\":" + String(nearby[i].rssi) +
-               ",\"isFriend\":" + (fr ? "true" : "false") + "}";
+        w.beginObject()
+         .key("id").id(nearby[i].id)
+         .field("rssi", nearby[i].rssi)
+         .fieldBool("isFriend", fr)
+         .endObject();
     }
-    out += "]";
-    return out;
+    w.endArray();
+}
+
+void MochiNow::writeNearbyTlv(MochiFrame& f) {
+    for (int i = 0; i < nearbyLen; i++) {
+        uint8_t e[5] = {
+            (uint8_t)nearby[i].id, (uint8_t)(nearby[i].id >> 8), (uint8_t)(nearby[i].id >> 16),
+            (uint8_t)(int8_t)nearby[i].rssi,
+            (uint8_t)((mochi && mochi->isFriend(nearby[i].id)) ? 1 : 0)
+        };
+        f.bytes(TAG_PEER, e, sizeof(e));
+    }
+}
+
+void MochiNow::writePresenceTlv(MochiFrame& f) {
+    unsigned long now = clock->now();
+    for (int i = 0; i < remoteLen; i++) {
+        const RemoteMochi& r = remote[i];
+        unsigned long ageS = min((now - r.seenAt) / 1000, 0xFFFFUL);
+        uint8_t e[7] = {
+            (uint8_t)r.id, (uint8_t)(r.id >> 8), (uint8_t)(r.id >> 16),
+            r.hops,
+            (uint8_t)ageS, (uint8_t)(ageS >> 8),
+            (uint8_t)((mochi && mochi->isFriend(r.id)) ? 1 : 0)
+        };
+        f.bytes(TAG_REMOTE, e, sizeof(e));
+    }
+}
+
+// Stessi dati del report testuale, come contatori binari.
+void MochiNow::writeDebugTlv(MochiFrame& f) {
+    f.str(TAG_FIRMWARE, MOCHI_VERSION);
+    f.id(TAG_SELF_ID, selfKey);
+    f.u8(TAG_CHANNEL, ready ? radio->channel() : 0);
+    f.u32(TAG_ANNOUNCES, announceCount);
+    f.u32(TAG_RECEIVED, recvCount);
+    f.u8(TAG_LAST_SEND, (uint8_t)(int8_t)lastSendStatus);
+    if (lastRecvId != MOCHI_ID_NONE) f.id(TAG_LAST_FROM, lastRecvId);
+    writeNearbyTlv(f);
+    f.u8(TAG_AWAY, mochi->isAway);
+    f.u8(TAG_HOSTING, mochi->isHostingGuest);
+    f.u32(TAG_FREE_HEAP, ESP.getFreeHeap());
 }
 
 // Report diagnostico leggibile (prefisso "DBG" così la app lo riconosce).
-String MochiNow::getDebugReport() {
-    uint8_t primaryCh = 0; wifi_second_chan_t secondCh;
-    esp_wifi_get_channel(&primaryCh, &secondCh);
+void MochiNow::writeDebugReport(MochiWriter& w) {
+    uint8_t primaryCh = radio->channel();
 
     const char* sendStr = (lastSendStatus == -1) ? "mai" : (lastSendStatus == 0 ? "OK" : "FALLITO");
 
-    unsigned long now = millis();
-    String out = "DBG\n";
-    out += "build: " + String(MOCHI_VERSION) + "\n";
-    out += "id: " + selfId + "\n";
-    out += "espnow: " + String(ready ? "ready" : "OFF") + " ch" + String(primaryCh) + "\n";
-    out += "annunci inviati: " + String(announceCount) + " | ultimo invio: " + String(sendStr) + "\n";
-    out += "pacchetti ricevuti: " + String(recvCount) + " | ultimo da: " + (lastRecvId.length() ? lastRecvId : "-") + "\n";
-    out += "vicini (" + String(nearbyLen) + "):\n";
+    unsigned long now = clock->now();
+    w.raw("DBG\n");
+    w.printf("build: %s\n", MOCHI_VERSION);
+    w.printf("id: %s\n", selfId.c_str());
+    w.printf("espnow: %s ch%u\n", ready ? "ready" : "OFF", primaryCh);
+    w.printf("annunci inviati: %lu | ultimo invio: %s | %lu byte in aria\n",
+             (unsigned long)announceCount, sendStr, (unsigned long)txBytes);
+    w.printf("annunci: ogni %lums | %lu soppressi\n", announceI, announceSkipped);
+    int queued = 0;
+    for (int i = 0; i < NOW_TX_QUEUE_LEN; i++) queued += txQueue[i].used;
+    w.printf("invio: %d/%d in coda | %lu ritrasmessi | %lu falliti | %lu coda piena | %lu doppioni\n",
+             queued, NOW_TX_QUEUE_LEN, (unsigned long)txRetries, (unsigned long)txFailed,
+             (unsigned long)txQueueFull, (unsigned long)rxDuplicates);
+    w.printf("pacchetti ricevuti: %lu | ultimo da: %s\n", (unsigned long)recvCount,
+             lastRecvId != MOCHI_ID_NONE ? MochiIdStr(lastRecvId).c_str() : "-");
+    w.printf("coda rx: %u/%u | picco %u | %lu scartati | %lu invalidi\n",
+             (unsigned)rxQueue.size(), (unsigned)rxQueue.capacity(), (unsigned)rxQueue.highWater(),
+             (unsigned long)rxQueue.dropped(), (unsigned long)rxInvalid);
+    int cached = 0;
+    for (int i = 0; i < NOW_PEER_CACHE; i++) cached += peers[i].used;
+    w.printf("peer: %d/%d in cache | %lu sostituiti | %lu vicini oltre il limite\n",
+             cached, NOW_PEER_CACHE, (unsigned long)peerEvictions, (unsigned long)nearbyFull);
+    int remoteFriends = 0;
+    for (int i = 0; i < remoteLen; i++) remoteFriends += mochi->isFriend(remote[i].id);
+    w.printf("gossip: %d/%d lontani (%d amici) | %lu byte di digest | %lu scartati\n",
+             remoteLen, GOSSIP_TABLE_SIZE, remoteFriends, (unsigned long)gossipBytes, (unsigned long)remoteFull);
+    w.printf("vicini (%d):\n", nearbyLen);
     for (int i = 0; i < nearbyLen; i++) {
+        if (w.room() < 192) break; // Resta spazio per le ultime righe
         unsigned long ageS = (now - nearby[i].lastSeen) / 1000;
-        out += "  - " + nearby[i].id + " rssi " + String(nearby[i].rssi) +
-               " visto " + String(ageS) + "s fa\n";
+        w.printf("  - %s rssi %d visto %lus fa\n", MochiIdStr(nearby[i].id).c_str(), nearby[i].rssi, ageS);
     }
-    out += "away: " + String(mochi->isAway ? "si" : "no") +
-           " | ospite: " + String(mochi->isHostingGuest ? "si" : "no") + "\n";
-    out += "heap libero: " + String(ESP.getFreeHeap());
-    return out;
+    w.printf("visite: %lu chieste | %lu partite | %lu rifiutate | %lu senza ack | %lu ospitate\n",
+             (unsigned long)visits.asked, (unsigned long)visits.accepted, (unsigned long)visits.refused,
+             (unsigned long)visits.noAck, (unsigned long)visits.hosted);
+    w.printf("away: %s | ospite: %s\n", mochi->isAway ? "si" : "no", mochi->isHostingGuest ? "si" : "no");
+    w.printf("heap libero: %lu", (unsigned long)ESP.getFreeHeap());
 }
@@ -2,102 +2,265 @@
 #define MOCHI_NOW_H
 
 #include <Arduino.h>
-#include <esp_now.h>
 #include "MochiState.h"
+#include "MochiWire.h"
+#include "MochiTransport.h"
+#include "MochiRing.h"
 
-// Tipi di pacchetto scambiati tra Mochi via ESP-NOW.
-enum MochiPktType : uint8_t {
-    PKT_ANNOUNCE     = 0, // Broadcast periodico di presenza
-    PKT_VISIT        = 1, // Consegna dell'avatar in visita (unicast)
-    PKT_VISIT_ACK    = 2, // Risposta all'host (unicast): accettato o occupato
-    PKT_FRIEND_REQ   = 3, // Richiesta di amicizia (unicast)
-    PKT_FRIEND_ACCEPT= 4, // Accettazione di una richiesta (unicast) → amicizia mutua
-    PKT_FRIEND_REMOVE= 5, // Rimozione amicizia (unicast) → l'altro rimuove a sua volta
-    PKT_VISIT_END    = 6  // L'ospite torna a casa in anticipo (unicast all'host)
+// Statistiche del collegamento con un vicino. I contatori si fermano a 65535.
+struct NowLinkStats {
+    uint16_t      sent;       // Pacchetti unicast inviati (prima trasmissione)
+    uint16_t      delivered;  // Confermati da PKT_LINK_ACK
+    uint16_t      failed;     // Abbandonati dopo NOW_TX_MAX_TRIES
+    uint16_t      retried;    // Ritrasmissioni
+    uint16_t      received;   // Tutti i pacchetti validi da quel MAC (ack e doppioni compresi)
+    uint16_t      duplicates; // Di cui ritrasmissioni gia' ricevute, scartate
+    int8_t        rssiMin;
+    int8_t        rssiMax;
+    int32_t       rssiSum;
+    uint16_t      rssiN;
+    uint16_t      rttMax;     // ms fino all'ack, solo consegne al primo tentativo
+    uint32_t      rttSum;
+    uint16_t      rttN;
+    uint16_t      gap[LINK_GAP_BUCKETS]; // Intervalli tra i suoi annunci
+    unsigned long lastAnnounceAt; // 0 = nessun annuncio dall'azzeramento
 };
 
-// Pacchetto ESP-NOW (max 250 byte: questo è ~226).
-typedef struct {
-    uint8_t type;        // MochiPktType
-    uint8_t ackOk;       // Per PKT_VISIT_ACK: 1 = accettato, 0 = occupato
-    char    id[24];      // ID del mittente (es. "MOCHI-ABCDEF")
-    char    payload[200];// Per PKT_VISIT: avatar JSON; altrimenti vuoto
-} MochiPacket;
+// Totali per tipo di pacchetto (MochiPktType).
+struct NowTypeStats {
+    uint32_t sent, delivered, failed, retried, received, duplicates;
+};
+
+// Visite dal punto di vista di questo Mochi (non si azzerano).
+struct NowVisitStats {
+    uint32_t asked;     // PKT_VISIT inviati
+    uint32_t accepted;  // Ack positivo: partito
+    uint32_t refused;   // Host occupato
+    uint32_t noAck;     // Nessun ack entro VISIT_ACK_TIMEOUT_MS
+    uint32_t hosted;    // Ospiti accolti
+};
 
 // Un Mochi vicino rilevato via ESP-NOW.
 struct NearbyMochi {
-    String        id;        // ID stabile (es. "MOCHI-ABCDEF")
+    MochiId       id;        // ID stabile (24 bit, "MOCHI-ABCDEF" solo ai bordi)
     uint8_t       mac[6];    // MAC del peer (per inviargli pacchetti)
     int           rssi;      // Potenza segnale
+    int           shownRssi; // RSSI dell'ultima variazione "grande" (versione della lista)
     unsigned long lastSeen;  // millis() dell'ultimo annuncio ricevuto
 };
 
-class MochiNow {
+// Statistiche di un Mochi con cui abbiamo parlato. Fuori da nearby[]: restano
+// anche quando esce dai vicini, che e' proprio il caso da diagnosticare.
+struct NowLinkEntry {
+    uint8_t       mac[6];
+    MochiId       id;        // MOCHI_ID_NONE finche' non si sa
+    bool          used;
+    unsigned long lastAt;    // millis() dell'ultimo pacchetto da o verso di lui
+    NowLinkStats  stats;
+};
+
+// Un Mochi fuori portata, saputo dal gossip degli annunci.
+struct RemoteMochi {
+    MochiId       id;
+    MochiId       via;       // Vicino da cui l'abbiamo saputo
+    uint8_t       hops;      // 2 = vicino di un vicino
+    unsigned long seenAt;    // millis() stimato dell'ultimo annuncio diretto
+};
+
+// Peer registrato in ESP-NOW per l'unicast (cache LRU, vedi ensurePeer).
+struct NowPeerSlot {
+    uint8_t       mac[6];
+    bool          used;
+    unsigned long usedAt;    // millis() dell'ultimo invio
+};
+
+// Ultimi seq affidabili ricevuti da un mittente, per scartare i doppioni.
+// Separati dalla cache dei peer: ricevere non deve togliere posto a chi scriviamo.
+struct NowRxDedup {
+    uint8_t       mac[6];
+    bool          used;
+    unsigned long lastAt;    // Dopo NOW_RX_DEDUP_MS senza pacchetti si dimentica tutto
+    uint8_t       seen[NOW_RX_DEDUP];
+    uint8_t       seenLen;
+};
+
+// Pacchetto ricevuto, copiato dal task della radio e gestito dal loop.
+struct NowRxSlot {
+    uint8_t mac[6];
+    int8_t  rssi;
+    uint8_t len;
+    uint8_t data[NOW_WIRE_MAX];
+};
+
+// Pacchetto in attesa di invio (coda del loop, vedi pumpTx).
+struct NowTxSlot {
+    bool          used;
+    bool          reliable;  // Ritrasmesso finche' non arriva PKT_LINK_ACK
+    uint8_t       mac[6];
+    uint8_t       seq;
+    uint8_t       tries;
+    uint8_t       len;
+    unsigned long nextAt;    // millis() del prossimo tentativo
+    unsigned long firstAt;   // millis() della prima trasmissione (tempo di conferma)
+    uint8_t       data[NOW_WIRE_MAX];
+};
+
+class MochiNow : public MochiRadioSink {
 private:
+    // Indice dei vicini per MAC: sondaggio lineare, carico <= 50%
+    static constexpr uint16_t NEARBY_SLOTS = 2 * MAX_NEARBY;
+    static constexpr uint8_t  NEARBY_EMPTY = 0xFF;
+    static_assert(MAX_NEARBY <= 64 && (MAX_NEARBY & (MAX_NEARBY - 1)) == 0, "MAX_NEARBY: potenza di 2 fino a 64");
+
     MochiState* mochi;
-    String      selfId;
+    MochiTransport* radio;
+    MochiClock* clock;       // Della radio: millis()/esp_random() sul device
+    String      selfId;      // Forma testuale, usata nel campo id dei pacchetti
+    MochiId     selfKey = MOCHI_ID_NONE;
     uint8_t     selfMac[6];
     bool        ready = false;
 
-    NearbyMochi   nearby[MAX_NEARBY];
+    NearbyMochi   nearby[MAX_NEARBY];      // Compatti: 0..nearbyLen-1
+    uint8_t       nearbyIndex[NEARBY_SLOTS]; // MAC -> posizione in nearby[]
     int           nearbyLen = 0;
+    NowPeerSlot   peers[NOW_PEER_CACHE];
+    NowRxDedup    rxDedup[NOW_RX_DEDUP_PEERS];
+    NowLinkEntry  links[LINK_TABLE_SIZE];
+    // Seq dei pacchetti affidabili, uno solo per tutti i peer: uscire dalla
+    // cache non lo fa ripartire, quindi il destinatario non vede vecchi seq.
+    uint8_t       txSeq = 0;
+
+    // Presenza a piu' salti: ogni annuncio porta un digest di Mochi visti di
+    // recente, a turno (gossipCursor) tra vicini diretti e remote[].
+    RemoteMochi   remote[GOSSIP_TABLE_SIZE]; // Compatti: 0..remoteLen-1
+    int           remoteLen = 0;
+    uint16_t      gossipCursor = 0;
+
+    // Ricezione: la callback della radio copia qui, il loop svuota in tick()
+    MochiRing<NowRxSlot, NOW_RX_QUEUE_LEN> rxQueue;
 
+    // Invio: un pacchetto alla volta al driver, il successivo dopo la callback
+    NowTxSlot     txQueue[NOW_TX_QUEUE_LEN];
+    volatile bool txBusy = false;
+    unsigned long txSentAt = 0;
+    volatile uint32_t nearbyVer = 0; // Cambia quando la lista cambia davvero
+
+    // Annunci alla Trickle: intervallo che raddoppia finche' il vicinato non
+    // cambia, istante casuale nella seconda meta', silenzio se altri hanno gia'
+    // parlato abbastanza.
     unsigned long lastAnnounce = 0;
+    unsigned long announceI = ANNOUNCE_MIN_MS;
+    unsigned long announceStart = 0;
+    unsigned long announceAt = 0;     // Offset dall'inizio dell'intervallo
+    bool          announceDone = false;
+    uint8_t       announceHeard = 0;  // Annunci di vicini noti nell'intervallo
     unsigned long lastVisitCheck = 0;
     unsigned long lastVisitDepart = 0;
 
     // Partenza in attesa di ack (la visita parte solo su ack positivo)
     bool          awaitingAck = false;
     uint8_t       pendingMac[6];
-    String        pendingHostId = "";
+    MochiId       pendingHostId = MOCHI_ID_NONE;
     unsigned long pendingSentAt = 0;
 
-    // Accettazione amicizia ricevuta via ESP-NOW: l'addFriend (scrive in NVS)
-    // viene differito al tick() del loop principale per non bloccare la callback.
-    String        inboundAcceptId = "";
-    // Rimozione amicizia ricevuta da remoto: anche removeFriend scrive in NVS,
-    // quindi viene differita al tick().
-    String        inboundRemoveId = "";
-
     // --- DIAGNOSTICA ---
     unsigned long announceCount = 0; // Annunci broadcast inviati
+    unsigned long announceSkipped = 0; // Annunci soppressi (vicinato gia' rumoroso)
+    uint32_t      txBytes = 0;       // Byte trasmessi (tempo in aria)
     unsigned long recvCount = 0;     // Pacchetti ESP-NOW ricevuti
+    volatile uint32_t rxInvalid = 0; // Scartati dalla callback (corti o di tipo sconosciuto)
+    uint32_t      nearbyFull = 0;    // Annunci ignorati con la tabella dei vicini piena
+    uint32_t      peerEvictions = 0; // Peer tolti dalla cache per farne posto a un altro
     int           lastSendStatus = -1; // -1=mai, 0=successo, 1=fallito
-    String        lastRecvId = "";   // ID dell'ultimo mittente
+    uint32_t      txRetries = 0;     // Ritrasmissioni
+    uint32_t      txFailed = 0;      // Consegne abbandonate dopo NOW_TX_MAX_TRIES
+    uint32_t      txQueueFull = 0;   // Invii rifiutati con la coda piena
+    uint32_t      rxDuplicates = 0;  // Doppioni scartati (ack perso, ritrasmissione)
+    uint32_t      gossipBytes = 0;   // Byte di digest trasmessi (costo del gossip)
+    uint32_t      remoteFull = 0;    // Voci del gossip scartate con la tabella piena
+    // Statistiche dei collegamenti (azzerate da resetLinkStats): per Mochi in
+    // links[], qui i totali per tipo e i tempi di conferma
+    NowTypeStats  typeStats[PKT_TYPE_COUNT];
+    uint32_t      rttHist[LINK_RTT_BUCKETS]; // PKT_LINK_ACK, tutti i vicini
+    uint16_t      rttMin = 0xFFFF;
+    uint16_t      rttMax = 0;
+    uint32_t      rttSum = 0;
+    uint32_t      rttN = 0;
+    uint16_t      visitRttMin = 0xFFFF; // PKT_VISIT -> PKT_VISIT_ACK
+    uint16_t      visitRttMax = 0;
+    uint32_t      visitRttSum = 0;
+    uint32_t      visitRttN = 0;
+    MochiId       lastRecvId = MOCHI_ID_NONE; // ID dell'ultimo mittente
+    NowVisitStats visits;
 
     void computeSelfId();
+    bool sendPacket(const uint8_t* mac, uint8_t type, const void* payload = nullptr, size_t n = 0);
     void sendAnnounce();
     void sendVisit(NearbyMochi& target);
     void sendAck(const uint8_t* mac, bool ok);
-    int  findNearbyIndex(const String& id);
-    bool sendFriendPkt(const String& id, uint8_t type);
-    void ensurePeer(const uint8_t* mac);
-    void reportNearby(const String& id, const uint8_t* mac, int rssi);
+    int  findNearbyIndex(MochiId id);
+    bool sendFriendPkt(MochiId id, uint8_t type);
+    NowPeerSlot* ensurePeer(const uint8_t* mac); // nullptr per il broadcast
+    void pumpTx(unsigned long now);
+    void onLinkAck(const uint8_t* mac, uint8_t seq);
+    bool isDuplicate(const uint8_t* mac, uint8_t seq, unsigned long now);
+    int  findNearbyByMac(const uint8_t* mac);
+    void rebuildNearbyIndex();
+    bool reportNearby(MochiId id, const uint8_t* mac, int rssi); // true se il vicino e' nuovo
+    void startAnnounceInterval(unsigned long now);
+    void resetAnnounce(unsigned long now);
+    void tickAnnounce(unsigned long now);
     void pruneNearby(unsigned long now);
+    size_t buildGossip(NowGossipEntry* out, unsigned long now);
+    void mergeGossip(MochiId via, const uint8_t* data, size_t len, unsigned long now);
+    void pruneRemote(unsigned long now);
+    NowLinkStats* linkFor(const uint8_t* mac, MochiId id = MOCHI_ID_NONE); // nullptr per il broadcast
+    void noteRtt(NowLinkStats* link, unsigned long ms);
+    void noteReceived(const uint8_t* mac, MochiId id, int rssi, uint8_t type);
     void tickVisit(unsigned long now);
+    void handlePacket(const uint8_t* mac, int rssi, const uint8_t* data, int len);
 
 public:
-    MochiNow(MochiState* m);
+    MochiNow(MochiState* m, MochiTransport* t);
     bool begin();
-    void tick(unsigned long now);            // Annuncio + prune + logica visite
-    void onRecv(const esp_now_recv_info_t* info, const uint8_t* data, int len);
-    void onSend(int status);                 // Esito invio (dalla send callback)
+    void tick(unsigned long now);            // Pacchetti ricevuti + annuncio + prune + logica visite
+    // Dalla radio (task WiFi): solo in coda / flag
+    void onRadioRecv(const uint8_t* mac, int rssi, const uint8_t* data, size_t len) override;
+    void onRadioSent(bool ok) override;
 
     // Invia una richiesta/accettazione di amicizia a un Mochi vicino (per id).
-    bool   sendFriendRequest(const String& id);
-    bool   sendFriendAccept(const String& id);
+    bool   sendFriendRequest(MochiId id);
+    bool   sendFriendAccept(MochiId id);
     // Avvisa l'altro Mochi che lo abbiamo rimosso dagli amici (unfriend mutuo).
-    bool   sendUnfriend(const String& id);
+    bool   sendUnfriend(MochiId id);
 
     // DEBUG (temporaneo): forza subito una visita verso il Mochi vicino indicato,
     // bypassando cooldown e probabilità. Ritorna false se non è nei paraggi/occupato.
-    bool   forceVisit(const String& id);
+    bool   forceVisit(MochiId id);
     // Forza il rientro a casa anticipato (se in visita), avvisando l'host.
     bool   forceHome();
 
     int    nearbyCount() const { return nearbyLen; }
-    String getNearbyJson();
-    String getDebugReport();                 // Report diagnostico per la companion app
+    const NearbyMochi& nearbyAt(int i) const { return nearby[i]; }
+    uint32_t nearbyVersion() const { return nearbyVer; }
+    void writeNearbyJson(MochiWriter& w);
+    void writeNearbyTlv(MochiFrame& f);
+    int    remoteCount() const { return remoteLen; }
+    const RemoteMochi& remoteAt(int i) const { return remote[i]; }
+    void writePresenceTlv(MochiFrame& f);    // Mochi fuori portata (TAG_REMOTE)
+    void writeDebugTlv(MochiFrame& f);
+    void writeDebugReport(MochiWriter& w);   // Report diagnostico per la companion app
+    void writeLinkReport(MochiWriter& w);    // Statistiche dei collegamenti, testo
+    void writeLinkTlv(MochiFrame& f);        // Le stesse, compatte
+    void resetLinkStats();
+    const NowVisitStats& visitStats() const { return visits; }
+    // Ricezione: gestiti dal loop, scartati con la coda piena, invalidi
+    uint32_t rxHandled() const  { return recvCount; }
+    uint32_t rxDropped() const  { return rxQueue.dropped(); }
+    uint32_t rxRejected() const { return rxInvalid; }
+    uint32_t duplicates() const { return rxDuplicates; }
+    const NowTypeStats& typeStat(uint8_t type) const { return typeStats[type]; }
+    const NowLinkStats* linkStats(MochiId id) const;  // nullptr se non ci abbiamo parlato
     const String& getSelfId() const { return selfId; }
 };
 
@@ -0,0 +1,147 @@
+#include "MochiOta.h"
+#include "MochiMem.h"
+#include <mbedtls/sha256.h>
+#include <new>
+
+#include <esp_ota_ops.h>
+
+#ifdef ARDUINO
+#if __has_include("rom/miniz.h")
+  #include "rom/miniz.h"
+#else
+  #include "esp32s3/rom/miniz.h"
+#endif
+#else
+#include <miniz.h>
+#endif
+
+struct MochiOtaWork {
+  tinfl_decompressor     inflator;
+  uint8_t                dict[TINFL_LZ_DICT_SIZE];
+  mbedtls_sha256_context sha;
+};
+
+// ==========================================
+// DESTINAZIONE
+// ==========================================
+
+bool MochiOta::sinkOpen() {
+  const esp_partition_t* p = esp_ota_get_next_update_partition(nullptr);
+  if (!p || rawSize > p->size) return false;
+  // Scrittura sequenziale: cancella un settore alla volta invece di tutta la
+  // partizione in begin (secondi di loop bloccato).
+  esp_ota_handle_t h;
+  if (esp_ota_begin(p, OTA_WITH_SEQUENTIAL_WRITES, &h) != ESP_OK) return false;
+  part = p;
+  handle = h;
+  return true;
+}
+
+bool MochiOta::sinkWrite(const uint8_t* data, size_t len) {
+  return esp_ota_write(handle, data, len) == ESP_OK;
+}
+
+// esp_ota_end controlla anche che l'immagine sia un'app valida.
+bool MochiOta::sinkCommit() {
+  esp_err_t err = esp_ota_end(handle);
+  handle = 0;
+  if (err != ESP_OK) return false;
+  return esp_ota_set_boot_partition((const esp_partition_t*)part) == ESP_OK;
+}
+
+void MochiOta::sinkAbort() {
+  if (handle) esp_ota_abort(handle);
+  handle = 0;
+}
+
+// ==========================================
+// SESSIONE
+// ==========================================
+
+OtaStatus MochiOta::begin(uint32_t raw, uint32_t comp, const uint8_t digest[OTA_SHA_SIZE]) {
+  if (work && raw == rawSize && comp == compSize && memcmp(digest, sha, OTA_SHA_SIZE) == 0) {
+    Serial.printf("[OTA] Ripresa da %lu/%lu byte\n", (unsigned long)inOffset, (unsigned long)compSize);
+    return OTA_OK;
+  }
+  abort();
+
+  MochiMemScope mem(MEM_BLE);
+  work = new (std::nothrow) MochiOtaWork;
+  if (!work) return OTA_NO_MEMORY;
+  tinfl_init(&work->inflator);
+  mbedtls_sha256_init(&work->sha);
+  mbedtls_sha256_starts(&work->sha, 0);
+
+  rawSize  = raw;
+  compSize = comp;
+  memcpy(sha, digest, OTA_SHA_SIZE);
+  inOffset = 0;
+  outBytes = 0;
+  dictPos  = 0;
+  done     = false;
+  if (!sinkOpen()) return fail(OTA_TOO_BIG);
+  Serial.printf("[OTA] Inizio: %lu byte (%lu compressi)\n", (unsigned long)rawSize, (unsigned long)compSize);
+  return OTA_OK;
+}
+
+OtaStatus MochiOta::write(uint32_t offset, const uint8_t* data, size_t len) {
+  if (!work) return OTA_NO_SESSION;
+  if (offset != inOffset) return OTA_BAD_OFFSET;
+  if (len > compSize - inOffset) return fail(OTA_TOO_BIG);
+
+  // Il dizionario e' anche il buffer di uscita: tinfl scrive nella finestra
+  // circolare e ogni pezzo prodotto va subito in partizione e nell'hash.
+  const uint8_t* in = data;
+  size_t inLeft = len;
+  while (!done) {
+    size_t inBytes = inLeft;
+    size_t outLen = TINFL_LZ_DICT_SIZE - dictPos;
+    tinfl_status st = tinfl_decompress(&work->inflator, in, &inBytes, work->dict, work->dict + dictPos, &outLen,
+                                       TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+    in += inBytes;
+    inLeft -= inBytes;
+    if (outLen) {
+      if (outBytes + outLen > rawSize) return fail(OTA_TOO_BIG);
+      if (!sinkWrite(work->dict + dictPos, outLen)) return fail(OTA_FLASH_ERROR);
+      mbedtls_sha256_update(&work->sha, work->dict + dictPos, outLen);
+      outBytes += outLen;
+      dictPos = (dictPos + outLen) & (TINFL_LZ_DICT_SIZE - 1);
+    }
+    if (st < 0) return fail(OTA_INFLATE_ERROR);
+    if (st == TINFL_STATUS_DONE) done = true;
+    else if (st == TINFL_STATUS_NEEDS_MORE_INPUT && inLeft == 0) break;
+  }
+  inOffset += len;
+  return OTA_OK;
+}
+
+OtaStatus MochiOta::finish() {
+  if (!work) return OTA_NO_SESSION;
+  if (!done || outBytes != rawSize || inOffset != compSize) return OTA_INCOMPLETE;
+
+  uint8_t digest[OTA_SHA_SIZE];
+  mbedtls_sha256_finish(&work->sha, digest);
+  if (memcmp(digest, sha, OTA_SHA_SIZE) != 0) return fail(OTA_HASH_MISMATCH);
+  if (!sinkCommit()) return fail(OTA_FLASH_ERROR);
+
+  mbedtls_sha256_free(&work->sha);
+  delete work;
+  work = nullptr;
+  Serial.printf("[OTA] Immagine verificata (%lu byte): nuova partizione di boot\n", (unsigned long)outBytes);
+  return OTA_OK;
+}
+
+void MochiOta::abort() {
+  if (!work) return;
+  sinkAbort();
+  mbedtls_sha256_free(&work->sha);
+  delete work;
+  work = nullptr;
+  Serial.println("[OTA] Sessione chiusa.");
+}
+
+OtaStatus MochiOta::fail(OtaStatus st) {
+  Serial.printf("[OTA] Errore %u a %lu byte\n", st, (unsigned long)inOffset);
+  abort();
+  return st;
+}
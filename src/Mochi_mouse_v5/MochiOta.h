@@ -0,0 +1,78 @@
+#ifndef MOCHI_OTA_H
+#define MOCHI_OTA_H
+
+#include <Arduino.h>
+
+// ================================================================
+// AGGIORNAMENTO FIRMWARE VIA BLE (OTA)
+// ----------------------------------------------------------------
+// L'immagine dell'app arriva compressa (zlib, vedi tools/pack_ota.py) a pezzi
+// in ordine di offset. Ogni pezzo viene decompresso al volo (tinfl della ROM,
+// dizionario circolare da 32 KB) e scritto nella partizione OTA inattiva; lo
+// SHA-256 dell'immagine decompressa si calcola strada facendo e deve
+// coincidere con quello annunciato in begin() prima di cambiare partizione
+// di boot.
+//
+// La sessione sopravvive a una disconnessione: la app rimanda begin() con lo
+// stesso hash e riprende da received() (offset nei byte compressi). Un riavvio
+// invece la perde: lo stato del decompressore e' solo in RAM.
+//
+// Build host (senza ARDUINO): stessa strada, con esp_ota_ops e partizioni
+// finte in memoria (test/shim).
+// ================================================================
+
+enum OtaStatus : uint8_t {
+  OTA_OK            = 0,
+  OTA_BAD_OFFSET    = 1, // Pezzo fuori sequenza: riprendere da received()
+  OTA_NO_SESSION    = 2,
+  OTA_FLASH_ERROR   = 3,
+  OTA_INFLATE_ERROR = 4,
+  OTA_HASH_MISMATCH = 5,
+  OTA_TOO_BIG       = 6, // Immagine piu' grande della partizione o dei byte annunciati
+  OTA_INCOMPLETE    = 7, // finish() prima della fine dei dati
+  OTA_NO_MEMORY     = 8,
+  OTA_BAD_REQUEST   = 9, // Messaggio corto o operazione sconosciuta
+};
+
+#define OTA_SHA_SIZE 32
+
+struct MochiOtaWork; // Decompressore, dizionario e hash: in heap solo durante la sessione
+
+class MochiOta {
+public:
+  ~MochiOta() { abort(); }
+
+  // Nuova sessione, o ripresa se dimensioni e hash sono quelli della sessione aperta.
+  OtaStatus begin(uint32_t rawSize, uint32_t compSize, const uint8_t sha[OTA_SHA_SIZE]);
+  OtaStatus write(uint32_t offset, const uint8_t* data, size_t len);
+  OtaStatus finish(); // Verifica lunghezza e hash, poi imposta la partizione di boot
+  void      abort();
+
+  bool     active() const         { return work != nullptr; }
+  uint32_t received() const       { return inOffset; } // Byte compressi consumati
+  uint32_t written() const        { return outBytes; } // Byte scritti in partizione
+  uint32_t compressedSize() const { return compSize; }
+  uint32_t imageSize() const      { return rawSize; }
+
+private:
+  MochiOtaWork* work = nullptr;
+  uint32_t rawSize = 0;
+  uint32_t compSize = 0;
+  uint8_t  sha[OTA_SHA_SIZE];
+  uint32_t inOffset = 0;
+  uint32_t outBytes = 0;
+  uint32_t dictPos = 0;
+  bool     done = false; // Fine dello stream zlib raggiunta
+
+  // Destinazione: la partizione OTA inattiva
+  const void* part = nullptr;
+  uint32_t    handle = 0;
+
+  bool sinkOpen();
+  bool sinkWrite(const uint8_t* data, size_t len);
+  bool sinkCommit();
+  void sinkAbort();
+  OtaStatus fail(OtaStatus st);
+};
+
+#endif // MOCHI_OTA_H
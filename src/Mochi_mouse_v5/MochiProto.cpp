@@ -0,0 +1,82 @@
+#include "MochiProto.h"
+
+MochiFrame::MochiFrame(MochiWriter& writer, uint8_t type, uint8_t reqId) : w(writer) {
+  start = w.length();
+  uint8_t hdr[PROTO_HEADER_SIZE] = { PROTO_MAGIC, type, reqId, 0, 0 };
+  w.raw((const char*)hdr, sizeof(hdr));
+}
+
+void MochiFrame::u16(uint8_t tag, uint16_t v) {
+  uint8_t b[2] = { (uint8_t)v, (uint8_t)(v >> 8) };
+  bytes(tag, b, 2);
+}
+
+void MochiFrame::u32(uint8_t tag, uint32_t v) {
+  uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+  bytes(tag, b, 4);
+}
+
+void MochiFrame::id(uint8_t tag, MochiId v) {
+  uint8_t b[3] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16) };
+  bytes(tag, b, 3);
+}
+
+void MochiFrame::str(uint8_t tag, const char* s) {
+  size_t n = strlen(s);
+  bytes(tag, s, n > 255 ? 255 : n);
+}
+
+// Un TLV troncato a meta' confonderebbe il lettore: se non ci sta intero
+// non viene scritto (e il writer segna l'overflow).
+void MochiFrame::bytes(uint8_t tag, const void* p, size_t n) {
+  if (n > 255) n = 255;
+  if (n + 2 > w.room()) {
+    w.markOverflow();
+    return;
+  }
+  uint8_t h[2] = { tag, (uint8_t)n };
+  w.raw((const char*)h, 2);
+  w.raw((const char*)p, n);
+}
+
+void MochiFrame::end() {
+  size_t body = w.length() - start - PROTO_HEADER_SIZE;
+  uint8_t len[2] = { (uint8_t)body, (uint8_t)(body >> 8) };
+  w.patch(start + 3, len, 2);
+}
+
+bool MochiTlvReader::next(uint8_t* tag, const uint8_t** val, uint8_t* len) {
+  if (n < 2 || (size_t)p[1] + 2 > n) return false;
+  *tag = p[0];
+  *len = p[1];
+  *val = p + 2;
+  p += 2 + *len;
+  n -= 2 + *len;
+  return true;
+}
+
+bool mochiProtoParse(const uint8_t* data, size_t len, uint8_t* type, uint8_t* reqId, MochiTlvReader* body) {
+  if (len < PROTO_HEADER_SIZE || data[0] != PROTO_MAGIC) return false;
+  size_t bodyLen = data[3] | (data[4] << 8);
+  if (PROTO_HEADER_SIZE + bodyLen > len) return false;
+  *type  = data[1];
+  *reqId = data[2];
+  body->p = data + PROTO_HEADER_SIZE;
+  body->n = bodyLen;
+  return true;
+}
+
+uint32_t mochiTlvU32(const uint8_t* v, uint8_t len) {
+  uint32_t r = 0;
+  for (uint8_t i = 0; i < len && i < 4; i++) r |= (uint32_t)v[i] << (8 * i);
+  return r;
+}
+
+uint16_t mochiTlvU16(const uint8_t* v, uint8_t len) {
+  uint32_t r = mochiTlvU32(v, len);
+  return r > 0xFFFF ? 0xFFFF : (uint16_t)r;
+}
+
+void mochiTlvPutLe(uint8_t* out, uint32_t v, uint8_t len) {
+  for (uint8_t i = 0; i < len && i < 4; i++) out[i] = (uint8_t)(v >> (8 * i));
+}
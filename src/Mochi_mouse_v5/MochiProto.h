@@ -0,0 +1,206 @@
+#ifndef MOCHI_PROTO_H
+#define MOCHI_PROTO_H
+
+#include <Arduino.h>
+#include "MochiId.h"
+#include "MochiWriter.h"
+
+// ================================================================
+// PROTOCOLLO BINARIO BLE (v1)
+// ----------------------------------------------------------------
+// Convive con i verbi testuali sulla stessa caratteristica: un frame binario
+// inizia con PROTO_MAGIC, che non e' ASCII e quindi non e' mai un verbo.
+//
+//   [0xB1][tipo][reqId][len lo][len hi][TLV ... (len byte)]
+//   TLV = [tag][lunghezza][valore], interi little endian, id su 3 byte.
+//
+// La risposta ha tipo = richiesta | PROTO_REPLY e lo stesso reqId, cosi' la
+// app sa sempre a cosa risponde (anche per le liste vuote). I messaggi
+// spontanei del Mochi (eventi) hanno anche loro PROTO_REPLY ma reqId 0, mai
+// usato dalla app. I tag sconosciuti si saltano: campi nuovi non rompono le app
+// vecchie. La app manda per primo HELLO con le sue capacita' e il Mochi
+// risponde con versione e capacita'.
+// Con CAP_BATCH una write puo' contenere piu' frame di fila: le risposte
+// arrivano concatenate, ognuna col suo tipo e reqId.
+// ================================================================
+
+#define PROTO_MAGIC        0xB1 // 0xB0 | versione
+#define PROTO_VERSION      1
+#define PROTO_HEADER_SIZE  5
+#define PROTO_REPLY        0x80
+
+// Frammenti: una risposta piu' lunga di una notify (MTU - 3) viene spezzata,
+// solo per le app che dichiarano CAP_FRAGMENT. Ogni frammento e'
+//   [0xBF][msgId][seq][totale lo][totale hi][dati...]
+// con seq da 0 e lo stesso msgId; la app riunisce i dati in ordine e tratta il
+// risultato come una notify normale (testo, JSON o frame). Le notify non hanno
+// conferma: se manca un frammento la app manda PT_RESEND con msgId e il primo
+// byte mancante e i frammenti ripartono da li' (CAP_RESEND), finche' il Mochi
+// non ha sostituito la risposta con un'altra (allora PE_GONE).
+#define FRAG_MAGIC         0xBF
+#define FRAG_HEADER_SIZE   5
+
+enum ProtoType : uint8_t {
+  PT_HELLO        = 0x01,
+  PT_GET_STATE    = 0x02,
+  PT_GET_SETTINGS = 0x03,
+  PT_GET_NEARBY   = 0x04,
+  PT_GET_FRIENDS  = 0x05,
+  PT_GET_REQUESTS = 0x06,
+  PT_GET_DEBUG    = 0x07,
+  PT_SUB_STATE    = 0x08, // Iscrizione allo stato (TAG_INTERVAL, 0 = disiscrivi)
+  PT_STATE_EVENT  = 0x09, // Spontaneo: solo i campi cambiati (TAG_KEYFRAME = tutti)
+  PT_SUB_SOCIAL   = 0x0A, // Iscrizione alle liste (TAG_INTERVAL, versioni note alla app)
+  PT_SOCIAL_EVENT = 0x0B, // Spontaneo: voci aggiunte/cambiate/sparite delle liste cambiate
+  PT_GET_PRESENCE = 0x0C, // Mochi fuori portata saputi dal gossip (TAG_REMOTE)
+  PT_GET_LINK     = 0x0D, // Statistiche dei collegamenti ESP-NOW (TAG_LINK_*)
+  PT_RESET_LINK   = 0x0E, // Azzera le statistiche dei collegamenti
+  PT_RESEND       = 0x0F, // Rimanda i frammenti (TAG_FRAG_MSG, TAG_FRAG_OFFSET): risposta = i frammenti
+  PT_ERROR        = 0x7F,
+};
+
+enum ProtoTag : uint8_t {
+  // HELLO
+  TAG_VERSION     = 0x01, // u8
+  TAG_CAPS        = 0x02, // u32, bit CAP_*
+  TAG_MTU         = 0x03, // u16
+  TAG_FIRMWARE    = 0x04, // stringa
+  TAG_SELF_ID     = 0x05, // id
+  TAG_INTERVAL    = 0x06, // u16 ms
+  // Frammenti
+  TAG_FRAG_MSG    = 0x07, // u8 msgId
+  TAG_FRAG_OFFSET = 0x08, // u16 primo byte mancante
+  // Stato
+  TAG_HUNGER      = 0x10, // u8 (tutti)
+  TAG_HAPPY       = 0x11,
+  TAG_STR         = 0x12,
+  TAG_SPD         = 0x13,
+  TAG_INT         = 0x14,
+  TAG_CHR         = 0x15,
+  TAG_AGE         = 0x16,
+  TAG_KEYFRAME    = 0x17, // u8, presente se l'evento porta tutti i campi
+  // Impostazioni
+  TAG_BRIGHTNESS  = 0x20, // u8
+  TAG_BG_TOP      = 0x21, // u16 RGB565
+  TAG_BG_BOTTOM   = 0x22, // u16 RGB565
+  TAG_TIMEZONE    = 0x23, // stringa
+  TAG_SCHEDULE    = 0x24, // voci da 3 byte: u16 minuto della settimana, u8 stadio
+  TAG_EXTRA       = 0x25, // JSON delle chiavi sconosciute
+  // Social (una voce per elemento)
+  TAG_PEER        = 0x30, // id, i8 rssi, u8 flag (bit 0 = amico)
+  TAG_FRIEND      = 0x31, // id
+  TAG_REQUEST     = 0x32, // id
+  TAG_NEARBY_VER  = 0x33, // u32 versione della lista (ordine come SocialList)
+  TAG_FRIENDS_VER = 0x34,
+  TAG_REQUESTS_VER = 0x35,
+  TAG_PEER_GONE   = 0x36, // id
+  TAG_FRIEND_GONE = 0x37, // id
+  TAG_REQUEST_GONE = 0x38, // id
+  TAG_LIST_RESET  = 0x39, // u8, bit SocialList: lista mandata per intero (svuotare prima)
+  TAG_REMOTE      = 0x3A, // id, u8 salti, u16 secondi dall'ultimo avvistamento, u8 flag (bit 0 = amico)
+  // Diagnostica
+  TAG_ANNOUNCES   = 0x40, // u32
+  TAG_RECEIVED    = 0x41, // u32
+  TAG_LAST_SEND   = 0x42, // i8 (-1 mai, 0 ok, 1 fallito)
+  TAG_LAST_FROM   = 0x43, // id
+  TAG_CHANNEL     = 0x44, // u8
+  TAG_FREE_HEAP   = 0x45, // u32
+  TAG_AWAY        = 0x46, // u8
+  TAG_HOSTING     = 0x47, // u8
+  TAG_LINK_TYPE   = 0x48, // u8 tipo, u32 inviati/confermati/falliti/ritrasmessi/ricevuti/doppioni
+  TAG_LINK_RTT    = 0x49, // u16 ms min/media/max, u16 campioni, u16 istogramma (LINK_RTT_BUCKETS)
+  TAG_VISIT_RTT   = 0x4A, // u16 ms min/media/max, u16 campioni (visita -> ack)
+  TAG_LINK_PEER   = 0x4B, // id, u16 x 6 come TAG_LINK_TYPE, i8 rssi min/media/max,
+                          // u16 ms conferma media, u16 istogramma intervalli annunci (LINK_GAP_BUCKETS)
+  // Errore
+  TAG_ERROR_CODE  = 0x7F, // u8 PE_*
+};
+
+#define STATE_FIELD_COUNT (TAG_AGE - TAG_HUNGER + 1) // Tag di stato contigui
+
+enum ProtoCap : uint32_t {
+  CAP_BINARY  = 1UL << 0,
+  CAP_HISTORY = 1UL << 1,
+  CAP_MEM     = 1UL << 2,
+  CAP_STATE_SUB = 1UL << 3,
+  CAP_FRAGMENT  = 1UL << 4,
+  CAP_BATCH     = 1UL << 5, // Piu' frame in una write, risposte in un'unica notify
+  CAP_SOCIAL_SUB = 1UL << 6,
+  CAP_OTA        = 1UL << 7, // Caratteristica di aggiornamento firmware (OTA_OP_*)
+  CAP_PRESENCE   = 1UL << 8, // PT_GET_PRESENCE
+  CAP_LINK_STATS = 1UL << 9, // PT_GET_LINK / PT_RESET_LINK
+  CAP_RESEND     = 1UL << 10, // PT_RESEND per i frammenti persi
+};
+
+#define PROTO_DEVICE_CAPS (CAP_BINARY | CAP_HISTORY | CAP_MEM | CAP_STATE_SUB | CAP_FRAGMENT | \
+                           CAP_BATCH | CAP_SOCIAL_SUB | CAP_OTA | CAP_PRESENCE | \
+                           CAP_LINK_STATS | CAP_RESEND)
+
+// Liste social seguite dall'iscrizione (indice = tag versione - TAG_NEARBY_VER).
+enum SocialList : uint8_t {
+  SL_NEARBY   = 0,
+  SL_FRIENDS  = 1,
+  SL_REQUESTS = 2,
+  SL_COUNT
+};
+
+enum ProtoError : uint8_t {
+  PE_BAD_FRAME    = 1,
+  PE_UNKNOWN_TYPE = 2,
+  PE_BUSY         = 3, // Coda comandi piena: riprovare
+  PE_GONE         = 4, // PT_RESEND di una risposta gia' sostituita: richiederla da capo
+};
+
+// Aggiornamento firmware: caratteristica a parte, messaggi senza TLV perche'
+// i pezzi di immagine devono stare interi in una write.
+//   app -> Mochi: [op][...]    BEGIN: rawSize u32, compSize u32, sha256[32]
+//                              DATA:  offset u32, byte compressi
+//                              END, ABORT: nient'altro
+//   Mochi -> app: [op | 0x80][OtaStatus][offset u32] (byte compressi ricevuti)
+// La risposta a BEGIN dice da dove (ri)partire; i DATA sono confermati ogni
+// OTA_ACK_BYTES (o OTA_ACK_CHUNKS pezzi) e BAD_OFFSET indica alla app dove tornare.
+enum OtaOp : uint8_t {
+  OTA_OP_BEGIN = 0x01,
+  OTA_OP_DATA  = 0x02,
+  OTA_OP_END   = 0x03,
+  OTA_OP_ABORT = 0x04,
+};
+
+#define OTA_BEGIN_SIZE  41 // op + 4 + 4 + 32
+#define OTA_DATA_HEADER 5  // op + offset
+#define OTA_REPLY_SIZE  6
+
+// Costruisce un frame nel writer: intestazione subito, lunghezza in end().
+class MochiFrame {
+public:
+  MochiFrame(MochiWriter& w, uint8_t type, uint8_t reqId);
+
+  void u8(uint8_t tag, uint8_t v)   { bytes(tag, &v, 1); }
+  void u16(uint8_t tag, uint16_t v);
+  void u32(uint8_t tag, uint32_t v);
+  void id(uint8_t tag, MochiId v);
+  void str(uint8_t tag, const char* s);
+  void bytes(uint8_t tag, const void* p, size_t n);
+  void end();
+  size_t room() const { return w.room(); }
+
+private:
+  MochiWriter& w;
+  size_t       start;
+};
+
+// Scorre i TLV di un frame ricevuto.
+struct MochiTlvReader {
+  const uint8_t* p;
+  size_t         n;
+
+  bool next(uint8_t* tag, const uint8_t** val, uint8_t* len);
+};
+
+// Riconosce un frame: false se incompleto o con magic sbagliato.
+bool mochiProtoParse(const uint8_t* data, size_t len, uint8_t* type, uint8_t* reqId, MochiTlvReader* body);
+uint32_t mochiTlvU32(const uint8_t* v, uint8_t len); // little endian, 1..4 byte
+uint16_t mochiTlvU16(const uint8_t* v, uint8_t len); // come sopra, saturato a 0xFFFF
+void     mochiTlvPutLe(uint8_t* out, uint32_t v, uint8_t len); // per i TLV composti
+
+#endif // MOCHI_PROTO_H
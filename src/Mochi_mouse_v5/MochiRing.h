@@ -0,0 +1,71 @@
+#ifndef MOCHI_RING_H
+#define MOCHI_RING_H
+
+#include <Arduino.h>
+#include <atomic>
+
+// ================================================================
+// CODA CIRCOLARE SPSC (un produttore, un consumatore)
+// ----------------------------------------------------------------
+// Senza lock: il produttore (una callback di un altro task) scrive solo head,
+// il consumatore (il loop) scrive solo tail. Gli slot si riempiono sul posto
+// (beginPush/endPush) per non copiare due volte elementi grandi. Se la coda e'
+// piena il push fallisce e conta uno scarto: chi produce decide come avvisare.
+// ================================================================
+
+template <typename T, uint8_t N>
+class MochiRing {
+public:
+  static_assert(N >= 2 && N <= 128 && (N & (N - 1)) == 0, "MochiRing: N potenza di due fino a 128");
+
+  // Produttore: slot libero da riempire, nullptr se piena.
+  T* beginPush() {
+    uint8_t h = head.load(std::memory_order_relaxed);
+    if ((uint8_t)(h - tail.load(std::memory_order_acquire)) >= N) {
+      drops.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    return &slots[h & (N - 1)];
+  }
+
+  // Produttore: pubblica lo slot ottenuto da beginPush.
+  void endPush() {
+    uint8_t h = head.load(std::memory_order_relaxed) + 1;
+    head.store(h, std::memory_order_release);
+    uint8_t used = h - tail.load(std::memory_order_relaxed);
+    if (used > peak.load(std::memory_order_relaxed)) peak.store(used, std::memory_order_relaxed);
+  }
+
+  bool push(const T& v) {
+    T* s = beginPush();
+    if (!s) return false;
+    *s = v;
+    endPush();
+    return true;
+  }
+
+  // Consumatore: elemento in testa (resta in coda fino a pop), nullptr se vuota.
+  T* front() {
+    uint8_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return nullptr;
+    return &slots[t & (N - 1)];
+  }
+
+  void pop() {
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  uint8_t  size() const     { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+  uint8_t  capacity() const { return N; }
+  uint8_t  highWater() const { return peak.load(std::memory_order_relaxed); }
+  uint32_t dropped() const  { return drops.load(std::memory_order_relaxed); }
+
+private:
+  T slots[N];
+  std::atomic<uint8_t>  head{0};
+  std::atomic<uint8_t>  tail{0};
+  std::atomic<uint8_t>  peak{0};
+  std::atomic<uint32_t> drops{0};
+};
+
+#endif // MOCHI_RING_H
@@ -0,0 +1,105 @@
+#include "MochiSchedule.h"
+#include "MochiState.h"
+
+// Il 1/1/1970 era un Giovedi' (tm_wday = 4): da qui si ricava il giorno della
+// settimana senza passare da gmtime.
+static uint16_t minuteOfWeek(time_t t) {
+  long days = (long)(t / 86400);
+  long secs = (long)(t % 86400);
+  return (uint16_t)(((days + 4) % 7) * 1440 + secs / 60);
+}
+
+// Istante (in secondi) della Domenica 00:00 della settimana che contiene t.
+static time_t weekStart(time_t t) {
+  long days = (long)(t / 86400);
+  return t - (time_t)(((days + 4) % 7) * 86400L + (long)(t % 86400));
+}
+
+MochiSchedule::MochiSchedule() {
+  setDefault();
+}
+
+// Stesso calendario del vecchio getExpectedStage(): weekend da uovo, schiusa
+// Lunedi' alle 10, adulto Martedi' alle 18, anziano Giovedi' alle 18, morte
+// Venerdi' alle 18.
+void MochiSchedule::setDefault() {
+  entries[0] = { 1 * 1440 + 10 * 60, BABY  };
+  entries[1] = { 2 * 1440 + 18 * 60, ADULT };
+  entries[2] = { 4 * 1440 + 18 * 60, ELDER };
+  entries[3] = { 5 * 1440 + 18 * 60, EGG   };
+  count = 4;
+}
+
+bool MochiSchedule::isValid() const {
+  if (count == 0 || count > SCHEDULE_MAX_ENTRIES) return false;
+  for (int i = 0; i < count; i++) {
+    if (entries[i].startMin >= MINUTES_PER_WEEK) return false;
+    if (entries[i].stage > ELDER) return false;
+    if (i > 0 && entries[i].startMin <= entries[i - 1].startMin) return false;
+    if (count > 1 && entries[i].stage == entries[(i + count - 1) % count].stage) return false;
+  }
+  return true;
+}
+
+bool MochiSchedule::fromJson(JsonVariantConst v) {
+  JsonArrayConst arr = v.as<JsonArrayConst>();
+  if (arr.isNull() || arr.size() == 0 || arr.size() > SCHEDULE_MAX_ENTRIES) return false;
+
+  MochiSchedule next;
+  next.count = 0;
+  for (JsonVariantConst item : arr) {
+    if (!item[0].is<int>() || !item[1].is<int>()) return false;
+    int m = item[0].as<int>();
+    int s = item[1].as<int>();
+    if (m < 0 || m >= MINUTES_PER_WEEK || s < EGG || s > ELDER) return false;
+    next.entries[next.count++] = { (uint16_t)m, (uint8_t)s };
+  }
+  if (!next.isValid()) return false;
+  *this = next;
+  return true;
+}
+
+void MochiSchedule::write(MochiWriter& w) const {
+  w.beginArray();
+  for (int i = 0; i < count; i++) {
+    w.beginArray().num(entries[i].startMin).num(entries[i].stage).endArray();
+  }
+  w.endArray();
+}
+
+// Ultima voce iniziata entro `m`; prima della prima voce vale ancora l'ultima
+// della settimana precedente.
+int MochiSchedule::indexAt(uint16_t m) const {
+  int idx = count - 1;
+  for (int i = 0; i < count; i++) {
+    if (entries[i].startMin <= m) idx = i;
+    else break;
+  }
+  return idx;
+}
+
+uint8_t MochiSchedule::stageAt(time_t t) const {
+  return entries[indexAt(minuteOfWeek(t))].stage;
+}
+
+time_t MochiSchedule::nextTransition(time_t t) const {
+  // Con una sola voce lo stadio non cambia mai: ricontrolliamo tra una settimana.
+  if (count <= 1) return t + SECONDS_PER_WEEK;
+
+  uint16_t m = minuteOfWeek(t);
+  time_t base = weekStart(t);
+  // Prima della prima voce siamo ancora nell'ultima della settimana scorsa:
+  // il prossimo confine e' la voce 0 di questa settimana.
+  if (entries[0].startMin > m) return base + (time_t)entries[0].startMin * 60;
+  int next = indexAt(m) + 1;
+  if (next < count) return base + (time_t)entries[next].startMin * 60;
+  return base + SECONDS_PER_WEEK + (time_t)entries[0].startMin * 60;
+}
+
+bool MochiSchedule::operator==(const MochiSchedule& o) const {
+  if (count != o.count) return false;
+  for (int i = 0; i < count; i++) {
+    if (entries[i].startMin != o.entries[i].startMin || entries[i].stage != o.entries[i].stage) return false;
+  }
+  return true;
+}
@@ -0,0 +1,59 @@
+#ifndef MOCHI_SCHEDULE_H
+#define MOCHI_SCHEDULE_H
+
+#include <Arduino.h>
+#include <time.h>
+#include <ArduinoJson.h>
+#include "Settings.h"
+#include "MochiWriter.h"
+
+#define MINUTES_PER_WEEK 10080
+#define SECONDS_PER_WEEK 604800L
+
+// ================================================================
+// CALENDARIO SETTIMANALE DEL CICLO VITALE
+// ----------------------------------------------------------------
+// Tabella compatta di intervalli: ogni voce dice "da questo minuto della
+// settimana in poi lo stadio atteso e' X", fino alla voce successiva (l'ultima
+// fa il giro e vale fino alla prima della settimana dopo). Il minuto 0 e'
+// Domenica 00:00, come tm_wday.
+//
+// Via set_json arriva come "schedule":[[minuto,stadio],...], es. il default:
+//   [[2040,1],[3960,2],[6840,3],[8280,0]]  (Lun 10:00 BABY, Mar 18:00 ADULT,
+//                                           Gio 18:00 ELDER, Ven 18:00 EGG)
+// ================================================================
+
+struct ScheduleEntry {
+  uint16_t startMin; // minuto della settimana da cui vale la voce (0..10079)
+  uint8_t  stage;    // AgeStage atteso (EGG..ELDER)
+};
+
+class MochiSchedule {
+public:
+  ScheduleEntry entries[SCHEDULE_MAX_ENTRIES];
+  uint8_t       count = 0;
+
+  MochiSchedule();
+  void setDefault();
+
+  // Regole: 1..SCHEDULE_MAX_ENTRIES voci, minuti in ordine strettamente
+  // crescente, stadi validi e voci consecutive (anche a cavallo della
+  // settimana) con stadi diversi, cosi' ogni confine e' una vera transizione.
+  bool isValid() const;
+
+  // Carica da JSON solo se la tabella ricevuta e' valida; altrimenti resta com'era.
+  bool fromJson(JsonVariantConst v);
+  void write(MochiWriter& w) const; // [[minuto,stadio],...]
+
+  // Stadio atteso all'istante t e primo istante > t in cui cambia.
+  uint8_t stageAt(time_t t) const;
+  time_t  nextTransition(time_t t) const;
+
+  bool operator==(const MochiSchedule& o) const;
+  bool operator!=(const MochiSchedule& o) const { return !(*this == o); }
+
+private:
+  int indexAt(uint16_t minuteOfWeek) const;
+};
+
+#endif // MOCHI_SCHEDULE_H
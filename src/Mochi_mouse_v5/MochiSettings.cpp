@@ -0,0 +1,91 @@
+#include "MochiSettings.h"
+
+uint16_t hexToRGB565(const char* hexStr) {
+    if (!hexStr) return 0xFFFF; // Sicurezza extra se è nullo
+    if (hexStr[0] == '#') hexStr++;
+    long rgb = strtol(hexStr, NULL, 16);
+    uint8_t r = (rgb >> 16) & 0xFF;
+    uint8_t g = (rgb >> 8) & 0xFF;
+    uint8_t b = rgb & 0xFF;
+    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+}
+
+uint8_t MochiSettings::patch(JsonObjectConst in) {
+  uint8_t changed = 0;
+  for (JsonPairConst kv : in) {
+    const char* key = kv.key().c_str();
+    JsonVariantConst v = kv.value();
+
+    if (strcmp(key, "brightness") == 0) {
+      if (!v.is<int>()) continue;
+      uint8_t b = constrain(v.as<int>(), 0, 255);
+      if (b != brightness) { brightness = b; changed |= SETTINGS_CHANGED_BRIGHTNESS; }
+    } else if (strcmp(key, "bgTop") == 0 || strcmp(key, "bgBottom") == 0) {
+      if (!v.is<const char*>()) continue;
+      uint16_t c = hexToRGB565(v.as<const char*>());
+      uint16_t& field = (key[2] == 'T') ? bgTop : bgBottom;
+      if (c != field) { field = c; changed |= SETTINGS_CHANGED_COLORS; }
+    } else if (strcmp(key, "timezone") == 0) {
+      const char* tz = v.as<const char*>();
+      if (!tz || strlen(tz) >= sizeof(timezone)) {
+        Serial.println("Fuso orario non valido, ignorato.");
+        continue;
+      }
+      if (strcmp(tz, timezone) != 0) {
+        strcpy(timezone, tz);
+        changed |= SETTINGS_CHANGED_TIMEZONE;
+      }
+    } else if (strcmp(key, "schedule") == 0) {
+      continue; // gestito da MochiState
+    } else if (mergeSpill(key, v)) {
+      changed |= SETTINGS_CHANGED_SPILL;
+    }
+  }
+  return changed;
+}
+
+// Aggiorna una chiave sconosciuta nell'area spill. Se il risultato non ci sta
+// la chiave viene scartata e lo spill resta com'era.
+bool MochiSettings::mergeSpill(const char* key, JsonVariantConst value) {
+  StaticJsonDocument<SETTINGS_SPILL_SIZE * 3> doc; // Nodi + copia delle stringhe
+  // Da const char*: con un char[] modificabile ArduinoJson lavora in zero-copy
+  // e scrive i terminatori dentro lo spill, che poi non sarebbe piu' valido.
+  if (spill[0] == '\0' || deserializeJson(doc, (const char*)spill)) doc.to<JsonObject>();
+  doc[key] = value;
+
+  char next[SETTINGS_SPILL_SIZE];
+  if (doc.overflowed() || measureJson(doc) >= sizeof(next)) {
+    Serial.printf("Impostazione '%s' scartata: spazio esaurito.\n", key);
+    return false;
+  }
+  serializeJson(doc, next, sizeof(next));
+  if (strcmp(next, spill) == 0) return false;
+  strcpy(spill, next);
+  return true;
+}
+
+void MochiSettings::writeFields(MochiWriter& w) const {
+  w.key("bgTop").hexColor(bgTop);
+  w.key("bgBottom").hexColor(bgBottom);
+  w.field("brightness", (int)brightness);
+  if (timezone[0]) w.field("timezone", timezone);
+  // Lo spill e' un oggetto "{...}": se ne copiano solo i membri.
+  size_t n = strlen(spill);
+  if (n > 2) w.members(spill + 1, n - 2);
+}
+
+bool MochiSettings::load(Preferences& prefs) {
+  MochiSettings stored;
+  if (prefs.getBytesLength("cfg") != sizeof(stored)) return false;
+  prefs.getBytes("cfg", &stored, sizeof(stored));
+  if (stored.version != SETTINGS_VERSION) return false;
+  // Stringhe sempre terminate, anche se il blob e' corrotto.
+  stored.timezone[sizeof(stored.timezone) - 1] = '\0';
+  stored.spill[sizeof(stored.spill) - 1] = '\0';
+  *this = stored;
+  return true;
+}
+
+void MochiSettings::save(Preferences& prefs) const {
+  prefs.putBytes("cfg", this, sizeof(*this));
+}
@@ -0,0 +1,52 @@
+#ifndef MOCHI_SETTINGS_H
+#define MOCHI_SETTINGS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include "Settings.h"
+#include "MochiWriter.h"
+
+// ================================================================
+// IMPOSTAZIONI TIPIZZATE
+// ----------------------------------------------------------------
+// I campi noti (luminosita', colori, fuso orario) vivono in una struct e
+// vengono salvati in binario (chiave NVS "cfg"). Le chiavi sconosciute
+// mandate dalla app finiscono in un'area "spill" di dimensione fissa, come
+// oggetto JSON, cosi' tornano indietro con get_json senza limitare i campi noti.
+// set_json e' una patch: tocca solo i campi presenti e dice quali sono cambiati.
+// Il calendario ("schedule") e' gestito a parte da MochiState.
+// ================================================================
+
+uint16_t hexToRGB565(const char* hexStr);
+
+// Bit restituiti da patch()
+#define SETTINGS_CHANGED_BRIGHTNESS 0x01
+#define SETTINGS_CHANGED_COLORS     0x02
+#define SETTINGS_CHANGED_TIMEZONE   0x04
+#define SETTINGS_CHANGED_SPILL      0x08
+
+#define SETTINGS_VERSION 1
+
+struct MochiSettings {
+  uint8_t  version    = SETTINGS_VERSION;
+  uint8_t  brightness = 255;
+  uint16_t bgTop      = K_BG_TOP;
+  uint16_t bgBottom   = K_BG_BOTTOM;
+  char     timezone[SETTINGS_TZ_SIZE] = "";
+  char     spill[SETTINGS_SPILL_SIZE] = ""; // Oggetto JSON delle chiavi sconosciute ("" = nessuna)
+
+  // Applica i campi presenti in `in`; restituisce i bit SETTINGS_CHANGED_*.
+  uint8_t patch(JsonObjectConst in);
+
+  // Scrive i membri (senza graffe) dentro un oggetto gia' aperto nel writer.
+  void writeFields(MochiWriter& w) const;
+
+  bool load(Preferences& prefs);  // false se la chiave "cfg" manca o non e' valida
+  void save(Preferences& prefs) const;
+
+private:
+  bool mergeSpill(const char* key, JsonVariantConst value);
+};
+
+#endif // MOCHI_SETTINGS_H
@@ -1,35 +1,19 @@
 #include "MochiState.h"
 #include "Board.h"
+#include "MochiMem.h"
+#include "MochiWire.h"
 
 MochiState::MochiState() {
 }
 
 void MochiState::begin() {
-  lastActionTime = millis();
+  lastActionTime = clock->now();
   loadState();    // Loads hunger, happyness, etc
   loadSettings(); // Loads Json Settings
   loadFriends();  // Loads friend list
-}
-
-uint16_t hexToRGB565(const char* hexStr) {
-    if (!hexStr) return 0xFFFF; // Sicurezza extra se è nullo
-    if (hexStr[0] == '#') hexStr++;
-    long rgb = strtol(hexStr, NULL, 16);
-    uint8_t r = (rgb >> 16) & 0xFF;
-    uint8_t g = (rgb >> 8) & 0xFF;
-    uint8_t b = rgb & 0xFF;
-    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
-}
-
-// Inverso di hexToRGB565: ricostruisce una stringa "#RRGGBB" da un colore RGB565,
-// espandendo ogni canale a 8 bit (con replica dei bit alti per non perdere brillantezza).
-static String rgb565ToHex(uint16_t c) {
-    uint8_t r = (c >> 11) & 0x1F; r = (r << 3) | (r >> 2);
-    uint8_t g = (c >> 5)  & 0x3F; g = (g << 2) | (g >> 4);
-    uint8_t b =  c        & 0x1F; b = (b << 3) | (b >> 2);
-    char buf[8];
-    sprintf(buf, "#%02X%02X%02X", r, g, b);
-    return String(buf);
+  friendsVer  = clock->random32();
+  requestsVer = clock->random32();
+  history.begin();
 }
 
 // ==========================================
@@ -46,8 +30,8 @@ void MochiState::loadState() {
     statChr       = prefs.getInt("statChr", 0);
     pendingAction = (PendingAction)prefs.getInt("pending", (int)ACTION_NONE);
     currentAge    = (AgeStage)prefs.getInt("age", (int)ADULT);
-    baseUnixTime = prefs.getULong("savedTime", 1700000000);
-    syncMillis   = millis();
+    baseUnixTime = prefs.getULong("savedTime", DEFAULT_UNIX_TIME);
+    syncMillis   = clock->now();
     prefs.end();
     Serial.println("Dati caricati correttamente!");
   } else {
@@ -66,68 +50,118 @@ void MochiState::saveState() {
   prefs.putInt("statChr",  statChr);
   prefs.putInt("pending",  (int)pendingAction);
   prefs.putInt("age",      (int)currentAge);
-  unsigned long currentUnix = baseUnixTime + ((millis() - syncMillis) / 1000);
+  unsigned long currentUnix = baseUnixTime + ((clock->now() - syncMillis) / 1000);
   prefs.putULong("savedTime", currentUnix);
-  prefs.putString("settings", settingsBlob);
   prefs.end();
   Serial.println("Dati salvati in memoria!");
 }
 
+// I setting sono salvati in binario (chiave "cfg"). Il vecchio formato (JSON
+// grezzo nella stringa "settings") viene applicato come patch e migrato una
+// volta sola.
 void MochiState::loadSettings() {
     prefs.begin("mochi-data", false);
-    // Legge la stringa "settings", se non esiste usa "{}"
-    settingsBlob = prefs.getString("settings", "{}");
+    bool loaded = settings.load(prefs);
+    String legacy = loaded ? String() : prefs.getString("settings", "");
     prefs.end();
 
-    applySettings();
+    loadSchedule();
+
+    if (legacy.length() > 0) {
+        saveSettings(legacy.c_str(), legacy.length());
+        prefs.begin("mochi-data", false);
+        prefs.remove("settings");
+        prefs.end();
+        Serial.println("Impostazioni migrate al formato binario.");
+    }
+    colorsUpdated = true; // la luminosità la applica setup() dopo pinMode
 }
 
-void MochiState::saveSettings(String newJson) {
-    settingsBlob = newJson;
+// Il calendario e' salvato in binario (chiave "sched"), gia' validato: al boot
+// non serve ri-parsare nulla. Se manca o e' corrotto resta quello di default.
+void MochiState::loadSchedule() {
+    MochiSchedule stored;
     prefs.begin("mochi-data", false);
-    prefs.putString("settings", settingsBlob);
+    size_t len = prefs.getBytesLength("sched");
+    if (len > 0 && len <= sizeof(stored.entries)) {
+        prefs.getBytes("sched", stored.entries, len);
+        stored.count = len / sizeof(ScheduleEntry);
+        if (stored.isValid()) schedule = stored;
+    }
     prefs.end();
+    nextStageAt = 0;
+}
 
-    applySettings();
+void MochiState::saveSchedule() {
+    prefs.begin("mochi-data", false);
+    prefs.putBytes("sched", schedule.entries, schedule.count * sizeof(ScheduleEntry));
+    prefs.end();
 }
 
-void MochiState::applySettings() {
-  StaticJsonDocument<512> doc;
-  DeserializationError error = deserializeJson(doc, settingsBlob);
-  
-  if (!error) {
-    // 1. Applica la Luminosità direttamente al Pin della Retroilluminazione (PIN_BL)
-    if (doc.containsKey("brightness")) {
-      screenBrightness = doc["brightness"];
-      analogWrite(g_board.bl, screenBrightness); // Applica fisicamente la luminosità al display!
-    }
-    
-    // 2. Estrai i colori, convertili e avvisa che sono cambiati
-    if (doc.containsKey("bgTop") && doc.containsKey("bgBottom")) {
-      uint16_t newTop = hexToRGB565(doc["bgTop"]);
-      uint16_t newBottom = hexToRGB565(doc["bgBottom"]);
-      
-      if (bgTopColor != newTop || bgBottomColor != newBottom) {
-        bgTopColor = newTop;
-        bgBottomColor = newBottom;
-        colorsUpdated = true; // Segnala che i colori sono nuovi!
-      }
+void MochiState::saveSettings(const char* json, size_t len) {
+  MochiMemScope mem(MEM_JSON);
+  StaticJsonDocument<SETTINGS_JSON_SIZE> doc;
+  DeserializationError error = deserializeJson(doc, json, len);
+  if (error || !doc.is<JsonObject>()) {
+    Serial.println("Settings non validi, ignorati.");
+    return;
+  }
+  applySettingsPatch(doc.as<JsonObjectConst>());
+}
+
+// Applica solo i campi presenti nella patch e salva solo se qualcosa e' cambiato.
+void MochiState::applySettingsPatch(JsonObjectConst patch) {
+  uint8_t changed = settings.patch(patch);
+
+  if (changed & SETTINGS_CHANGED_BRIGHTNESS) {
+    analogWrite(g_board.bl, settings.brightness); // Applica fisicamente la luminosità al display!
+  }
+  if (changed & SETTINGS_CHANGED_COLORS) {
+    colorsUpdated = true; // Segnala che i colori sono nuovi!
+  }
+  if (changed) {
+    prefs.begin("mochi-data", false);
+    settings.save(prefs);
+    prefs.end();
+    Serial.println("Settings salvati.");
+  }
+
+  // Calendario del ciclo vitale: accettato solo se valido, e la prossima
+  // transizione viene ricalcolata una volta sola.
+  if (patch.containsKey("schedule")) {
+    MochiSchedule incoming = schedule;
+    if (!incoming.fromJson(patch["schedule"])) {
+      Serial.println("Calendario non valido, ignorato.");
+    } else if (incoming != schedule) {
+      schedule = incoming;
+      saveSchedule();
+      nextStageAt = 0;
+      Serial.println("Nuovo calendario del ciclo vitale salvato.");
     }
   }
 }
 
-// Restituisce il JSON dei setting garantendo SEMPRE i colori e la luminosità
-// correnti del Mochi. Su un device appena resettato il blob è "{}" e non
-// conterrebbe colori: così la companion app adotta comunque lo schema reale.
-String MochiState::getSettingsJson() {
-  StaticJsonDocument<512> doc;
-  deserializeJson(doc, settingsBlob); // se fallisce parte da un oggetto vuoto
-  doc["bgTop"]      = rgb565ToHex(bgTopColor);
-  doc["bgBottom"]   = rgb565ToHex(bgBottomColor);
-  doc["brightness"] = screenBrightness;
-  String out;
-  serializeJson(doc, out);
-  return out;
+void MochiState::writeSettingsJson(MochiWriter& w) {
+  w.beginObject();
+  settings.writeFields(w);
+  w.key("schedule");
+  schedule.write(w);
+  w.endObject();
+}
+
+void MochiState::writeSettingsTlv(MochiFrame& f) {
+  f.u8(TAG_BRIGHTNESS, settings.brightness);
+  f.u16(TAG_BG_TOP, settings.bgTop);
+  f.u16(TAG_BG_BOTTOM, settings.bgBottom);
+  if (settings.timezone[0]) f.str(TAG_TIMEZONE, settings.timezone);
+  uint8_t sched[SCHEDULE_MAX_ENTRIES * 3];
+  for (int i = 0; i < schedule.count; i++) {
+    sched[i * 3]     = schedule.entries[i].startMin & 0xFF;
+    sched[i * 3 + 1] = schedule.entries[i].startMin >> 8;
+    sched[i * 3 + 2] = schedule.entries[i].stage;
+  }
+  f.bytes(TAG_SCHEDULE, sched, schedule.count * 3);
+  if (settings.spill[0]) f.str(TAG_EXTRA, settings.spill);
 }
 
 // ==========================================
@@ -147,7 +181,8 @@ void MochiState::syncTime(long unixTime) {
   }
 
   baseUnixTime = unixTime;
-  syncMillis = millis();
+  syncMillis = clock->now();
+  nextStageAt = 0; // l'ora e' cambiata: ricalcola la prossima transizione
   Serial.printf("Ora Sincronizzata: %ld\n", unixTime);
   saveState();
 }
@@ -156,7 +191,7 @@ String MochiState::getTimeString() {
   if (baseUnixTime == 0) return "--:--";
   
   // Calcoliamo i secondi passati dalla sincronizzazione
-  unsigned long elapsedSeconds = (millis() - syncMillis) / 1000;
+  unsigned long elapsedSeconds = (clock->now() - syncMillis) / 1000;
   time_t now = baseUnixTime + elapsedSeconds;
   
   // Usiamo gmtime per visualizzare il timestamp 
@@ -170,7 +205,7 @@ String MochiState::getTimeString() {
 
 time_t MochiState::getNow() {
     if (baseUnixTime == 0) return 0; 
-    return baseUnixTime + (millis() - syncMillis) / 1000;
+    return baseUnixTime + (clock->now() - syncMillis) / 1000;
 }
 
 // ==========================================
@@ -178,6 +213,7 @@ time_t MochiState::getNow() {
 // ==========================================
 
 void MochiState::applyTick() {
+  MochiMemScope mem(MEM_STATE);
   // 1. Aggiorna i bisogni (Fame, Felicità, ecc.)
   updateDecay();
   recharge();
@@ -185,12 +221,26 @@ void MochiState::applyTick() {
   checkLifecycle();
   // 3. Salva i progressi in memoria in modo sicuro ogni 5 minuti
   saveState();
+  recordHistory();
   
   // Debug
   Serial.println("--- TICK 5 MINUTI ESEGUITO ---");
   Serial.printf("Fame: %.1f | Felicità: %.1f | Età: %d\n", hunger, happy, currentAge);
 }
 
+void MochiState::recordHistory() {
+  HistorySample s;
+  s.time = getNow();
+  s.v[0] = (uint8_t)hunger;
+  s.v[1] = (uint8_t)happy;
+  s.v[2] = statStr;
+  s.v[3] = statSpd;
+  s.v[4] = statInt;
+  s.v[5] = statChr;
+  s.v[6] = currentAge;
+  history.append(s);
+}
+
 void MochiState::updateDecay() {
   if (currentAge != EGG) {
     hunger -= HUNGER_DECAY;
@@ -200,8 +250,8 @@ void MochiState::updateDecay() {
   }
   
   // 2. Pulizia dell'ultimo comando
-  if (lastCommand != "" && millis() - commandFeedbackTime > 1000) {
-    lastCommand = "";
+  if (lastCommand != CMD_NONE && clock->now() - commandFeedbackTime > 1000) {
+    lastCommand = CMD_NONE;
   }
 }
 
@@ -236,39 +286,20 @@ bool MochiState::shouldDie(int day, int hour) {
     return (day == 0 || day > 5 || (day == 5 && hour >= 18));
 } */
 
-AgeStage MochiState::getExpectedStage(int day, int hour) {
-    // 1. IL WEEKEND (Morte/Uovo): Da Venerdì ore 18:00 a Lunedì ore 09:59
-    if (day == 6 || day == 0) return EGG; // Sabato e Domenica
-    if (day == 5 && hour >= 18) return EGG; // Venerdì sera
-    if (day == 1 && hour < 10) return EGG; // Lunedì mattina presto
-
-    // 2. FASE BABY: Da Lunedì ore 10:00 a Martedì ore 17:59
-    if (day == 1 && hour >= 10) return BABY;
-    if (day == 2 && hour < 18) return BABY;
-
-    // 3. FASE ADULTO: Da Martedì ore 18:00 a Giovedì ore 17:59
-    if (day == 2 && hour >= 18) return ADULT;
-    if (day == 3) return ADULT; // Mercoledì tutto il giorno
-    if (day == 4 && hour < 18) return ADULT;
-
-    // 4. FASE ANZIANO: Da Giovedì ore 18:00 a Venerdì ore 17:59
-    if (day == 4 && hour >= 18) return ELDER;
-    if (day == 5 && hour < 18) return ELDER;
-
-    return EGG; // Sicurezza fallback
+// Calcola lo stadio atteso adesso e arma l'unica scadenza successiva: fino a
+// nextStageAt lo stadio atteso non puo' cambiare, quindi i tick intermedi non
+// fanno alcun calcolo di calendario.
+void MochiState::armLifecycle(time_t now) {
+    expectedStage = (AgeStage)schedule.stageAt(now);
+    nextStageAt   = schedule.nextTransition(now);
 }
 
 void MochiState::checkLifecycle() {
     time_t now = getNow();
-    if (now == 0 || needsGrowthAnimation || isDying || (millis() - lastEvolutionTime < evolutionCooldown)) return; // Se l'ora non è sincro o sta già animando, esci
-
-    struct tm * timeinfo;
-    timeinfo = gmtime(&now); // Converte il timestamp in ore/giorni
-    
-    int day = timeinfo->tm_wday; // 0 = Domenica, 1 = Lunedì, 2 = Martedì... 5 = Venerdì
-    int hour = timeinfo->tm_hour;
+    if (now == 0 || needsGrowthAnimation || isDying || (clock->now() - lastEvolutionTime < evolutionCooldown)) return; // Se l'ora non è sincro o sta già animando, esci
 
-    AgeStage expected = getExpectedStage(day, hour);
+    if (nextStageAt == 0 || now >= nextStageAt) armLifecycle(now);
+    AgeStage expected = expectedStage;
     
     if ((expected == EGG && currentAge != EGG) || currentAge > expected) {
         isDying = true;
@@ -292,8 +323,8 @@ void MochiState::checkLifecycle() {
 }
 
 int MochiState::getMissedIncrements(time_t newUnixTime) {
-    // 1. Se è la prima accensione in assoluto o l'orario salvato era il default (1700000000)
-    if (baseUnixTime == 0 || baseUnixTime == 1700000000) {
+    // 1. Se è la prima accensione in assoluto o l'orario salvato era il default (DEFAULT_UNIX_TIME)
+    if (baseUnixTime == 0 || baseUnixTime == DEFAULT_UNIX_TIME) {
         return 0; // Nessun incremento perso, si parte da zero
     }
 
@@ -312,25 +343,24 @@ int MochiState::getMissedIncrements(time_t newUnixTime) {
     return missedIntervals;
 }
 
-void MochiState::applyCommand(String cmd) {
-  if (cmd.startsWith("queue:")) {
-    queueAction(cmd.substring(6));
-    return;
-  }
-  if (cmd == "get_state") return; // handled by BLE layer
-
+// Comandi diretti della app (gia' riconosciuti dal dispatcher BLE).
+void MochiState::applyCommand(MochiCmdId cmd) {
   lastCommand = cmd;
-  commandFeedbackTime = millis();
-  if (cmd == "FEED") hunger += 20.0;
-  else if (cmd == "PLAY") happy += 20.0;
-  else if (cmd == "KILL") {
-    isDying = true;
-    return;
-  } else if (cmd == "GROW") {
-    growUp();
-    return;
-  } else if (cmd == "prev" || cmd == "next") {
-    toggleAutoclick();
+  commandFeedbackTime = clock->now();
+  switch (cmd) {
+    case CMD_FEED: hunger += 20.0; break;
+    case CMD_PLAY: happy += 20.0; break;
+    case CMD_KILL:
+      isDying = true;
+      return;
+    case CMD_GROW:
+      growUp();
+      return;
+    case CMD_PREV:
+    case CMD_NEXT:
+      toggleAutoclick();
+      break;
+    default: break;
   }
 
   if (hunger > MAX_VAL) hunger = MAX_VAL;
@@ -340,13 +370,18 @@ void MochiState::applyCommand(String cmd) {
   triggerHeart();
 }
 
-void MochiState::queueAction(String action) {
-  if      (action == "FEED")      pendingAction = ACTION_FEED;
-  else if (action == "PET")       pendingAction = ACTION_PET;
-  else if (action == "TRAIN_STR") pendingAction = ACTION_TRAIN_STR;
-  else if (action == "TRAIN_SPD") pendingAction = ACTION_TRAIN_SPD;
-  else if (action == "TRAIN_INT") pendingAction = ACTION_TRAIN_INT;
-  else if (action == "TRAIN_CHR") pendingAction = ACTION_TRAIN_CHR;
+PendingAction MochiState::actionFromName(const MochiArg& name) {
+  if      (name.equals("FEED"))      return ACTION_FEED;
+  else if (name.equals("PET"))       return ACTION_PET;
+  else if (name.equals("TRAIN_STR")) return ACTION_TRAIN_STR;
+  else if (name.equals("TRAIN_SPD")) return ACTION_TRAIN_SPD;
+  else if (name.equals("TRAIN_INT")) return ACTION_TRAIN_INT;
+  else if (name.equals("TRAIN_CHR")) return ACTION_TRAIN_CHR;
+  return ACTION_NONE;
+}
+
+void MochiState::queueAction(PendingAction action) {
+  if (action != ACTION_NONE) pendingAction = action;
   saveState();
   triggerBubble('!');
 }
@@ -370,93 +405,139 @@ void MochiState::gainFromMinigame(PendingAction action, int score) {
   triggerHeart();
 }
 
-String MochiState::getStateJson() {
-  static StaticJsonDocument<192> doc;
-  doc.clear();
-  doc["hunger"] = (int)hunger;
-  doc["happy"]  = (int)happy;
-  doc["str"]    = statStr;
-  doc["spd"]    = statSpd;
-  doc["int"]    = statInt;
-  doc["chr"]    = statChr;
-  String out;
-  serializeJson(doc, out);
-  return out;
+void MochiState::writeStateJson(MochiWriter& w) {
+  w.beginObject()
+   .field("hunger", (int)hunger)
+   .field("happy",  (int)happy)
+   .field("str",    statStr)
+   .field("spd",    statSpd)
+   .field("int",    statInt)
+   .field("chr",    statChr)
+   .endObject();
+}
+
+void MochiState::readStateFields(uint8_t out[STATE_FIELD_COUNT]) const {
+  out[0] = (uint8_t)hunger;
+  out[1] = (uint8_t)happy;
+  out[2] = statStr;
+  out[3] = statSpd;
+  out[4] = statInt;
+  out[5] = statChr;
+  out[6] = currentAge;
+}
+
+void MochiState::writeStateTlv(MochiFrame& f) {
+  uint8_t v[STATE_FIELD_COUNT];
+  readStateFields(v);
+  for (int i = 0; i < STATE_FIELD_COUNT; i++) f.u8(TAG_HUNGER + i, v[i]);
 }
 
 // ==========================================
 // AMICI
 // ==========================================
 
-// Gli amici sono salvati come un'unica stringa con id separati da '\n'.
+// Gli amici sono salvati nella chiave binaria "friendIds": id ordinati, 3 byte
+// ciascuno (big endian). Il vecchio formato (stringa "friends" con id separati
+// da '\n') viene migrato una volta sola al primo avvio.
+// Blob e id ordinati passano da buffer statici (solo loop) invece che dallo stack.
+static uint8_t s_friendBlob[MAX_FRIENDS * 3];
+static MochiId s_friendSorted[MAX_FRIENDS];
+
 void MochiState::loadFriends() {
+  friends.clear();
   prefs.begin("mochi-data", false);
-  String blob = prefs.getString("friends", "");
-  prefs.end();
-
-  friendCount = 0;
-  int start = 0;
-  while (start < blob.length() && friendCount < MAX_FRIENDS) {
-    int nl = blob.indexOf('\n', start);
-    if (nl < 0) nl = blob.length();
-    String id = blob.substring(start, nl);
-    id.trim();
-    if (id.length() > 0) friendIds[friendCount++] = id;
-    start = nl + 1;
+  size_t len = prefs.getBytesLength("friendIds");
+  if (len > 0) {
+    if (len > sizeof(s_friendBlob)) len = sizeof(s_friendBlob);
+    len = prefs.getBytes("friendIds", s_friendBlob, len);
+    for (size_t i = 0; i + 3 <= len; i += 3) {
+      const uint8_t* b = s_friendBlob + i;
+      friends.add(((MochiId)b[0] << 16) | ((MochiId)b[1] << 8) | b[2]);
+    }
+    prefs.end();
+  } else {
+    String blob = prefs.getString("friends", "");
+    prefs.end();
+    int start = 0;
+    while (start < (int)blob.length()) {
+      int nl = blob.indexOf('\n', start);
+      if (nl < 0) nl = blob.length();
+      MochiId id;
+      if (mochiIdParse(blob.c_str() + start, nl - start, &id)) friends.add(id);
+      start = nl + 1;
+    }
+    if (blob.length() > 0) {
+      saveFriends();
+      prefs.begin("mochi-data", false);
+      prefs.remove("friends");
+      prefs.end();
+      Serial.println("Amici migrati al formato binario.");
+    }
   }
-  Serial.println("Amici caricati: " + String(friendCount));
+  Serial.printf("Amici caricati: %u\n", friends.size());
 }
 
 void MochiState::saveFriends() {
-  String blob = "";
-  for (int i = 0; i < friendCount; i++) {
-    if (i > 0) blob += "\n";
-    blob += friendIds[i];
+  // toSorted e non next(): next() rifa' il giro degli slot a ogni amico
+  uint16_t count = friends.toSorted(s_friendSorted);
+  size_t n = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    MochiId v = s_friendSorted[i];
+    s_friendBlob[n++] = (v >> 16) & 0xFF;
+    s_friendBlob[n++] = (v >> 8) & 0xFF;
+    s_friendBlob[n++] = v & 0xFF;
   }
   prefs.begin("mochi-data", false);
-  prefs.putString("friends", blob);
+  prefs.putBytes("friendIds", s_friendBlob, n);
   prefs.end();
 }
 
-bool MochiState::addFriend(const String& id) {
-  if (id.length() == 0) return false;
+bool MochiState::addFriend(MochiId id) {
+  if (id == MOCHI_ID_NONE) return false;
   if (isFriend(id)) return true;          // Già amico
-  if (friendCount >= MAX_FRIENDS) return false; // Lista piena
-  friendIds[friendCount++] = id;
+  if (!friends.add(id)) return false;     // Lista piena
+  friendsVer++;
   saveFriends();
-  Serial.println("Amico aggiunto: " + id);
+  Serial.printf("Amico aggiunto: %s\n", MochiIdStr(id).c_str());
   return true;
 }
 
-bool MochiState::removeFriend(const String& id) {
-  for (int i = 0; i < friendCount; i++) {
-    if (friendIds[i] == id) {
-      for (int j = i; j < friendCount - 1; j++) friendIds[j] = friendIds[j + 1];
-      friendCount--;
-      friendIds[friendCount] = "";
-      saveFriends();
-      Serial.println("Amico rimosso: " + id);
-      return true;
-    }
-  }
-  return false;
+bool MochiState::removeFriend(MochiId id) {
+  if (!friends.remove(id)) return false;
+  friendsVer++;
+  saveFriends();
+  Serial.printf("Amico rimosso: %s\n", MochiIdStr(id).c_str());
+  return true;
 }
 
-bool MochiState::isFriend(const String& id) {
-  for (int i = 0; i < friendCount; i++) {
-    if (friendIds[i] == id) return true;
+// Amici in ordine crescente a partire dal primo id dopo `after`. Se non ci
+// stanno tutti nel writer l'ultimo elemento e' {"next":"MOCHI-..."} e la app
+// chiede la pagina dopo con get_friends:<id>: l'array resta sempre valido.
+void MochiState::writeFriendsJson(MochiWriter& w, MochiId after) {
+  const size_t ITEM = 24; // ,{"id":"MOCHI-ABCDEF"}
+  const size_t TAIL = 26; // ,{"next":"MOCHI-ABCDEF"}]
+  // Una copia ordinata e una ricerca binaria: next() costerebbe un giro
+  // degli slot per ogni amico.
+  uint16_t n = friends.toSorted(s_friendSorted);
+  uint16_t i = after == MOCHI_ID_NONE ? 0
+             : std::upper_bound(s_friendSorted, s_friendSorted + n, after) - s_friendSorted;
+  w.beginArray();
+  MochiId last = after;
+  for (; i < n; i++) {
+    MochiId id = s_friendSorted[i];
+    if (w.room() < ITEM + TAIL && last != after) {
+      w.beginObject().key("next").id(last).endObject();
+      break;
+    }
+    w.beginObject().key("id").id(id).endObject();
+    last = id;
   }
-  return false;
+  w.endArray();
 }
 
-String MochiState::getFriendsJson() {
-  String out = "[";
-  for (int i = 0; i < friendCount; i++) {
-    if (i > 0) out += ",";
-    out += "{\"id\":\"" + friendIds[i] + "\"}";
-  }
-  out += "]";
-  return out;
+void MochiState::writeFriendsTlv(MochiFrame& f) {
+  uint16_t n = friends.toSorted(s_friendSorted);
+  for (uint16_t i = 0; i < n; i++) f.id(TAG_FRIEND, s_friendSorted[i]);
 }
 
 // ==========================================
@@ -465,39 +546,37 @@ String MochiState::getFriendsJson() {
 
 // Registra una richiesta in arrivo. Ignora se siamo già amici o se la richiesta
 // è già presente. Non persistita: un reboot azzera le richieste in sospeso.
-bool MochiState::addPendingRequest(const String& id) {
-  if (id.length() == 0) return false;
+bool MochiState::addPendingRequest(MochiId id) {
+  if (id == MOCHI_ID_NONE) return false;
   if (isFriend(id)) return false; // già amici, niente richiesta
-  for (int i = 0; i < pendingReqCount; i++) {
-    if (pendingReqIds[i] == id) return true; // già in sospeso
-  }
-  if (pendingReqCount >= MAX_FRIENDS) return false;
-  pendingReqIds[pendingReqCount++] = id;
-  Serial.println("Richiesta di amicizia da: " + id);
+  if (pendingReqs.contains(id)) return true; // già in sospeso
+  if (!pendingReqs.add(id)) return false;
+  requestsVer++;
+  Serial.printf("Richiesta di amicizia da: %s\n", MochiIdStr(id).c_str());
   return true;
 }
 
-bool MochiState::removePendingRequest(const String& id) {
-  for (int i = 0; i < pendingReqCount; i++) {
-    if (pendingReqIds[i] == id) {
-      for (int j = i; j < pendingReqCount - 1; j++) pendingReqIds[j] = pendingReqIds[j + 1];
-      pendingReqCount--;
-      pendingReqIds[pendingReqCount] = "";
-      return true;
-    }
-  }
-  return false;
+bool MochiState::removePendingRequest(MochiId id) {
+  if (!pendingReqs.remove(id)) return false;
+  requestsVer++;
+  return true;
 }
 
 // Le richieste hanno il campo "pending":true così la app le distingue dagli amici.
-String MochiState::getRequestsJson() {
-  String out = "[";
-  for (int i = 0; i < pendingReqCount; i++) {
-    if (i > 0) out += ",";
-    out += "{\"id\":\"" + pendingReqIds[i] + "\",\"pending\":true}";
+void MochiState::writeRequestsJson(MochiWriter& w) {
+  MochiId ids[MAX_PENDING_REQS];
+  uint16_t n = pendingReqs.toSorted(ids);
+  w.beginArray();
+  for (uint16_t i = 0; i < n; i++) {
+    w.beginObject().key("id").id(ids[i]).fieldBool("pending", true).endObject();
   }
-  out += "]";
-  return out;
+  w.endArray();
+}
+
+void MochiState::writeRequestsTlv(MochiFrame& f) {
+  MochiId ids[MAX_PENDING_REQS];
+  uint16_t n = pendingReqs.toSorted(ids);
+  for (uint16_t i = 0; i < n; i++) f.id(TAG_REQUEST, ids[i]);
 }
 
 // ==========================================
@@ -505,9 +584,32 @@ String MochiState::getRequestsJson() {
 // ==========================================
 
 // Snapshot del Mochi da inviare all'host quando parte in visita.
-String MochiState::getVisitPayloadJson(const String& selfId) {
+size_t MochiState::writeVisitRecord(uint8_t* out, size_t room) {
+  if (room < sizeof(NowVisitRecord)) return 0;
+  NowVisitRecord r;
+  memset(&r, 0, sizeof(r));
+  r.version  = VISIT_RECORD_VERSION;
+  r.size     = sizeof(r);
+  r.age      = (uint8_t)currentAge;
+  r.hunger   = (uint8_t)constrain((int)hunger, 0, 255);
+  r.happy    = (uint8_t)constrain((int)happy, 0, 255);
+  r.str      = (uint8_t)constrain(statStr, 0, 255);
+  r.spd      = (uint8_t)constrain(statSpd, 0, 255);
+  r.intel    = (uint8_t)constrain(statInt, 0, 255);
+  r.chr      = (uint8_t)constrain(statChr, 0, 255);
+  r.bgTop    = settings.bgTop;
+  r.bgBottom = settings.bgBottom;
+  memcpy(out, &r, sizeof(r));
+  return sizeof(r);
+}
+
+// Formato v1: solo con NOW_WIRE_LEGACY_TX, per gli host non aggiornati.
+String MochiState::getVisitPayloadJson(MochiId selfId) {
+  MochiMemScope mem(MEM_JSON);
+  char idBuf[MOCHI_ID_STR_SIZE];
+  mochiIdFormat(selfId, idBuf, sizeof(idBuf));
   StaticJsonDocument<192> doc;
-  doc["id"]     = selfId;
+  doc["id"]     = (const char*)idBuf;
   doc["age"]    = (int)currentAge;
   doc["str"]    = statStr;
   doc["spd"]    = statSpd;
@@ -515,62 +617,92 @@ String MochiState::getVisitPayloadJson(const String& selfId) {
   doc["chr"]    = statChr;
   doc["hunger"] = (int)hunger;
   doc["happy"]  = (int)happy;
-  doc["btop"]   = bgTopColor;    // colori di casa (RGB565), per il gradiente dell'ospite
-  doc["bbot"]   = bgBottomColor;
+  doc["btop"]   = settings.bgTop;    // colori di casa (RGB565), per il gradiente dell'ospite
+  doc["bbot"]   = settings.bgBottom;
   String out;
   serializeJson(doc, out);
   return out;
 }
 
-void MochiState::goAway(const String& hostId, unsigned long durationMs) {
+void MochiState::goAway(MochiId hostId, unsigned long durationMs) {
   isAway = true;
   awayHostId = hostId;
-  awayUntil = millis() + durationMs;
-  Serial.println("Parto in visita da: " + hostId);
+  awayUntil = clock->now() + durationMs;
+  Serial.printf("Parto in visita da: %s\n", MochiIdStr(hostId).c_str());
 }
 
 void MochiState::returnHome() {
   if (!isAway) return;
   isAway = false;
-  awayHostId = "";
+  awayHostId = MOCHI_ID_NONE;
   // Piccola gioia al rientro
   triggerHeart();
   Serial.println("Tornato a casa!");
 }
 
-// Accetta un ospite (payload = JSON inviato dal Mochi visitatore).
-bool MochiState::receiveGuest(const String& payload, unsigned long durationMs) {
+// Accetta un ospite. Il record si legge per i byte che il mittente dichiara:
+// un record piu' lungo (versione futura) porta campi in coda che si ignorano.
+bool MochiState::receiveGuest(MochiId from, const uint8_t* payload, size_t len, unsigned long durationMs) {
   if (isAway || isHostingGuest) return false; // Già occupato
-  StaticJsonDocument<192> doc;
-  if (deserializeJson(doc, payload)) return false; // JSON non valido
-  guestId  = String((const char*)(doc["id"] | ""));
-  if (guestId.length() == 0) return false;
-  guestAge = (AgeStage)((int)(doc["age"] | (int)ADULT));
-  guestBgTop    = (uint16_t)(doc["btop"] | (int)K_BG_TOP);
-  guestBgBottom = (uint16_t)(doc["bbot"] | (int)K_BG_BOTTOM);
+  int      age;
+  uint16_t bgTop, bgBottom;
+  if (len && payload[0] == '{') {
+    // Mochi v1: JSON, l'id nel JSON e' lo stesso del pacchetto
+    MochiMemScope mem(MEM_JSON);
+    StaticJsonDocument<192> doc;
+    if (deserializeJson(doc, payload, len)) return false; // JSON non valido
+    age      = doc["age"] | (int)ADULT;
+    bgTop    = (uint16_t)(doc["btop"] | (int)K_BG_TOP);
+    bgBottom = (uint16_t)(doc["bbot"] | (int)K_BG_BOTTOM);
+  } else {
+    NowVisitRecord r;
+    if (len < VISIT_RECORD_MIN_SIZE) return false;
+    if (payload[0] != VISIT_RECORD_VERSION) {
+      Serial.printf("Visita rifiutata: record versione %u\n", payload[0]);
+      return false;
+    }
+    size_t n = payload[1];
+    if (n < VISIT_RECORD_MIN_SIZE || n > len) return false; // Troncato
+    memset(&r, 0, sizeof(r));
+    memcpy(&r, payload, min(n, sizeof(r)));
+    age      = r.age;
+    bgTop    = r.bgTop;
+    bgBottom = r.bgBottom;
+  }
+  guestId = from;
+  guestAge = (age >= EGG && age <= ELDER) ? (AgeStage)age : ADULT;
+  guestBgTop = bgTop;
+  guestBgBottom = bgBottom;
   isHostingGuest = true;
-  guestUntil = millis() + durationMs;
+  guestUntil = clock->now() + durationMs;
   triggerHeart();
-  Serial.println("Ospite arrivato: " + guestId);
+  Serial.printf("Ospite arrivato: %s\n", MochiIdStr(guestId).c_str());
   return true;
 }
 
+// Scadenze di visita e ospitalita', dal loop.
+void MochiState::tickVisits() {
+  unsigned long now = clock->now();
+  if (isAway && (long)(now - awayUntil) >= 0) returnHome();
+  if (isHostingGuest && (long)(now - guestUntil) >= 0) guestLeaves();
+}
+
 void MochiState::guestLeaves() {
   if (!isHostingGuest) return;
   isHostingGuest = false;
-  Serial.println("L'ospite " + guestId + " è tornato a casa.");
-  guestId = "";
+  Serial.printf("L'ospite %s è tornato a casa.\n", MochiIdStr(guestId).c_str());
+  guestId = MOCHI_ID_NONE;
 }
 
 void MochiState::triggerHeart() {
   // Solo logica casuale: se non è già visibile, c'è una piccola chance
-  if (!isHeartVisible && random(5000) < 5) { // Ho abbassato un po' la probabilità
+  if (!isHeartVisible && clock->random(5000) < 5) { // Ho abbassato un po' la probabilità
     isHeartVisible = true;
-    heartShowTime = millis();
+    heartShowTime = clock->now();
   }
   
   // Gestione dello spegnimento del cuore dopo 2.5 secondi
-  if (isHeartVisible && (millis() - heartShowTime > 2500)) {
+  if (isHeartVisible && (clock->now() - heartShowTime > 2500)) {
     isHeartVisible = false;
   }
 }
@@ -578,28 +710,28 @@ void MochiState::triggerHeart() {
 void MochiState::triggerBubble(char type) {
   isBubbleVisible = true;
   bubbleType = type;
-  bubbleShowTime = millis();
+  bubbleShowTime = clock->now();
 }
 
 void MochiState::updateBubbles() {
     if (!isBubbleVisible) return;
     if (bubbleType == '!' && pendingAction != ACTION_NONE) return; // stay visible while action pending
-    if (millis() - bubbleShowTime > 2500) {
+    if (clock->now() - bubbleShowTime > 2500) {
         isBubbleVisible = false;
     }
 }
 
 float MochiState::getProgress() {
-  float p = (float)(millis() - lastActionTime) / (float)ACTION_INTERVAL;
+  float p = (float)(clock->now() - lastActionTime) / (float)ACTION_INTERVAL;
   return (p > 1.0) ? 1.0 : p;
 }
 
 bool MochiState::timeForAction() {
-  return (millis() - lastActionTime > ACTION_INTERVAL);
+  return (clock->now() - lastActionTime > ACTION_INTERVAL);
 }
 
 void MochiState::resetTimer() {
-  lastActionTime = millis();
+  lastActionTime = clock->now();
   minigamePlayedThisSlot = false;
 }
 
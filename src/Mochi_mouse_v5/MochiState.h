@@ -4,6 +4,14 @@
 #include <Preferences.h> // Libreria per la memoria permanente
 #include <ArduinoJson.h>
 #include "Settings.h"
+#include "MochiSchedule.h"
+#include "MochiId.h"
+#include "MochiCmd.h"
+#include "MochiWriter.h"
+#include "MochiSettings.h"
+#include "MochiHistory.h"
+#include "MochiProto.h"
+#include "MochiClock.h"
 
 enum AgeStage {
   EGG,
@@ -25,6 +33,7 @@ enum PendingAction {
 class MochiState {
 private:
   Preferences prefs; // Oggetto per gestire i salvataggi
+  MochiClock* clock = mochiSystemClock(); // Tutti i tempi e le scelte a caso
 
   int evolutionCooldown = STATE_COOLDOWN;
 
@@ -33,10 +42,18 @@ private:
   bool shouldBecomeElder(int day, int hour);
   bool shouldDie(int day, int hour);
 */
-  AgeStage getExpectedStage(int day, int hour);
+  // Calendario del ciclo vitale + prossima scadenza gia' calcolata: lo stadio
+  // atteso si ricalcola solo quando si raggiunge nextStageAt (0 = da ricalcolare,
+  // es. dopo una sync dell'ora o un nuovo calendario).
+  MochiSchedule schedule;
+  AgeStage      expectedStage = EGG;
+  time_t        nextStageAt = 0;
+  void          armLifecycle(time_t now);
+  void          loadSchedule();
+  void          saveSchedule();
 
   time_t baseUnixTime = 0;       // Il tempo Unix ricevuto via BLE/WiFi
-  unsigned long syncMillis = 0;  // Il valore di millis() al momento della sicro
+  unsigned long syncMillis = 0;  // Il valore di clock->now() al momento della sicro
 
   // --- LOGICA GIOCO ---
   void updateDecay();
@@ -54,13 +71,8 @@ public:
 
   unsigned long lastActionTime = 0;
 
-  String settingsBlob = "{}"; // Default: JSON vuoto
-
-  uint16_t bgTopColor = K_BG_TOP;    // Default: K_BG_TOP
-  uint16_t bgBottomColor = K_BG_BOTTOM; // Default: K_BG_BOTTOM
+  MochiSettings settings;     // Luminosita', colori, fuso orario (+ chiavi sconosciute)
   bool colorsUpdated = false;
-
-  int screenBrightness = 255;
   
   bool isDying = false;
   bool isHeartVisible = false;
@@ -75,24 +87,33 @@ public:
 
   bool isFriendNearby = false; // Almeno un altro Mochi è nei paraggi (discovery)
 
+  // --- STORICO (un campione per tick, per i grafici della app) ---
+  MochiHistory history;
+
   // --- AMICI (persistiti) ---
-  String friendIds[MAX_FRIENDS]; // ID degli amici (es. "Mochi-ABCD")
-  int    friendCount = 0;
+  // ID binari (24 bit del MAC) in un hash set: isFriend() e' O(1) anche con
+  // centinaia di amici. Su flash sono salvati ordinati, 3 byte per amico.
+  MochiIdSet<MAX_FRIENDS> friends;
 
   // --- RICHIESTE DI AMICIZIA IN ARRIVO (runtime, non persistite) ---
   // L'amicizia richiede una richiesta + un'accettazione: questi sono gli ID
   // dei Mochi che ci hanno chiesto l'amicizia e attendono una risposta.
-  String pendingReqIds[MAX_FRIENDS];
-  int    pendingReqCount = 0;
+  MochiIdSet<MAX_PENDING_REQS> pendingReqs;
+
+  // Versioni delle due liste: cambiano a ogni aggiunta/rimozione, cosi' chi le
+  // segue (iscrizione social della app) sa se rileggerle. Partono da un valore
+  // casuale: una versione vista prima di un riavvio non combacia per sbaglio.
+  uint32_t friendsVer  = 0;
+  uint32_t requestsVer = 0;
 
   // --- VISITE (runtime, non persistite: un reboot riporta tutti a casa) ---
   // Il mio Mochi è in visita altrove
   bool          isAway = false;
-  String        awayHostId = "";
+  MochiId       awayHostId = MOCHI_ID_NONE;
   unsigned long awayUntil = 0;
   // Sto ospitando il Mochi di un amico
   bool          isHostingGuest = false;
-  String        guestId = "";
+  MochiId       guestId = MOCHI_ID_NONE;
   AgeStage      guestAge = ADULT;
   unsigned long guestUntil = 0;
   // Colori "di casa" dell'ospite: in visita viene disegnato con il SUO gradiente
@@ -100,7 +121,7 @@ public:
   uint16_t      guestBgTop = K_BG_TOP;
   uint16_t      guestBgBottom = K_BG_BOTTOM;
 
-  String lastCommand = ""; 
+  MochiCmdId lastCommand = CMD_NONE; // Ultimo comando diretto (FEED, prev, ...) da mostrare
   unsigned long commandFeedbackTime = 0;
 
   unsigned long lastEvolutionTime = 0;
@@ -114,39 +135,46 @@ public:
 
   // --- METODI PRINCIPALI ---
   void begin();
+  void setClock(MochiClock* c) { clock = c; } // Prima di begin() (simulatore)
 
   // --- LOGICA MEMORIA ---
   void loadState();
   void saveState();
   void loadSettings();
-  void saveSettings(String newJson);
+  void saveSettings(const char* json, size_t len); // set_json: applica come patch
 
-  void applySettings();            // Nuova funzione per applicare il JSON dei setting
+  void applySettingsPatch(JsonObjectConst patch);
 
   // --- AMICI ---
   void   loadFriends();
   void   saveFriends();
-  bool   addFriend(const String& id);
-  bool   removeFriend(const String& id);
-  bool   isFriend(const String& id);
-  String getFriendsJson();
+  bool   addFriend(MochiId id);
+  bool   removeFriend(MochiId id);
+  bool   isFriend(MochiId id) const { return friends.contains(id); }
+  void   writeFriendsJson(MochiWriter& w, MochiId after = MOCHI_ID_NONE); // Una pagina
+  void   writeFriendsTlv(MochiFrame& f);
 
   // --- RICHIESTE DI AMICIZIA ---
-  bool   addPendingRequest(const String& id);    // Registra una richiesta in arrivo
-  bool   removePendingRequest(const String& id); // Accettata o rifiutata
-  String getRequestsJson();
+  bool   addPendingRequest(MochiId id);    // Registra una richiesta in arrivo
+  bool   removePendingRequest(MochiId id); // Accettata o rifiutata
+  void   writeRequestsJson(MochiWriter& w);
+  void   writeRequestsTlv(MochiFrame& f);
 
   // --- IMPOSTAZIONI ---
-  // JSON dei setting con SEMPRE i colori/luminosità correnti del Mochi, così la
+  // JSON dei setting, con SEMPRE i colori/luminosità correnti del Mochi così la
   // companion app può adottare lo schema colore del device appena connesso.
-  String getSettingsJson();
+  void   writeSettingsJson(MochiWriter& w);
+  void   writeSettingsTlv(MochiFrame& f);
 
   // --- VISITE ---
-  String getVisitPayloadJson(const String& selfId); // Snapshot da spedire all'host
-  void   goAway(const String& hostId, unsigned long durationMs);
+  size_t writeVisitRecord(uint8_t* out, size_t room); // Snapshot da spedire all'host (NowVisitRecord)
+  String getVisitPayloadJson(MochiId selfId);         // Lo stesso in JSON, per i Mochi v1
+  void   goAway(MochiId hostId, unsigned long durationMs);
   void   returnHome();
-  bool   receiveGuest(const String& payload, unsigned long durationMs);
+  // Payload di PKT_VISIT: record binario o JSON v1. Il mittente e' quello del pacchetto.
+  bool   receiveGuest(MochiId from, const uint8_t* payload, size_t len, unsigned long durationMs);
   void   guestLeaves();
+  void   tickVisits(); // Rientro a casa e partenza dell'ospite alla scadenza
 
   // --- LOGICA ORARIO ---
   void syncTime(long unixTime);
@@ -156,11 +184,16 @@ public:
 
   // --- LOGICA GIOCO ---
   void applyTick();
-  void applyCommand(String cmd);
+  void recordHistory();
+  void applyCommand(MochiCmdId cmd);
   void recharge();
-  void queueAction(String action);
+  void queueAction(PendingAction action);
+  static PendingAction actionFromName(const MochiArg& name); // "FEED", "TRAIN_STR", ...
   void gainFromMinigame(PendingAction action, int score);
-  String getStateJson();
+  void writeStateJson(MochiWriter& w);
+  void writeStateTlv(MochiFrame& f);
+  // Campi dello stato nell'ordine dei tag TAG_HUNGER..TAG_AGE (per i delta).
+  void readStateFields(uint8_t out[STATE_FIELD_COUNT]) const;
   
   // --- GESTIONE EFFETTI VISIVI ---
   void triggerHeart();
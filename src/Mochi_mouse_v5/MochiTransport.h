@@ -0,0 +1,43 @@
+#ifndef MOCHI_TRANSPORT_H
+#define MOCHI_TRANSPORT_H
+
+#include <Arduino.h>
+#include "MochiId.h"
+#include "MochiClock.h"
+
+// ================================================================
+// RADIO DI MOCHINOW
+// ----------------------------------------------------------------
+// MochiNow parla con gli altri Mochi solo attraverso questa interfaccia: sul
+// device e' ESP-NOW (MochiEspNow), nel simulatore host (test/now_sim.h) una
+// rete finta con posizioni, perdite, latenze e un orologio per nodo. Come la callback
+// ESP-NOW, il ricevitore viene chiamato dal task della radio: deve solo
+// copiare e tornare.
+// ================================================================
+
+class MochiRadioSink {
+public:
+  virtual ~MochiRadioSink() {}
+  virtual void onRadioRecv(const uint8_t* mac, int rssi, const uint8_t* data, size_t len) = 0;
+  virtual void onRadioSent(bool ok) = 0; // Esito dell'ultimo send()
+};
+
+class MochiTransport {
+public:
+  virtual ~MochiTransport() {}
+
+  virtual bool    begin(MochiRadioSink* sink) = 0;
+  virtual void    macAddress(uint8_t mac[6]) = 0;
+  virtual MochiId localId() { return mochiIdSelf(); } // Id con cui presentarsi
+  virtual uint8_t channel() = 0;                      // 0 = radio spenta
+
+  // Peer unicast registrati (il broadcast FF:FF:FF:FF:FF:FF lo e' sempre).
+  virtual bool    addPeer(const uint8_t* mac) = 0;
+  virtual void    removePeer(const uint8_t* mac) = 0;
+  virtual bool    send(const uint8_t* mac, const uint8_t* data, size_t len) = 0;
+
+  // Orologio e generatore del nodo: tempi e scelte a caso di MochiNow.
+  virtual MochiClock* clock() { return mochiSystemClock(); }
+};
+
+#endif // MOCHI_TRANSPORT_H
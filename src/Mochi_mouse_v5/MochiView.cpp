@@ -1,4 +1,5 @@
 #include "MochiView.h"
+#include "MochiMem.h"
 
 // ==========================================
 // COSTRUTTORE E METODI PUBBLICI
@@ -7,6 +8,8 @@
 MochiView::MochiView(LGFX_Sprite* spritePtr) {
   canvas = spritePtr;
   eggTempSprite = nullptr; // Inizialmente vuoto
+  MochiAsset ease;
+  bgEase = (mochiAssetGet(ASSET_EASE_BG, &ease) && ease.w == 172) ? (const uint16_t*)ease.data : nullptr;
   // Inizializza le variabili definite nel file .h
   bgCalculated = false;
   currentBgTop = K_BG_TOP;
@@ -22,6 +25,7 @@ MochiView::~MochiView() {
 }
 
 void MochiView::render(MochiState &state, int yOff, float animAngle, bool wink, bool connected) {
+  MochiMemScope mem(MEM_VIEW);
   drawBackground();
 
   if (state.isDying) {
@@ -159,8 +163,8 @@ void MochiView::drawBackground() {
       // Usa 171.0 così l'ultima riga (171) raggiunge esattamente 1.0
       float ratio = (float)i / 171.0; 
       
-      // Curva a Coseno per transizioni morbide
-      float smoothRatio = (1.0 - cos(ratio * PI)) / 2.0;
+      // Curva a Coseno per transizioni morbide (precalcolata negli asset, se ci sono)
+      float smoothRatio = bgEase ? bgEase[i] / 65535.0f : (1.0 - cos(ratio * PI)) / 2.0;
 
       // Calcola la sfumatura con i canali spacchettati
       int r = (int)((1.0 - smoothRatio) * topR + smoothRatio * botR);
@@ -310,8 +314,15 @@ void MochiView::fillRoundRectGradient(int x, int y, int w, int h, int r, uint16_
       float dy = (float)(i - (h - r) + 1);
       inset = r - (int)(sqrtf((float)(r * r) - dy * dy) + 0.5f);
     }
-    float ratio = (h > 1) ? (float)i / (float)(h - 1) : 0.0f;
-    float smooth = (1.0f - cosf(ratio * (float)M_PI)) / 2.0f; // morbido come lo sfondo
+    // Morbido come lo sfondo: la stessa curva, campionata sulla tabella se c'e'
+    float smooth;
+    if (h <= 1) {
+      smooth = 0.0f;
+    } else if (bgEase) {
+      smooth = bgEase[i * 171 / (h - 1)] / 65535.0f;
+    } else {
+      smooth = (1.0f - cosf((float)i / (float)(h - 1) * (float)M_PI)) / 2.0f;
+    }
     uint16_t col = lerp565(top, bottom, smooth);
     canvas->drawFastHLine(x + inset, y + i, w - 2 * inset, col);
   }
@@ -383,6 +394,17 @@ void MochiView::drawEgg(int cx, int cy, float animAngle, float crackProgress) {
   // Se l'uovo è sano oscilla morbidamente, se si sta rompendo trema violentemente
   float wobbleDeg = (crackProgress > 0) ? animAngle : sin(animAngle) * 6.0f;
 
+  // Uovo pre-renderizzato (uno sprite per crepa) letto direttamente dalla flash.
+  int stage = (crackProgress > 0.7f) ? 3 : (crackProgress > 0.4f) ? 2 : (crackProgress > 0.1f) ? 1 : 0;
+  MochiAsset egg;
+  if (mochiAssetGet(ASSET_EGG_0 + stage, &egg) && egg.w == eggW && egg.h == eggH) {
+    eggFlashSprite.setBuffer(const_cast<void*>(egg.data), egg.w, egg.h, 16);
+    eggFlashSprite.setPivot(eggW / 2, eggH / 2 + rY);
+    canvas->fillEllipse(cx, anchorY - 5, rX - 5, 8, K_PROG_BG);
+    eggFlashSprite.pushRotateZoom(canvas, cx, anchorY, wobbleDeg, 1.0f, 1.0f, 0xF81F);
+    return;
+  }
+
   // Variabile statica per ricordare a che punto era la crepa nel frame precedente
   static float lastCrack = -1.0f;
 
@@ -585,6 +607,7 @@ void MochiView::drawMgMochi(int cx, int cy, int w, int h, bool mouthOpen, bool b
 
 // ---- Dispatch ----
 void MochiView::drawMinigame(MochiMinigame &mg, unsigned long now) {
+  MochiMemScope mem(MEM_VIEW);
   drawBackground();
   switch (mg.type) {
     case MG_CHEW:     drawMgChew    (mg, now); break;
@@ -621,6 +644,21 @@ void MochiView::drawMinigameResult(bool success) {
   canvas->pushSprite(0, 0);
 }
 
+// Abbinamento BLE (aggiornamento firmware): il telefono chiede questo codice.
+void MochiView::drawPasskey(uint32_t passkey) {
+  drawBackground();
+  canvas->setTextColor(K_EYE);
+  canvas->setTextSize(2);
+  canvas->setCursor(100, 40);
+  canvas->print("CODICE BLE");
+  char digits[8];
+  snprintf(digits, sizeof(digits), "%06lu", (unsigned long)passkey);
+  canvas->setTextSize(4);
+  canvas->setCursor(88, 80);
+  canvas->print(digits);
+  canvas->pushSprite(0, 0);
+}
+
 // ---- CHEW ----
 void MochiView::drawMgChew(MochiMinigame &mg, unsigned long now) {
   unsigned long elapsed = now - mg.startTime;
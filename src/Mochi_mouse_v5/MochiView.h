@@ -9,12 +9,16 @@
 #include "Settings.h"
 #include "MochiState.h"
 #include "MochiMinigame.h"
+#include "MochiAssets.h"
 
 class MochiView {
 private:
   LGFX_Sprite* canvas;
 
-  LGFX_Sprite* eggTempSprite;
+  LGFX_Sprite* eggTempSprite;   // Uovo disegnato a runtime (solo senza partizione assets)
+  LGFX_Sprite  eggFlashSprite;  // Vista sugli sprite dell'uovo in flash: nessun buffer in heap
+
+  const uint16_t* bgEase;       // Curva del gradiente dagli asset (nullptr = calcolata con cos)
 
   uint16_t bgColors[172]; 
   bool bgCalculated;
@@ -60,6 +64,7 @@ public:
   void drawGrowthFrame(float t, AgeStage from, AgeStage to);
   void drawMinigame(MochiMinigame &mg, unsigned long now);
   void drawMinigameResult(bool success);
+  void drawPasskey(uint32_t passkey); // Codice di abbinamento BLE da digitare sul telefono
 };
 
 #endif // MOCHI_VIEW_H
\ No newline at end of file
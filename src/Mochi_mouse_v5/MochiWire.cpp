@@ -0,0 +1,87 @@
+#include "MochiWire.h"
+
+static uint8_t wireVersion(const uint8_t* data) {
+    return data[0] >> 4;
+}
+
+bool mochiWireCheck(const uint8_t* data, size_t len) {
+    if (len < 1) return false;
+    switch (wireVersion(data)) {
+        case 0:  return data[0] < PKT_LINK_ACK && len >= offsetof(MochiPacket, payload); // v1: niente ack
+        case NOW_WIRE_VERSION_V2:
+            return (data[0] & 0x0F) < PKT_LINK_ACK && len >= NOW_WIRE_HEADER_SIZE;
+        case NOW_WIRE_VERSION: {
+            uint8_t type = data[0] & 0x0F;
+            bool seq = mochiWireReliable(type) || type == PKT_LINK_ACK; // seq o seq confermato
+            return type < PKT_TYPE_COUNT && len >= NOW_WIRE_HEADER_SIZE + (seq ? 1 : 0);
+        }
+        default: return false;
+    }
+}
+
+bool mochiWireParse(const uint8_t* data, size_t len, NowPacketView* out) {
+    if (!mochiWireCheck(data, len)) return false;
+    if (len > NOW_WIRE_MAX) len = NOW_WIRE_MAX;
+
+    uint8_t version = wireVersion(data);
+    if (version) {
+        const NowWireHeader* h = (const NowWireHeader*)data;
+        out->type       = h->verType & 0x0F;
+        out->version    = version;
+        out->sender     = (MochiId)h->id[0] | ((MochiId)h->id[1] << 8) | ((MochiId)h->id[2] << 16);
+        out->hasSeq     = version == NOW_WIRE_VERSION && mochiWireReliable(out->type);
+        out->seq        = out->hasSeq ? data[NOW_WIRE_HEADER_SIZE] : 0;
+        size_t head     = NOW_WIRE_HEADER_SIZE + (out->hasSeq ? 1 : 0);
+        out->payload    = data + head;
+        out->payloadLen = len - head;
+        return true;
+    }
+
+    // v1: id testuale, ackOk come payload dell'ack, JSON della visita fino al '\0'
+    const MochiPacket* p = (const MochiPacket*)data;
+    if (!mochiIdParse(p->id, strnlen(p->id, sizeof(p->id)), &out->sender)) return false;
+    out->type    = p->type;
+    out->version = 1;
+    out->hasSeq  = false;
+    out->seq     = 0;
+    if (p->type == PKT_VISIT_ACK) {
+        out->payload    = &p->ackOk;
+        out->payloadLen = 1;
+    } else if (p->type == PKT_VISIT) {
+        size_t room = min(len - offsetof(MochiPacket, payload), sizeof(p->payload));
+        out->payload    = (const uint8_t*)p->payload;
+        out->payloadLen = strnlen(p->payload, room);
+    } else {
+        out->payload    = data + len;
+        out->payloadLen = 0;
+    }
+    return true;
+}
+
+size_t mochiWireEncode(uint8_t* out, uint8_t type, MochiId sender, uint8_t seq, const void* payload, size_t n,
+                       bool legacy) {
+    if (legacy) {
+        MochiPacket* p = (MochiPacket*)out;
+        memset(p, 0, sizeof(*p));
+        p->type = type;
+        mochiIdFormat(sender, p->id, sizeof(p->id));
+        if (type == PKT_VISIT_ACK) {
+            p->ackOk = n ? ((const uint8_t*)payload)[0] : 0;
+        } else if (n) {
+            if (n >= sizeof(p->payload)) return 0;
+            memcpy(p->payload, payload, n);
+        }
+        return sizeof(*p);
+    }
+
+    if (n > NOW_WIRE_PAYLOAD_MAX) return 0;
+    NowWireHeader* h = (NowWireHeader*)out;
+    h->verType = (NOW_WIRE_VERSION << 4) | (type & 0x0F);
+    h->id[0] = (uint8_t)sender;
+    h->id[1] = (uint8_t)(sender >> 8);
+    h->id[2] = (uint8_t)(sender >> 16);
+    size_t head = NOW_WIRE_HEADER_SIZE;
+    if (mochiWireReliable(type)) out[head++] = seq;
+    if (n) memcpy(out + head, payload, n);
+    return head + n;
+}
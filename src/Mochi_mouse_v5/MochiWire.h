@@ -0,0 +1,121 @@
+#ifndef MOCHI_WIRE_H
+#define MOCHI_WIRE_H
+
+#include <Arduino.h>
+#include <stddef.h>
+#include "MochiId.h"
+
+// ================================================================
+// PACCHETTI ESP-NOW
+// ----------------------------------------------------------------
+// v3, lunghezza variabile (la fine del pacchetto e' la fine del payload):
+//
+//   [versione << 4 | tipo][id mittente, 3 byte LE][seq][payload ...]
+//
+// seq c'e' solo nei tipi affidabili (mochiWireReliable: tutti gli unicast):
+// chi riceve risponde PKT_LINK_ACK con lo stesso seq e scarta i doppioni,
+// chi invia ritrasmette finche' non arriva l'ack. Un annuncio sono 4 byte piu'
+// il digest del gossip (NowGossipEntry, vedi MochiNow).
+//
+// Versioni precedenti, ancora decodificate per i Mochi non aggiornati:
+// - v2: stessa intestazione senza seq e senza PKT_LINK_ACK (niente conferme);
+// - v1 (MochiPacket, 226 byte fissi con l'id come testo): inizia col tipo,
+//   quindi ha il nibble alto a 0.
+// Con NOW_WIRE_LEGACY_TX si trasmette anche in v1 (e gli annunci non portano
+// il digest).
+// ================================================================
+
+#define NOW_WIRE_VERSION     3
+#define NOW_WIRE_VERSION_V2  2   // Senza seq
+#define NOW_WIRE_HEADER_SIZE 4
+#define NOW_WIRE_MAX         250 // Payload massimo di un pacchetto ESP-NOW
+#define NOW_WIRE_PAYLOAD_MAX (NOW_WIRE_MAX - NOW_WIRE_HEADER_SIZE - 1) // Meno il seq
+
+// Tipi di pacchetto scambiati tra Mochi (4 bit).
+enum MochiPktType : uint8_t {
+    PKT_ANNOUNCE     = 0, // Broadcast periodico di presenza
+    PKT_VISIT        = 1, // Consegna dell'avatar in visita (unicast)
+    PKT_VISIT_ACK    = 2, // Risposta all'host (unicast): payload [1 = accettato, 0 = occupato]
+    PKT_FRIEND_REQ   = 3, // Richiesta di amicizia (unicast)
+    PKT_FRIEND_ACCEPT= 4, // Accettazione di una richiesta (unicast) → amicizia mutua
+    PKT_FRIEND_REMOVE= 5, // Rimozione amicizia (unicast) → l'altro rimuove a sua volta
+    PKT_VISIT_END    = 6, // L'ospite torna a casa in anticipo (unicast all'host)
+    PKT_LINK_ACK     = 7, // Conferma di consegna: payload [seq ricevuto] (dalla v3)
+    PKT_TYPE_COUNT
+};
+
+struct __attribute__((packed)) NowWireHeader {
+    uint8_t verType; // NOW_WIRE_VERSION << 4 | MochiPktType
+    uint8_t id[3];   // MochiId little endian
+};
+static_assert(sizeof(NowWireHeader) == NOW_WIRE_HEADER_SIZE, "NowWireHeader: 4 byte");
+
+// Voce del digest in coda a PKT_ANNOUNCE: un Mochi che il mittente conosce,
+// direttamente (hops = 1) o per sentito dire. age in unita' di GOSSIP_AGE_UNIT_MS,
+// saturata a 255.
+struct __attribute__((packed)) NowGossipEntry {
+    uint8_t id[3];   // MochiId little endian
+    uint8_t hops;
+    uint8_t age;
+};
+static_assert(sizeof(NowGossipEntry) == 5, "NowGossipEntry: 5 byte");
+
+// Payload di PKT_VISIT: lo stato del Mochi che parte, per disegnarlo dall'host.
+// I campi nuovi si aggiungono solo in coda e size dice quanti byte ha scritto
+// il mittente: chi e' piu' vecchio legge il prefisso che conosce, chi e' piu'
+// nuovo tiene i default per i campi che mancano. version cambia solo se il
+// formato diventa incompatibile. Interi little endian (come l'ESP32). I Mochi
+// v1 mandano ancora il JSON di una volta, che inizia con '{'.
+#define VISIT_RECORD_VERSION  1
+#define VISIT_RECORD_MIN_SIZE 13 // Fino a bgBottom: i campi della prima versione
+
+struct __attribute__((packed)) NowVisitRecord {
+    uint8_t  version;       // VISIT_RECORD_VERSION
+    uint8_t  size;          // sizeof(NowVisitRecord) del mittente
+    uint8_t  age;           // AgeStage
+    uint8_t  hunger;
+    uint8_t  happy;
+    uint8_t  str, spd, intel, chr;
+    uint16_t bgTop;         // Colori di casa (RGB565), per il gradiente dell'ospite
+    uint16_t bgBottom;
+    uint8_t  appearance[4]; // Riservati all'aspetto (accessori, ...): 0 = niente
+};
+static_assert(sizeof(NowVisitRecord) == 17, "NowVisitRecord: 17 byte");
+static_assert(sizeof(NowVisitRecord) <= NOW_WIRE_PAYLOAD_MAX, "NowVisitRecord: non sta in un pacchetto");
+static_assert(offsetof(NowVisitRecord, appearance) == VISIT_RECORD_MIN_SIZE, "NowVisitRecord: prima versione");
+
+// Formato v1, solo per compatibilita'.
+typedef struct {
+    uint8_t type;        // MochiPktType
+    uint8_t ackOk;       // Per PKT_VISIT_ACK: 1 = accettato, 0 = occupato
+    char    id[24];      // ID del mittente (es. "MOCHI-ABCDEF")
+    char    payload[200];// Per PKT_VISIT: avatar JSON; altrimenti vuoto
+} MochiPacket;
+static_assert(sizeof(MochiPacket) == 226, "MochiPacket v1: 226 byte");
+static_assert(offsetof(MochiPacket, payload) == 26, "MochiPacket v1: payload a 26");
+
+// Pacchetto ricevuto, v1 o v2: punta nel buffer di ricezione, niente copie.
+struct NowPacketView {
+    uint8_t        type;
+    uint8_t        version;
+    MochiId        sender;
+    bool           hasSeq;  // Pacchetto affidabile v3: va confermato
+    uint8_t        seq;
+    const uint8_t* payload;
+    uint8_t        payloadLen;
+};
+
+// Tipi consegnati con conferma e ritrasmissione (in v3).
+inline bool mochiWireReliable(uint8_t type) {
+    return type != PKT_ANNOUNCE && type != PKT_LINK_ACK;
+}
+
+// Controllo veloce per la callback di ricezione: versione, tipo e lunghezza minima.
+bool   mochiWireCheck(const uint8_t* data, size_t len);
+bool   mochiWireParse(const uint8_t* data, size_t len, NowPacketView* out);
+// Scrive un pacchetto in out (almeno NOW_WIRE_MAX byte), 0 se il payload non ci
+// sta. seq si usa solo per i tipi affidabili; la v1 non lo porta.
+size_t mochiWireEncode(uint8_t* out, uint8_t type, MochiId sender, uint8_t seq, const void* payload, size_t n,
+                       bool legacy = false);
+
+#endif // MOCHI_WIRE_H
@@ -0,0 +1,133 @@
+#include "MochiWriter.h"
+#include <stdarg.h>
+
+MochiWriter::MochiWriter(char* b, size_t c) : buf(b), cap(c) {
+  reset();
+}
+
+void MochiWriter::reset() {
+  len = 0;
+  overflow = false;
+  depth = 0;
+  first[0] = true;
+  afterKey = false;
+  if (cap > 0) buf[0] = '\0';
+}
+
+void MochiWriter::advance(size_t n) {
+  if (n > room()) { n = room(); overflow = true; }
+  len += n;
+  buf[len] = '\0';
+}
+
+void MochiWriter::patch(size_t pos, const void* p, size_t n) {
+  if (pos + n > len) return;
+  memcpy(buf + pos, p, n);
+}
+
+MochiWriter& MochiWriter::raw(const char* s, size_t n) {
+  size_t r = room();
+  if (n > r) { n = r; overflow = true; }
+  memcpy(buf + len, s, n);
+  len += n;
+  if (cap > 0) buf[len] = '\0';
+  return *this;
+}
+
+MochiWriter& MochiWriter::raw(const char* s) {
+  return raw(s, strlen(s));
+}
+
+MochiWriter& MochiWriter::ch(char c) {
+  return raw(&c, 1);
+}
+
+MochiWriter& MochiWriter::printf(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  size_t r = room();
+  int n = vsnprintf(buf + len, r + 1, fmt, ap);
+  va_end(ap);
+  if (n < 0) return *this;
+  if ((size_t)n > r) { n = r; overflow = true; }
+  len += n;
+  return *this;
+}
+
+void MochiWriter::sep() {
+  if (afterKey) { afterKey = false; return; }
+  if (!first[depth]) ch(',');
+  first[depth] = false;
+}
+
+void MochiWriter::open(char c) {
+  sep();
+  ch(c);
+  if (depth + 1 < WRITER_MAX_DEPTH) depth++;
+  first[depth] = true;
+}
+
+void MochiWriter::close(char c) {
+  if (depth > 0) depth--;
+  ch(c);
+}
+
+MochiWriter& MochiWriter::beginObject() { open('{');  return *this; }
+MochiWriter& MochiWriter::endObject()   { close('}'); return *this; }
+MochiWriter& MochiWriter::beginArray()  { open('[');  return *this; }
+MochiWriter& MochiWriter::endArray()    { close(']'); return *this; }
+
+MochiWriter& MochiWriter::key(const char* k) {
+  sep();
+  ch('"').raw(k).raw("\":", 2);
+  afterKey = true;
+  return *this;
+}
+
+MochiWriter& MochiWriter::members(const char* s, size_t n) {
+  if (n == 0) return *this;
+  sep();
+  return raw(s, n);
+}
+
+MochiWriter& MochiWriter::str(const char* s, size_t n) {
+  sep();
+  ch('"');
+  for (size_t i = 0; i < n; i++) {
+    char c = s[i];
+    if (c == '"' || c == '\\') { ch('\\'); ch(c); }
+    else if (c == '\n') raw("\\n", 2);
+    else if ((uint8_t)c < 0x20) printf("\\u%04x", (uint8_t)c);
+    else ch(c);
+  }
+  return ch('"');
+}
+
+MochiWriter& MochiWriter::str(const char* s) {
+  return str(s, strlen(s));
+}
+
+MochiWriter& MochiWriter::num(long v) {
+  sep();
+  return printf("%ld", v);
+}
+
+MochiWriter& MochiWriter::boolean(bool v) {
+  sep();
+  return v ? raw("true", 4) : raw("false", 5);
+}
+
+MochiWriter& MochiWriter::id(MochiId v) {
+  char b[MOCHI_ID_STR_SIZE];
+  size_t n = mochiIdFormat(v, b, sizeof(b));
+  return str(b, n);
+}
+
+// Espande ogni canale a 8 bit replicando i bit alti (inverso di hexToRGB565).
+MochiWriter& MochiWriter::hexColor(uint16_t c) {
+  uint8_t r = (c >> 11) & 0x1F; r = (r << 3) | (r >> 2);
+  uint8_t g = (c >> 5)  & 0x3F; g = (g << 2) | (g >> 4);
+  uint8_t b =  c        & 0x1F; b = (b << 3) | (b >> 2);
+  sep();
+  return printf("\"#%02X%02X%02X\"", r, g, b);
+}
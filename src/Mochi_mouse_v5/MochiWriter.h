@@ -0,0 +1,75 @@
+#ifndef MOCHI_WRITER_H
+#define MOCHI_WRITER_H
+
+#include <Arduino.h>
+#include "MochiId.h"
+
+// ================================================================
+// WRITER A BUFFER FISSO
+// ----------------------------------------------------------------
+// Serializza JSON (o testo) direttamente in un buffer preallocato dal
+// chiamante, tipicamente il buffer di notify del BLE: niente String, niente
+// copie intermedie. Le virgole tra gli elementi sono gestite in automatico.
+// Se il buffer finisce il testo viene troncato e overflowed() diventa true.
+// ================================================================
+
+#define WRITER_MAX_DEPTH 8
+
+class MochiWriter {
+public:
+  MochiWriter(char* buf, size_t cap);
+
+  void   reset();
+  const char* data() const { return buf; }
+  size_t length() const { return len; }
+  bool   overflowed() const { return overflow; }
+
+  // --- Testo grezzo ---
+  MochiWriter& raw(const char* s);
+  MochiWriter& raw(const char* s, size_t n);
+  MochiWriter& ch(char c);
+  MochiWriter& printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+  // --- JSON ---
+  MochiWriter& beginObject();
+  MochiWriter& endObject();
+  MochiWriter& beginArray();
+  MochiWriter& endArray();
+  MochiWriter& key(const char* k);            // "k": (virgola inclusa se serve)
+  MochiWriter& members(const char* s, size_t n); // membri gia' serializzati ("k":v,...)
+  MochiWriter& str(const char* s);            // stringa con escape
+  MochiWriter& str(const char* s, size_t n);
+  MochiWriter& num(long v);
+  MochiWriter& boolean(bool v);
+  MochiWriter& id(MochiId v);                 // "MOCHI-ABCDEF"
+  MochiWriter& hexColor(uint16_t rgb565);     // "#RRGGBB"
+
+  // Scorciatoie chiave + valore
+  MochiWriter& field(const char* k, long v)        { return key(k).num(v); }
+  MochiWriter& field(const char* k, int v)         { return key(k).num(v); }
+  MochiWriter& field(const char* k, const char* v) { return key(k).str(v); }
+  MochiWriter& fieldBool(const char* k, bool v)    { return key(k).boolean(v); }
+
+  // Spazio libero in coda, per chi scrive da se' (es. serializeJson) e poi
+  // chiama advance() con i byte scritti.
+  char*  tail() { return buf + len; }
+  size_t room() const { return (cap > len + 1) ? cap - len - 1 : 0; }
+  void   advance(size_t n);
+  void   patch(size_t pos, const void* p, size_t n); // Riscrive byte gia' scritti (es. lunghezze)
+  void   markOverflow() { overflow = true; }          // Qualcosa non ci stava ed e' stato saltato
+
+private:
+  char*   buf;
+  size_t  cap;
+  size_t  len;
+  bool    overflow;
+  uint8_t depth;
+  bool    first[WRITER_MAX_DEPTH]; // nessun elemento ancora nel contenitore corrente
+  bool    afterKey;                // il prossimo valore segue una chiave: niente virgola
+
+  void sep();                      // virgola prima di un nuovo elemento
+  void open(char c);
+  void close(char c);
+};
+
+#endif // MOCHI_WRITER_H
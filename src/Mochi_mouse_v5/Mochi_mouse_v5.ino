@@ -11,6 +11,9 @@
 // #include "MochiServer.h"
 #include "MochiBLE.h"
 #include "MochiNow.h"
+#include "MochiEspNow.h"
+#include "MochiCmd.h"
+#include "MochiMem.h"
 
 // --- OGGETTI GLOBALI ---
 LGFX_Waveshare display;
@@ -162,6 +165,24 @@ void handleAnimations(unsigned long now) {
   }
 }
 
+// --- COMANDI DA SERIALE (diagnostica) ---
+// Una riga alla volta, con i verbi della app: per ora solo get_mem, che
+// stampa la tabella della memoria per sottosistema.
+void handleSerial() {
+  static char line[32];
+  static uint8_t len = 0;
+  while (Serial.available()) {
+    char c = Serial.read();
+    if (c != '\n' && c != '\r') {
+      if (len < sizeof(line)) line[len++] = c;
+      continue;
+    }
+    MochiCmd cmd;
+    if (len && mochiCmdParse((const uint8_t*)line, len, &cmd) && cmd.id == CMD_GET_MEM) mochiMemPrint();
+    len = 0;
+  }
+}
+
 //----------------- SETUP ---------------------------------------------------------------
 
 void setup() {
@@ -184,10 +205,11 @@ void setup() {
 
   // Inizializzazione Stato e View
   mochi.begin();
+  mochiAssetsBegin(); // Sprite e tabelle in flash (prima della view, che li cerca)
   view = new MochiView(&canvas);
 
   pinMode(g_board.bl, OUTPUT);
-  analogWrite(g_board.bl, mochi.screenBrightness);
+  analogWrite(g_board.bl, mochi.settings.brightness);
 
   pinMode(PIN_BTN, INPUT_PULLUP);
   attachInterrupt(digitalPinToInterrupt(PIN_BTN), btnISR, CHANGE);
@@ -210,7 +232,7 @@ void setup() {
   ble->begin();
 
   // Discovery e visite tra Mochi ora via ESP-NOW (BLE resta solo per la app)
-  social = new MochiNow(&mochi);
+  social = new MochiNow(&mochi, new MochiEspNow());
   social->begin();
   ble->attachSocial(social);
 
@@ -223,6 +245,17 @@ void loop() {
   unsigned long now = millis();
   bool isConnected = true;
 
+  // Comandi BLE in coda e risposte a pezzi (storico): anche durante animazioni e minigiochi
+  ble->tick();
+  handleSerial();
+
+  // Abbinamento BLE in corso: il codice resta a schermo finche' non finisce
+  if (ble->pairingPasskey()) {
+    view->drawPasskey(ble->pairingPasskey());
+    delay(15);
+    return;
+  }
+
   // --- BUTTON (ISR flags) ---
   bool justPressed = false, justReleased = false;
   noInterrupts();
@@ -278,12 +311,12 @@ void loop() {
     return;
   } 
   
-  if (mochi.lastCommand != "") {
+  if (mochi.lastCommand != CMD_NONE) {
      mochi.isHeartVisible = true;
      mochi.heartShowTime = millis();
-     if (mochi.lastCommand == "prev") indietroPresentazione();
-     else if (mochi.lastCommand == "next") avantiPresentazione();
-     mochi.lastCommand = ""; 
+     if (mochi.lastCommand == CMD_PREV) indietroPresentazione();
+     else if (mochi.lastCommand == CMD_NEXT) avantiPresentazione();
+     mochi.lastCommand = CMD_NONE; 
   } else {
      mochi.triggerHeart(); 
   }
@@ -319,13 +352,12 @@ void loop() {
   mochi.isFriendNearby = (social->nearbyCount() > 0);
 
   // --- VISITE: scadenze (ritorno a casa / fine ospitalità) ---
-  if (mochi.isAway && now >= mochi.awayUntil) mochi.returnHome();
-  if (mochi.isHostingGuest && now >= mochi.guestUntil) mochi.guestLeaves();
+  mochi.tickVisits();
 
   // Disegno a schermo
   // --- CONTROLLO AGGIORNAMENTO COLORI ---
   if (mochi.colorsUpdated) {
-    view->setBackgroundColors(mochi.bgTopColor, mochi.bgBottomColor);
+    view->setBackgroundColors(mochi.settings.bgTop, mochi.settings.bgBottom);
     mochi.colorsUpdated = false; // Resetta il flag
   }
   view->render(mochi, (int)bounce, animAngle, wink, isConnected);
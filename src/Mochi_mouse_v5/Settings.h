@@ -45,6 +45,15 @@
 #define HAPPY_DECAY  0.10
 #define ACTION_INTERVAL 300000 // 5 minuti
 #define STATE_COOLDOWN  60000  // 1 minuto
+#define DEFAULT_UNIX_TIME 1700000000 // Orario di ripiego prima della prima sincronizzazione
+
+// --- CICLO VITALE ---
+#define SCHEDULE_MAX_ENTRIES  8    // Voci massime del calendario settimanale (set_json "schedule")
+
+// --- IMPOSTAZIONI ---
+#define SETTINGS_JSON_SIZE    1024 // Capienza del documento JSON di un set_json (schedule incluso)
+#define SETTINGS_TZ_SIZE      48   // Fuso orario IANA, es. "America/Argentina/Buenos_Aires"
+#define SETTINGS_SPILL_SIZE   256  // Spazio per le chiavi di setting sconosciute (JSON)
 
 // --- BUTTON ---
 #define PIN_BTN        0   // BOOT button, active LOW
@@ -55,10 +64,80 @@
 
 // --- SOCIAL / DISCOVERY (ESP-NOW) ---
 #define ESPNOW_CHANNEL      1       // Canale WiFi comune a tutti i Mochi per ESP-NOW
-#define ANNOUNCE_INTERVAL_MS 5000   // Ogni quanto un Mochi annuncia la propria presenza
+#define ANNOUNCE_MIN_MS     1000    // Intervallo degli annunci dopo un cambio di vicini (Trickle)
+#define ANNOUNCE_MAX_MS     8000    // Intervallo massimo a vicinato stabile
+#define ANNOUNCE_REDUNDANCY 3       // Annunci sentiti nell'intervallo oltre i quali si tace
+#define ANNOUNCE_MAX_SILENT_MS 10000 // Annuncio comunque dopo tanto silenzio (<= NEARBY_TIMEOUT_MS / 3)
 #define NEARBY_TIMEOUT_MS   30000   // Dopo quanto un vicino è considerato "sparito"
-#define MAX_NEARBY          8       // Numero massimo di vicini tracciati
-#define MAX_FRIENDS         16      // Numero massimo di amici memorizzabili
+#define MAX_NEARBY          64      // Numero massimo di vicini tracciati (potenza di 2, max 64)
+#define NOW_PEER_CACHE      6       // Peer unicast registrati in ESP-NOW (limite hardware 20)
+#define MAX_FRIENDS         256     // Numero massimo di amici memorizzabili
+#define MAX_PENDING_REQS    32      // Richieste di amicizia in arrivo tenute in sospeso
+#define NEARBY_RSSI_STEP    6       // dB: variazione di RSSI che conta come "vicino cambiato"
+#define NOW_RX_QUEUE_LEN    16      // Pacchetti ricevuti in attesa del loop (potenza di 2)
+#define NOW_RX_PER_TICK     8       // Pacchetti gestiti per giro di loop
+#define NOW_WIRE_LEGACY_TX  0       // 1 = trasmette ancora i pacchetti v1 da 226 byte (flotta mista)
+#define NOW_TX_QUEUE_LEN    8       // Pacchetti in attesa di invio o di conferma
+#define NOW_TX_ACK_RESERVED 2       // Posti della coda tenuti liberi per i PKT_LINK_ACK
+#define NOW_TX_RETRY_MS     60      // Primo timeout di ritrasmissione (poi raddoppia)
+#define NOW_TX_MAX_TRIES    5       // Tentativi prima di rinunciare (~2 s in tutto)
+#define NOW_TX_DONE_TIMEOUT_MS 50   // Callback di invio mai arrivata: si riparte lo stesso
+#define NOW_RX_DEDUP        4       // Seq ricordati per peer per scartare i doppioni
+#define NOW_RX_DEDUP_PEERS  16      // Mittenti ricordati per i doppioni (tabella per MAC)
+#define NOW_RX_DEDUP_MS     2500    // Oltre i ritentativi di chi invia: poi un seq e' di nuovo valido
+#define GOSSIP_DIGEST_MAX   8       // Voci del digest per annuncio (5 byte l'una)
+#define GOSSIP_MAX_HOPS     3       // Mochi lontani piu' di cosi' non si tengono
+#define GOSSIP_TABLE_SIZE   32      // Mochi fuori portata ricordati
+#define GOSSIP_TTL_MS       120000  // Dopo quanto un Mochi lontano e' considerato "sparito"
+#define GOSSIP_AGE_UNIT_MS  2000    // Risoluzione dell'eta' nel digest (255 unita' = 8.5 min)
+#define LINK_TABLE_SIZE     24      // Mochi di cui si tengono le statistiche, anche dopo che sono spariti
+#define LINK_GAP_BUCKETS    6       // Istogramma degli intervalli tra annunci: <2s, <4s ... >=32s
+#define LINK_GAP_FIRST_MS   2000
+#define LINK_RTT_BUCKETS    6       // Istogramma dei tempi di conferma: <10ms, <20ms ... >=160ms
+#define LINK_RTT_FIRST_MS   10
+
+// --- BLE ---
+#define BLE_MTU             512     // MTU richiesto alla connessione
+#define BLE_NOTIFY_SIZE     (BLE_MTU - 3) // Payload massimo di una notify (MTU - header ATT)
+#define BLE_STATE_BUF_SIZE  96      // Buffer dedicato al push periodico dello stato
+#define BLE_REPLY_BUF_SIZE  2048    // Risposta completa, prima di dividerla in frammenti
+#define BLE_MIN_MTU         23      // MTU di default se la app non ne negozia uno
+#define BLE_CMD_QUEUE_LEN   8       // Comandi in attesa del loop (potenza di 2)
+#define BLE_CMD_MAX_LEN     512     // Comando piu' lungo accettato (set_json)
+#define BLE_CMD_PER_TICK    4       // Comandi eseguiti per giro di loop
+#define BLE_BUSY_QUEUE_LEN  8       // PE_BUSY in attesa del loop (potenza di 2)
+#define STATE_SUB_MIN_MS    250     // Intervallo minimo tra due notifiche di stato (iscrizione)
+#define STATE_SUB_DEFAULT_MS 1000   // Intervallo se la app non lo specifica
+#define STATE_KEYFRAME_MS   60000   // Ogni quanto rimandare lo stato completo (resync)
+#define SOCIAL_SUB_MIN_MS   500     // Intervallo minimo tra due eventi social (iscrizione)
+#define SOCIAL_SUB_DEFAULT_MS 1000  // Intervallo se la app non lo specifica
+
+// --- STORICO (partizione "history", vedi partitions.csv) ---
+#define HISTORY_PARTITION    "history"
+#define HISTORY_SUBTYPE      0x40   // Sottotipo "data" custom
+#define HISTORY_INTERVAL_S   (ACTION_INTERVAL / 1000) // Un campione a ogni tick
+#define HISTORY_PUMP_RECORDS 128    // Record decodificati al massimo per pacchetto
+
+// --- AGGIORNAMENTO FIRMWARE VIA BLE (vedi MochiOta.h, tools/pack_ota.py) ---
+#define OTA_QUEUE_LEN        16     // Pezzi in attesa del loop (potenza di 2)
+#define OTA_PER_TICK         8      // Pezzi decompressi e scritti per giro di loop
+#define OTA_ACK_BYTES        4096   // Conferma alla app ogni tanti byte compressi...
+#define OTA_ACK_CHUNKS       8      // ...o ogni tanti pezzi (MTU piccolo), sotto OTA_QUEUE_LEN
+#define OTA_RESTART_DELAY_MS 1000   // Attesa dopo END, per far partire la risposta
+#define OTA_NAK_REPEAT_MS    300    // BAD_OFFSET ripetuto finche' la app non torna al buco...
+#define OTA_NAK_REPEATS      6      // ...al massimo tante volte (poi vale il timeout della app)
+
+// --- ASSET (partizione "assets", generata da tools/pack_assets.py) ---
+#define ASSETS_PARTITION     "assets"
+#define ASSETS_SUBTYPE       0x41
+
+// --- DIAGNOSTICA MEMORIA (vedi MochiMem.h) ---
+// I contatori di new/delete per sottosistema ci sono sempre. 1 = anche la
+// variazione dell'heap libero misurata in ogni scope (getFreeHeap() a ogni
+// scope: solo per il debug). Si puo' accendere da fuori con -DMOCHI_MEM_TRACK=1.
+#ifndef MOCHI_MEM_TRACK
+#define MOCHI_MEM_TRACK      0
+#endif
 
 // --- VISITE ---
 #define VISIT_DURATION_MS   120000  // Quanto dura una visita (2 min)
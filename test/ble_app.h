@@ -0,0 +1,202 @@
+#ifndef MOCHI_BLE_APP_H
+#define MOCHI_BLE_APP_H
+
+// ================================================================
+// APP FINTA PER I TEST BLE
+// ----------------------------------------------------------------
+// Un Mochi (MochiState + MochiBLE) collegato in loopback allo shim BLE e una
+// app minima che fa quello che fa connect.js: HELLO, frame, batch, comandi di
+// testo, riassemblaggio dei frammenti e PT_RESEND per quelli persi. Le notify
+// arrivano in inbox; lossPct scarta a caso i frammenti (random() dello shim,
+// quindi sempre gli stessi a parita' di seme).
+// ================================================================
+
+#include "mochi_test.h"
+#include "MochiBLE.h"
+#include "MochiProto.h"
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <map>
+#include <vector>
+
+#define APP_CMD_UUID    "beb5483e-36e1-4688-b7f5-ea07361b26a9"
+#define APP_LEGACY_UUID "beb5483e-36e1-4688-b7f5-ea07361b26a8"
+#define APP_STATE_UUID  "beb5483e-36e1-4688-b7f5-ea07361b26aa"
+#define APP_SOCIAL_UUID "beb5483e-36e1-4688-b7f5-ea07361b26ab"
+#define APP_DIAG_UUID   "beb5483e-36e1-4688-b7f5-ea07361b26ac"
+#define APP_OTA_UUID    "beb5483e-36e1-4688-b7f5-ea07361b26ad"
+#define APP_CAPS        0x7FF // Tutto quello che conosce connect.js
+
+typedef std::vector<uint8_t> Bytes;
+
+struct AppNote {
+  BLECharacteristic* chr;
+  Bytes data;
+};
+
+struct AppTlv {
+  uint8_t tag;
+  Bytes   val;
+};
+
+struct AppFrame {
+  uint8_t type = 0;
+  uint8_t reqId = 0;
+  std::vector<AppTlv> tlvs;
+  size_t count(uint8_t tag) const {
+    size_t n = 0;
+    for (const AppTlv& t : tlvs) n += t.tag == tag;
+    return n;
+  }
+};
+
+class BleApp {
+public:
+  MochiState state;
+  Adafruit_NeoPixel led;
+  MochiBLE ble;
+  BLECharacteristic *cmd, *legacy, *stateChr, *social, *diag, *ota;
+  std::vector<AppNote> inbox;
+  int      lossPct = 0;   // Probabilita' di perdere un frammento
+  unsigned lost = 0;      // Frammenti persi
+  unsigned resends = 0;   // PT_RESEND mandati
+  uint8_t  reqId = 0;
+
+  explicit BleApp(uint16_t mtu) : led(1, 0, 0), ble(&state, &led) {
+    hostPartitionsClear();
+    hostOtaReset();
+    state.begin();
+    ble.begin();
+    cmd      = hostBleFind(APP_CMD_UUID);
+    legacy   = hostBleFind(APP_LEGACY_UUID);
+    stateChr = hostBleFind(APP_STATE_UUID);
+    social   = hostBleFind(APP_SOCIAL_UUID);
+    diag     = hostBleFind(APP_DIAG_UUID);
+    ota      = hostBleFind(APP_OTA_UUID);
+    hostBleNotify = [this](BLECharacteristic* c, const uint8_t* d, size_t n) {
+      if (n && d[0] == FRAG_MAGIC && lossPct && random(100) < lossPct) {
+        lost++;
+        return;
+      }
+      inbox.push_back({ c, Bytes(d, d + n) });
+    };
+    hostBleConnect(mtu);
+  }
+
+  ~BleApp() {
+    hostBleDisconnect();
+    hostBleNotify = nullptr;
+  }
+
+  bool write(BLECharacteristic* c, const Bytes& b) { return hostBleWrite(c, b.data(), b.size()); }
+  bool write(BLECharacteristic* c, const char* s)  { return hostBleWrite(c, (const uint8_t*)s, strlen(s)); }
+
+  // Qualche giro di loop: i comandi in coda vengono eseguiti e rispondono.
+  void run(int ticks = 4) {
+    for (int i = 0; i < ticks; i++) ble.tick();
+  }
+
+  Bytes frame(uint8_t type, const std::vector<AppTlv>& tlvs = {}) {
+    reqId = reqId % 255 + 1;
+    Bytes body;
+    for (const AppTlv& t : tlvs) {
+      body.push_back(t.tag);
+      body.push_back(t.val.size());
+      body.insert(body.end(), t.val.begin(), t.val.end());
+    }
+    Bytes f = { PROTO_MAGIC, type, reqId, (uint8_t)body.size(), (uint8_t)(body.size() >> 8) };
+    f.insert(f.end(), body.begin(), body.end());
+    return f;
+  }
+
+  static Bytes le(uint32_t v, int n) {
+    Bytes b;
+    for (int i = 0; i < n; i++) b.push_back(v >> (8 * i));
+    return b;
+  }
+
+  static std::vector<AppFrame> parse(const Bytes& b) {
+    std::vector<AppFrame> out;
+    const uint8_t* p = b.data();
+    size_t left = b.size();
+    AppFrame f;
+    MochiTlvReader r;
+    while (left && mochiProtoParse(p, left, &f.type, &f.reqId, &r)) {
+      size_t used = PROTO_HEADER_SIZE + r.n;
+      uint8_t tag, len;
+      const uint8_t* val;
+      f.tlvs.clear();
+      while (r.next(&tag, &val, &len)) f.tlvs.push_back({ tag, Bytes(val, val + len) });
+      out.push_back(f);
+      p += used;
+      left -= used;
+    }
+    return out;
+  }
+
+  bool hello(uint32_t caps = APP_CAPS) {
+    write(cmd, frame(PT_HELLO, { { TAG_CAPS, le(caps, 4) } }));
+    run();
+    Bytes r;
+    return take(&r) && !parse(r).empty() && parse(r)[0].type == (PT_HELLO | PROTO_REPLY);
+  }
+
+  // Prossimo messaggio completo arrivato (frammenti gia' riuniti). Se dopo le
+  // notify manca qualche frammento chiede il resto come connect.js, al massimo
+  // maxResends volte.
+  bool take(Bytes* out, BLECharacteristic** from = nullptr, int maxResends = 0) {
+    for (int round = 0;; round++) {
+      while (!inbox.empty()) {
+        AppNote n = inbox.front();
+        inbox.erase(inbox.begin());
+        if (n.data.empty()) continue;
+        if (n.data[0] != FRAG_MAGIC) {
+          *out = n.data;
+          if (from) *from = n.chr;
+          return true;
+        }
+        if (reassemble(n.data, out)) {
+          if (from) *from = n.chr;
+          return true;
+        }
+      }
+      if (round >= maxResends || !askResend()) return false;
+      run();
+    }
+  }
+
+private:
+  struct Partial {
+    Bytes    buf;
+    size_t   size = 0;
+    uint8_t  next = 0;
+  };
+  std::map<uint8_t, Partial> partial;
+
+  bool reassemble(const Bytes& n, Bytes* out) {
+    uint8_t msgId = n[1], seq = n[2];
+    size_t total = n[3] | (n[4] << 8);
+    size_t len = n.size() - FRAG_HEADER_SIZE;
+    Partial& m = partial[msgId];
+    if (m.buf.size() != total || (seq == 0 && m.next > 0)) m = Partial{ Bytes(total), 0, 0 };
+    if (seq != m.next || m.size + len > total) return false; // Fuori ordine: torna col resend
+    memcpy(m.buf.data() + m.size, n.data() + FRAG_HEADER_SIZE, len);
+    m.size += len;
+    m.next++;
+    if (m.size < total) return false;
+    *out = m.buf;
+    partial.erase(msgId);
+    return true;
+  }
+
+  bool askResend() {
+    if (partial.empty()) return false;
+    auto it = partial.begin();
+    write(cmd, frame(PT_RESEND, { { TAG_FRAG_MSG, { it->first } },
+                                  { TAG_FRAG_OFFSET, le(it->second.size, 2) } }));
+    resends++;
+    return true;
+  }
+};
+
+#endif // MOCHI_BLE_APP_H
@@ -0,0 +1,33 @@
+#include "mochi_test.h"
+#include <stdlib.h>
+
+static MochiTestCase* s_first = nullptr;
+static MochiTestCase** s_last = &s_first;
+static int s_failures = 0;
+
+void mochiTestRegister(MochiTestCase* t) {
+  *s_last = t;
+  s_last = &t->next;
+}
+
+void mochiTestFail(const char* file, int line, const char* what) {
+  s_failures++;
+  printf("  FALLITO %s:%d: %s\n", file, line, what);
+}
+
+int main(int argc, char** argv) {
+  int failed = 0, run = 0;
+  for (MochiTestCase* t = s_first; t; t = t->next) {
+    if (argc > 1 && !strstr(t->name, argv[1])) continue; // Filtro per nome
+    int before = s_failures;
+    hostSetMillis(0);
+    randomSeed(1);
+    t->fn();
+    run++;
+    bool ok = s_failures == before;
+    failed += !ok;
+    printf("[%s] %s\n", ok ? " ok " : "FAIL", t->name);
+  }
+  printf("%d/%d test superati\n", run - failed, run);
+  return failed;
+}
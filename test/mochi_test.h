@@ -0,0 +1,50 @@
+#ifndef MOCHI_TEST_H
+#define MOCHI_TEST_H
+
+// ================================================================
+// MINI FRAMEWORK DEI TEST HOST
+// ----------------------------------------------------------------
+//   TEST(nome) { CHECK(cond); CHECK_EQ(a, b); }
+// Ogni eseguibile raccoglie i suoi TEST e li esegue tutti (mochi_test.cpp):
+// il codice di uscita e' il numero di test falliti, come vuole ctest.
+// BENCH_REPORT stampa una riga "bench" che finisce anche nel log di ctest.
+// ================================================================
+
+#include <Arduino.h>
+#include <stdio.h>
+
+struct MochiTestCase {
+  const char*    name;
+  void         (*fn)();
+  MochiTestCase* next;
+};
+
+void mochiTestRegister(MochiTestCase* t);
+void mochiTestFail(const char* file, int line, const char* what);
+
+struct MochiTestReg {
+  MochiTestCase t;
+  MochiTestReg(const char* name, void (*fn)()) : t{ name, fn, nullptr } { mochiTestRegister(&t); }
+};
+
+#define TEST(name)                                           \
+  static void name();                                        \
+  static MochiTestReg name##_reg(#name, name);               \
+  static void name()
+
+#define CHECK(cond)                                          \
+  do { if (!(cond)) mochiTestFail(__FILE__, __LINE__, #cond); } while (0)
+
+#define CHECK_EQ(a, b)                                                          \
+  do {                                                                          \
+    long long va_ = (long long)(a), vb_ = (long long)(b);                       \
+    if (va_ != vb_) {                                                           \
+      char msg_[256];                                                           \
+      snprintf(msg_, sizeof(msg_), "%s == %s (%lld != %lld)", #a, #b, va_, vb_); \
+      mochiTestFail(__FILE__, __LINE__, msg_);                                  \
+    }                                                                           \
+  } while (0)
+
+#define BENCH_REPORT(...) do { printf("bench: "); printf(__VA_ARGS__); printf("\n"); } while (0)
+
+#endif // MOCHI_TEST_H
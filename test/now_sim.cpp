@@ -0,0 +1,324 @@
+#include "now_sim.h"
+#include <esp_partition.h>
+#include <algorithm>
+#include <math.h>
+
+static const uint8_t BCAST[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static uint32_t xorshift(uint32_t& s) {
+  s ^= s << 13;
+  s ^= s >> 17;
+  s ^= s << 5;
+  return s;
+}
+
+// ==========================================
+// NODO
+// ==========================================
+
+SimNode::SimNode(NowSim* n, int i) : index(i), net(n) {
+  const SimConfig& cfg = n->config();
+  id = 0xA00000 + i;
+  const uint8_t m[6] = { 0x02, 0x4D, 0x4F, 0x00, (uint8_t)(i >> 8), (uint8_t)i };
+  memcpy(mac, m, 6);
+  x = (net->rand32() % 10000) * cfg.areaM / 10000;
+  y = (net->rand32() % 10000) * cfg.areaM / 10000;
+  clockOffset = cfg.clockSpreadMs ? net->rand32() % cfg.clockSpreadMs : 0;
+  driftPpm = cfg.driftPpm ? (int32_t)(net->rand32() % (2 * cfg.driftPpm + 1)) - cfg.driftPpm : 0;
+  rng = (cfg.seed * 2654435761UL) ^ (0x9E3779B9UL * (i + 1));
+  if (!rng) rng = 1;
+  phase = net->rand32() % cfg.tickMs;
+}
+
+unsigned long SimNode::now() {
+  unsigned long t = net->time();
+  return clockOffset + t + (unsigned long)((long long)t * driftPpm / 1000000);
+}
+
+uint32_t SimNode::random32() { return xorshift(rng); }
+
+bool SimNode::addPeer(const uint8_t* peer) {
+  for (auto& p : peers) if (memcmp(p.data(), peer, 6) == 0) return true;
+  if (peers.size() >= SIM_MAX_PEERS) return false;
+  std::array<uint8_t, 6> p;
+  memcpy(p.data(), peer, 6);
+  peers.push_back(p);
+  peakPeers = std::max(peakPeers, peers.size());
+  return true;
+}
+
+void SimNode::removePeer(const uint8_t* peer) {
+  for (size_t i = 0; i < peers.size(); i++) {
+    if (memcmp(peers[i].data(), peer, 6) == 0) {
+      peers.erase(peers.begin() + i);
+      return;
+    }
+  }
+}
+
+bool SimNode::send(const uint8_t* dst, const uint8_t* data, size_t len) {
+  return net->transmit(*this, dst, data, len);
+}
+
+bool SimNode::knows(const SimNode& other) const {
+  for (int i = 0; i < social->nearbyCount(); i++) {
+    if (social->nearbyAt(i).id == other.id) return true;
+  }
+  return false;
+}
+
+int SimNode::hopsTo(const SimNode& other) const {
+  if (knows(other)) return 1;
+  for (int i = 0; i < social->remoteCount(); i++) {
+    if (social->remoteAt(i).id == other.id) return social->remoteAt(i).hops;
+  }
+  return 0;
+}
+
+// ==========================================
+// RETE
+// ==========================================
+
+NowSim::NowSim(const SimConfig& c) : cfg(c), rng(c.seed ? c.seed : 1) {
+  if (!cfg.tickMs) cfg.tickMs = 1;
+  hostPartitionsClear(); // Niente storico: cento Mochi sulla stessa partizione finta
+  hostSetMillis(0);
+  for (int i = 0; i < cfg.nodes; i++) {
+    nodes.emplace_back(new SimNode(this, i));
+    SimNode& n = *nodes.back();
+    n.state.setClock(&n);
+    n.state.begin();
+  }
+  // Amici: i piu' vicini fra quelli in portata, in entrambe le direzioni
+  for (int i = 0; i < cfg.nodes && cfg.friendsPerNode > 0; i++) {
+    std::vector<std::pair<float, int>> near;
+    for (int j = 0; j < cfg.nodes; j++) {
+      if (j != i && inRange(*nodes[i], *nodes[j])) near.push_back({ -meanRssi(*nodes[i], *nodes[j]), j });
+    }
+    std::sort(near.begin(), near.end());
+    for (int k = 0; k < cfg.friendsPerNode && k < (int)near.size(); k++) befriend(i, near[k].second);
+  }
+  for (auto& n : nodes) {
+    n->social.reset(new MochiNow(&n->state, n.get()));
+    n->social->begin();
+  }
+}
+
+uint32_t NowSim::rand32() { return xorshift(rng); }
+
+void NowSim::place(int i, float x, float y) {
+  nodes[i]->x = x;
+  nodes[i]->y = y;
+}
+
+void NowSim::befriend(int a, int b) {
+  nodes[a]->state.addFriend(nodes[b]->id);
+  nodes[b]->state.addFriend(nodes[a]->id);
+}
+
+float NowSim::meanRssi(const SimNode& a, const SimNode& b) const {
+  float d = hypotf(a.x - b.x, a.y - b.y);
+  if (d < 1) d = 1;
+  return SIM_RSSI_1M - 10 * SIM_PATH_EXP * log10f(d);
+}
+
+bool NowSim::hears(const SimNode& from, const SimNode& to, int8_t* rssi) {
+  int noise = (int)(rand32() % (SIM_NOISE_DB + 1)) + (int)(rand32() % (SIM_NOISE_DB + 1)) - SIM_NOISE_DB;
+  int r = (int)lroundf(meanRssi(from, to)) + noise;
+  if (r < SIM_SENSITIVITY) return false;
+  if ((int)(rand32() % 100) < cfg.lossPct) return false;
+  if (rssi) *rssi = r > 0 ? 0 : r;
+  return true;
+}
+
+void NowSim::schedule(unsigned long at, int to, int from, int8_t rssi, bool ok, const uint8_t* data, size_t len) {
+  Event e;
+  e.t = at;
+  e.seq = seq++;
+  e.to = to;
+  e.from = from;
+  e.rssi = rssi;
+  e.ok = ok;
+  if (data) e.data.assign(data, data + len);
+  events.push(std::move(e));
+}
+
+bool NowSim::transmit(SimNode& from, const uint8_t* dst, const uint8_t* data, size_t len) {
+  bool bcast = memcmp(dst, BCAST, 6) == 0;
+  if (!bcast) {
+    // Come esp_now_send: l'unicast vuole il peer registrato
+    bool known = false;
+    for (auto& p : from.peers) known |= memcmp(p.data(), dst, 6) == 0;
+    if (!known) {
+      from.refused++;
+      return false;
+    }
+  }
+  unsigned long air = ((len + SIM_FRAME_OVERHEAD) * 8 + SIM_BITRATE_KBPS - 1) / SIM_BITRATE_KBPS;
+  from.sent++;
+  from.sentBytes += len;
+  if (len) from.sentByType[data[0] & 0x0F]++;
+  if (len > NOW_WIRE_HEADER_SIZE && data[0] == (NOW_WIRE_VERSION << 4 | PKT_ANNOUNCE)) {
+    from.gossipBytes += len - NOW_WIRE_HEADER_SIZE;
+  }
+
+  if (bcast) {
+    for (auto& n : nodes) {
+      int8_t rssi;
+      if (n.get() == &from || !hears(from, *n, &rssi)) continue;
+      schedule(t + air + cfg.latencyMs + rand32() % (cfg.jitterMs + 1), n->index, from.index, rssi, true, data, len);
+    }
+    schedule(t + air, from.index, -1, 0, true, nullptr, 0);
+    return true;
+  }
+
+  SimNode* to = nullptr;
+  for (auto& n : nodes) {
+    if (memcmp(n->mac, dst, 6) == 0) to = n.get();
+  }
+  bool delivered = false, acked = false;
+  int tries = 0;
+  while (tries < SIM_MAC_TRIES && !acked) {
+    tries++;
+    int8_t rssi;
+    if (!to || !hears(from, *to, &rssi)) continue;
+    if (!delivered) {
+      delivered = true; // Il MAC scarta i doppioni dei suoi ritentativi
+      schedule(t + tries * air + cfg.latencyMs + rand32() % (cfg.jitterMs + 1), to->index, from.index, rssi, true,
+               data, len);
+    }
+    acked = hears(*to, from, nullptr);
+  }
+  schedule(t + tries * air, from.index, -1, 0, acked, nullptr, 0);
+  return true;
+}
+
+float NowSim::discovered(int* pairs) const {
+  int total = 0, seen = 0;
+  for (auto& a : nodes) {
+    for (auto& b : nodes) {
+      if (a == b || !inRange(*a, *b)) continue;
+      total++;
+      seen += a->knows(*b);
+    }
+  }
+  if (pairs) *pairs = total;
+  return total ? (float)seen / total : 1.0f;
+}
+
+// Salti minimi da a verso tutti, sul grafo delle coppie in portata (0 = a o irraggiungibile).
+std::vector<int> NowSim::hopsFrom(int a, const std::vector<std::vector<bool>>& adj) const {
+  std::vector<int> dist(nodes.size(), -1);
+  std::vector<int> todo = { a };
+  dist[a] = 0;
+  for (size_t k = 0; k < todo.size(); k++) {
+    int i = todo[k];
+    for (size_t j = 0; j < nodes.size(); j++) {
+      if (dist[j] < 0 && adj[i][j]) {
+        dist[j] = dist[i] + 1;
+        todo.push_back(j);
+      }
+    }
+  }
+  for (int& d : dist) d = d < 0 ? 0 : d;
+  return dist;
+}
+
+float NowSim::presence(int* pairs) const {
+  std::vector<std::vector<bool>> adj(nodes.size(), std::vector<bool>(nodes.size()));
+  for (int a = 0; a < size(); a++) {
+    for (int b = 0; b < size(); b++) adj[a][b] = a != b && inRange(*nodes[a], *nodes[b]);
+  }
+  int total = 0, seen = 0;
+  for (int a = 0; a < size(); a++) {
+    std::vector<int> hops = hopsFrom(a, adj);
+    for (int b = 0; b < size(); b++) {
+      if (hops[b] < 2 || hops[b] > GOSSIP_MAX_HOPS) continue;
+      total++;
+      seen += nodes[a]->hopsTo(*nodes[b]) != 0;
+    }
+  }
+  if (pairs) *pairs = total;
+  return total ? (float)seen / total : 1.0f;
+}
+
+void NowSim::sampleConvergence() {
+  float d = discovered();
+  if (t90 < 0 && d >= 0.90f) t90 = t;
+  if (t99 < 0 && d >= 0.99f) t99 = t;
+  if (t100 < 0 && d >= 1.0f) t100 = t;
+}
+
+void NowSim::run(unsigned long ms) {
+  std::vector<std::vector<SimNode*>> byPhase(cfg.tickMs);
+  for (auto& n : nodes) byPhase[n->phase].push_back(n.get());
+
+  for (unsigned long end = t + ms; t < end;) {
+    t++;
+    hostSetMillis(t);
+    while (!events.empty() && events.top().t <= t) {
+      Event e = events.top();
+      events.pop();
+      SimNode& n = *nodes[e.to];
+      if (e.from < 0) {
+        n.sink->onRadioSent(e.ok);
+      } else {
+        n.received++;
+        n.sink->onRadioRecv(nodes[e.from]->mac, e.rssi, e.data.data(), e.data.size());
+      }
+    }
+    for (SimNode* n : byPhase[t % cfg.tickMs]) {
+      n->social->tick(n->now());
+      n->state.tickVisits();
+      if (n->state.isAway && !n->wasAway) n->departures++;
+      n->wasAway = n->state.isAway;
+    }
+    if (t % 1000 == 0) sampleConvergence();
+  }
+}
+
+SimReport NowSim::report() const {
+  SimReport r = {};
+  r.ms = t;
+  r.nodes = size();
+  r.discovered = discovered(&r.pairs);
+  r.t90 = t90;
+  r.t99 = t99;
+  r.t100 = t100;
+  r.presence = presence(&r.farPairs);
+  uint64_t sent = 0, bytes = 0, announces = 0, gossip = 0;
+  for (auto& n : nodes) {
+    sent += n->sent;
+    bytes += n->sentBytes;
+    gossip += n->gossipBytes;
+    announces += n->sentByType[PKT_ANNOUNCE];
+    const NowVisitStats& v = n->social->visitStats();
+    r.visitsAsked += v.asked;
+    r.visitsAccepted += v.accepted;
+    r.visitsRefused += v.refused;
+    r.visitsNoAck += v.noAck;
+    r.departures += n->departures;
+  }
+  float nodeMin = r.nodes * (t / 60000.0f);
+  if (nodeMin > 0) {
+    r.pktPerNodeMin = sent / nodeMin;
+    r.bytesPerNodeMin = bytes / nodeMin;
+    r.announcePerNodeMin = announces / nodeMin;
+    r.gossipPerNodeMin = gossip / nodeMin;
+  }
+  r.visitSuccess = r.visitsAsked ? (float)r.visitsAccepted / r.visitsAsked : 0;
+  return r;
+}
+
+void NowSim::printReport(const char* title) const {
+  SimReport r = report();
+  printf("bench: %s: %d nodi, %.1f min, perdita %d%%\n", title, r.nodes, r.ms / 60000.0f, cfg.lossPct);
+  printf("bench:   scoperta: %.1f%% di %d coppie in portata | 90%% a %ld ms, 99%% a %ld ms, 100%% a %ld ms\n",
+         r.discovered * 100, r.pairs, r.t90, r.t99, r.t100);
+  printf("bench:   traffico: %.1f pacchetti/nodo/min (%.1f annunci), %.0f byte/nodo/min\n",
+         r.pktPerNodeMin, r.announcePerNodeMin, r.bytesPerNodeMin);
+  printf("bench:   gossip: %.1f%% di %d coppie a 2-%d salti, %.0f byte di digest/nodo/min\n",
+         r.presence * 100, r.farPairs, GOSSIP_MAX_HOPS, r.gossipPerNodeMin);
+  printf("bench:   visite: %u chieste, %u partite (%.0f%%), %u rifiutate, %u senza ack\n",
+         r.visitsAsked, r.visitsAccepted, r.visitSuccess * 100, r.visitsRefused, r.visitsNoAck);
+}
@@ -0,0 +1,169 @@
+#ifndef MOCHI_NOW_SIM_H
+#define MOCHI_NOW_SIM_H
+
+// ================================================================
+// RETE ESP-NOW SIMULATA
+// ----------------------------------------------------------------
+// Tanti Mochi (MochiState + MochiNow veri) in un processo solo, collegati da
+// una radio finta al posto di MochiEspNow. Ogni nodo ha una posizione, un
+// orologio suo (sfasato e con deriva) e un generatore con seme: la stessa
+// configurazione da' sempre la stessa simulazione.
+//
+// Radio: RSSI dalla distanza (log-distance piu' rumore), pacchetti persi sotto
+// la sensibilita' e con probabilita' lossPct sopra, latenza con jitter.
+// L'unicast ha i tentativi del MAC e l'ack di livello 2 (anche lui perdibile),
+// come ESP-NOW; il broadcast no. Collisioni non modellate.
+//
+// Il tempo avanza a passi di 1 ms; ogni nodo gira il suo loop ogni tickMs
+// (con fase diversa). Usata da test_now_sim e dallo strumento now_sim.
+// ================================================================
+
+#include "MochiNow.h"
+#include <array>
+#include <memory>
+#include <queue>
+#include <vector>
+
+struct SimConfig {
+  int           nodes = 100;
+  float         areaM = 150;         // Lato del quadrato in cui stanno i nodi
+  int           lossPct = 5;         // Perdita di base di ogni trasmissione
+  unsigned      latencyMs = 2;       // Dalla fine dell'invio alla callback di ricezione
+  unsigned      jitterMs = 4;
+  unsigned      tickMs = 20;         // Giro di loop di un nodo
+  int           driftPpm = 100;      // Deriva massima degli orologi (+/-)
+  unsigned long clockSpreadMs = 0;   // Orologi sfasati a caso fino a tanto (0 = tutti a 0)
+  int           friendsPerNode = 3;  // Amicizie mutue con i piu' vicini
+  uint32_t      seed = 1;
+};
+
+// Radio (limiti di ESP-NOW e ambiente interno).
+#define SIM_RSSI_1M        -40   // dBm a un metro
+#define SIM_PATH_EXP       2.7f  // Esponente di attenuazione
+#define SIM_NOISE_DB       4     // Rumore per pacchetto, +/- (triangolare)
+#define SIM_SENSITIVITY    -90   // Sotto, il pacchetto non si riceve
+#define SIM_IN_RANGE       -86   // RSSI medio dei vicini "veri" per la convergenza
+#define SIM_MAC_TRIES      4     // Tentativi del MAC per un unicast
+#define SIM_MAX_PEERS      20    // Peer registrabili in ESP-NOW
+#define SIM_BITRATE_KBPS   1000  // Tempo in aria: 1 Mbps piu' il preambolo
+#define SIM_FRAME_OVERHEAD 60    // Byte di intestazioni 802.11 e vendor action
+
+class NowSim;
+
+class SimNode : public MochiTransport, public MochiClock {
+public:
+  MochiState state;
+  std::unique_ptr<MochiNow> social;
+  int      index;
+  float    x, y;
+  uint8_t  mac[6];
+  MochiId  id;
+
+  // Contatori della radio: una trasmissione per send(), ritentativi del MAC esclusi
+  uint32_t sent = 0;
+  uint32_t sentBytes = 0;
+  uint32_t sentByType[PKT_TYPE_COUNT] = {};
+  uint32_t gossipBytes = 0; // Digest in coda agli annunci
+  uint32_t received = 0;
+  uint32_t refused = 0;  // send() rifiutati (peer non registrato)
+  uint32_t departures = 0; // Partenze in visita viste dal simulatore
+  size_t   peakPeers = 0;  // Massimo di peer unicast registrati insieme
+
+  SimNode(NowSim* net, int index);
+
+  // MochiTransport
+  bool    begin(MochiRadioSink* s) override { sink = s; return true; }
+  void    macAddress(uint8_t out[6]) override { memcpy(out, mac, 6); }
+  MochiId localId() override { return id; }
+  uint8_t channel() override { return ESPNOW_CHANNEL; }
+  bool    addPeer(const uint8_t* peer) override;
+  void    removePeer(const uint8_t* peer) override;
+  bool    send(const uint8_t* dst, const uint8_t* data, size_t len) override;
+  MochiClock* clock() override { return this; }
+
+  // MochiClock: tempo della simulazione visto da questo nodo
+  unsigned long now() override;
+  uint32_t random32() override;
+
+  bool knows(const SimNode& other) const; // E' fra i suoi vicini?
+  int  hopsTo(const SimNode& other) const; // 1 = vicino, 2.. dal gossip, 0 = sconosciuto
+
+private:
+  friend class NowSim;
+  NowSim* net;
+  MochiRadioSink* sink = nullptr;
+  std::vector<std::array<uint8_t, 6>> peers;
+  unsigned long clockOffset;
+  int32_t  driftPpm;
+  uint32_t rng;
+  unsigned phase;       // ms del suo giro di loop
+  bool     wasAway = false;
+};
+
+struct SimReport {
+  unsigned long ms;          // Tempo simulato
+  int      nodes;
+  int      pairs;            // Coppie (a, b) con b in portata di a
+  float    discovered;       // Frazione di quelle coppie in cui a vede b
+  long     t90, t99, t100;   // ms alla prima volta sopra 90%, 99%, 100% (-1 = mai)
+  float    pktPerNodeMin;    // Trasmissioni per nodo al minuto
+  float    bytesPerNodeMin;
+  float    announcePerNodeMin;
+  uint32_t visitsAsked, visitsAccepted, visitsRefused, visitsNoAck;
+  float    visitSuccess;     // Partenze su richieste
+  uint32_t departures;
+  int      farPairs;         // Coppie a 2..GOSSIP_MAX_HOPS salti nel grafo della portata
+  float    presence;         // Frazione di quelle in cui a sa di b (gossip o diretto)
+  float    gossipPerNodeMin; // Byte di digest trasmessi
+};
+
+class NowSim {
+public:
+  explicit NowSim(const SimConfig& cfg);
+
+  void run(unsigned long ms);
+  void place(int i, float x, float y); // Prima di run(), o per spostare un nodo
+  void befriend(int a, int b);         // Amicizia mutua gia' salvata
+  SimNode& node(int i) { return *nodes[i]; }
+  int size() const { return (int)nodes.size(); }
+  unsigned long time() const { return t; }
+  const SimConfig& config() const { return cfg; }
+
+  float meanRssi(const SimNode& a, const SimNode& b) const;
+  bool  inRange(const SimNode& a, const SimNode& b) const { return meanRssi(a, b) >= SIM_IN_RANGE; }
+  float discovered(int* pairs = nullptr) const;
+  float presence(int* pairs = nullptr) const;
+  SimReport report() const;
+  void  printReport(const char* title) const;
+
+  uint32_t rand32(); // Generatore della radio (perdite, rumore, latenza)
+
+private:
+  friend class SimNode;
+  struct Event {
+    unsigned long t;
+    uint32_t      seq;
+    int           to;       // Nodo che riceve (o che aspetta la callback)
+    int           from;     // -1 = callback di invio
+    int8_t        rssi;
+    bool          ok;
+    std::vector<uint8_t> data;
+    bool operator>(const Event& o) const { return t != o.t ? t > o.t : seq > o.seq; }
+  };
+
+  SimConfig cfg;
+  std::vector<std::unique_ptr<SimNode>> nodes;
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  unsigned long t = 0;
+  uint32_t seq = 0;
+  uint32_t rng;
+  long t90 = -1, t99 = -1, t100 = -1;
+
+  bool transmit(SimNode& from, const uint8_t* dst, const uint8_t* data, size_t len);
+  bool hears(const SimNode& from, const SimNode& to, int8_t* rssi);
+  void schedule(unsigned long at, int to, int from, int8_t rssi, bool ok, const uint8_t* data, size_t len);
+  void sampleConvergence();
+  std::vector<int> hopsFrom(int a, const std::vector<std::vector<bool>>& adj) const;
+};
+
+#endif // MOCHI_NOW_SIM_H
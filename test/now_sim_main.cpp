@@ -0,0 +1,30 @@
+// Simulatore della rete ESP-NOW (vedi now_sim.h), per provare parametri senza
+// un tavolo pieno di schede:
+//   now_sim [--nodes 100] [--minutes 10] [--area 150] [--loss 5] [--seed 1]
+#include "now_sim.h"
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char** argv) {
+  SimConfig cfg;
+  cfg.clockSpreadMs = 24UL * 3600 * 1000;
+  unsigned long minutes = 10;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const char* k = argv[i];
+    const char* v = argv[i + 1];
+    if (!strcmp(k, "--nodes")) cfg.nodes = atoi(v);
+    else if (!strcmp(k, "--minutes")) minutes = strtoul(v, nullptr, 10);
+    else if (!strcmp(k, "--area")) cfg.areaM = atof(v);
+    else if (!strcmp(k, "--loss")) cfg.lossPct = atoi(v);
+    else if (!strcmp(k, "--friends")) cfg.friendsPerNode = atoi(v);
+    else if (!strcmp(k, "--seed")) cfg.seed = strtoul(v, nullptr, 10);
+    else {
+      fprintf(stderr, "opzione sconosciuta: %s\n", k);
+      return 2;
+    }
+  }
+  NowSim sim(cfg);
+  for (unsigned long m = 0; m < minutes; m++) sim.run(60000);
+  sim.printReport("now_sim");
+  return 0;
+}
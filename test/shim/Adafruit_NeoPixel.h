@@ -0,0 +1,22 @@
+#ifndef HOST_ADAFRUIT_NEOPIXEL_H
+#define HOST_ADAFRUIT_NEOPIXEL_H
+
+#include <Arduino.h>
+
+#define NEO_GRB    0
+#define NEO_KHZ800 0
+
+// Solo test host: ricorda l'ultimo colore del primo LED.
+class Adafruit_NeoPixel {
+public:
+  Adafruit_NeoPixel(int, int, int) {}
+  void begin() {}
+  void show() {}
+  void setPin(int) {}
+  void setBrightness(uint8_t) {}
+  void setPixelColor(int, uint32_t c) { color = c; }
+  static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+  uint32_t color = 0;
+};
+
+#endif // HOST_ADAFRUIT_NEOPIXEL_H
@@ -0,0 +1,56 @@
+#include <Arduino.h>
+
+HostSerial Serial;
+EspClass ESP;
+
+static unsigned long s_millis = 0;
+static uint64_t s_rng = 0x9E3779B97F4A7C15ULL;
+
+unsigned long millis() { return s_millis; }
+unsigned long micros() { return s_millis * 1000UL; }
+void hostSetMillis(unsigned long ms) { s_millis = ms; }
+void hostAdvanceMillis(unsigned long ms) { s_millis += ms; }
+void delay(unsigned long ms) { s_millis += ms; }
+void delayMicroseconds(unsigned) {}
+
+// splitmix64: stesso seme, stessa sequenza su ogni PC.
+static uint64_t nextRandom() {
+  uint64_t z = (s_rng += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+void randomSeed(unsigned long seed) { s_rng = seed; }
+long random(long howbig) { return howbig > 0 ? (long)(nextRandom() % (uint64_t)howbig) : 0; }
+long random(long howsmall, long howbig) { return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall); }
+uint32_t esp_random(void) { return (uint32_t)nextRandom(); }
+
+size_t Print::printf(const char* fmt, ...) {
+  char buf[512];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (n < 0) return 0;
+  return write((const uint8_t*)buf, min((size_t)n, sizeof(buf) - 1));
+}
+
+static bool serialEcho() {
+  static int on = -1;
+  if (on < 0) on = getenv("MOCHI_TEST_SERIAL") != nullptr;
+  return on;
+}
+
+size_t HostSerial::write(uint8_t c) {
+  if (serialEcho()) fputc(c, stdout);
+  return 1;
+}
+
+size_t HostSerial::write(const uint8_t* p, size_t n) {
+  if (serialEcho()) fwrite(p, 1, n, stdout);
+  return n;
+}
+
+uint64_t EspClass::getEfuseMac() { return efuseMac; }
+void EspClass::restart() { restarts++; }
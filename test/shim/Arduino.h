@@ -0,0 +1,182 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// ================================================================
+// ARDUINO SUL PC (solo test host)
+// ----------------------------------------------------------------
+// Quanto basta del core ESP32 per compilare e far girare i moduli del firmware
+// sul PC: String vera, Serial muta (MOCHI_TEST_SERIAL=1 per vederla), un
+// orologio che si sposta a mano e un generatore casuale ripetibile.
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+#define IRAM_ATTR
+#define PI 3.14159265358979
+#define HEX 16
+#define DEC 10
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 3
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// --- Orologio e caso: li muove il test ---
+unsigned long millis();
+unsigned long micros();
+void hostSetMillis(unsigned long ms);
+void hostAdvanceMillis(unsigned long ms);
+void delay(unsigned long ms);                // Avanza l'orologio finto
+void delayMicroseconds(unsigned us);
+
+void     randomSeed(unsigned long seed);
+long     random(long howbig);
+long     random(long howsmall, long howbig);
+uint32_t esp_random(void);
+
+inline void analogWrite(int, int) {}
+inline void pinMode(int, int) {}
+inline int  digitalRead(int) { return HIGH; }
+inline void digitalWrite(int, int) {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+template <class T> T constrain(T x, T a, T b) { return x < a ? a : (x > b ? b : x); }
+
+class String {
+public:
+  String(const char* s = "") : s(s ? s : "") {}
+  String(const std::string& v) : s(v) {}
+  String(char c) : s(1, c) {}
+  String(int v, unsigned char base = 10) : s(num((long)v, base)) {}
+  String(unsigned int v, unsigned char base = 10) : s(unum(v, base)) {}
+  String(long v, unsigned char base = 10) : s(num(v, base)) {}
+  String(unsigned long v, unsigned char base = 10) : s(unum(v, base)) {}
+  String(double v, unsigned int d = 2) { char b[48]; snprintf(b, sizeof(b), "%.*f", (int)d, v); s = b; }
+
+  String& operator+=(const String& o) { s += o.s; return *this; }
+  String& operator+=(const char* o)   { s += o ? o : ""; return *this; }
+  String& operator+=(char c)          { s += c; return *this; }
+  String& operator+=(int v)           { s += num(v, 10); return *this; }
+  String& operator+=(unsigned long v) { s += unum(v, 10); return *this; }
+  friend String operator+(const String& a, const String& b) { return String(a.s + b.s); }
+  friend String operator+(const String& a, const char* b)   { return String(a.s + (b ? b : "")); }
+  friend String operator+(const char* a, const String& b)   { return String((a ? a : "") + b.s); }
+  friend String operator+(const String& a, char c)          { return String(a.s + c); }
+
+  bool operator==(const String& o) const { return s == o.s; }
+  bool operator==(const char* o) const   { return s == (o ? o : ""); }
+  bool operator!=(const String& o) const { return s != o.s; }
+  bool operator!=(const char* o) const   { return !(*this == o); }
+  char operator[](unsigned i) const      { return i < s.size() ? s[i] : 0; }
+
+  unsigned int length() const { return s.size(); }
+  const char*  c_str() const  { return s.c_str(); }
+  bool isEmpty() const        { return s.empty(); }
+  bool equals(const String& o) const { return s == o.s; }
+  bool startsWith(const String& p) const { return s.compare(0, p.s.size(), p.s) == 0; }
+  bool endsWith(const String& p) const {
+    return s.size() >= p.s.size() && s.compare(s.size() - p.s.size(), p.s.size(), p.s) == 0;
+  }
+  String substring(unsigned from) const { return from < s.size() ? String(s.substr(from)) : String(); }
+  String substring(unsigned from, unsigned to) const {
+    if (to > s.size()) to = s.size();
+    return from < to ? String(s.substr(from, to - from)) : String();
+  }
+  int  indexOf(char c, unsigned from = 0) const { size_t p = s.find(c, from); return p == std::string::npos ? -1 : (int)p; }
+  bool concat(const char* p, unsigned n) { s.append(p, n); return true; }
+  void trim() {
+    size_t a = s.find_first_not_of(" \t\r\n");
+    size_t b = s.find_last_not_of(" \t\r\n");
+    s = a == std::string::npos ? std::string() : s.substr(a, b - a + 1);
+  }
+  void toUpperCase() { for (char& c : s) c = toupper((unsigned char)c); }
+  bool reserve(unsigned n) { s.reserve(n); return true; }
+  long toInt() const { return atol(s.c_str()); }
+
+private:
+  std::string s;
+  static std::string num(long v, unsigned char base) {
+    return v < 0 && base == 10 ? "-" + unum((unsigned long)-v, base) : unum((unsigned long)v, base);
+  }
+  static std::string unum(unsigned long v, unsigned char base) {
+    char b[72];
+    int n = 0;
+    do { int d = v % base; b[n++] = d < 10 ? '0' + d : 'A' + d - 10; v /= base; } while (v);
+    std::string r(b, n);
+    std::reverse(r.begin(), r.end());
+    return r;
+  }
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* p, size_t n) { for (size_t i = 0; i < n; i++) write(p[i]); return n; }
+  size_t print(const char* s)          { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(const String& s)        { return print(s.c_str()); }
+  size_t print(char c)                 { return write((uint8_t)c); }
+  size_t print(int v)                  { return printf("%d", v); }
+  size_t print(unsigned int v)         { return printf("%u", v); }
+  size_t print(long v)                 { return printf("%ld", v); }
+  size_t print(unsigned long v)        { return printf("%lu", v); }
+  size_t print(double v)               { return printf("%.2f", v); }
+  size_t println()                     { return print("\n"); }
+  template <class T> size_t println(const T& v) { size_t n = print(v); return n + println(); }
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+// Serial: scrive su stdout solo se MOCHI_TEST_SERIAL e' impostata.
+class HostSerial : public Print {
+public:
+  void begin(unsigned long) {}
+  int  available() { return 0; }
+  int  read() { return -1; }
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* p, size_t n) override;
+};
+extern HostSerial Serial;
+
+class EspClass {
+public:
+  uint64_t getEfuseMac();
+  uint32_t getFreeHeap()    { return 200000; }
+  uint32_t getMinFreeHeap() { return 180000; }
+  uint32_t getMaxAllocHeap(){ return 100000; }
+  uint32_t getHeapSize()    { return 320000; }
+  uint32_t getPsramSize()   { return 0; }
+  void     restart();
+  unsigned restarts = 0;    // Solo host: quante volte il firmware ha chiesto il riavvio
+  uint64_t efuseMac = 0x0000CDAB0C22F4A8ULL;
+};
+extern EspClass ESP;
+
+#define portMUX_TYPE int
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(x) (void)(x)
+#define portEXIT_CRITICAL(x) (void)(x)
+#define portENTER_CRITICAL_ISR(x) (void)(x)
+#define portEXIT_CRITICAL_ISR(x) (void)(x)
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,616 @@
+#ifndef HOST_ARDUINOJSON_H
+#define HOST_ARDUINOJSON_H
+
+// ================================================================
+// ARDUINOJSON SUL PC (solo test host)
+// ----------------------------------------------------------------
+// La parte dell'API v6 che usa il firmware, sopra un albero di nodi in heap.
+// Non limita la memoria (overflowed() e' sempre false: i limiti li controlla
+// il firmware con measureJson) ma si comporta come la libreria dove conta:
+//  - i letti inesistenti sono null e "| default" ripiega sul default;
+//  - is<int>() e' vero solo per gli interi, is<const char*>() per le stringhe;
+//  - serializeJson su String aggiunge in coda;
+//  - deserializeJson da un char* modificabile lavora in zero-copy e scrive
+//    i terminatori delle stringhe nel buffer di ingresso, come la libreria.
+// ================================================================
+
+#include <Arduino.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include <limits>
+#include <errno.h>
+
+struct JsonNode;
+typedef std::shared_ptr<JsonNode> JsonNodePtr;
+
+struct JsonNode {
+  enum Kind { NUL, BOOL, INT, FLOAT, STR, ARR, OBJ } kind = NUL;
+  bool        b = false;
+  long long   i = 0;
+  double      f = 0;
+  std::string s;
+  std::vector<JsonNodePtr> arr;
+  std::vector<std::pair<std::string, JsonNodePtr>> obj;
+
+  JsonNodePtr member(const char* k) const {
+    if (kind != OBJ || !k) return nullptr;
+    for (auto& kv : obj) if (kv.first == k) return kv.second;
+    return nullptr;
+  }
+  JsonNodePtr at(size_t idx) const { return kind == ARR && idx < arr.size() ? arr[idx] : nullptr; }
+  void reset(Kind k) { kind = k; s.clear(); arr.clear(); obj.clear(); i = 0; f = 0; b = false; }
+  void copyFrom(const JsonNode& o) {
+    reset(o.kind);
+    b = o.b; i = o.i; f = o.f; s = o.s;
+    for (auto& e : o.arr) { auto n = std::make_shared<JsonNode>(); n->copyFrom(*e); arr.push_back(n); }
+    for (auto& kv : o.obj) { auto n = std::make_shared<JsonNode>(); n->copyFrom(*kv.second); obj.push_back({ kv.first, n }); }
+  }
+};
+
+class JsonVariant; class JsonVariantConst;
+class JsonArray; class JsonArrayConst; class JsonObject; class JsonObjectConst;
+
+// --- Conversioni (is / as / assegnazione) ---
+template <class T, class Enable = void> struct JsonConv;
+
+template <class T>
+struct JsonConv<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+  static bool is(const JsonNode* n) {
+    if (!n || n->kind != JsonNode::INT) return false;
+    return n->i >= (long long)std::numeric_limits<T>::min() &&
+           (n->i < 0 || (unsigned long long)n->i <= (unsigned long long)std::numeric_limits<T>::max());
+  }
+  static T as(const JsonNode* n) {
+    if (!n) return 0;
+    if (n->kind == JsonNode::INT) return (T)n->i;
+    if (n->kind == JsonNode::FLOAT) return (T)n->f;
+    if (n->kind == JsonNode::BOOL) return (T)n->b;
+    return 0;
+  }
+  static void set(JsonNode& n, T v) { n.reset(JsonNode::INT); n.i = (long long)v; }
+};
+
+template <class T>
+struct JsonConv<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+  static bool is(const JsonNode* n) { return n && (n->kind == JsonNode::INT || n->kind == JsonNode::FLOAT); }
+  static T as(const JsonNode* n) {
+    if (!n) return 0;
+    return n->kind == JsonNode::INT ? (T)n->i : n->kind == JsonNode::FLOAT ? (T)n->f : 0;
+  }
+  static void set(JsonNode& n, T v) { n.reset(JsonNode::FLOAT); n.f = v; }
+};
+
+template <> struct JsonConv<bool> {
+  static bool is(const JsonNode* n) { return n && n->kind == JsonNode::BOOL; }
+  static bool as(const JsonNode* n) {
+    if (!n) return false;
+    return n->kind == JsonNode::BOOL ? n->b : n->kind == JsonNode::INT ? n->i != 0 : false;
+  }
+  static void set(JsonNode& n, bool v) { n.reset(JsonNode::BOOL); n.b = v; }
+};
+
+template <> struct JsonConv<const char*> {
+  static bool is(const JsonNode* n) { return n && n->kind == JsonNode::STR; }
+  static const char* as(const JsonNode* n) { return is(n) ? n->s.c_str() : nullptr; }
+  static void set(JsonNode& n, const char* v) {
+    if (!v) { n.reset(JsonNode::NUL); return; }
+    n.reset(JsonNode::STR); n.s = v;
+  }
+};
+template <> struct JsonConv<char*> : JsonConv<const char*> {};
+
+template <> struct JsonConv<String> {
+  static bool is(const JsonNode* n) { return n && n->kind == JsonNode::STR; }
+  static String as(const JsonNode* n) { return is(n) ? String(n->s.c_str()) : String(); }
+  static void set(JsonNode& n, const String& v) { n.reset(JsonNode::STR); n.s = v.c_str(); }
+};
+
+template <size_t N> struct JsonConv<char[N]> {
+  static void set(JsonNode& n, const char* v) { JsonConv<const char*>::set(n, v); }
+};
+
+class JsonString {
+public:
+  explicit JsonString(const char* p = nullptr) : p(p) {}
+  const char* c_str() const { return p; }
+  size_t size() const { return p ? strlen(p) : 0; }
+private:
+  const char* p;
+};
+
+class JsonVariantConst {
+public:
+  JsonVariantConst(JsonNodePtr n = nullptr) : n(n) {}
+  template <class T> T    as() const { return JsonConv<T>::as(n.get()); }
+  template <class T> bool is() const { return JsonConv<T>::is(n.get()); }
+  template <class T> T operator|(T def) const { return is<T>() ? as<T>() : def; }
+  const char* operator|(const char* def) const { return is<const char*>() ? as<const char*>() : def; }
+  JsonVariantConst operator[](const char* k) const { return n ? n->member(k) : nullptr; }
+  JsonVariantConst operator[](size_t i) const { return n ? n->at(i) : nullptr; }
+  JsonVariantConst operator[](int i) const { return (*this)[(size_t)i]; }
+  bool   isNull() const { return !n || n->kind == JsonNode::NUL; }
+  size_t size() const { return !n ? 0 : n->kind == JsonNode::ARR ? n->arr.size() : n->kind == JsonNode::OBJ ? n->obj.size() : 0; }
+  bool   containsKey(const char* k) const { return n && n->member(k); }
+  JsonNodePtr node() const { return n; }
+private:
+  JsonNodePtr n;
+};
+
+class JsonPairConst {
+public:
+  JsonPairConst(const char* k, JsonNodePtr v) : k(k), v(v) {}
+  JsonString       key() const { return JsonString(k); }
+  JsonVariantConst value() const { return JsonVariantConst(v); }
+private:
+  const char* k;
+  JsonNodePtr v;
+};
+
+// Iteratori sui figli di un nodo (vector dentro il nodo: restano validi finche'
+// l'albero non cambia, come nella libreria).
+template <class Item>
+class JsonIter {
+public:
+  JsonIter(JsonNodePtr n, size_t i) : n(n), i(i) {}
+  bool operator!=(const JsonIter& o) const { return i != o.i; }
+  JsonIter& operator++() { i++; return *this; }
+  Item operator*() const;
+private:
+  JsonNodePtr n;
+  size_t i;
+};
+
+template <> inline JsonVariantConst JsonIter<JsonVariantConst>::operator*() const { return JsonVariantConst(n->arr[i]); }
+template <> inline JsonPairConst JsonIter<JsonPairConst>::operator*() const {
+  return JsonPairConst(n->obj[i].first.c_str(), n->obj[i].second);
+}
+
+class JsonArrayConst {
+public:
+  JsonArrayConst(JsonNodePtr n = nullptr) : n(n && n->kind == JsonNode::ARR ? n : nullptr) {}
+  JsonIter<JsonVariantConst> begin() const { return JsonIter<JsonVariantConst>(n, 0); }
+  JsonIter<JsonVariantConst> end() const { return JsonIter<JsonVariantConst>(n, size()); }
+  size_t size() const { return n ? n->arr.size() : 0; }
+  JsonVariantConst operator[](size_t i) const { return n ? n->at(i) : nullptr; }
+  bool isNull() const { return !n; }
+private:
+  JsonNodePtr n;
+};
+
+class JsonObjectConst {
+public:
+  JsonObjectConst(JsonNodePtr n = nullptr) : n(n && n->kind == JsonNode::OBJ ? n : nullptr) {}
+  JsonIter<JsonPairConst> begin() const { return JsonIter<JsonPairConst>(n, 0); }
+  JsonIter<JsonPairConst> end() const { return JsonIter<JsonPairConst>(n, size()); }
+  size_t size() const { return n ? n->obj.size() : 0; }
+  JsonVariantConst operator[](const char* k) const { return n ? n->member(k) : nullptr; }
+  bool isNull() const { return !n; }
+  bool containsKey(const char* k) const { return n && n->member(k); }
+private:
+  JsonNodePtr n;
+};
+
+template <> struct JsonConv<JsonArrayConst> {
+  static bool is(const JsonNode* n) { return n && n->kind == JsonNode::ARR; }
+};
+template <> struct JsonConv<JsonObjectConst> {
+  static bool is(const JsonNode* n) { return n && n->kind == JsonNode::OBJ; }
+};
+template <> struct JsonConv<JsonArray> : JsonConv<JsonArrayConst> {};
+template <> struct JsonConv<JsonObject> : JsonConv<JsonObjectConst> {};
+
+template <> inline JsonArrayConst JsonVariantConst::as<JsonArrayConst>() const { return JsonArrayConst(n); }
+template <> inline JsonObjectConst JsonVariantConst::as<JsonObjectConst>() const { return JsonObjectConst(n); }
+
+// Variante scrivibile: se il membro non esiste ancora ricorda genitore e
+// chiave, e lo crea alla prima assegnazione.
+class JsonVariant {
+public:
+  JsonVariant(JsonNodePtr n = nullptr, JsonNodePtr parent = nullptr, const char* key = nullptr)
+    : n(n), parent(parent), key(key ? key : "") {}
+
+  template <class T> JsonVariant& operator=(const T& v) {
+    JsonConv<typename std::decay<T>::type>::set(ensure(), v);
+    return *this;
+  }
+  JsonVariant& operator=(const char* v) { JsonConv<const char*>::set(ensure(), v); return *this; }
+  JsonVariant& operator=(JsonVariantConst v) {
+    JsonNode& dst = ensure();
+    if (v.node()) dst.copyFrom(*v.node()); else dst.reset(JsonNode::NUL);
+    return *this;
+  }
+  JsonVariant& operator=(const JsonVariant& v) { return *this = (JsonVariantConst)v; }
+
+  template <class T> T    as() const { return JsonConv<T>::as(n.get()); }
+  template <class T> bool is() const { return JsonConv<T>::is(n.get()); }
+  template <class T> T operator|(T def) const { return is<T>() ? as<T>() : def; }
+  const char* operator|(const char* def) const { return is<const char*>() ? as<const char*>() : def; }
+  operator JsonVariantConst() const { return JsonVariantConst(n); }
+
+  JsonVariant operator[](const char* k) const {
+    if (n && n->kind == JsonNode::OBJ) {
+      JsonNodePtr m = n->member(k);
+      return m ? JsonVariant(m) : JsonVariant(nullptr, n, k);
+    }
+    return JsonVariant();
+  }
+  JsonVariant operator[](size_t i) const { return JsonVariant(n ? n->at(i) : nullptr); }
+  JsonVariant operator[](int i) const { return (*this)[(size_t)i]; }
+  bool   isNull() const { return !n || n->kind == JsonNode::NUL; }
+  size_t size() const { return JsonVariantConst(n).size(); }
+  bool   containsKey(const char* k) const { return n && n->member(k); }
+  template <class T> T to();
+
+private:
+  JsonNodePtr n, parent;
+  std::string key;
+
+  JsonNode& ensure() {
+    if (!n) {
+      n = std::make_shared<JsonNode>();
+      if (parent) {
+        if (parent->kind == JsonNode::NUL) parent->reset(JsonNode::OBJ);
+        if (parent->kind == JsonNode::OBJ) parent->obj.push_back({ key, n });
+      }
+    }
+    return *n;
+  }
+};
+
+class JsonArray {
+public:
+  JsonArray(JsonNodePtr n = nullptr) : n(n) {}
+  size_t size() const { return n ? n->arr.size() : 0; }
+  JsonVariant operator[](size_t i) const { return JsonVariant(n ? n->at(i) : nullptr); }
+  template <class T> bool add(const T& v) const {
+    if (!n) return false;
+    auto e = std::make_shared<JsonNode>();
+    n->arr.push_back(e);
+    JsonVariant ev(e);
+    ev = v;
+    return true;
+  }
+  bool isNull() const { return !n; }
+  operator JsonArrayConst() const { return JsonArrayConst(n); }
+private:
+  JsonNodePtr n;
+};
+
+class JsonObject {
+public:
+  JsonObject(JsonNodePtr n = nullptr) : n(n) {}
+  size_t size() const { return n ? n->obj.size() : 0; }
+  JsonVariant operator[](const char* k) const { return JsonVariant(n).operator[](k); }
+  bool isNull() const { return !n; }
+  bool containsKey(const char* k) const { return n && n->member(k); }
+  operator JsonObjectConst() const { return JsonObjectConst(n); }
+private:
+  JsonNodePtr n;
+};
+
+template <> inline JsonObject JsonVariant::to<JsonObject>() { ensure().reset(JsonNode::OBJ); return JsonObject(n); }
+template <> inline JsonArray JsonVariant::to<JsonArray>() { ensure().reset(JsonNode::ARR); return JsonArray(n); }
+
+class JsonDocument {
+public:
+  explicit JsonDocument(size_t capacity = 0) : capacity(capacity), root(std::make_shared<JsonNode>()) {}
+  JsonDocument(const JsonDocument& o) : capacity(o.capacity), root(std::make_shared<JsonNode>()) { root->copyFrom(*o.root); }
+  JsonDocument& operator=(const JsonDocument& o) { root->copyFrom(*o.root); return *this; }
+
+  JsonVariant      operator[](const char* k) {
+    JsonNodePtr m = root->member(k);
+    return m ? JsonVariant(m) : JsonVariant(nullptr, root, k);
+  }
+  JsonVariantConst operator[](const char* k) const { return JsonVariantConst(root->member(k)); }
+  JsonVariant      operator[](size_t i) { return JsonVariant(root->at(i)); }
+  bool containsKey(const char* k) const { return root->member(k) != nullptr; }
+  void clear() { root->reset(JsonNode::NUL); }
+  template <class T> bool is() const { return JsonConv<T>::is(root.get()); }
+  template <class T> T as() const;
+  template <class T> T to();
+  bool   overflowed() const { return false; }
+  size_t memoryUsage() const { return 0; }
+  size_t memoryCapacity() const { return capacity; }
+  JsonNodePtr rootNode() const { return root; }
+  operator JsonVariantConst() const { return JsonVariantConst(root); }
+
+private:
+  size_t capacity;
+  JsonNodePtr root;
+};
+
+template <> inline JsonObject      JsonDocument::to<JsonObject>() { root->reset(JsonNode::OBJ); return JsonObject(root); }
+template <> inline JsonArray       JsonDocument::to<JsonArray>()  { root->reset(JsonNode::ARR); return JsonArray(root); }
+template <> inline JsonObjectConst JsonDocument::as<JsonObjectConst>() const { return JsonObjectConst(root); }
+template <> inline JsonArrayConst  JsonDocument::as<JsonArrayConst>() const  { return JsonArrayConst(root); }
+template <> inline JsonObject      JsonDocument::as<JsonObject>() const { return JsonObject(is<JsonObject>() ? root : nullptr); }
+template <> inline JsonVariantConst JsonDocument::as<JsonVariantConst>() const { return JsonVariantConst(root); }
+
+template <size_t N> class StaticJsonDocument : public JsonDocument {
+public:
+  StaticJsonDocument() : JsonDocument(N) {}
+};
+
+class DynamicJsonDocument : public JsonDocument {
+public:
+  explicit DynamicJsonDocument(size_t n) : JsonDocument(n) {}
+};
+
+class DeserializationError {
+public:
+  enum Code { Ok, EmptyInput, IncompleteInput, InvalidInput, NoMemory, TooDeep };
+  DeserializationError(Code c = Ok) : c(c) {}
+  explicit operator bool() const { return c != Ok; }
+  bool operator==(Code o) const { return c == o; }
+  bool operator!=(Code o) const { return c != o; }
+  Code code() const { return c; }
+  const char* c_str() const {
+    static const char* const names[] = { "Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory", "TooDeep" };
+    return names[c];
+  }
+private:
+  Code c;
+};
+
+// --- Lettura ---
+namespace jsonshim {
+
+struct Parser {
+  const char* p;
+  const char* end;
+  std::vector<size_t> stringEnds; // Posizioni delle virgolette di chiusura (zero-copy)
+  const char* base;
+  int depth = 0;
+
+  DeserializationError::Code fail = DeserializationError::Ok;
+
+  bool more() const { return p < end && *p; }
+  void ws() { while (more() && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++; }
+  bool error(DeserializationError::Code c) { if (!fail) fail = c; return false; }
+  bool eof() { return error(DeserializationError::IncompleteInput); }
+
+  bool literal(const char* word, JsonNode& n, JsonNode::Kind k, bool b) {
+    for (const char* w = word; *w; w++, p++) {
+      if (!more()) return eof();
+      if (*p != *w) return error(DeserializationError::InvalidInput);
+    }
+    n.reset(k);
+    n.b = b;
+    return true;
+  }
+
+  bool string(std::string& out) {
+    p++; // "
+    while (true) {
+      if (!more()) return eof();
+      char c = *p++;
+      if (c == '"') { stringEnds.push_back(p - 1 - base); return true; }
+      if (c != '\\') { out += c; continue; }
+      if (!more()) return eof();
+      char e = *p++;
+      switch (e) {
+        case '"': case '\\': case '/': out += e; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+          unsigned cp = 0;
+          for (int k = 0; k < 4; k++, p++) {
+            if (!more()) return eof();
+            char h = *p;
+            cp <<= 4;
+            if (h >= '0' && h <= '9') cp |= h - '0';
+            else if (h >= 'a' && h <= 'f') cp |= h - 'a' + 10;
+            else if (h >= 'A' && h <= 'F') cp |= h - 'A' + 10;
+            else return error(DeserializationError::InvalidInput);
+          }
+          if (cp < 0x80) out += (char)cp;
+          else if (cp < 0x800) { out += (char)(0xC0 | cp >> 6); out += (char)(0x80 | (cp & 0x3F)); }
+          else { out += (char)(0xE0 | cp >> 12); out += (char)(0x80 | ((cp >> 6) & 0x3F)); out += (char)(0x80 | (cp & 0x3F)); }
+          break;
+        }
+        default: return error(DeserializationError::InvalidInput);
+      }
+    }
+  }
+
+  bool number(JsonNode& n) {
+    std::string t;
+    bool isFloat = false;
+    while (more() && (isdigit((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E')) {
+      if (*p == '.' || *p == 'e' || *p == 'E') isFloat = true;
+      t += *p++;
+    }
+    if (t.empty() || t == "-") return more() ? error(DeserializationError::InvalidInput) : eof();
+    char* stop;
+    if (!isFloat) {
+      errno = 0;
+      long long v = strtoll(t.c_str(), &stop, 10);
+      if (*stop == '\0' && errno == 0) { n.reset(JsonNode::INT); n.i = v; return true; }
+    }
+    double d = strtod(t.c_str(), &stop);
+    if (*stop != '\0') return error(DeserializationError::InvalidInput);
+    n.reset(JsonNode::FLOAT);
+    n.f = d;
+    return true;
+  }
+
+  bool value(JsonNode& n) {
+    ws();
+    if (!more()) return eof();
+    if (++depth > 10) return error(DeserializationError::TooDeep);
+    bool ok;
+    switch (*p) {
+      case '{': ok = object(n); break;
+      case '[': ok = array(n); break;
+      case '"': n.reset(JsonNode::STR); ok = string(n.s); break;
+      case 't': ok = literal("true", n, JsonNode::BOOL, true); break;
+      case 'f': ok = literal("false", n, JsonNode::BOOL, false); break;
+      case 'n': ok = literal("null", n, JsonNode::NUL, false); break;
+      default:  ok = number(n); break;
+    }
+    depth--;
+    return ok;
+  }
+
+  bool array(JsonNode& n) {
+    n.reset(JsonNode::ARR);
+    p++;
+    ws();
+    if (!more()) return eof();
+    if (*p == ']') { p++; return true; }
+    while (true) {
+      auto e = std::make_shared<JsonNode>();
+      if (!value(*e)) return false;
+      n.arr.push_back(e);
+      ws();
+      if (!more()) return eof();
+      if (*p == ',') { p++; continue; }
+      if (*p == ']') { p++; return true; }
+      return error(DeserializationError::InvalidInput);
+    }
+  }
+
+  bool object(JsonNode& n) {
+    n.reset(JsonNode::OBJ);
+    p++;
+    ws();
+    if (!more()) return eof();
+    if (*p == '}') { p++; return true; }
+    while (true) {
+      ws();
+      if (!more()) return eof();
+      if (*p != '"') return error(DeserializationError::InvalidInput);
+      std::string k;
+      if (!string(k)) return false;
+      ws();
+      if (!more()) return eof();
+      if (*p++ != ':') return error(DeserializationError::InvalidInput);
+      auto v = std::make_shared<JsonNode>();
+      if (!value(*v)) return false;
+      JsonNodePtr old = n.member(k.c_str());
+      if (old) *old = *v; else n.obj.push_back({ k, v });
+      ws();
+      if (!more()) return eof();
+      if (*p == ',') { p++; continue; }
+      if (*p == '}') { p++; return true; }
+      return error(DeserializationError::InvalidInput);
+    }
+  }
+};
+
+inline DeserializationError parse(JsonDocument& doc, const char* in, size_t len, std::vector<size_t>* ends = nullptr) {
+  doc.clear();
+  if (!in) return DeserializationError::EmptyInput;
+  Parser ps;
+  ps.p = ps.base = in;
+  ps.end = in + len;
+  ps.ws();
+  if (!ps.more()) return DeserializationError::EmptyInput;
+  JsonNode tmp;
+  if (!ps.value(tmp)) return ps.fail;
+  doc.rootNode()->copyFrom(tmp);
+  if (ends) *ends = ps.stringEnds;
+  return DeserializationError::Ok;
+}
+
+// --- Scrittura ---
+inline void write(const JsonNode* n, std::string& out) {
+  if (!n) { out += "null"; return; }
+  char b[40];
+  switch (n->kind) {
+    case JsonNode::NUL:   out += "null"; break;
+    case JsonNode::BOOL:  out += n->b ? "true" : "false"; break;
+    case JsonNode::INT:   snprintf(b, sizeof(b), "%lld", n->i); out += b; break;
+    case JsonNode::FLOAT: snprintf(b, sizeof(b), "%.9g", n->f); out += b; break;
+    case JsonNode::STR:
+      out += '"';
+      for (char c : n->s) {
+        switch (c) {
+          case '"':  out += "\\\""; break;
+          case '\\': out += "\\\\"; break;
+          case '\n': out += "\\n"; break;
+          case '\r': out += "\\r"; break;
+          case '\t': out += "\\t"; break;
+          default:
+            if ((unsigned char)c < 0x20) { snprintf(b, sizeof(b), "\\u%04x", c); out += b; }
+            else out += c;
+        }
+      }
+      out += '"';
+      break;
+    case JsonNode::ARR:
+      out += '[';
+      for (size_t i = 0; i < n->arr.size(); i++) { if (i) out += ','; write(n->arr[i].get(), out); }
+      out += ']';
+      break;
+    case JsonNode::OBJ:
+      out += '{';
+      for (size_t i = 0; i < n->obj.size(); i++) {
+        if (i) out += ',';
+        JsonNode k;
+        k.reset(JsonNode::STR);
+        k.s = n->obj[i].first;
+        write(&k, out);
+        out += ':';
+        write(n->obj[i].second.get(), out);
+      }
+      out += '}';
+      break;
+  }
+}
+
+} // namespace jsonshim
+
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* in) {
+  return jsonshim::parse(doc, in, in ? strlen(in) : 0);
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* in, size_t len) {
+  return jsonshim::parse(doc, in, len);
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, const uint8_t* in, size_t len) {
+  return jsonshim::parse(doc, (const char*)in, len);
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, const String& in) {
+  return jsonshim::parse(doc, in.c_str(), in.length());
+}
+// Zero-copy, come la libreria con un char* modificabile: le stringhe restano
+// nel buffer di ingresso, che viene modificato (terminatori al posto delle
+// virgolette di chiusura).
+inline DeserializationError deserializeJson(JsonDocument& doc, char* in) {
+  std::vector<size_t> ends;
+  DeserializationError err = jsonshim::parse(doc, in, in ? strlen(in) : 0, &ends);
+  if (!err) for (size_t e : ends) in[e] = '\0';
+  return err;
+}
+
+inline size_t serializeJson(JsonVariantConst v, String& out) {
+  std::string s;
+  jsonshim::write(v.node().get(), s);
+  out += s.c_str();
+  return s.size();
+}
+inline size_t serializeJson(JsonVariantConst v, char* buf, size_t size) {
+  std::string s;
+  jsonshim::write(v.node().get(), s);
+  if (!size) return 0;
+  size_t n = min(s.size(), size - 1);
+  memcpy(buf, s.data(), n);
+  buf[n] = '\0';
+  return n;
+}
+inline size_t serializeJson(const JsonDocument& d, String& out) { return serializeJson(JsonVariantConst(d.rootNode()), out); }
+inline size_t serializeJson(const JsonDocument& d, char* buf, size_t size) { return serializeJson(JsonVariantConst(d.rootNode()), buf, size); }
+inline size_t measureJson(JsonVariantConst v) {
+  std::string s;
+  jsonshim::write(v.node().get(), s);
+  return s.size();
+}
+inline size_t measureJson(const JsonDocument& d) { return measureJson(JsonVariantConst(d.rootNode())); }
+
+#endif // HOST_ARDUINOJSON_H
@@ -0,0 +1,79 @@
+#include <BLEDevice.h>
+#include <BLESecurity.h>
+
+uint16_t BLEDevice::localMtu = 23;
+BLESecurityCallbacks* BLEDevice::securityCallbacks = nullptr;
+std::function<void(BLECharacteristic*, const uint8_t*, size_t)> hostBleNotify;
+
+// Un server per begin(): quello di prima (e le sue caratteristiche) sparisce.
+static std::unique_ptr<BLEServer> s_server;
+static BLEAdvertising s_advertising;
+
+BLEServer* BLEDevice::createServer() {
+  s_server.reset(new BLEServer());
+  return s_server.get();
+}
+
+BLEAdvertising* BLEDevice::getAdvertising() {
+  return s_server ? s_server->getAdvertising() : &s_advertising;
+}
+
+void BLECharacteristic::notify(bool) {
+  if (!s_server || !s_server->connected || !(props & (PROPERTY_NOTIFY | PROPERTY_INDICATE))) return;
+  size_t n = value.size();
+  size_t max = s_server->mtu - 3;
+  if (hostBleNotify) hostBleNotify(this, value.data(), n < max ? n : max);
+}
+
+void hostBleConnect(uint16_t mtu) {
+  if (!s_server) return;
+  s_server->connected = true;
+  s_server->mtu = mtu < BLEDevice::localMtu ? mtu : BLEDevice::localMtu;
+  s_server->authenticated = s_server->bonded;
+  if (s_server->callbacks) s_server->callbacks->onConnect(s_server.get());
+}
+
+void hostBleDisconnect() {
+  if (!s_server || !s_server->connected) return;
+  s_server->connected = false;
+  s_server->authenticated = false;
+  s_server->passkey = 0;
+  if (s_server->callbacks) s_server->callbacks->onDisconnect(s_server.get());
+}
+
+BLECharacteristic* hostBleFind(const char* uuid) {
+  if (!s_server) return nullptr;
+  for (auto& s : s_server->services) {
+    for (auto& c : s->chars) {
+      if (c->uuid == uuid) return c.get();
+    }
+  }
+  return nullptr;
+}
+
+bool hostBleWrite(BLECharacteristic* c, const uint8_t* data, size_t len) {
+  const esp_gatt_perm_t secure = ESP_GATT_PERM_WRITE_ENCRYPTED | ESP_GATT_PERM_WRITE_ENC_MITM;
+  if ((c->perms & secure) && !(s_server && s_server->authenticated)) return false; // Insufficient authentication
+  c->setValue(data, len);
+  if (c->callbacks) c->callbacks->onWrite(c);
+  return true;
+}
+
+uint32_t hostBlePairStart() {
+  if (!s_server || !s_server->connected) return 0;
+  s_server->passkey = 100000 + random(900000);
+  if (BLEDevice::securityCallbacks) BLEDevice::securityCallbacks->onPassKeyNotify(s_server->passkey);
+  return s_server->passkey;
+}
+
+bool hostBlePairFinish(uint32_t typed) {
+  if (!s_server || !s_server->passkey) return false;
+  esp_ble_auth_cmpl_t cmpl = {};
+  cmpl.success = typed == s_server->passkey;
+  cmpl.fail_reason = cmpl.success ? 0 : ESP_AUTH_SMP_PASSKEY_FAIL;
+  cmpl.auth_mode = ESP_LE_AUTH_REQ_SC_MITM_BOND;
+  s_server->passkey = 0;
+  s_server->authenticated = s_server->bonded = cmpl.success;
+  if (BLEDevice::securityCallbacks) BLEDevice::securityCallbacks->onAuthenticationComplete(cmpl);
+  return cmpl.success;
+}
@@ -0,0 +1,9 @@
+#ifndef HOST_BLE2902_H
+#define HOST_BLE2902_H
+
+#include <BLEDevice.h>
+
+// Descrittore CCCD: sul PC la app e' sempre iscritta alle notify.
+class BLE2902 : public BLEDescriptor {};
+
+#endif // HOST_BLE2902_H
@@ -0,0 +1,153 @@
+#ifndef HOST_BLE_DEVICE_H
+#define HOST_BLE_DEVICE_H
+
+// ================================================================
+// BLE SUL PC (solo test host)
+// ----------------------------------------------------------------
+// Un server con una sola connessione finta, collegato al test invece che a
+// un telefono. La app del test scrive con hostBleWrite() (che chiama onWrite
+// come il task Bluedroid) e riceve le notify da hostBleNotify, gia' tagliate
+// all'MTU negoziato con hostBleConnect(): cosa perdere lo decide il test.
+// Le caratteristiche con permessi cifrati (setAccessPermissions) rifiutano le
+// write finche' la app non si abbina con hostBlePairStart/hostBlePairFinish.
+// ================================================================
+
+#include <Arduino.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class BLEServer;
+class BLECharacteristic;
+class BLESecurityCallbacks;
+
+// Permessi GATT (esp_gatt_defs.h)
+typedef uint16_t esp_gatt_perm_t;
+#define ESP_GATT_PERM_READ             (1 << 0)
+#define ESP_GATT_PERM_READ_ENCRYPTED   (1 << 1)
+#define ESP_GATT_PERM_READ_ENC_MITM    (1 << 2)
+#define ESP_GATT_PERM_WRITE            (1 << 4)
+#define ESP_GATT_PERM_WRITE_ENCRYPTED  (1 << 5)
+#define ESP_GATT_PERM_WRITE_ENC_MITM   (1 << 6)
+
+class BLEServerCallbacks {
+public:
+  virtual ~BLEServerCallbacks() {}
+  virtual void onConnect(BLEServer*) {}
+  virtual void onDisconnect(BLEServer*) {}
+};
+
+class BLECharacteristicCallbacks {
+public:
+  virtual ~BLECharacteristicCallbacks() {}
+  virtual void onWrite(BLECharacteristic*) {}
+  virtual void onRead(BLECharacteristic*) {}
+};
+
+class BLEDescriptor {
+public:
+  virtual ~BLEDescriptor() {}
+};
+
+class BLECharacteristic {
+public:
+  static const uint32_t PROPERTY_READ     = 1 << 0;
+  static const uint32_t PROPERTY_WRITE    = 1 << 1;
+  static const uint32_t PROPERTY_NOTIFY   = 1 << 2;
+  static const uint32_t PROPERTY_WRITE_NR = 1 << 3;
+  static const uint32_t PROPERTY_INDICATE = 1 << 4;
+
+  BLECharacteristic(const char* uuid, uint32_t props) : uuid(uuid), props(props) {}
+
+  String   getValue()  { return String(std::string(value.begin(), value.end())); }
+  uint8_t* getData()   { return value.data(); }
+  size_t   getLength() { return value.size(); }
+  void setValue(const uint8_t* p, size_t n) { value.assign(p, p + n); }
+  void setValue(uint8_t* p, size_t n)       { value.assign(p, p + n); }
+  void setValue(const char* s)              { setValue((const uint8_t*)s, strlen(s)); }
+  void setValue(String s)                   { setValue(s.c_str()); }
+  void notify(bool isNotification = true);
+  void setCallbacks(BLECharacteristicCallbacks* c) { callbacks = c; }
+  void addDescriptor(BLEDescriptor* d)             { descriptors.emplace_back(d); }
+  void setAccessPermissions(esp_gatt_perm_t p)     { perms = p; }
+  uint16_t getHandle() { return 0; }
+
+  const std::string uuid;
+  const uint32_t    props;
+  esp_gatt_perm_t   perms = ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE;
+  std::vector<uint8_t> value;
+  BLECharacteristicCallbacks* callbacks = nullptr; // Come nella libreria: non sono nostre
+  std::vector<std::unique_ptr<BLEDescriptor>> descriptors;
+};
+
+class BLEService {
+public:
+  BLECharacteristic* createCharacteristic(const char* uuid, uint32_t props) {
+    chars.emplace_back(new BLECharacteristic(uuid, props));
+    return chars.back().get();
+  }
+  void start() {}
+
+  std::vector<std::unique_ptr<BLECharacteristic>> chars;
+};
+
+class BLEAdvertising {
+public:
+  void addServiceUUID(const char*) {}
+  void setScanResponse(bool) {}
+  void setMinPreferred(uint16_t) {}
+  void start() { starts++; }
+  unsigned starts = 0;
+};
+
+class BLEServer {
+public:
+  void setCallbacks(BLEServerCallbacks* c) { callbacks = c; }
+  BLEService* createService(const char*, uint32_t = 15, uint8_t = 0) {
+    services.emplace_back(new BLEService());
+    return services.back().get();
+  }
+  BLEAdvertising* getAdvertising() { return &advertising; }
+  uint32_t getConnectedCount() { return connected ? 1 : 0; }
+  uint16_t getConnId() { return 0; }
+  uint16_t getPeerMTU(uint16_t) { return mtu; }
+
+  bool     connected = false;
+  bool     bonded = false;        // Chiavi salvate: alla riconnessione il link e' gia' cifrato
+  bool     authenticated = false; // Link cifrato con MITM (passkey)
+  uint32_t passkey = 0;           // Abbinamento in corso
+  uint16_t mtu = 23;
+  BLEAdvertising advertising;
+  BLEServerCallbacks* callbacks = nullptr;
+  std::vector<std::unique_ptr<BLEService>> services;
+};
+
+class BLEDevice {
+public:
+  static void init(const char*) {}
+  static void setMTU(uint16_t m) { localMtu = m; }
+  static uint16_t getMTU() { return localMtu; }
+  static BLEServer* createServer();
+  static BLEAdvertising* getAdvertising();
+  static void setSecurityCallbacks(BLESecurityCallbacks* c) { securityCallbacks = c; }
+  static uint16_t localMtu;
+  static BLESecurityCallbacks* securityCallbacks;
+};
+
+// --- Lato app: li usa il test ---
+// Connessione con l'MTU che la app ha negoziato (il minimo fra i due).
+void hostBleConnect(uint16_t mtu);
+void hostBleDisconnect();
+// Caratteristica per UUID sull'ultimo server creato (nullptr se non c'e').
+BLECharacteristic* hostBleFind(const char* uuid);
+// Write dalla app: il valore cambia e parte onWrite, come da Bluedroid. False
+// (e niente onWrite) se la caratteristica vuole un link cifrato che non c'e'.
+bool hostBleWrite(BLECharacteristic* c, const uint8_t* data, size_t len);
+// Abbinamento passkey: il Mochi riceve il codice da mostrare (onPassKeyNotify),
+// la app lo "digita" in hostBlePairFinish. Riuscito, resta legato (bond).
+uint32_t hostBlePairStart();
+bool     hostBlePairFinish(uint32_t typed);
+// Ogni notify, gia' tagliata a MTU - 3, mentre la app e' connessa.
+extern std::function<void(BLECharacteristic*, const uint8_t*, size_t)> hostBleNotify;
+
+#endif // HOST_BLE_DEVICE_H
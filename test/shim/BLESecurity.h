@@ -0,0 +1,51 @@
+#ifndef HOST_BLE_SECURITY_H
+#define HOST_BLE_SECURITY_H
+
+// Abbinamento BLE (solo test host): i valori di esp_gap_ble_api.h che usa il
+// firmware; chi digita il passkey e' il test, vedi hostBlePairStart().
+#include <BLEDevice.h>
+
+typedef uint8_t esp_ble_auth_req_t;
+typedef uint8_t esp_ble_io_cap_t;
+#define ESP_LE_AUTH_NO_BOND          0x00
+#define ESP_LE_AUTH_BOND             0x01
+#define ESP_LE_AUTH_REQ_MITM         (1 << 2)
+#define ESP_LE_AUTH_REQ_SC_ONLY      (1 << 3)
+#define ESP_LE_AUTH_REQ_SC_MITM_BOND (ESP_LE_AUTH_REQ_MITM | ESP_LE_AUTH_REQ_SC_ONLY | ESP_LE_AUTH_BOND)
+#define ESP_IO_CAP_OUT               0 // Solo display
+#define ESP_IO_CAP_IO                1
+#define ESP_IO_CAP_IN                2
+#define ESP_IO_CAP_NONE              3
+#define ESP_BLE_ENC_KEY_MASK         (1 << 0)
+#define ESP_BLE_ID_KEY_MASK          (1 << 1)
+#define ESP_AUTH_SMP_PASSKEY_FAIL    78
+
+typedef struct {
+  bool    success;
+  uint8_t fail_reason;
+  esp_ble_auth_req_t auth_mode;
+} esp_ble_auth_cmpl_t;
+
+class BLESecurityCallbacks {
+public:
+  virtual ~BLESecurityCallbacks() {}
+  virtual uint32_t onPassKeyRequest() = 0;
+  virtual void onPassKeyNotify(uint32_t pass_key) = 0;
+  virtual bool onSecurityRequest() = 0;
+  virtual void onAuthenticationComplete(esp_ble_auth_cmpl_t) = 0;
+  virtual bool onConfirmPIN(uint32_t pin) = 0;
+};
+
+class BLESecurity {
+public:
+  void setAuthenticationMode(esp_ble_auth_req_t m) { authMode = m; }
+  void setCapability(esp_ble_io_cap_t c)           { ioCap = c; }
+  void setInitEncryptionKey(uint8_t k)             { initKey = k; }
+  void setRespEncryptionKey(uint8_t k)             { respKey = k; }
+
+  esp_ble_auth_req_t authMode = 0;
+  esp_ble_io_cap_t   ioCap = ESP_IO_CAP_NONE;
+  uint8_t initKey = 0, respKey = 0;
+};
+
+#endif // HOST_BLE_SECURITY_H
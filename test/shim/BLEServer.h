@@ -0,0 +1,2 @@
+// Solo test host: tutto il BLE finto sta in BLEDevice.h.
+#include <BLEDevice.h>
@@ -0,0 +1,6 @@
+#include "Board.h"
+
+// Solo test host: nessun display, nessun probe.
+BoardProfile g_board = { "host", -1, -1, -1, -1, -1, -1, false, 1, false, -1, false };
+
+void boardDetect() {}
@@ -0,0 +1,88 @@
+#ifndef HOST_PREFERENCES_H
+#define HOST_PREFERENCES_H
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// NVS in memoria (solo test host). Ogni oggetto Preferences e' una flash a se'
+// (un MochiState = un device); share() fa vedere a un secondo oggetto la
+// stessa memoria, per simulare un riavvio che ritrova i dati. hostShareNext()
+// fa lo stesso con il prossimo oggetto creato (quello dentro un MochiState).
+class Preferences {
+public:
+  typedef std::map<std::string, std::map<std::string, std::vector<uint8_t>>> Store;
+
+  Preferences() : store(nextStore() ? std::move(nextStore()) : std::make_shared<Store>()) {}
+  void share(const Preferences& o) { store = o.store; }
+  static void hostShareNext(const Preferences& o) { nextStore() = o.store; }
+
+  bool begin(const char* name, bool readOnly = false) { ns = name; ro = readOnly; return true; }
+  void end() { ns.clear(); }
+  bool clear() { if (ro) return false; (*store)[ns].clear(); return true; }
+  bool remove(const char* key) { return !ro && (*store)[ns].erase(key) > 0; }
+  bool isKey(const char* key) { return find(key) != nullptr; }
+
+  float    getFloat(const char* k, float d = 0)      { return get(k, d); }
+  int32_t  getInt(const char* k, int32_t d = 0)      { return get(k, d); }
+  uint32_t getUInt(const char* k, uint32_t d = 0)    { return get(k, d); }
+  uint32_t getULong(const char* k, uint32_t d = 0)   { return get(k, d); }
+  uint8_t  getUChar(const char* k, uint8_t d = 0)    { return get(k, d); }
+  size_t putFloat(const char* k, float v)     { return put(k, &v, sizeof(v)); }
+  size_t putInt(const char* k, int32_t v)     { return put(k, &v, sizeof(v)); }
+  size_t putUInt(const char* k, uint32_t v)   { return put(k, &v, sizeof(v)); }
+  size_t putULong(const char* k, uint32_t v)  { return put(k, &v, sizeof(v)); }
+  size_t putUChar(const char* k, uint8_t v)   { return put(k, &v, sizeof(v)); }
+
+  String getString(const char* k, String d = String()) {
+    const std::vector<uint8_t>* v = find(k);
+    return v ? String(std::string(v->begin(), v->end()).c_str()) : d;
+  }
+  size_t putString(const char* k, const char* v) { return put(k, v, strlen(v)); }
+  size_t putString(const char* k, String v) { return putString(k, v.c_str()); }
+
+  size_t getBytesLength(const char* k) { const std::vector<uint8_t>* v = find(k); return v ? v->size() : 0; }
+  size_t getBytes(const char* k, void* out, size_t len) {
+    const std::vector<uint8_t>* v = find(k);
+    if (!v || v->size() > len) return 0;
+    memcpy(out, v->data(), v->size());
+    return v->size();
+  }
+  size_t putBytes(const char* k, const void* v, size_t len) { return put(k, v, len); }
+
+  unsigned writes = 0; // Solo host: scritture su questa flash
+
+private:
+  std::shared_ptr<Store> store;
+  std::string ns;
+
+  static std::shared_ptr<Store>& nextStore() {
+    static std::shared_ptr<Store> next;
+    return next;
+  }
+  bool ro = false;
+
+  const std::vector<uint8_t>* find(const char* k) {
+    auto n = store->find(ns);
+    if (n == store->end()) return nullptr;
+    auto v = n->second.find(k);
+    return v == n->second.end() ? nullptr : &v->second;
+  }
+  size_t put(const char* k, const void* v, size_t len) {
+    if (ro || ns.empty()) return 0;
+    writes++;
+    (*store)[ns][k].assign((const uint8_t*)v, (const uint8_t*)v + len);
+    return len;
+  }
+  template <class T> T get(const char* k, T d) {
+    const std::vector<uint8_t>* v = find(k);
+    if (!v || v->size() != sizeof(T)) return d;
+    T out;
+    memcpy(&out, v->data(), sizeof(T));
+    return out;
+  }
+};
+
+#endif // HOST_PREFERENCES_H
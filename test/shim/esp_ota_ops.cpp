@@ -0,0 +1,89 @@
+#include "esp_ota_ops.h"
+#include <map>
+
+struct HostOtaSession {
+  const esp_partition_t* part;
+  uint32_t written;
+  uint32_t erased;     // Byte gia' cancellati dall'inizio
+};
+
+static std::map<esp_ota_handle_t, HostOtaSession> s_sessions;
+static esp_ota_handle_t s_nextHandle = 1;
+static const esp_partition_t* s_boot = nullptr;
+
+static bool isOta(const esp_partition_t* p) {
+  return p->subtype == ESP_PARTITION_SUBTYPE_APP_OTA_0 || p->subtype == ESP_PARTITION_SUBTYPE_APP_OTA_1;
+}
+
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from) {
+  const esp_partition_t* running = start_from ? start_from : s_boot;
+  const esp_partition_subtype_t subs[] = { ESP_PARTITION_SUBTYPE_APP_OTA_0, ESP_PARTITION_SUBTYPE_APP_OTA_1 };
+  for (esp_partition_subtype_t sub : subs) {
+    const esp_partition_t* p = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, sub, nullptr);
+    if (p && p != running) return p;
+  }
+  return nullptr;
+}
+
+const esp_partition_t* esp_ota_get_running_partition(void) { return s_boot; }
+const esp_partition_t* esp_ota_get_boot_partition(void) { return s_boot; }
+
+esp_err_t esp_ota_begin(const esp_partition_t* partition, size_t image_size, esp_ota_handle_t* out_handle) {
+  if (!partition || !out_handle || !isOta(partition)) return ESP_ERR_INVALID_ARG;
+  HostOtaSession s = { partition, 0, 0 };
+  if (image_size != OTA_WITH_SEQUENTIAL_WRITES) {
+    uint32_t len = image_size == OTA_SIZE_UNKNOWN ? partition->size : (uint32_t)image_size;
+    len = (len + partition->erase_size - 1) / partition->erase_size * partition->erase_size;
+    if (len > partition->size) return ESP_ERR_INVALID_SIZE;
+    if (esp_partition_erase_range(partition, 0, len) != ESP_OK) return ESP_FAIL;
+    s.erased = len;
+  }
+  *out_handle = s_nextHandle++;
+  s_sessions[*out_handle] = s;
+  return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void* data, size_t size) {
+  auto it = s_sessions.find(handle);
+  if (it == s_sessions.end()) return ESP_ERR_INVALID_ARG;
+  HostOtaSession& s = it->second;
+  if (size > s.part->size - s.written) return ESP_ERR_INVALID_SIZE;
+  while (s.erased < s.written + size) {
+    if (esp_partition_erase_range(s.part, s.erased, s.part->erase_size) != ESP_OK) return ESP_FAIL;
+    s.erased += s.part->erase_size;
+  }
+  if (esp_partition_write(s.part, s.written, data, size) != ESP_OK) return ESP_FAIL;
+  s.written += size;
+  return ESP_OK;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle) {
+  auto it = s_sessions.find(handle);
+  if (it == s_sessions.end()) return ESP_ERR_NOT_FOUND;
+  HostOtaSession s = it->second;
+  s_sessions.erase(it);
+  uint8_t magic = 0;
+  if (!s.written || esp_partition_read(s.part, 0, &magic, 1) != ESP_OK || magic != ESP_IMAGE_HEADER_MAGIC) {
+    return ESP_ERR_OTA_VALIDATE_FAILED;
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle) {
+  return s_sessions.erase(handle) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition) {
+  if (!partition || !isOta(partition)) return ESP_ERR_INVALID_ARG;
+  s_boot = partition;
+  return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void) { return ESP_OK; }
+
+unsigned hostOtaOpenHandles() { return (unsigned)s_sessions.size(); }
+
+void hostOtaReset() {
+  s_sessions.clear();
+  s_boot = nullptr;
+}
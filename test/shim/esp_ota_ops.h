@@ -0,0 +1,35 @@
+#ifndef HOST_ESP_OTA_OPS_H
+#define HOST_ESP_OTA_OPS_H
+
+// Aggiornamento su partizione (solo test host), sopra le partizioni in memoria
+// di esp_partition.h: il test crea "ota_0"/"ota_1" con hostPartitionCreate e
+// poi legge cosa ci e' finito e quale partizione partirebbe al riavvio.
+#include "esp_partition.h"
+
+typedef uint32_t esp_ota_handle_t;
+
+#define OTA_SIZE_UNKNOWN           0xffffffff
+#define OTA_WITH_SEQUENTIAL_WRITES 0xfffffffe
+#define ESP_ERR_NOT_FOUND              0x105
+#define ESP_ERR_OTA_VALIDATE_FAILED    0x1503
+#define ESP_IMAGE_HEADER_MAGIC         0xE9
+
+// Prossima partizione OTA diversa da quella di boot (nullptr = la prima).
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from);
+const esp_partition_t* esp_ota_get_running_partition(void);
+const esp_partition_t* esp_ota_get_boot_partition(void);
+// Con OTA_WITH_SEQUENTIAL_WRITES cancella un settore alla volta, quando la
+// scrittura ci arriva; altrimenti cancella subito image_size byte (o tutto).
+esp_err_t esp_ota_begin(const esp_partition_t* partition, size_t image_size, esp_ota_handle_t* out_handle);
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void* data, size_t size);
+// Come sul device l'immagine deve sembrare un'app: qui basta il magic 0xE9.
+esp_err_t esp_ota_end(esp_ota_handle_t handle);
+esp_err_t esp_ota_abort(esp_ota_handle_t handle);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition);
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void);
+
+// Solo host: sessioni aperte (begin senza end/abort) e torna al firmware di fabbrica.
+unsigned hostOtaOpenHandles();
+void     hostOtaReset();
+
+#endif // HOST_ESP_OTA_OPS_H
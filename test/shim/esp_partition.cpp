@@ -0,0 +1,91 @@
+#include "esp_partition.h"
+#include <string.h>
+#include <memory>
+#include <vector>
+
+struct HostPartition {
+  esp_partition_t      info;
+  std::vector<uint8_t> data;
+};
+
+static std::vector<std::unique_ptr<HostPartition>> s_parts;
+
+static HostPartition* find(const esp_partition_t* p) {
+  for (auto& h : s_parts) if (&h->info == p) return h.get();
+  return nullptr;
+}
+
+static bool inRange(HostPartition* h, size_t off, size_t len) {
+  return h && off <= h->data.size() && len <= h->data.size() - off;
+}
+
+const esp_partition_t* hostPartitionCreate(const char* label, uint8_t subtype, uint32_t size) {
+  for (auto& h : s_parts) {
+    if (strcmp(h->info.label, label) == 0) {
+      h->data.assign(size, 0xFF);
+      h->info.size = size;
+      return &h->info;
+    }
+  }
+  std::unique_ptr<HostPartition> h(new HostPartition());
+  memset(&h->info, 0, sizeof(h->info));
+  h->info.type = ESP_PARTITION_TYPE_DATA;
+  h->info.subtype = (esp_partition_subtype_t)subtype;
+  h->info.size = size;
+  h->info.erase_size = 4096;
+  strncpy(h->info.label, label, sizeof(h->info.label) - 1);
+  h->data.assign(size, 0xFF);
+  s_parts.push_back(std::move(h));
+  return &s_parts.back()->info;
+}
+
+uint8_t* hostPartitionData(const esp_partition_t* p) {
+  HostPartition* h = find(p);
+  return h ? h->data.data() : nullptr;
+}
+
+void hostPartitionsClear() { s_parts.clear(); }
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+  for (auto& h : s_parts) {
+    if (type != ESP_PARTITION_TYPE_ANY && h->info.type != type) continue;
+    if (subtype != ESP_PARTITION_SUBTYPE_ANY && h->info.subtype != subtype) continue;
+    if (label && strcmp(label, h->info.label) != 0) continue;
+    return &h->info;
+  }
+  return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* p, size_t off, void* dst, size_t len) {
+  HostPartition* h = find(p);
+  if (!inRange(h, off, len)) return ESP_ERR_INVALID_SIZE;
+  memcpy(dst, h->data.data() + off, len);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* p, size_t off, const void* src, size_t len) {
+  HostPartition* h = find(p);
+  if (!inRange(h, off, len)) return ESP_ERR_INVALID_SIZE;
+  const uint8_t* s = (const uint8_t*)src;
+  for (size_t i = 0; i < len; i++) h->data[off + i] &= s[i];
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* p, size_t off, size_t len) {
+  HostPartition* h = find(p);
+  if (!inRange(h, off, len) || off % h->info.erase_size || len % h->info.erase_size) return ESP_ERR_INVALID_ARG;
+  memset(h->data.data() + off, 0xFF, len);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* p, size_t off, size_t len, esp_partition_mmap_memory_t,
+                             const void** out, esp_partition_mmap_handle_t* handle) {
+  HostPartition* h = find(p);
+  if (!inRange(h, off, len)) return ESP_ERR_INVALID_SIZE;
+  *out = h->data.data() + off;
+  *handle = 1;
+  return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t) {}
@@ -0,0 +1,52 @@
+#ifndef HOST_ESP_PARTITION_H
+#define HOST_ESP_PARTITION_H
+
+// Partizioni in memoria (solo test host), con la semantica della flash NOR:
+// la cancellazione porta i byte a 0xFF, la scrittura puo' solo spegnere bit.
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int esp_err_t;
+#ifndef ESP_OK
+#define ESP_OK 0
+#define ESP_FAIL -1
+#endif
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_SIZE 0x104
+
+typedef enum { ESP_PARTITION_TYPE_APP = 0, ESP_PARTITION_TYPE_DATA = 1, ESP_PARTITION_TYPE_ANY = 0xff } esp_partition_type_t;
+typedef enum {
+  ESP_PARTITION_SUBTYPE_ANY = 0xff,
+  ESP_PARTITION_SUBTYPE_APP_OTA_0 = 0x10,
+  ESP_PARTITION_SUBTYPE_APP_OTA_1 = 0x11
+} esp_partition_subtype_t;
+
+typedef struct {
+  void*                   flash_chip;
+  esp_partition_type_t    type;
+  esp_partition_subtype_t subtype;
+  uint32_t                address;
+  uint32_t                size;
+  uint32_t                erase_size;
+  char                    label[17];
+  bool                    encrypted;
+  bool                    readonly;
+} esp_partition_t;
+
+typedef uint32_t esp_partition_mmap_handle_t;
+typedef enum { ESP_PARTITION_MMAP_DATA, ESP_PARTITION_MMAP_INST } esp_partition_mmap_memory_t;
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t, esp_partition_subtype_t, const char* label);
+esp_err_t esp_partition_read(const esp_partition_t*, size_t off, void* dst, size_t len);
+esp_err_t esp_partition_write(const esp_partition_t*, size_t off, const void* src, size_t len);
+esp_err_t esp_partition_erase_range(const esp_partition_t*, size_t off, size_t len);
+esp_err_t esp_partition_mmap(const esp_partition_t*, size_t off, size_t len, esp_partition_mmap_memory_t,
+                             const void** out, esp_partition_mmap_handle_t* handle);
+void esp_partition_munmap(esp_partition_mmap_handle_t);
+
+// Solo host: crea (o svuota) una partizione dati, tutta a 0xFF.
+const esp_partition_t* hostPartitionCreate(const char* label, uint8_t subtype, uint32_t size);
+uint8_t*               hostPartitionData(const esp_partition_t* p); // Contenuto, per simulare guasti
+void                   hostPartitionsClear();
+
+#endif // HOST_ESP_PARTITION_H
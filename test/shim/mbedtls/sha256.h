@@ -0,0 +1,21 @@
+#ifndef HOST_MBEDTLS_SHA256_H
+#define HOST_MBEDTLS_SHA256_H
+
+// SHA-256 con l'interfaccia di mbedtls (solo test host, vedi sha256.cpp).
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t total;          // Byte ricevuti
+  uint8_t  block[64];
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init(mbedtls_sha256_context* ctx);
+void mbedtls_sha256_free(mbedtls_sha256_context* ctx);
+int  mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int is224);
+int  mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t ilen);
+int  mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char output[32]);
+
+#endif // HOST_MBEDTLS_SHA256_H
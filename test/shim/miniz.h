@@ -0,0 +1,88 @@
+#ifndef HOST_MINIZ_H
+#define HOST_MINIZ_H
+
+// ================================================================
+// TINFL SUL PC (solo test host)
+// ----------------------------------------------------------------
+// L'interfaccia a flusso di tinfl (quella della ROM ESP32) sopra zlib. zlib
+// tiene la sua finestra: il buffer d'uscita circolare serve solo come uscita.
+// Le allocazioni di zlib stanno in un'arena dentro il decompressore, cosi'
+// basta liberare lui (come sul device, dove tinfl non alloca niente).
+// ================================================================
+
+#include <stdint.h>
+#include <stddef.h>
+#include <zlib.h>
+
+typedef uint8_t  mz_uint8;
+typedef uint32_t mz_uint32;
+
+enum {
+  TINFL_FLAG_PARSE_ZLIB_HEADER             = 1,
+  TINFL_FLAG_HAS_MORE_INPUT                = 2,
+  TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+  TINFL_FLAG_COMPUTE_ADLER32               = 8,
+};
+
+typedef enum {
+  TINFL_STATUS_BAD_PARAM         = -3,
+  TINFL_STATUS_ADLER32_MISMATCH  = -2,
+  TINFL_STATUS_FAILED            = -1,
+  TINFL_STATUS_DONE              = 0,
+  TINFL_STATUS_NEEDS_MORE_INPUT  = 1,
+  TINFL_STATUS_HAS_MORE_OUTPUT   = 2,
+} tinfl_status;
+
+#define TINFL_LZ_DICT_SIZE 32768
+
+struct tinfl_decompressor {
+  z_stream z;
+  bool     started;
+  size_t   used;               // Byte dell'arena gia' dati a zlib
+  uint8_t  arena[64 * 1024];   // Stato di inflate + finestra da 32 KB
+};
+
+inline void tinfl_init(tinfl_decompressor* r) {
+  r->started = false;
+  r->used = 0;
+}
+
+inline voidpf hostTinflAlloc(voidpf opaque, uInt items, uInt size) {
+  tinfl_decompressor* r = (tinfl_decompressor*)opaque;
+  size_t n = ((size_t)items * size + 15) & ~(size_t)15;
+  if (r->used + n > sizeof(r->arena)) return Z_NULL;
+  voidpf p = r->arena + r->used;
+  r->used += n;
+  return p;
+}
+
+inline void hostTinflFree(voidpf, voidpf) {}
+
+inline tinfl_status tinfl_decompress(tinfl_decompressor* r, const mz_uint8* in, size_t* inBytes,
+                                     mz_uint8* outStart, mz_uint8* outNext, size_t* outBytes,
+                                     const mz_uint32 flags) {
+  (void)outStart;
+  if (!r->started) {
+    r->z = z_stream();
+    r->z.zalloc = hostTinflAlloc;
+    r->z.zfree = hostTinflFree;
+    r->z.opaque = r;
+    int bits = (flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? MAX_WBITS : -MAX_WBITS;
+    if (inflateInit2(&r->z, bits) != Z_OK) return TINFL_STATUS_FAILED;
+    r->started = true;
+  }
+  r->z.next_in = (Bytef*)in;
+  r->z.avail_in = (uInt)*inBytes;
+  r->z.next_out = outNext;
+  r->z.avail_out = (uInt)*outBytes;
+  int ret = inflate(&r->z, Z_NO_FLUSH);
+  *inBytes -= r->z.avail_in;
+  *outBytes -= r->z.avail_out;
+  if (ret == Z_STREAM_END) return TINFL_STATUS_DONE;
+  if (ret != Z_OK && ret != Z_BUF_ERROR) return TINFL_STATUS_FAILED;
+  if (r->z.avail_out == 0) return TINFL_STATUS_HAS_MORE_OUTPUT;
+  if (!(flags & TINFL_FLAG_HAS_MORE_INPUT)) return TINFL_STATUS_FAILED; // Stream troncato
+  return TINFL_STATUS_NEEDS_MORE_INPUT;
+}
+
+#endif // HOST_MINIZ_H
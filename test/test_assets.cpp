@@ -0,0 +1,173 @@
+#include "mochi_test.h"
+#include "MochiAssets.h"
+#include "Settings.h"
+#include <esp_partition.h>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+// Pack nello stesso formato di tools/pack_assets.py.
+struct PackAsset {
+  uint16_t id;
+  uint8_t  format;
+  uint16_t w, h;
+  std::vector<uint8_t> data;
+};
+
+static void put16(std::vector<uint8_t>& b, size_t at, uint16_t v) { b[at] = v; b[at + 1] = v >> 8; }
+static void put32(std::vector<uint8_t>& b, size_t at, uint32_t v) {
+  for (int i = 0; i < 4; i++) b[at + i] = v >> (8 * i);
+}
+
+static std::vector<uint8_t> buildPack(const std::vector<PackAsset>& assets) {
+  const size_t HEADER = 12, ENTRY = 16;
+  size_t off = HEADER + ENTRY * assets.size();
+  std::vector<uint8_t> pack(off, 0);
+  for (size_t i = 0; i < assets.size(); i++) {
+    off = (pack.size() + 3) & ~(size_t)3;
+    pack.resize(off, 0);
+    size_t e = HEADER + ENTRY * i;
+    put16(pack, e, assets[i].id);
+    pack[e + 2] = assets[i].format;
+    put16(pack, e + 4, assets[i].w);
+    put16(pack, e + 6, assets[i].h);
+    put32(pack, e + 8, off);
+    put32(pack, e + 12, assets[i].data.size());
+    pack.insert(pack.end(), assets[i].data.begin(), assets[i].data.end());
+  }
+  memcpy(pack.data(), "MAS1", 4);
+  put16(pack, 4, assets.size());
+  put32(pack, 8, pack.size());
+  return pack;
+}
+
+static const esp_partition_t* flash(const std::vector<uint8_t>& pack, uint32_t size = 0x20000) {
+  hostPartitionsClear();
+  const esp_partition_t* p = hostPartitionCreate(ASSETS_PARTITION, ASSETS_SUBTYPE, size);
+  memcpy(hostPartitionData(p), pack.data(), pack.size());
+  return p;
+}
+
+static std::vector<PackAsset> sampleAssets() {
+  PackAsset egg = { ASSET_EGG_0, ASSET_FMT_RGB565_SWAPPED, 3, 2, {} };
+  for (int i = 0; i < 3 * 2 * 2; i++) egg.data.push_back(i);
+  PackAsset ease = { ASSET_EASE_BG, ASSET_FMT_U16_TABLE, 5, 1, { 0, 0, 1, 0, 2, 0, 3, 0, 0xFF, 0xFF } };
+  return { egg, ease };
+}
+
+TEST(missing_partition) {
+  hostPartitionsClear();
+  CHECK(!mochiAssetsBegin());
+  MochiAsset a;
+  CHECK(!mochiAssetGet(ASSET_EGG_0, &a));
+}
+
+TEST(blank_partition) {
+  flash({});
+  CHECK(!mochiAssetsBegin());
+}
+
+// Gli asset si leggono direttamente dalla partizione mappata, senza copie.
+TEST(lookup_points_into_flash) {
+  std::vector<uint8_t> pack = buildPack(sampleAssets());
+  const esp_partition_t* p = flash(pack);
+  CHECK(mochiAssetsBegin());
+
+  MochiAsset a;
+  CHECK(mochiAssetGet(ASSET_EGG_0, &a));
+  CHECK_EQ(a.w, 3);
+  CHECK_EQ(a.h, 2);
+  CHECK_EQ(a.size, 12);
+  CHECK_EQ(a.format, ASSET_FMT_RGB565_SWAPPED);
+  CHECK((const uint8_t*)a.data >= hostPartitionData(p));
+  CHECK((const uint8_t*)a.data < hostPartitionData(p) + pack.size());
+  CHECK(memcmp(a.data, sampleAssets()[0].data.data(), 12) == 0);
+  CHECK_EQ(((uintptr_t)a.data - (uintptr_t)hostPartitionData(p)) % 4, 0);
+
+  CHECK(mochiAssetGet(ASSET_EASE_BG, &a));
+  CHECK_EQ(a.w, 5);
+  CHECK_EQ(((const uint16_t*)a.data)[4], 0xFFFF);
+
+  CHECK(!mochiAssetGet(ASSET_EGG_3, &a));
+}
+
+TEST(rejects_entry_outside_pack) {
+  std::vector<uint8_t> pack = buildPack(sampleAssets());
+  put32(pack, 12 + 16 + 12, 0x1000); // size della seconda voce oltre la fine
+  flash(pack);
+  CHECK(!mochiAssetsBegin());
+
+  pack = buildPack(sampleAssets());
+  put32(pack, 12 + 8, 4); // offset dentro la tabella
+  flash(pack);
+  CHECK(!mochiAssetsBegin());
+}
+
+TEST(rejects_pack_larger_than_partition) {
+  std::vector<uint8_t> pack = buildPack(sampleAssets());
+  put32(pack, 8, 0x30000);
+  flash(pack);
+  CHECK(!mochiAssetsBegin());
+}
+
+TEST(rejects_table_past_end) {
+  std::vector<uint8_t> pack = buildPack(sampleAssets());
+  put16(pack, 4, 4000);
+  flash(pack);
+  CHECK(!mochiAssetsBegin());
+}
+
+// Un pack rifiutato non lascia in giro quello di prima.
+TEST(failed_begin_forgets_previous_pack) {
+  flash(buildPack(sampleAssets()));
+  CHECK(mochiAssetsBegin());
+  flash({});
+  CHECK(!mochiAssetsBegin());
+  MochiAsset a;
+  CHECK(!mochiAssetGet(ASSET_EGG_0, &a));
+}
+
+#ifdef MOCHI_ASSETS_BIN
+// ================================================================
+// PACK VERO
+// ----------------------------------------------------------------
+// bin/assets.bin come lo scrive tools/pack_assets.py (CMake lo rigenera nella
+// cartella di build): le quattro uova e la curva dello sfondo devono esserci,
+// sia mappando il file con mmap sia passando dalla partizione.
+// ================================================================
+
+static void checkRealPack() {
+  MochiAsset a;
+  for (uint16_t id = ASSET_EGG_0; id <= ASSET_EGG_3; id++) {
+    CHECK(mochiAssetGet(id, &a));
+    CHECK_EQ(a.format, ASSET_FMT_RGB565_SWAPPED);
+    CHECK_EQ(a.size, (uint32_t)a.w * a.h * 2);
+    CHECK_EQ((uintptr_t)a.data % 4, 0);
+  }
+  CHECK(mochiAssetGet(ASSET_EASE_BG, &a));
+  CHECK_EQ(a.format, ASSET_FMT_U16_TABLE);
+  CHECK_EQ(a.w, 172);
+  CHECK_EQ(a.size, 172 * 2);
+  const uint16_t* ease = (const uint16_t*)a.data;
+  CHECK_EQ(ease[0], 0);
+  CHECK_EQ(ease[171], 65535);
+  for (int i = 1; i < 172; i++) CHECK(ease[i] >= ease[i - 1]);
+}
+
+TEST(packer_output_maps_from_file) {
+  CHECK(mochiAssetsBeginFile(MOCHI_ASSETS_BIN));
+  checkRealPack();
+  CHECK(!mochiAssetsBeginFile(MOCHI_ASSETS_BIN ".manca"));
+  MochiAsset a;
+  CHECK(!mochiAssetGet(ASSET_EGG_0, &a));
+}
+
+TEST(packer_output_in_partition) {
+  std::ifstream f(MOCHI_ASSETS_BIN, std::ios::binary);
+  std::vector<uint8_t> pack((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  CHECK(!pack.empty());
+  flash(pack);
+  CHECK(mochiAssetsBegin());
+  checkRealPack();
+}
+#endif
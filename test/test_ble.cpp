@@ -0,0 +1,714 @@
+#include "ble_app.h"
+#include "MochiMem.h"
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <thread>
+
+// Amici con id sparsi ma ripetibili.
+static void addFriends(MochiState& s, int n) {
+  for (int i = 0; i < n; i++) CHECK(s.addFriend(0x100000 + i * 0x3A7));
+}
+
+static std::vector<MochiId> friendIds(const AppFrame& f) {
+  std::vector<MochiId> ids;
+  for (const AppTlv& t : f.tlvs) {
+    if (t.tag == TAG_FRIEND) ids.push_back(mochiTlvU32(t.val.data(), t.val.size()));
+  }
+  return ids;
+}
+
+// App testuale vecchia (niente HELLO): write + read della caratteristica. Con
+// 256 amici la lista arriva a pagine, ognuna un array JSON valido.
+TEST(text_friends_paginated) {
+  BleApp app(BLE_MTU);
+  addFriends(app.state, MAX_FRIENDS);
+
+  std::set<std::string> seen;
+  std::string cmd = "get_friends";
+  int pages = 0;
+  while (pages < 20) {
+    app.write(app.legacy, cmd.c_str());
+    app.run();
+    pages++;
+    std::string body(app.legacy->value.begin(), app.legacy->value.end());
+    CHECK(body.size() <= BLE_REPLY_BUF_SIZE);
+    DynamicJsonDocument doc(8192);
+    CHECK(!deserializeJson(doc, body.c_str(), body.size()));
+    JsonArrayConst arr = doc.as<JsonArrayConst>();
+    CHECK(arr.size() > 0);
+    const char* next = nullptr;
+    for (JsonVariantConst v : arr) {
+      if (v["next"].is<const char*>()) next = v["next"].as<const char*>();
+      else CHECK(seen.insert(v["id"].as<const char*>()).second);
+    }
+    if (!next) break;
+    cmd = std::string("get_friends:") + next;
+  }
+  CHECK_EQ(seen.size(), MAX_FRIENDS);
+  CHECK(pages > 1);
+}
+
+// Stessa lista a frame: un messaggio solo, frammentato secondo l'MTU.
+TEST(binary_friends_any_mtu) {
+  for (uint16_t mtu : { 23, 185, 512 }) {
+    BleApp app(mtu);
+    addFriends(app.state, MAX_FRIENDS);
+    CHECK(app.hello());
+    app.write(app.cmd, app.frame(PT_GET_FRIENDS));
+    app.run();
+    Bytes r;
+    BLECharacteristic* from;
+    CHECK(app.take(&r, &from));
+    CHECK(from == app.social);
+    std::vector<AppFrame> f = BleApp::parse(r);
+    CHECK_EQ(f.size(), 1);
+    std::vector<MochiId> ids = friendIds(f[0]);
+    CHECK_EQ(ids.size(), MAX_FRIENDS);
+    CHECK(std::is_sorted(ids.begin(), ids.end()));
+    CHECK(app.inbox.empty());
+  }
+}
+
+// Con il 20% dei frammenti persi la app chiede il resto finche' la lista e'
+// completa, e il risultato e' identico a quello senza perdite.
+TEST(lost_fragments_are_resent) {
+  BleApp app(23);
+  addFriends(app.state, MAX_FRIENDS);
+  CHECK(app.hello());
+  app.write(app.cmd, app.frame(PT_GET_FRIENDS));
+  app.run();
+  Bytes clean;
+  CHECK(app.take(&clean));
+
+  app.lossPct = 20;
+  app.write(app.cmd, app.frame(PT_GET_FRIENDS));
+  app.run();
+  Bytes r;
+  CHECK(app.take(&r, nullptr, 30));
+  CHECK(app.lost > 0);
+  CHECK(app.resends > 0);
+  // Stesso contenuto a parte il reqId
+  CHECK_EQ(r.size(), clean.size());
+  CHECK(memcmp(r.data() + 3, clean.data() + 3, r.size() - 3) == 0);
+  BENCH_REPORT("resend: %u frammenti persi, %u richieste per %u byte a MTU 23",
+               app.lost, app.resends, (unsigned)r.size());
+}
+
+// Una risposta sostituita nel frattempo non si puo' rimandare: PE_GONE.
+TEST(resend_after_overwrite_is_gone) {
+  BleApp app(23);
+  addFriends(app.state, 64);
+  CHECK(app.hello());
+  app.write(app.cmd, app.frame(PT_GET_FRIENDS));
+  app.run();
+  CHECK(!app.inbox.empty());
+  uint8_t msgId = app.inbox[0].data[1];
+  app.inbox.clear();
+
+  // Stesso flusso, risposta corta: riscrive l'inizio del buffer
+  app.write(app.cmd, app.frame(PT_GET_REQUESTS));
+  app.run();
+  app.inbox.clear();
+
+  app.write(app.cmd, app.frame(PT_RESEND, { { TAG_FRAG_MSG, { msgId } }, { TAG_FRAG_OFFSET, BleApp::le(40, 2) } }));
+  app.run();
+  Bytes r;
+  BLECharacteristic* from;
+  CHECK(app.take(&r, &from));
+  CHECK(from == app.diag);
+  std::vector<AppFrame> f = BleApp::parse(r);
+  CHECK_EQ(f.size(), 1);
+  CHECK_EQ(f[0].type, PT_ERROR | PROTO_REPLY);
+  CHECK_EQ(f[0].tlvs[0].val[0], PE_GONE);
+
+  // msgId mai visto
+  app.write(app.cmd, app.frame(PT_RESEND, { { TAG_FRAG_MSG, { (uint8_t)(msgId + 100) } } }));
+  app.run();
+  CHECK(app.take(&r));
+  CHECK_EQ(BleApp::parse(r)[0].tlvs[0].val[0], PE_GONE);
+}
+
+// Il resend riparte dal frammento che contiene l'offset chiesto.
+TEST(resend_from_offset) {
+  BleApp app(23);
+  addFriends(app.state, 64);
+  CHECK(app.hello());
+  app.write(app.cmd, app.frame(PT_GET_FRIENDS));
+  app.run();
+  size_t sent = app.inbox.size();
+  uint8_t msgId = app.inbox[0].data[1];
+  app.inbox.clear();
+
+  const size_t body = 20 - FRAG_HEADER_SIZE;
+  app.write(app.cmd, app.frame(PT_RESEND, { { TAG_FRAG_MSG, { msgId } }, { TAG_FRAG_OFFSET, BleApp::le(body * 3, 2) } }));
+  app.run();
+  CHECK_EQ(app.inbox.size(), sent - 3);
+  CHECK_EQ(app.inbox[0].data[1], msgId);
+  CHECK_EQ(app.inbox[0].data[2], 3);
+}
+
+// Dentro un batch PT_RESEND e' un tipo sconosciuto: il resto del batch risponde.
+TEST(resend_inside_batch_is_rejected) {
+  BleApp app(BLE_MTU);
+  CHECK(app.hello());
+  Bytes batch = app.frame(PT_RESEND, { { TAG_FRAG_MSG, { 1 } } });
+  Bytes second = app.frame(PT_GET_REQUESTS);
+  batch.insert(batch.end(), second.begin(), second.end());
+  app.write(app.cmd, batch);
+  app.run();
+  Bytes r;
+  CHECK(app.take(&r));
+  std::vector<AppFrame> f = BleApp::parse(r);
+  CHECK_EQ(f.size(), 2);
+  CHECK_EQ(f[0].type, PT_ERROR | PROTO_REPLY);
+  CHECK_EQ(f[0].tlvs[0].val[0], PE_UNKNOWN_TYPE);
+  CHECK_EQ(f[1].type, PT_GET_REQUESTS | PROTO_REPLY);
+}
+
+// Raffica di frame oltre la coda: da onWrite non parte nessuna notify, il
+// loop risponde PE_BUSY a quelli scartati e la app, riprovando come
+// connect.js, alla fine ottiene tutte le risposte.
+TEST(flood_busy_from_loop) {
+  BleApp app(BLE_MTU);
+  CHECK(app.hello());
+  const int N = 40;
+  std::map<uint8_t, int> pending; // reqId -> richiesta
+  for (int i = 0; i < N; i++) {
+    Bytes f = app.frame(PT_GET_STATE);
+    pending[f[2]] = i;
+    app.write(app.cmd, f);
+  }
+  CHECK(app.inbox.empty());
+
+  int rounds = 0, busy = 0;
+  while (!pending.empty() && rounds < 20) {
+    rounds++;
+    app.run(N);
+    Bytes r;
+    std::map<uint8_t, int> retry;
+    while (app.take(&r)) {
+      for (const AppFrame& f : BleApp::parse(r)) {
+        CHECK(pending.count(f.reqId));
+        if (f.type == (PT_ERROR | PROTO_REPLY)) {
+          CHECK_EQ(f.tlvs.size(), 1);
+          CHECK_EQ(f.tlvs[0].val[0], PE_BUSY);
+          busy++;
+          retry[f.reqId] = pending[f.reqId];
+        } else {
+          CHECK_EQ(f.type, PT_GET_STATE | PROTO_REPLY);
+        }
+        pending.erase(f.reqId);
+      }
+    }
+    // Risposte mai arrivate (anche PE_BUSY scartato): scadono e si riprovano
+    for (auto& p : pending) retry[p.first] = p.second;
+    pending.clear();
+    for (auto& p : retry) {
+      Bytes f = app.frame(PT_GET_STATE);
+      pending[f[2]] = p.second;
+      app.write(app.cmd, f);
+    }
+    CHECK(app.inbox.empty());
+  }
+  CHECK(pending.empty());
+  CHECK(busy > 0);
+  BENCH_REPORT("raffica: %d frame, %d PE_BUSY, %d giri", N, busy, rounds);
+}
+
+// Come sopra con il "task Bluedroid" su un altro thread: le notify partono
+// solo dal loop, ogni risposta e' un frame intero (risposta o PE_BUSY).
+TEST(flood_busy_threads) {
+  BleApp app(BLE_MTU);
+  CHECK(app.hello());
+  const int N = 3000;
+  std::vector<Bytes> frames;
+  for (int i = 0; i < N; i++) frames.push_back(app.frame(PT_GET_STATE));
+  std::thread::id loop = std::this_thread::get_id();
+  bool offLoop = false;
+  hostBleNotify = [&](BLECharacteristic* c, const uint8_t* d, size_t n) {
+    if (std::this_thread::get_id() != loop) offLoop = true;
+    app.inbox.push_back({ c, Bytes(d, d + n) });
+  };
+
+  std::atomic<bool> done{ false };
+  std::thread bluedroid([&] {
+    for (const Bytes& f : frames) {
+      hostBleWrite(app.cmd, f.data(), f.size());
+      if (f[2] % 8 == 0) std::this_thread::yield();
+    }
+    done = true;
+  });
+  while (!done) {
+    app.ble.tick();
+    std::this_thread::yield();
+  }
+  bluedroid.join();
+  app.run(N);
+
+  CHECK(!offLoop);
+  int replies = 0, busy = 0;
+  Bytes r;
+  while (app.take(&r)) {
+    std::vector<AppFrame> f = BleApp::parse(r);
+    CHECK_EQ(f.size(), 1);
+    if (f[0].type == (PT_ERROR | PROTO_REPLY)) busy += f[0].tlvs.size() == 1 && f[0].tlvs[0].val[0] == PE_BUSY;
+    else replies += f[0].type == (PT_GET_STATE | PROTO_REPLY);
+  }
+  CHECK(replies > 0);
+  CHECK(replies + busy <= N);
+  BENCH_REPORT("thread: %d frame, %d risposte, %d PE_BUSY", N, replies, busy);
+}
+
+// Modello del collegamento per i benchmark: ogni operazione GATT della app
+// (write con risposta, read) costa un intervallo di connessione; le notify
+// partono negli intervalli dopo, al massimo BENCH_NOTIFY_PER_EVENT ciascuno
+// (valori tipici di Chrome su Android).
+#define BENCH_INTERVAL_MS      30
+#define BENCH_NOTIFY_PER_EVENT 4
+
+static unsigned linkMs(unsigned ops, unsigned notifies) {
+  return (ops + (notifies + BENCH_NOTIFY_PER_EVENT - 1) / BENCH_NOTIFY_PER_EVENT) * BENCH_INTERVAL_MS;
+}
+
+static void fillSocial(MochiState& s) {
+  addFriends(s, 40);
+  for (int i = 0; i < 6; i++) s.addPendingRequest(0x200000 + i);
+}
+
+// Refresh completo delle liste social (richieste, amici, vicini) come lo fa
+// pollSocial: comandi di testo con write + read, frame uno alla volta, batch.
+TEST(bench_social_refresh) {
+  for (uint16_t mtu : { 23, 185, 512 }) {
+    unsigned ms[3], ops[3];
+
+    {
+      BleApp app(mtu); // App senza HELLO: le notify sono tagliate, legge il valore
+      fillSocial(app.state);
+      ops[0] = ms[0] = 0;
+      for (const char* c : { "get_requests", "get_friends", "get_nearby" }) {
+        app.write(app.legacy, c);
+        app.run();
+        app.inbox.clear();
+        // Valori oltre l'MTU: read lunga, un'operazione ogni MTU - 1 byte
+        unsigned reads = (app.legacy->value.size() + mtu - 2) / (mtu - 1);
+        ops[0] += 1 + reads;
+        ms[0] += linkMs(1 + reads, 0);
+      }
+    }
+    {
+      BleApp app(mtu);
+      fillSocial(app.state);
+      CHECK(app.hello());
+      ops[1] = ms[1] = 0;
+      for (uint8_t t : { PT_GET_REQUESTS, PT_GET_FRIENDS, PT_GET_NEARBY }) {
+        app.write(app.cmd, app.frame(t));
+        app.run();
+        unsigned n = app.inbox.size();
+        Bytes r;
+        CHECK(app.take(&r));
+        ops[1]++;
+        ms[1] += linkMs(1, n);
+      }
+    }
+    {
+      BleApp app(mtu);
+      fillSocial(app.state);
+      CHECK(app.hello());
+      Bytes batch;
+      for (uint8_t t : { PT_GET_REQUESTS, PT_GET_FRIENDS, PT_GET_NEARBY }) {
+        Bytes f = app.frame(t);
+        batch.insert(batch.end(), f.begin(), f.end());
+      }
+      app.write(app.cmd, batch);
+      app.run();
+      unsigned n = app.inbox.size();
+      Bytes r;
+      CHECK(app.take(&r));
+      std::vector<AppFrame> f = BleApp::parse(r);
+      CHECK_EQ(f.size(), 3);
+      CHECK_EQ(friendIds(f[1]).size(), 40);
+      CHECK_EQ(f[0].count(TAG_REQUEST), 6);
+      ops[2] = 1;
+      ms[2] = linkMs(1, n);
+    }
+    CHECK(ms[2] < ms[1]);
+    BENCH_REPORT("refresh social MTU %u: testo %u op %u ms | frame %u op %u ms | batch %u op %u ms",
+                 mtu, ops[0], ms[0], ops[1], ms[1], ops[2], ms[2]);
+  }
+}
+
+// ================================================================
+// THROUGHPUT DELLE RISPOSTE
+// ----------------------------------------------------------------
+// Il percorso di prima: get_state serializzato con ArduinoJson in una String,
+// get_friends concatenato a pezzi, poi setValue(c_str()) e notify. Contro
+// get_state/get_friends di testo che passano dalla coda e finiscono nel
+// buffer fisso di notify. Le notify vanno a un contatore che non alloca, cosi'
+// le allocazioni misurate sono solo quelle della risposta.
+// ================================================================
+
+static String oldStateJson(const MochiState& s) {
+  static StaticJsonDocument<192> doc;
+  doc.clear();
+  doc["hunger"] = (int)s.hunger;
+  doc["happy"]  = (int)s.happy;
+  doc["str"]    = s.statStr;
+  doc["spd"]    = s.statSpd;
+  doc["int"]    = s.statInt;
+  doc["chr"]    = s.statChr;
+  String out;
+  serializeJson(doc, out);
+  return out;
+}
+
+static String oldFriendsJson(const String* ids, int n) {
+  String out = "[";
+  for (int i = 0; i < n; i++) {
+    if (i > 0) out += ",";
+    out += "{\"id\":\"" + ids[i] + "\"}";
+  }
+  out += "]";
+  return out;
+}
+
+TEST(bench_reply_throughput) {
+  BleApp app(BLE_MTU);
+  fillSocial(app.state);
+  String ids[MAX_FRIENDS];
+  int nIds = 0;
+  for (MochiId id = app.state.friends.next(); id != MOCHI_ID_NONE; id = app.state.friends.next(id)) {
+    ids[nIds++] = mochiIdToString(id);
+  }
+  unsigned long notified = 0;
+  hostBleNotify = [&](BLECharacteristic*, const uint8_t*, size_t) { notified++; };
+
+  const int N = 20000;
+  unsigned long oldBytes = 0;
+  uint32_t a0 = mochiMemThreadAllocs();
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < N; i++) {
+    String reply = i % 2 ? oldFriendsJson(ids, nIds) : oldStateJson(app.state);
+    app.legacy->setValue(reply.c_str());
+    app.legacy->notify();
+    oldBytes += reply.length();
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  uint32_t oldAllocs = mochiMemThreadAllocs() - a0;
+
+  // Un giro a vuoto: il valore della caratteristica prende la sua capacita'
+  for (const char* c : { "get_state", "get_friends" }) {
+    app.write(app.legacy, c);
+    app.run(1);
+  }
+  BleReplyStats before = app.ble.replyStats();
+  notified = 0;
+  auto t2 = std::chrono::steady_clock::now();
+  for (int i = 0; i < N; i++) {
+    app.write(app.legacy, i % 2 ? "get_friends" : "get_state");
+    app.run(1);
+  }
+  auto t3 = std::chrono::steady_clock::now();
+  BleReplyStats after = app.ble.replyStats();
+
+  uint32_t replies = after.replies - before.replies;
+  uint32_t bytes = after.bytes - before.bytes;
+  CHECK_EQ(replies, N);
+  CHECK_EQ(after.copies - before.copies, bytes); // Niente frammenti: una copia per byte
+  CHECK_EQ(after.heapAllocs, before.heapAllocs);
+  CHECK_EQ(notified, N);
+  CHECK(oldAllocs >= (uint32_t)N);
+
+  double oldNs = std::chrono::duration<double, std::nano>(t1 - t0).count() / N;
+  double newNs = std::chrono::duration<double, std::nano>(t3 - t2).count() / N;
+  BENCH_REPORT("risposte get_state/get_friends (%d amici): String %.0f ns, %.1f alloc, %lu B | buffer %.0f ns, 0 alloc, %lu B",
+               nIds, oldNs, (double)oldAllocs / N, oldBytes / N, newNs, (unsigned long)bytes / N);
+}
+
+// ================================================================
+// ISCRIZIONE ALLO STATO
+// ----------------------------------------------------------------
+// Un'ora simulata con il loop a 20 Hz: 10 minuti di gioco (una statistica
+// cambia ogni 100 ms) e 10 di calma, a turno, con la fame che scende ogni 5
+// minuti. La app iscritta ricostruisce lo stato dagli eventi; gli eventi
+// rispettano l'intervallo chiesto (i keyframe a parte) e alla fine lo stato
+// ricostruito e' quello vero. Contro una app che fa polling di get_state allo
+// stesso ritmo, come testo e come frame.
+// ================================================================
+
+#define HOUR_MS      3600000UL
+#define HOUR_STEP_MS 50
+#define HOUR_SUB_MS  1000 // STATE_SUB_MS di connect.js
+
+static void hourStep(MochiState& s, unsigned long t) {
+  bool playing = (t / 600000) % 2 == 0;
+  if (playing && t % 100 == 0) s.statSpd = (s.statSpd + 1) % 100;
+  if (t % 300000 == 0 && s.hunger > 0) s.hunger -= 1;
+}
+
+TEST(state_subscription_hour) {
+  const unsigned long T0 = 10000000UL;
+  hostSetMillis(T0);
+  BleApp app(BLE_MTU);
+  CHECK(app.hello());
+  app.state.hunger = 80;
+
+  std::vector<unsigned long> eventMs;
+  std::vector<bool> keyframe;
+  uint8_t seen[STATE_FIELD_COUNT] = {};
+  unsigned long subBytes = 0;
+  hostBleNotify = [&](BLECharacteristic*, const uint8_t* d, size_t n) {
+    for (const AppFrame& f : BleApp::parse(Bytes(d, d + n))) {
+      if (f.type != (PT_STATE_EVENT | PROTO_REPLY)) continue;
+      eventMs.push_back(millis());
+      keyframe.push_back(f.count(TAG_KEYFRAME) > 0);
+      for (const AppTlv& t : f.tlvs) {
+        if (t.tag >= TAG_HUNGER && t.tag < TAG_HUNGER + STATE_FIELD_COUNT) seen[t.tag - TAG_HUNGER] = t.val[0];
+      }
+      subBytes += n;
+    }
+  };
+  app.write(app.cmd, app.frame(PT_SUB_STATE, { { TAG_INTERVAL, BleApp::le(HOUR_SUB_MS, 2) } }));
+  app.run(1);
+  eventMs.clear();
+  keyframe.clear();
+  subBytes = 0;
+
+  for (unsigned long t = HOUR_STEP_MS; t <= HOUR_MS; t += HOUR_STEP_MS) {
+    hourStep(app.state, t);
+    hostSetMillis(T0 + t);
+    app.ble.tick();
+  }
+  hostSetMillis(T0 + HOUR_MS + HOUR_SUB_MS); // L'ultimo cambio parte allo scadere dell'intervallo
+  app.ble.tick();
+
+  uint8_t cur[STATE_FIELD_COUNT];
+  app.state.readStateFields(cur);
+  CHECK(memcmp(seen, cur, sizeof(cur)) == 0);
+  unsigned fast = 0, keys = 0;
+  for (size_t i = 1; i < eventMs.size(); i++) {
+    keys += keyframe[i];
+    if (!keyframe[i] && eventMs[i] - eventMs[i - 1] < HOUR_SUB_MS) fast++;
+  }
+  CHECK_EQ(fast, 0);
+  CHECK(keys >= HOUR_MS / STATE_KEYFRAME_MS - 1);
+  CHECK(eventMs.size() <= HOUR_MS / HOUR_SUB_MS + HOUR_MS / STATE_KEYFRAME_MS + 1);
+  unsigned events = eventMs.size();
+
+  // Polling: una richiesta al secondo, testo e frame
+  unsigned long pollBytes[2] = { 0, 0 };
+  unsigned pollNotify[2] = { 0, 0 };
+  for (int bin = 0; bin < 2; bin++) {
+    BleApp poll(BLE_MTU);
+    if (bin) CHECK(poll.hello());
+    for (unsigned long t = 0; t < HOUR_MS; t += HOUR_SUB_MS) {
+      Bytes req = bin ? poll.frame(PT_GET_STATE) : Bytes((const uint8_t*)"get_state", (const uint8_t*)"get_state" + 9);
+      poll.write(bin ? poll.cmd : poll.legacy, req);
+      poll.run(1);
+      pollBytes[bin] += req.size();
+      for (const AppNote& n : poll.inbox) pollBytes[bin] += n.data.size();
+      pollNotify[bin] += poll.inbox.size();
+      poll.inbox.clear();
+    }
+  }
+  CHECK(subBytes < pollBytes[1]);
+  BENCH_REPORT("stato per ora: iscrizione %u notify, %lu B | polling testo %u, %lu B | polling frame %u, %lu B",
+               events, subBytes, pollNotify[0], pollBytes[0], pollNotify[1], pollBytes[1]);
+}
+
+// ================================================================
+// ISCRIZIONE SOCIAL
+// ----------------------------------------------------------------
+// La app tiene una copia delle liste e la aggiorna con gli eventi, come
+// socialCache in connect.js: TAG_LIST_RESET svuota, le versioni si
+// sovrascrivono, le voci si aggiungono o si tolgono.
+// ================================================================
+
+struct SocialMirror {
+  std::set<MochiId> friends, requests;
+  uint32_t ver[SL_COUNT] = {};
+  unsigned events = 0, resets = 0;
+  std::vector<unsigned long> eventMs;
+
+  void apply(const AppFrame& f) {
+    events++;
+    eventMs.push_back(millis());
+    for (const AppTlv& t : f.tlvs) {
+      uint32_t v = mochiTlvU32(t.val.data(), t.val.size());
+      switch (t.tag) {
+        case TAG_LIST_RESET:
+          resets++;
+          if (v & (1 << SL_FRIENDS)) friends.clear();
+          if (v & (1 << SL_REQUESTS)) requests.clear();
+          break;
+        case TAG_NEARBY_VER:
+        case TAG_FRIENDS_VER:
+        case TAG_REQUESTS_VER: ver[t.tag - TAG_NEARBY_VER] = v; break;
+        case TAG_FRIEND:       friends.insert(v); break;
+        case TAG_FRIEND_GONE:  friends.erase(v); break;
+        case TAG_REQUEST:      requests.insert(v); break;
+        case TAG_REQUEST_GONE: requests.erase(v); break;
+      }
+    }
+  }
+
+  // Tutti gli eventi arrivati finora
+  void drain(BleApp& app) {
+    for (const AppNote& n : app.inbox) {
+      for (const AppFrame& f : BleApp::parse(n.data)) {
+        if (f.type == (PT_SOCIAL_EVENT | PROTO_REPLY)) apply(f);
+      }
+    }
+    app.inbox.clear();
+  }
+
+  bool matches(const MochiState& s) const {
+    return ver[SL_FRIENDS] == s.friendsVer && ver[SL_REQUESTS] == s.requestsVer &&
+           friends.size() == s.friends.size() && requests.size() == s.pendingReqs.size() &&
+           std::all_of(friends.begin(), friends.end(), [&](MochiId id) { return s.isFriend(id); }) &&
+           std::all_of(requests.begin(), requests.end(), [&](MochiId id) { return s.pendingReqs.contains(id); });
+  }
+};
+
+// PT_SUB_SOCIAL con l'intervallo e le versioni che la app conosce gia'.
+static uint16_t subscribeSocial(BleApp& app, uint16_t ms, const SocialMirror& m) {
+  std::vector<AppTlv> tlvs = { { TAG_INTERVAL, BleApp::le(ms, 2) } };
+  for (int i = 0; i < SL_COUNT; i++) {
+    if (m.ver[i]) tlvs.push_back({ (uint8_t)(TAG_NEARBY_VER + i), BleApp::le(m.ver[i], 4) });
+  }
+  app.write(app.cmd, app.frame(PT_SUB_SOCIAL, tlvs));
+  app.run(1);
+  for (const AppNote& n : app.inbox) {
+    for (const AppFrame& f : BleApp::parse(n.data)) {
+      if (f.type != (PT_SUB_SOCIAL | PROTO_REPLY)) continue;
+      for (const AppTlv& t : f.tlvs) {
+        if (t.tag == TAG_INTERVAL) return mochiTlvU16(t.val.data(), t.val.size());
+      }
+    }
+  }
+  return 0;
+}
+
+// Ogni cambio di una lista sposta la sua versione e manda solo la differenza;
+// le liste ferme non compaiono nell'evento.
+TEST(social_sub_version_bumps) {
+  hostSetMillis(20000000UL);
+  BleApp app(BLE_MTU);
+  CHECK(app.hello());
+  addFriends(app.state, 3);
+  SocialMirror m;
+  CHECK_EQ(subscribeSocial(app, SOCIAL_SUB_MIN_MS, m), SOCIAL_SUB_MIN_MS);
+  m.drain(app);
+  CHECK_EQ(m.events, 1); // Liste complete: la app non ne conosceva nessuna
+  CHECK_EQ(m.resets, 1);
+  CHECK(m.matches(app.state));
+
+  unsigned long t = millis();
+  uint32_t fv = app.state.friendsVer, rv = app.state.requestsVer;
+  app.state.addFriend(0x700001);
+  hostSetMillis(t += SOCIAL_SUB_MIN_MS);
+  app.run(1);
+  CHECK_EQ(app.inbox.size(), 1);
+  std::vector<AppFrame> f = BleApp::parse(app.inbox[0].data);
+  CHECK_EQ(f.size(), 1);
+  CHECK_EQ(f[0].count(TAG_FRIENDS_VER), 1);
+  CHECK_EQ(f[0].count(TAG_FRIEND), 1);        // Solo l'amico nuovo
+  CHECK_EQ(f[0].count(TAG_REQUESTS_VER), 0);  // Richieste ferme
+  CHECK_EQ(f[0].count(TAG_LIST_RESET), 0);
+  m.drain(app);
+  CHECK(m.ver[SL_FRIENDS] != fv);
+  CHECK(m.matches(app.state));
+
+  app.state.addPendingRequest(0x700002);
+  app.state.removeFriend(0x700001);
+  hostSetMillis(t += SOCIAL_SUB_MIN_MS);
+  app.run(1);
+  m.drain(app);
+  CHECK_EQ(m.events, 3);
+  CHECK(m.ver[SL_REQUESTS] != rv);
+  CHECK(!m.friends.count(0x700001));
+  CHECK(m.requests.count(0x700002));
+  CHECK(m.matches(app.state));
+
+  // Niente cambi: niente eventi
+  hostSetMillis(t += 10 * SOCIAL_SUB_MIN_MS);
+  app.run(1);
+  CHECK(app.inbox.empty());
+}
+
+// Cambi ogni 50 ms per 20 secondi: al massimo un evento per intervallo, e
+// nessun cambio perso. Un intervallo sotto il minimo viene alzato.
+TEST(social_sub_rate_limit) {
+  hostSetMillis(30000000UL);
+  BleApp app(BLE_MTU);
+  CHECK(app.hello());
+  SocialMirror m;
+  CHECK_EQ(subscribeSocial(app, 100, m), SOCIAL_SUB_MIN_MS);
+  m.drain(app);
+  m.eventMs.clear();
+
+  const unsigned long RUN_MS = 20000, STEP_MS = 50;
+  unsigned long t0 = millis();
+  unsigned changes = 0;
+  for (unsigned long t = STEP_MS; t <= RUN_MS; t += STEP_MS) {
+    MochiId id = 0x710000 + (t / STEP_MS) % 16;
+    if (app.state.isFriend(id)) app.state.removeFriend(id);
+    else app.state.addFriend(id);
+    changes++;
+    hostSetMillis(t0 + t);
+    app.run(1);
+    m.drain(app);
+  }
+  hostSetMillis(t0 + RUN_MS + SOCIAL_SUB_MIN_MS);
+  app.run(1);
+  m.drain(app);
+
+  CHECK(m.matches(app.state));
+  for (size_t i = 1; i < m.eventMs.size(); i++) CHECK(m.eventMs[i] - m.eventMs[i - 1] >= SOCIAL_SUB_MIN_MS);
+  CHECK(m.eventMs.size() <= RUN_MS / SOCIAL_SUB_MIN_MS + 1);
+  BENCH_REPORT("social: %u cambi in %lu s -> %u eventi", changes, RUN_MS / 1000, (unsigned)m.eventMs.size());
+}
+
+// La app perde un evento (notify persa o disconnessione): la sua versione
+// resta indietro. Riscrivendosi con le versioni che ha, riceve per intero
+// solo la lista rimasta indietro; con versioni giuste non riceve nulla.
+TEST(social_sub_resync_after_missed_version) {
+  hostSetMillis(40000000UL);
+  BleApp app(BLE_MTU);
+  CHECK(app.hello());
+  addFriends(app.state, 5);
+  app.state.addPendingRequest(0x720001);
+  SocialMirror m;
+  subscribeSocial(app, SOCIAL_SUB_MIN_MS, m);
+  m.drain(app);
+  CHECK(m.matches(app.state));
+
+  // Evento perso
+  app.state.addFriend(0x720002);
+  hostSetMillis(millis() + SOCIAL_SUB_MIN_MS);
+  app.run(1);
+  CHECK_EQ(app.inbox.size(), 1);
+  app.inbox.clear();
+  CHECK(!m.matches(app.state));
+
+  unsigned before = m.events;
+  subscribeSocial(app, SOCIAL_SUB_MIN_MS, m);
+  std::vector<AppFrame> ev;
+  for (const AppNote& n : app.inbox) {
+    for (const AppFrame& f : BleApp::parse(n.data)) {
+      if (f.type == (PT_SOCIAL_EVENT | PROTO_REPLY)) ev.push_back(f);
+    }
+  }
+  CHECK_EQ(ev.size(), 1);
+  CHECK_EQ(ev[0].count(TAG_LIST_RESET), 1);
+  CHECK_EQ(ev[0].count(TAG_FRIEND), 6);         // Amici per intero
+  CHECK_EQ(ev[0].count(TAG_REQUESTS_VER), 0);   // Le richieste la app le ha gia'
+  m.drain(app);
+  CHECK_EQ(m.events, before + 1);
+  CHECK(m.matches(app.state));
+
+  // Versioni aggiornate: la nuova iscrizione non rimanda niente
+  subscribeSocial(app, SOCIAL_SUB_MIN_MS, m);
+  m.drain(app);
+  CHECK_EQ(m.events, before + 1);
+}
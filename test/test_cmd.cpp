@@ -0,0 +1,229 @@
+#include "ble_app.h"
+#include "MochiCmd.h"
+#include "MochiMem.h"
+#include <chrono>
+#include <limits.h>
+#include <string>
+
+static bool parse(const char* s, MochiCmd* cmd) {
+  return mochiCmdParse((const uint8_t*)s, strlen(s), cmd);
+}
+
+static bool toLong(const std::string& s, long* out) {
+  MochiArg a = { s.data(), s.size() };
+  return a.toLong(out);
+}
+
+// Ogni verbo della tabella si ritrova col suo id (il nome viene dalla tabella stessa).
+TEST(every_verb_round_trips) {
+  for (int id = CMD_NONE + 1; id < CMD_COUNT; id++) {
+    const char* name = mochiCmdName((MochiCmdId)id);
+    MochiCmd cmd;
+    CHECK(parse(name, &cmd));
+    CHECK_EQ(cmd.id, id);
+    CHECK_EQ(cmd.arg.len, 0);
+  }
+}
+
+TEST(unknown_verbs) {
+  MochiCmd cmd;
+  const char* bad[] = { "", "get", "get_stat", "get_statex", "feed", "unix2:5", ":", "GET_STATE" };
+  for (const char* s : bad) {
+    CHECK(!parse(s, &cmd));
+    CHECK_EQ(cmd.id, CMD_NONE);
+  }
+}
+
+TEST(argument_view) {
+  MochiCmd cmd;
+  CHECK(parse("add_friend:MOCHI-ABCDEF", &cmd));
+  CHECK_EQ(cmd.id, CMD_ADD_FRIEND);
+  CHECK(cmd.arg.equals("MOCHI-ABCDEF"));
+  MochiId id;
+  CHECK(cmd.arg.toId(&id));
+  CHECK_EQ(id, 0xABCDEF);
+  CHECK(parse("set_json:{\"a\":1}", &cmd));
+  CHECK_EQ(cmd.arg.len, 7);
+}
+
+TEST(to_long_accepts_full_range) {
+  long v;
+  CHECK(toLong("0", &v));
+  CHECK_EQ(v, 0);
+  CHECK(toLong("1700000000", &v));
+  CHECK_EQ(v, 1700000000L);
+  CHECK(toLong("-42", &v));
+  CHECK_EQ(v, -42);
+  CHECK(toLong("000000000000000000000007", &v)); // Zeri davanti: niente limite di cifre
+  CHECK_EQ(v, 7);
+  CHECK(toLong(std::to_string(LONG_MAX), &v));
+  CHECK(v == LONG_MAX);
+  CHECK(toLong(std::to_string(LONG_MIN), &v));
+  CHECK(v == LONG_MIN);
+}
+
+// Un oltre LONG_MAX / LONG_MIN (e molto oltre) non e' un numero valido:
+// niente overflow con segno.
+TEST(to_long_rejects_overflow) {
+  long v = 123;
+  std::string max = std::to_string(LONG_MAX), min = std::to_string(LONG_MIN);
+  max.back()++;
+  min.back()++;
+  CHECK(!toLong(max, &v));
+  CHECK(!toLong(min, &v));
+  CHECK(!toLong("99999999999999999999", &v));
+  CHECK(!toLong("-99999999999999999999", &v));
+  CHECK_EQ(v, 123); // Fallito: out non toccato
+  // 11 cifre: fuori scala con il long a 32 bit dell'ESP32
+  CHECK(!toLong("99999999999", &v) || sizeof(long) > 4);
+}
+
+TEST(to_long_rejects_garbage) {
+  long v;
+  const char* bad[] = { "", "-", "+5", " 5", "5 ", "1e5", "0x10", "--1", "12a" };
+  for (const char* s : bad) CHECK(!toLong(s, &v));
+}
+
+// ================================================================
+// TRACCIA DELLA COMPANION APP
+// ----------------------------------------------------------------
+// Una sessione di connect.js registrata: connessione (impostazioni, stato,
+// ora), polling social ogni 5 s, azioni, impostazioni salvate, storico,
+// amici, pagine della lista e qualche tasto di debug.
+// ================================================================
+
+static const char* const TRACE[] = {
+  "get_json", "get_state", "unix:1760860800",
+  "get_requests", "get_friends", "get_nearby",
+  "get_requests", "get_friends", "get_nearby",
+  "queue:feed", "get_state",
+  "get_requests", "get_friends", "get_nearby",
+  "set_json:{\"timezone\":\"Europe/Rome\",\"bgTop\":\"#ffa0c8\",\"bgBottom\":\"#82f0ff\",\"brightness\":180}",
+  "unix:1760860862",
+  "get_history:0,4294967295,3600",
+  "get_requests", "get_friends", "get_nearby",
+  "accept_friend:MOCHI-A1B2C3", "get_friends:MOCHI-100150",
+  "queue:train_str", "get_state", "force_visit:MOCHI-A1B2C3",
+  "get_requests", "get_friends", "get_nearby",
+  "del_friend:MOCHI-A1B2C3", "get_debug", "get_link", "prev", "next", "FEED",
+};
+
+// Il dispatcher di prima: copia in String e catena di startsWith/==/substring,
+// con gli argomenti convertiti dalla sottostringa.
+static MochiCmdId oldDispatch(const char* raw, long* num, MochiId* id) {
+  String cmd = raw;
+  if (cmd.startsWith("unix:")) { *num = atol(cmd.substring(5).c_str()); return CMD_UNIX; }
+  if (cmd.startsWith("set_json:")) { String json = cmd.substring(9); *num = json.length(); return CMD_SET_JSON; }
+  if (cmd == "get_json") return CMD_GET_JSON;
+  if (cmd == "get_settings") return CMD_GET_SETTINGS;
+  if (cmd == "get_state") return CMD_GET_STATE;
+  if (cmd == "get_nearby") return CMD_GET_NEARBY;
+  if (cmd == "get_friends") return CMD_GET_FRIENDS;
+  if (cmd.startsWith("get_friends:")) { mochiIdParse(cmd.substring(12), id); return CMD_GET_FRIENDS; }
+  if (cmd == "get_requests") return CMD_GET_REQUESTS;
+  if (cmd.startsWith("add_friend:")) { mochiIdParse(cmd.substring(11), id); return CMD_ADD_FRIEND; }
+  if (cmd.startsWith("accept_friend:")) { mochiIdParse(cmd.substring(14), id); return CMD_ACCEPT_FRIEND; }
+  if (cmd.startsWith("decline_friend:")) { mochiIdParse(cmd.substring(15), id); return CMD_DECLINE_FRIEND; }
+  if (cmd.startsWith("del_friend:")) { mochiIdParse(cmd.substring(11), id); return CMD_DEL_FRIEND; }
+  if (cmd.startsWith("force_visit:")) { mochiIdParse(cmd.substring(12), id); return CMD_FORCE_VISIT; }
+  if (cmd == "force_home") return CMD_FORCE_HOME;
+  if (cmd == "get_debug") return CMD_GET_DEBUG;
+  if (cmd == "get_link") return CMD_GET_LINK;
+  if (cmd.startsWith("get_history")) return CMD_GET_HISTORY;
+  // applyCommand
+  if (cmd.startsWith("queue:")) { String a = cmd.substring(6); *num = a.length(); return CMD_QUEUE; }
+  if (cmd == "FEED") return CMD_FEED;
+  if (cmd == "PLAY") return CMD_PLAY;
+  if (cmd == "KILL") return CMD_KILL;
+  if (cmd == "GROW") return CMD_GROW;
+  if (cmd == "prev") return CMD_PREV;
+  if (cmd == "next") return CMD_NEXT;
+  return CMD_NONE;
+}
+
+static MochiCmdId newDispatch(const char* raw, long* num, MochiId* id) {
+  MochiCmd cmd;
+  if (!mochiCmdParse((const uint8_t*)raw, strlen(raw), &cmd)) return CMD_NONE;
+  switch (cmd.id) {
+    case CMD_UNIX: cmd.arg.toLong(num); break;
+    case CMD_SET_JSON: case CMD_QUEUE: *num = cmd.arg.len; break;
+    case CMD_GET_FRIENDS: case CMD_ADD_FRIEND: case CMD_ACCEPT_FRIEND: case CMD_DECLINE_FRIEND:
+    case CMD_DEL_FRIEND: case CMD_FORCE_VISIT:
+      if (cmd.arg.len) cmd.arg.toId(id);
+      break;
+    default: break;
+  }
+  return cmd.id;
+}
+
+static uint32_t allocsIn(MemTag tag) { return mochiMemStats(tag).allocs; }
+
+static uint32_t allocsTotal() {
+  uint32_t n = 0;
+  for (int t = 0; t < MEM_TAG_COUNT; t++) n += allocsIn((MemTag)t);
+  return n;
+}
+
+// La traccia intera, dal write della caratteristica alla risposta, senza una
+// sola allocazione. Unica eccezione il documento di set_json: qui e' lo shim
+// di ArduinoJson (nodi sull'heap), sul device StaticJsonDocument ha il suo
+// pool fisso. Per questo conta solo sotto MEM_JSON.
+TEST(trace_dispatch_does_not_allocate) {
+  BleApp app(BLE_MTU);
+  for (int i = 0; i < 40; i++) app.state.addFriend(0x100000 + i * 0x10);
+  app.state.addPendingRequest(0xA1B2C3);
+  hostBleNotify = [](BLECharacteristic*, const uint8_t*, size_t) {};
+  for (const char* c : TRACE) { // Primo giro: i valori delle caratteristiche prendono la loro misura
+    app.write(app.legacy, c);
+    app.run();
+  }
+  for (int round = 0; round < 3; round++) {
+    app.state.addPendingRequest(0xA1B2C3);
+    for (const char* c : TRACE) {
+      uint32_t json = allocsIn(MEM_JSON), total = allocsTotal();
+      CHECK(app.write(app.legacy, c));
+      app.run();
+      uint32_t others = (allocsTotal() - total) - (allocsIn(MEM_JSON) - json);
+      if (others) printf("  %s: %u allocazioni\n", c, others);
+      CHECK_EQ(others, 0);
+      if (strncmp(c, "set_json:", 9) != 0) CHECK_EQ(allocsIn(MEM_JSON), json);
+    }
+  }
+}
+
+// La String dello shim e' una std::string con SSO fino a 15 caratteri: le
+// allocazioni della catena vecchia qui sono meno che sul device.
+TEST(bench_trace_replay) {
+  const int ROUNDS = 20000;
+  const int N = ROUNDS * (int)(sizeof(TRACE) / sizeof(TRACE[0]));
+  long sumOld = 0, sumNew = 0;
+  MochiId idOld = 0, idNew = 0;
+
+  uint32_t a0 = allocsTotal();
+  auto t0 = std::chrono::steady_clock::now();
+  for (int r = 0; r < ROUNDS; r++) {
+    for (const char* c : TRACE) {
+      long n = 0;
+      sumOld += oldDispatch(c, &n, &idOld) + n;
+    }
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  uint32_t a1 = allocsTotal();
+  for (int r = 0; r < ROUNDS; r++) {
+    for (const char* c : TRACE) {
+      long n = 0;
+      sumNew += newDispatch(c, &n, &idNew) + n;
+    }
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  uint32_t a2 = allocsTotal();
+
+  CHECK_EQ(sumOld, sumNew);
+  CHECK_EQ(idOld, idNew);
+  CHECK_EQ(a2 - a1, 0);
+  double oldNs = std::chrono::duration<double, std::nano>(t1 - t0).count() / N;
+  double newNs = std::chrono::duration<double, std::nano>(t2 - t1).count() / N;
+  CHECK(newNs < oldNs);
+  BENCH_REPORT("traccia app (%u comandi): catena String %.0f ns e %.1f alloc/comando | hash perfetto %.0f ns e 0 alloc",
+               (unsigned)(sizeof(TRACE) / sizeof(TRACE[0])), oldNs, (double)(a1 - a0) / N, newNs);
+}
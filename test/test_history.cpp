@@ -0,0 +1,226 @@
+#include "mochi_test.h"
+#include "MochiHistory.h"
+#include <string>
+#include <vector>
+
+#define SECTOR 4096
+#define T0     1700000000UL
+
+// Campione i-esimo: ogni campo cambia con un ritmo diverso, cosi' i record
+// hanno lunghezze diverse (da 2 byte in su).
+static HistorySample sample(uint32_t i) {
+  HistorySample s;
+  s.time = T0 + i * HISTORY_INTERVAL_S;
+  for (int k = 0; k < HISTORY_FIELDS; k++) s.v[k] = (uint8_t)((i / (k + 1)) * 7);
+  return s;
+}
+
+static bool same(const HistorySample& a, const HistorySample& b) {
+  return a.time == b.time && memcmp(a.v, b.v, sizeof(a.v)) == 0;
+}
+
+// Esegue la query a pacchetti piccoli e rimette insieme le righe.
+static std::vector<HistorySample> query(MochiHistory& h, uint32_t from = 0, uint32_t to = 0xFFFFFFFF,
+                                        uint32_t step = 0) {
+  std::vector<HistorySample> out;
+  h.startQuery(from, to, step);
+  std::string text;
+  bool more = h.queryActive();
+  while (more) {
+    char buf[200];
+    MochiWriter w(buf, sizeof(buf));
+    more = h.pump(w);
+    text.append(w.data(), w.length());
+  }
+  const char* p = text.c_str();
+  HistorySample s;
+  unsigned long t;
+  unsigned v[HISTORY_FIELDS];
+  int used;
+  while (sscanf(p, "%lu,%u,%u,%u,%u,%u,%u,%u\n%n", &t, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6],
+                &used) == 8) {
+    s.time = t;
+    for (int k = 0; k < HISTORY_FIELDS; k++) s.v[k] = v[k];
+    out.push_back(s);
+    p += used;
+  }
+  return out;
+}
+
+static const esp_partition_t* freshPartition(int sectors) {
+  hostPartitionsClear();
+  return hostPartitionCreate(HISTORY_PARTITION, HISTORY_SUBTYPE, sectors * SECTOR);
+}
+
+// Trova l'ultimo record scritto nel settore in testa (crc = ultimo byte prima dello 0xFF).
+static uint8_t* lastRecordEnd(const esp_partition_t* p) {
+  uint8_t* d = hostPartitionData(p);
+  uint8_t* end = nullptr;
+  for (uint32_t s = 0; s < p->size; s += SECTOR) {
+    uint32_t off = SECTOR;
+    while (off > 16 && d[s + off - 1] == 0xFF) off--;
+    if (off > 16 && (!end || d + s + off > end)) end = d + s + off;
+  }
+  return end;
+}
+
+TEST(missing_partition) {
+  hostPartitionsClear();
+  MochiHistory h;
+  CHECK(!h.begin());
+  h.append(sample(0)); // non deve esplodere
+  CHECK(query(h).empty());
+}
+
+TEST(round_trip) {
+  freshPartition(4);
+  MochiHistory h;
+  CHECK(h.begin());
+  CHECK(query(h).empty());
+  for (uint32_t i = 0; i < 500; i++) h.append(sample(i));
+
+  std::vector<HistorySample> got = query(h);
+  CHECK_EQ(got.size(), 500);
+  for (uint32_t i = 0; i < got.size(); i++) CHECK(same(got[i], sample(i)));
+}
+
+// Un campione senza variazioni ne' salti di orario costa 2 byte.
+TEST(steady_sample_costs_two_bytes) {
+  const esp_partition_t* p = freshPartition(2);
+  MochiHistory h;
+  h.begin();
+  HistorySample s = sample(0);
+  h.append(s);
+  uint8_t* before = lastRecordEnd(p);
+  s.time += HISTORY_INTERVAL_S;
+  h.append(s);
+  CHECK_EQ(lastRecordEnd(p) - before, 2);
+}
+
+TEST(irregular_interval_and_clock_going_back) {
+  freshPartition(4);
+  MochiHistory h;
+  h.begin();
+  HistorySample a = sample(10), b = sample(11), c = sample(12);
+  b.time = a.time + 7;           // intervallo anomalo
+  c.time = a.time - 1000;        // orologio tornato indietro: nuovo settore
+  h.append(a); h.append(b); h.append(c);
+
+  std::vector<HistorySample> got = query(h);
+  CHECK_EQ(got.size(), 3);
+  CHECK(same(got[0], a));
+  CHECK(same(got[1], b));
+  CHECK(same(got[2], c));
+}
+
+// Il ring gira piu' volte: restano solo i settori piu' recenti, in ordine e
+// senza buchi, e l'ultimo campione e' sempre l'ultimo scritto.
+TEST(wrap_around) {
+  freshPartition(4);
+  MochiHistory h;
+  h.begin();
+  const uint32_t N = 20000;
+  for (uint32_t i = 0; i < N; i++) h.append(sample(i));
+
+  std::vector<HistorySample> got = query(h);
+  CHECK(got.size() > 1000);
+  CHECK(got.size() < N);
+  uint32_t first = (got[0].time - T0) / HISTORY_INTERVAL_S;
+  for (uint32_t i = 0; i < got.size(); i++) CHECK(same(got[i], sample(first + i)));
+  CHECK_EQ(first + got.size(), N);
+
+  // Dopo un riavvio si riprende dal punto giusto.
+  MochiHistory again;
+  CHECK(again.begin());
+  again.append(sample(N));
+  std::vector<HistorySample> after = query(again);
+  CHECK(same(after.back(), sample(N)));
+  CHECK(same(after[after.size() - 2], sample(N - 1)));
+}
+
+// Corrente staccata a meta' di un record: la coda corrotta si scarta, il
+// resto del settore resta leggibile e il campione dopo apre un settore nuovo.
+TEST(power_loss_mid_record) {
+  const esp_partition_t* p = freshPartition(4);
+  {
+    MochiHistory h;
+    h.begin();
+    for (uint32_t i = 0; i < 100; i++) h.append(sample(i));
+  }
+  // Il crc dell'ultimo record non e' arrivato in flash.
+  lastRecordEnd(p)[-1] = 0xFF;
+
+  MochiHistory h;
+  CHECK(h.begin());
+  std::vector<HistorySample> got = query(h);
+  CHECK_EQ(got.size(), 99);
+  CHECK(same(got.back(), sample(98)));
+
+  h.append(sample(100));
+  h.append(sample(101));
+  got = query(h);
+  CHECK_EQ(got.size(), 101);
+  CHECK(same(got[98], sample(98)));
+  CHECK(same(got[99], sample(100)));
+  CHECK(same(got[100], sample(101)));
+}
+
+// Corrente staccata tra la cancellazione del settore e l'intestazione: il
+// settore vuoto viene ignorato e lo storico precedente resta.
+TEST(power_loss_during_sector_open) {
+  const esp_partition_t* p = freshPartition(4);
+  {
+    MochiHistory h;
+    h.begin();
+    for (uint32_t i = 0; i < 50; i++) h.append(sample(i));
+  }
+  // Intestazione scritta a meta' nel settore successivo (magic si', crc no).
+  uint8_t* d = hostPartitionData(p);
+  memcpy(d + SECTOR, d, 8);
+
+  MochiHistory h;
+  CHECK(h.begin());
+  CHECK_EQ(query(h).size(), 50);
+  h.append(sample(50));
+  std::vector<HistorySample> got = query(h);
+  CHECK_EQ(got.size(), 51);
+  CHECK(same(got.back(), sample(50)));
+}
+
+TEST(query_range_and_step) {
+  freshPartition(4);
+  MochiHistory h;
+  h.begin();
+  for (uint32_t i = 0; i < 300; i++) h.append(sample(i));
+
+  uint32_t from = sample(100).time, to = sample(199).time;
+  std::vector<HistorySample> got = query(h, from, to, 10 * HISTORY_INTERVAL_S);
+  CHECK_EQ(got.size(), 10);
+  for (uint32_t i = 0; i < got.size(); i++) CHECK(same(got[i], sample(100 + 10 * i)));
+  CHECK_EQ(h.queryRows(), 10);
+}
+
+// append() tra un pacchetto e l'altro puo' riciclare il settore che la query
+// stava leggendo: la query lo salta e finisce comunque.
+TEST(query_survives_recycling) {
+  freshPartition(2);
+  MochiHistory h;
+  h.begin();
+  uint32_t i = 0;
+  for (; i < 3000; i++) h.append(sample(i));
+
+  h.startQuery(0, 0xFFFFFFFF, 0);
+  char buf[200];
+  MochiWriter w(buf, sizeof(buf));
+  CHECK(h.pump(w));
+  for (uint32_t k = 0; k < 4000; k++) h.append(sample(i++));
+  int packets = 0;
+  bool more = true;
+  while (more && packets < 10000) {
+    MochiWriter w2(buf, sizeof(buf));
+    more = h.pump(w2);
+    packets++;
+  }
+  CHECK(!more);
+  CHECK(!h.queryActive());
+}
@@ -0,0 +1,262 @@
+#include "mochi_test.h"
+#include "MochiState.h"
+#include <chrono>
+#include <set>
+#include <vector>
+
+typedef MochiIdSet<8> SmallSet; // 16 slot: facile riempire la fine e fare il giro
+
+// Stesso hash di MochiIdSet::home(), per costruire catene a colpo sicuro.
+static uint16_t homeOf(MochiId id, uint16_t slots) {
+  return (uint16_t)((uint32_t)(id * 2654435769UL) >> 16) & (slots - 1);
+}
+
+// Id che cadono tutti nell'ultimo slot: la catena riparte da 0.
+static std::vector<MochiId> idsAtEnd(int n) {
+  std::vector<MochiId> ids;
+  for (MochiId id = 1; (int)ids.size() < n; id++) {
+    if (homeOf(id, SmallSet::SLOTS) == SmallSet::SLOTS - 1) ids.push_back(id);
+  }
+  return ids;
+}
+
+TEST(id_text_edges) {
+  char buf[MOCHI_ID_STR_SIZE];
+  CHECK_EQ(mochiIdFormat(0xABCDEF, buf, sizeof(buf)), 12);
+  CHECK(strcmp(buf, "MOCHI-ABCDEF") == 0);
+  CHECK_EQ(mochiIdFormat(0x5, buf, sizeof(buf)), 7);
+  CHECK(strcmp(buf, "MOCHI-5") == 0);
+  CHECK_EQ(mochiIdFormat(1, buf, sizeof(buf) - 1), 0);
+  MochiId id;
+  CHECK(mochiIdParse("mochi-abcdef", 12, &id));
+  CHECK_EQ(id, 0xABCDEF);
+  CHECK(!mochiIdParse("MOCHI-", 6, &id));
+  CHECK(!mochiIdParse("MOCHI-1234567", 13, &id));
+  CHECK(!mochiIdParse("MOCHO-1", 7, &id));
+}
+
+// Catena che scavalca la fine della tabella: togliendo il primo elemento gli
+// altri vengono riportati indietro anche oltre lo slot 0, senza buchi.
+TEST(backward_shift_across_wrap) {
+  std::vector<MochiId> ids = idsAtEnd(4);
+  SmallSet s;
+  for (MochiId id : ids) CHECK(s.add(id));
+  CHECK_EQ(s.slot(SmallSet::SLOTS - 1), ids[0]);
+  CHECK_EQ(s.slot(0), ids[1]);
+  CHECK_EQ(s.slot(2), ids[3]);
+
+  CHECK(s.remove(ids[0]));
+  CHECK_EQ(s.size(), 3);
+  CHECK_EQ(s.slot(SmallSet::SLOTS - 1), ids[1]);
+  CHECK_EQ(s.slot(0), ids[2]);
+  CHECK_EQ(s.slot(1), ids[3]);
+  CHECK_EQ(s.slot(2), MOCHI_ID_NONE);
+  for (size_t i = 1; i < ids.size(); i++) CHECK(s.contains(ids[i]));
+  CHECK(!s.contains(ids[0]));
+
+  // Un elemento con casa nello slot 0 in coda alla catena: risale, ma non prima di casa sua
+  MochiId atZero = 1;
+  while (homeOf(atZero, SmallSet::SLOTS) != 0) atZero++;
+  CHECK(s.add(atZero));
+  CHECK_EQ(s.slot(2), atZero);
+  CHECK(s.remove(ids[2]));
+  CHECK_EQ(s.slot(0), ids[3]);
+  CHECK_EQ(s.slot(1), atZero);
+  CHECK(s.contains(atZero));
+  CHECK(!s.remove(ids[2]));
+}
+
+// Operazioni a caso contro std::set: stesso contenuto, stesso ordine, limite rispettato.
+TEST(random_ops_match_reference) {
+  MochiIdSet<64> s;
+  std::set<MochiId> ref;
+  for (int i = 0; i < 20000; i++) {
+    MochiId id = random(200) * 0x10101; // Pochi valori: tanti doppioni e catene
+    if (random(3) == 0) {
+      CHECK_EQ(s.remove(id), ref.erase(id) == 1);
+    } else {
+      bool ok = s.add(id);
+      CHECK_EQ(ok, ref.count(id) || ref.size() < 64);
+      if (ok) ref.insert(id);
+    }
+    CHECK_EQ(s.size(), ref.size());
+  }
+  for (MochiId id : ref) CHECK(s.contains(id));
+  MochiId sorted[64];
+  CHECK_EQ(s.toSorted(sorted), ref.size());
+  CHECK(std::equal(ref.begin(), ref.end(), sorted));
+}
+
+TEST(next_and_to_sorted) {
+  MochiIdSet<16> s;
+  CHECK_EQ(s.next(), MOCHI_ID_NONE);
+  CHECK_EQ(s.toSorted(nullptr), 0);
+  const MochiId ids[] = { 0xFFFFFE, 7, 0x800000, 0, 42 };
+  for (MochiId id : ids) s.add(id);
+  std::vector<MochiId> walk;
+  for (MochiId v = s.next(); v != MOCHI_ID_NONE; v = s.next(v)) walk.push_back(v);
+  CHECK((walk == std::vector<MochiId>{ 0, 7, 42, 0x800000, 0xFFFFFE }));
+  CHECK_EQ(s.next(42), 0x800000);
+  CHECK_EQ(s.next(43), 0x800000);
+  CHECK_EQ(s.next(0xFFFFFE), MOCHI_ID_NONE);
+  MochiId out[16];
+  CHECK_EQ(s.toSorted(out), 5);
+  CHECK(std::equal(walk.begin(), walk.end(), out));
+  CHECK(!s.add(MOCHI_ID_NONE));
+  CHECK(!s.contains(MOCHI_ID_NONE));
+}
+
+// Lista piena salvata e ritrovata dopo un "riavvio": 3 byte per amico, in ordine.
+TEST(friends_blob_round_trip) {
+  Preferences flash;
+  Preferences::hostShareNext(flash);
+  MochiState a;
+  a.begin();
+  for (int i = 0; i < MAX_FRIENDS; i++) CHECK(a.addFriend(0x100000 + i * 0x3A7));
+  CHECK(!a.addFriend(0xFFFFFF)); // Piena
+  CHECK(a.removeFriend(0x100000));
+
+  flash.begin("mochi-data", true);
+  CHECK_EQ(flash.getBytesLength("friendIds"), (MAX_FRIENDS - 1) * 3);
+  uint8_t blob[MAX_FRIENDS * 3];
+  size_t n = flash.getBytes("friendIds", blob, sizeof(blob));
+  flash.end();
+  for (size_t i = 3; i < n; i += 3) CHECK(memcmp(blob + i - 3, blob + i, 3) < 0);
+
+  Preferences::hostShareNext(flash);
+  MochiState b;
+  b.begin();
+  CHECK_EQ(b.friends.size(), MAX_FRIENDS - 1);
+  for (int i = 1; i < MAX_FRIENDS; i++) CHECK(b.isFriend(0x100000 + i * 0x3A7));
+  CHECK(!b.isFriend(0x100000));
+}
+
+// Vecchio formato: stringa "friends" con id separati da '\n' (righe vuote o
+// rotte ignorate). Al primo avvio diventa "friendIds" e la stringa sparisce.
+TEST(legacy_friends_string_migrates) {
+  Preferences flash;
+  flash.begin("mochi-data");
+  flash.putString("friends", "MOCHI-ABCDEF\nMOCHI-1\n\nnon-un-id\nmochi-00beef\nMOCHI-ABCDEF\n");
+  flash.end();
+
+  Preferences::hostShareNext(flash);
+  MochiState a;
+  a.begin();
+  CHECK_EQ(a.friends.size(), 3);
+  CHECK(a.isFriend(0xABCDEF));
+  CHECK(a.isFriend(0x1));
+  CHECK(a.isFriend(0xBEEF));
+
+  flash.begin("mochi-data", true);
+  CHECK(!flash.isKey("friends"));
+  CHECK_EQ(flash.getBytesLength("friendIds"), 9);
+  flash.end();
+
+  Preferences::hostShareNext(flash);
+  MochiState b;
+  b.begin();
+  CHECK_EQ(b.friends.size(), 3);
+  CHECK(b.isFriend(0xBEEF));
+}
+
+// ================================================================
+// BENCHMARK
+// ----------------------------------------------------------------
+// Contro il formato di prima: String friendIds[] con scansione lineare, e
+// salvataggio come stringa con un id per riga riletta con substring.
+// ================================================================
+
+struct OldFriends {
+  String ids[MAX_FRIENDS];
+  int    count = 0;
+
+  bool isFriend(const String& id) const {
+    for (int i = 0; i < count; i++) {
+      if (ids[i] == id) return true;
+    }
+    return false;
+  }
+  String save() const {
+    String blob;
+    for (int i = 0; i < count; i++) {
+      blob += ids[i];
+      blob += '\n';
+    }
+    return blob;
+  }
+  void load(const String& blob) {
+    count = 0;
+    int start = 0;
+    while (start < (int)blob.length() && count < MAX_FRIENDS) {
+      int nl = blob.indexOf('\n', start);
+      if (nl < 0) nl = blob.length();
+      String id = blob.substring(start, nl);
+      if (id.length() > 0) ids[count++] = id;
+      start = nl + 1;
+    }
+  }
+};
+
+template <class F> static double nsPer(int n, F fn) {
+  auto t0 = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+}
+
+TEST(bench_lookup_and_persistence) {
+  Preferences flash;
+  Preferences::hostShareNext(flash);
+  MochiState s;
+  s.begin();
+  OldFriends old;
+  std::vector<MochiId> probe;
+  std::vector<String> probeText;
+  for (int i = 0; i < MAX_FRIENDS; i++) {
+    MochiId id = 0x100000 + i * 0x3A7;
+    s.addFriend(id);
+    old.ids[old.count++] = mochiIdToString(id);
+    // Meta' amici, meta' sconosciuti: come i vicini di un raduno
+    MochiId q = i % 2 ? id : id + 1;
+    probe.push_back(q);
+    probeText.push_back(mochiIdToString(q));
+  }
+
+  const int LOOKUPS = 200000;
+  int hitsOld = 0, hitsNew = 0;
+  double oldNs = nsPer(LOOKUPS, [&] {
+    for (int i = 0; i < LOOKUPS; i++) hitsOld += old.isFriend(probeText[i % probe.size()]);
+  });
+  double newNs = nsPer(LOOKUPS, [&] {
+    for (int i = 0; i < LOOKUPS; i++) hitsNew += s.isFriend(probe[i % probe.size()]);
+  });
+  CHECK_EQ(hitsOld, hitsNew);
+  CHECK(newNs < oldNs);
+  BENCH_REPORT("isFriend con %d amici: String %.0f ns | MochiIdSet %.1f ns", MAX_FRIENDS, oldNs, newNs);
+
+  const int ROUNDS = 200;
+  Preferences oldFlash;
+  oldFlash.begin("mochi-data");
+  size_t oldBytes = 0;
+  double oldSave = nsPer(ROUNDS, [&] {
+    for (int i = 0; i < ROUNDS; i++) oldBytes = oldFlash.putString("friends", old.save());
+  });
+  double oldLoad = nsPer(ROUNDS, [&] {
+    for (int i = 0; i < ROUNDS; i++) old.load(oldFlash.getString("friends"));
+  });
+  CHECK_EQ(old.count, MAX_FRIENDS);
+  double newSave = nsPer(ROUNDS, [&] {
+    for (int i = 0; i < ROUNDS; i++) s.saveFriends();
+  });
+  double newLoad = nsPer(ROUNDS, [&] {
+    for (int i = 0; i < ROUNDS; i++) s.loadFriends();
+  });
+  CHECK_EQ(s.friends.size(), MAX_FRIENDS);
+  flash.begin("mochi-data", true);
+  size_t newBytes = flash.getBytesLength("friendIds");
+  flash.end();
+  CHECK_EQ(newBytes, MAX_FRIENDS * 3);
+  CHECK(newBytes * 3 < oldBytes);
+  BENCH_REPORT("salva/carica %d amici: String %.1f/%.1f us, %u B | blob %.1f/%.1f us, %u B", MAX_FRIENDS,
+               oldSave / 1000, oldLoad / 1000, (unsigned)oldBytes, newSave / 1000, newLoad / 1000,
+               (unsigned)newBytes);
+}
@@ -0,0 +1,144 @@
+#include "ble_app.h"
+#include "now_sim.h"
+#include "MochiMem.h"
+
+static int* volatile s_block; // Fuori dalla portata dell'ottimizzatore, che elide new + delete
+
+// Contatori per tag: l'allocazione va al tag attivo quando nasce, la delete
+// scala quello stesso tag anche se arriva da un altro scope.
+TEST(scope_tags_new_and_delete) {
+  MemTagStats before = mochiMemStats(MEM_VIEW);
+  {
+    MochiMemScope mem(MEM_VIEW);
+    CHECK_EQ(mochiMemTag(), MEM_VIEW);
+    {
+      MochiMemScope inner(MEM_JSON);
+      CHECK_EQ(mochiMemTag(), MEM_JSON);
+    }
+    CHECK_EQ(mochiMemTag(), MEM_VIEW);
+    s_block = new int[100];
+  }
+  CHECK_EQ(mochiMemTag(), MEM_OTHER);
+  MemTagStats s = mochiMemStats(MEM_VIEW);
+  CHECK_EQ(s.cur - before.cur, 100 * sizeof(int));
+  CHECK_EQ(s.allocs - before.allocs, 1);
+  CHECK(s.peak >= s.cur);
+
+  MochiMemScope mem(MEM_NOW);
+  delete[] s_block;
+  CHECK_EQ(mochiMemStats(MEM_VIEW).cur, before.cur);
+}
+
+// get_mem (anche senza MOCHI_MEM_TRACK) riporta la tabella per tag.
+TEST(get_mem_reports_tags) {
+  BleApp app(BLE_MTU);
+  app.write(app.legacy, "get_mem");
+  app.run();
+  std::string body(app.legacy->value.begin(), app.legacy->value.end());
+  DynamicJsonDocument doc(2048);
+  CHECK(!deserializeJson(doc, body.c_str(), body.size()));
+  const DynamicJsonDocument& reply = doc;
+  JsonVariantConst tags = reply["tags"];
+  for (int t = 0; t < MEM_TAG_COUNT; t++) {
+    JsonVariantConst tag = tags[mochiMemTagName((MemTag)t)];
+    CHECK(!tag.isNull());
+    CHECK(tag["n"].is<long>());
+  }
+  CHECK(reply["free"].as<long>() > 0);
+}
+
+// ================================================================
+// SOAK
+// ----------------------------------------------------------------
+// Giorni di traffico simulato: la app chiede stato e liste ogni 10 minuti
+// (testo, frame e batch), cambia impostazioni e amici; intanto quattro Mochi
+// si parlano via ESP-NOW e uno esce ed entra dalla portata, cosi' vicini,
+// peer e statistiche di link nascono e spariscono. Ogni ora si campionano i
+// byte vivi per tag: dopo il primo giorno non devono piu' crescere.
+// ================================================================
+
+#define SOAK_DAYS        7
+#define SOAK_ROUND_MS    600000UL // Un giro di comandi ogni 10 minuti
+#define SOAK_RADIO_MS    2000     // ESP-NOW simulato per ogni giro
+#define SOAK_SLACK_BYTES 512      // Oscillazione ammessa fra un giorno e l'altro
+
+static const char* const SOAK_TEXT[] = {
+  "get_state", "get_friends", "get_requests", "get_nearby", "get_settings",
+  "get_debug", "get_link", "get_mem", "queue:feed", "FEED", "PLAY",
+};
+
+TEST(soak_days_without_growth) {
+  SimConfig cfg;
+  cfg.nodes = 4;
+  cfg.areaM = 20;
+  cfg.friendsPerNode = 2;
+  cfg.seed = 7;
+  NowSim sim(cfg);
+  BleApp app(BLE_MTU);
+  app.ble.attachSocial(sim.node(0).social.get());
+  CHECK(app.hello());
+
+  const int rounds = SOAK_DAYS * 24 * 3600000UL / SOAK_ROUND_MS;
+  const int perHour = 3600000UL / SOAK_ROUND_MS;
+  std::vector<int32_t> cur[MEM_TAG_COUNT];
+  for (auto& s : cur) s.reserve(SOAK_DAYS * 24); // Le allocazioni del test stesso non devono crescere
+  unsigned long appMs = 0;
+  char cmd[64];
+
+  for (int r = 0; r < rounds; r++) {
+    sim.run(SOAK_RADIO_MS);
+    if (r % perHour == 0) sim.place(3, (r / perHour) % 2 ? 400 : 10, 10);
+
+    appMs += SOAK_ROUND_MS;
+    hostSetMillis(appMs); // run() muove millis() col tempo della rete
+    app.state.applyTick();
+    app.state.tickVisits();
+
+    for (const char* c : SOAK_TEXT) {
+      app.write(app.legacy, c);
+      app.run();
+    }
+    MochiId id = 0x300000 + r % 50;
+    snprintf(cmd, sizeof(cmd), "set_json:{\"brightness\":%d,\"timezone\":\"Europe/Rome\"}", 100 + r % 100);
+    app.write(app.legacy, cmd);
+    app.state.addPendingRequest(id);
+    snprintf(cmd, sizeof(cmd), "accept_friend:%s", mochiIdToString(id).c_str());
+    app.write(app.legacy, cmd);
+    snprintf(cmd, sizeof(cmd), "del_friend:%s", mochiIdToString(id).c_str());
+    app.write(app.legacy, cmd);
+    app.run();
+
+    Bytes batch;
+    for (uint8_t t : { PT_GET_STATE, PT_GET_FRIENDS, PT_GET_NEARBY, PT_GET_REQUESTS }) {
+      Bytes f = app.frame(t);
+      batch.insert(batch.end(), f.begin(), f.end());
+    }
+    app.write(app.cmd, batch);
+    app.run();
+    Bytes reply;
+    while (app.take(&reply)) {}
+    app.inbox.clear();
+
+    if (r % perHour == perHour - 1) {
+      for (int t = 0; t < MEM_TAG_COUNT; t++) cur[t].push_back(mochiMemStats((MemTag)t).cur);
+    }
+  }
+
+  CHECK(sim.node(0).social->nearbyCount() > 0);
+  CHECK(app.state.settings.brightness >= 100);
+
+  // Primo giorno (senza la prima ora, il riscaldamento) contro l'ultimo.
+  for (int t = 0; t < MEM_TAG_COUNT; t++) {
+    const std::vector<int32_t>& s = cur[t];
+    CHECK_EQ(s.size(), SOAK_DAYS * 24);
+    int32_t firstDay = *std::max_element(s.begin() + 1, s.begin() + 24);
+    int32_t lastDay = *std::max_element(s.end() - 24, s.end());
+    MemTagStats st = mochiMemStats((MemTag)t);
+    if (lastDay > firstDay + SOAK_SLACK_BYTES) {
+      printf("  %s: %d B il primo giorno, %d B l'ultimo\n", mochiMemTagName((MemTag)t), firstDay, lastDay);
+    }
+    CHECK(lastDay <= firstDay + SOAK_SLACK_BYTES);
+    BENCH_REPORT("soak %d giorni, %-6s: vivi %d -> %d B, picco %d B, %u allocazioni",
+                 SOAK_DAYS, mochiMemTagName((MemTag)t), firstDay, lastDay, st.peak, st.allocs);
+  }
+}
@@ -0,0 +1,435 @@
+#include "mochi_test.h"
+#include "MochiNow.h"
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <array>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Radio finta per un MochiNow solo: i pacchetti "arrivano" chiamando
+// onRadioRecv come farebbe il task WiFi, gli invii si contano e riescono
+// subito. Orologio fermo finche' il test non lo sposta.
+class BenchRadio : public MochiTransport, public MochiClock {
+public:
+  MochiRadioSink* sink = nullptr;
+  unsigned long t = 1000;
+  uint32_t rng = 1;
+  uint32_t sent = 0;
+  uint32_t unregistered = 0; // Unicast verso un peer non registrato (ESP-NOW li rifiuta)
+  size_t   peakPeers = 0;
+  std::vector<std::array<uint8_t, 6>> peers;
+  uint8_t  last[NOW_WIRE_MAX];
+  size_t   lastLen = 0;
+
+  bool    begin(MochiRadioSink* s) override { sink = s; return true; }
+  void    macAddress(uint8_t out[6]) override { memcpy(out, "\x02\x4D\x4F\x00\x00\x01", 6); }
+  MochiId localId() override { return 0xA00001; }
+  uint8_t channel() override { return ESPNOW_CHANNEL; }
+  bool    addPeer(const uint8_t* mac) override {
+    if (!registered(mac)) peers.push_back(toArray(mac));
+    peakPeers = std::max(peakPeers, peers.size());
+    return true;
+  }
+  void    removePeer(const uint8_t* mac) override {
+    peers.erase(std::remove(peers.begin(), peers.end(), toArray(mac)), peers.end());
+  }
+  bool    send(const uint8_t* mac, const uint8_t* data, size_t len) override {
+    if (mac[0] != 0xFF && !registered(mac)) unregistered++;
+    sent++;
+    memcpy(last, data, len);
+    lastLen = len;
+    sink->onRadioSent(true);
+    return true;
+  }
+  bool    registered(const uint8_t* mac) const {
+    return std::find(peers.begin(), peers.end(), toArray(mac)) != peers.end();
+  }
+  MochiClock* clock() override { return this; }
+  unsigned long now() override { return t; }
+  uint32_t random32() override {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+  }
+
+private:
+  static std::array<uint8_t, 6> toArray(const uint8_t* mac) {
+    std::array<uint8_t, 6> a;
+    memcpy(a.data(), mac, 6);
+    return a;
+  }
+};
+
+struct Peer {
+  uint8_t mac[6];
+  MochiId id;
+};
+
+static Peer peer(int i) {
+  Peer p = { { 0x02, 0x4D, 0x4F, 0x01, (uint8_t)(i >> 8), (uint8_t)i }, (MochiId)(0x100000 + i) };
+  return p;
+}
+
+static void inject(MochiNow& now, const Peer& p, uint8_t type, uint8_t seq = 0, const void* payload = nullptr,
+                   size_t len = 0) {
+  uint8_t buf[NOW_WIRE_MAX];
+  size_t n = mochiWireEncode(buf, type, p.id, seq, payload, len);
+  now.onRadioRecv(p.mac, -60, buf, n);
+}
+
+struct Bench {
+  MochiState state;
+  BenchRadio radio;
+  MochiNow   now;
+  Bench() : now(&state, &radio) {
+    hostPartitionsClear();
+    state.setClock(&radio);
+    state.begin();
+    now.begin();
+  }
+  void drain() {
+    for (int i = 0; i < 64; i++) now.tick(radio.t);
+  }
+  // Annunci da peer(from) a peer(to - 1), a gruppi che la coda regge.
+  void announce(int from, int to) {
+    for (int i = from; i < to; i++) {
+      inject(now, peer(i), PKT_ANNOUNCE);
+      if ((i - from) % NOW_RX_PER_TICK == NOW_RX_PER_TICK - 1) now.tick(radio.t);
+    }
+    drain();
+  }
+  bool knows(MochiId id) const {
+    for (int i = 0; i < now.nearbyCount(); i++) {
+      if (now.nearbyAt(i).id == id) return true;
+    }
+    return false;
+  }
+};
+
+// Raffica piu' grande della coda senza giri di loop in mezzo: entra quello che
+// ci sta, il resto si conta come scartato e niente viene gestito nella callback.
+TEST(burst_overflows_queue) {
+  Bench b;
+  const int N = 100;
+  for (int i = 0; i < N; i++) inject(b.now, peer(i), PKT_ANNOUNCE);
+  CHECK_EQ(b.now.rxHandled(), 0);
+  CHECK_EQ(b.now.nearbyCount(), 0);
+  CHECK_EQ(b.now.rxDropped(), N - NOW_RX_QUEUE_LEN);
+
+  b.now.tick(b.radio.t);
+  CHECK_EQ(b.now.rxHandled(), NOW_RX_PER_TICK);
+  b.drain();
+  CHECK_EQ(b.now.rxHandled(), NOW_RX_QUEUE_LEN);
+  CHECK_EQ(b.now.nearbyCount(), NOW_RX_QUEUE_LEN);
+}
+
+// Piu' accettazioni di amicizia nello stesso giro: prima stavano in un campo
+// solo e l'ultima sovrascriveva le altre.
+TEST(accepts_in_one_burst_all_land) {
+  Bench b;
+  const int N = 10;
+  for (int i = 0; i < N; i++) inject(b.now, peer(i), PKT_FRIEND_ACCEPT, i);
+  b.drain();
+  for (int i = 0; i < N; i++) CHECK(b.state.isFriend(peer(i).id));
+}
+
+// Ad un raduno con 200 Mochi la tabella si riempie fino a MAX_NEARBY e gli
+// altri restano fuori; dopo il timeout si svuota e si riempie con i nuovi.
+TEST(nearby_table_with_200_peers) {
+  Bench b;
+  b.announce(0, 200);
+  CHECK_EQ(b.now.rxDropped(), 0);
+  CHECK_EQ(b.now.nearbyCount(), MAX_NEARBY);
+  for (int i = 0; i < MAX_NEARBY; i++) CHECK(b.knows(peer(i).id));
+  CHECK(!b.knows(peer(MAX_NEARBY).id));
+
+  // Un annuncio ripetuto aggiorna il vicino, non ne crea un altro
+  b.announce(10, 20);
+  CHECK_EQ(b.now.nearbyCount(), MAX_NEARBY);
+
+  b.radio.t += NEARBY_TIMEOUT_MS + 1;
+  b.now.tick(b.radio.t);
+  CHECK_EQ(b.now.nearbyCount(), 0);
+  b.announce(100, 200);
+  CHECK_EQ(b.now.nearbyCount(), MAX_NEARBY);
+  CHECK(b.knows(peer(150).id));
+  CHECK(!b.knows(peer(5).id));
+  CHECK(b.now.sendFriendRequest(peer(150).id));
+  CHECK(!b.now.sendFriendRequest(peer(5).id));
+}
+
+// Unicast a 40 vicini diversi, uno dopo l'altro con il suo ack: la radio non
+// ha mai piu' di NOW_PEER_CACHE peer registrati e ogni invio va a uno
+// registrato.
+TEST(peer_cache_lru_with_many_peers) {
+  Bench b;
+  b.announce(0, MAX_NEARBY);
+  const int N = 40;
+  int acked = 0;
+  for (int i = 0; i < N; i++) {
+    CHECK(b.now.sendFriendRequest(peer(i).id));
+    NowPacketView v = {};
+    for (int k = 0; k < 50 && v.type != PKT_FRIEND_REQ; k++) { // Fra un annuncio e l'altro
+      b.radio.lastLen = 0;
+      b.radio.t += 10;
+      b.now.tick(b.radio.t);
+      if (!b.radio.lastLen || !mochiWireParse(b.radio.last, b.radio.lastLen, &v)) v.type = PKT_ANNOUNCE;
+    }
+    if (v.type != PKT_FRIEND_REQ) continue;
+    inject(b.now, peer(i), PKT_LINK_ACK, 0, &v.seq, 1);
+    b.now.tick(b.radio.t);
+    acked++;
+  }
+  CHECK_EQ(acked, N);
+  CHECK_EQ(b.radio.unregistered, 0);
+  CHECK(b.radio.peakPeers <= NOW_PEER_CACHE);
+  CHECK(b.radio.peers.size() <= NOW_PEER_CACHE);
+  BENCH_REPORT("peer cache: %d destinatari, al massimo %u registrati, %u invii", N, (unsigned)b.radio.peakPeers,
+               (unsigned)b.radio.sent);
+}
+
+// Ritrasmissione di un pacchetto gia' ricevuto (il nostro ack si era perso),
+// dopo pacchetti affidabili da altri 12 Mochi: si conferma di nuovo ma non si
+// gestisce due volte. Ricevere non tocca la cache dei peer di invio.
+TEST(duplicate_after_many_senders) {
+  Bench b;
+  b.announce(0, 16);
+  size_t peersBefore = b.radio.peers.size();
+  inject(b.now, peer(0), PKT_FRIEND_REQ, 42);
+  b.drain();
+  for (int i = 1; i <= 12; i++) {
+    inject(b.now, peer(i), PKT_FRIEND_REQ, 42);
+    b.radio.t += 20;
+    b.drain();
+  }
+  CHECK_EQ(b.now.duplicates(), 0);
+  uint32_t sent = b.radio.sent;
+  inject(b.now, peer(0), PKT_FRIEND_REQ, 42);
+  b.drain();
+  CHECK_EQ(b.now.duplicates(), 1);
+  CHECK(b.radio.sent > sent); // Ack ripetuto
+  // Il doppione si vede nel collegamento con chi l'ha rimandato, e fra i ricevuti
+  const NowLinkStats* l0 = b.now.linkStats(peer(0).id);
+  CHECK(l0 != nullptr);
+  CHECK_EQ(l0->duplicates, 1);
+  CHECK_EQ(l0->received, 3); // Annuncio, richiesta, doppione
+  CHECK_EQ(b.now.linkStats(peer(1).id)->duplicates, 0);
+  NowPacketView v;
+  CHECK(mochiWireParse(b.radio.last, b.radio.lastLen, &v));
+  CHECK_EQ(v.type, PKT_LINK_ACK);
+  CHECK_EQ(v.payload[0], 42);
+  CHECK(peersBefore <= b.radio.peers.size());
+
+  // Passati i ritentativi possibili, lo stesso seq e' un pacchetto nuovo
+  // (mittente riavviato o seq che ha fatto il giro)
+  b.radio.t += NOW_RX_DEDUP_MS + 1;
+  inject(b.now, peer(0), PKT_FRIEND_REQ, 42);
+  b.drain();
+  CHECK_EQ(b.now.duplicates(), 1);
+  CHECK_EQ(b.now.typeStat(PKT_FRIEND_REQ).received, 15);
+}
+
+// La coda di invio piena di pacchetti che nessuno conferma non blocca gli ack
+// verso chi ci scrive.
+TEST(acks_pass_a_full_queue) {
+  Bench b;
+  b.announce(0, 16);
+  int queued = 0;
+  while (b.now.sendFriendRequest(peer(queued).id)) queued++;
+  CHECK_EQ(queued, NOW_TX_QUEUE_LEN - NOW_TX_ACK_RESERVED);
+  CHECK(!b.now.sendFriendAccept(peer(15).id));
+
+  for (int i = 0; i < 2 * NOW_TX_ACK_RESERVED; i++) {
+    b.radio.lastLen = 0;
+    inject(b.now, peer(10 + i), PKT_VISIT_END, 7 + i);
+    b.now.tick(b.radio.t);
+    NowPacketView v;
+    CHECK(b.radio.lastLen && mochiWireParse(b.radio.last, b.radio.lastLen, &v));
+    CHECK_EQ(v.type, PKT_LINK_ACK);
+    CHECK_EQ(v.payload[0], 7 + i);
+  }
+}
+
+// Il seq degli invii affidabili non riparte quando il peer esce dalla cache.
+TEST(tx_seq_survives_peer_eviction) {
+  Bench b;
+  b.announce(0, 16);
+  std::vector<uint8_t> seqs;
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i <= NOW_PEER_CACHE; i++) {
+      CHECK(b.now.sendFriendRequest(peer(i).id));
+      b.now.tick(b.radio.t);
+      NowPacketView v;
+      CHECK(mochiWireParse(b.radio.last, b.radio.lastLen, &v));
+      if (i == 0) seqs.push_back(v.seq);
+      inject(b.now, peer(i), PKT_LINK_ACK, 0, &v.seq, 1);
+      b.radio.t += 10;
+      b.now.tick(b.radio.t);
+    }
+  }
+  CHECK_EQ(seqs.size(), 3);
+  CHECK_EQ((uint8_t)(seqs[1] - seqs[0]), NOW_PEER_CACHE + 1);
+  CHECK_EQ((uint8_t)(seqs[2] - seqs[1]), NOW_PEER_CACHE + 1);
+}
+
+static NowGossipEntry gossip(MochiId id, uint8_t hops, uint8_t age) {
+  NowGossipEntry e = { { (uint8_t)id, (uint8_t)(id >> 8), (uint8_t)(id >> 16) }, hops, age };
+  return e;
+}
+
+static int remoteHops(const MochiNow& now, MochiId id) {
+  for (int i = 0; i < now.remoteCount(); i++) {
+    if (now.remoteAt(i).id == id) return now.remoteAt(i).hops;
+  }
+  return 0;
+}
+
+// Regole del merge: un salto in piu', niente voci su noi stessi, sul mittente
+// o sui vicini diretti, niente oltre GOSSIP_MAX_HOPS o GOSSIP_TTL_MS; il
+// percorso piu' corto vince, e chi diventa vicino esce dalla tabella.
+TEST(gossip_merge_rules) {
+  Bench b;
+  b.announce(0, 2);
+  NowGossipEntry d[] = {
+    gossip(peer(50).id, 1, 0),
+    gossip(peer(51).id, 2, 3),
+    gossip(peer(52).id, GOSSIP_MAX_HOPS, 0),                  // Un salto di troppo
+    gossip(peer(53).id, 1, GOSSIP_TTL_MS / GOSSIP_AGE_UNIT_MS + 1), // Troppo vecchio
+    gossip(b.radio.localId(), 1, 0),
+    gossip(peer(0).id, 1, 0),                                 // Il mittente stesso
+    gossip(peer(1).id, 1, 0),                                 // Gia' vicino
+  };
+  inject(b.now, peer(0), PKT_ANNOUNCE, 0, d, sizeof(d));
+  b.drain();
+  CHECK_EQ(b.now.remoteCount(), 2);
+  CHECK_EQ(remoteHops(b.now, peer(50).id), 2);
+  CHECK_EQ(remoteHops(b.now, peer(51).id), 3);
+  CHECK_EQ(remoteHops(b.now, peer(52).id), 0);
+
+  // Stessa notizia da un percorso piu' corto
+  NowGossipEntry shorter[] = { gossip(peer(51).id, 1, 3) };
+  inject(b.now, peer(1), PKT_ANNOUNCE, 0, shorter, sizeof(shorter));
+  b.drain();
+  CHECK_EQ(remoteHops(b.now, peer(51).id), 2);
+  CHECK_EQ(b.now.remoteAt(0).id == peer(51).id ? b.now.remoteAt(0).via : b.now.remoteAt(1).via, peer(1).id);
+
+  // peer(50) arriva a portata: vicino diretto, non piu' lontano
+  b.announce(50, 51);
+  CHECK_EQ(remoteHops(b.now, peer(50).id), 0);
+  CHECK_EQ(b.now.remoteCount(), 1);
+
+  // Nessuno lo ripete: scade dopo GOSSIP_TTL_MS dall'ultimo annuncio diretto
+  b.radio.t += GOSSIP_TTL_MS;
+  b.drain();
+  CHECK_EQ(b.now.remoteCount(), 0);
+}
+
+// Tabella piena: una voce nuova prende il posto della piu' lontana solo se e'
+// piu' vicina, altrimenti si conta come scartata.
+TEST(gossip_table_full) {
+  Bench b;
+  b.announce(0, 1);
+  for (int i = 0; i < GOSSIP_TABLE_SIZE; i += GOSSIP_DIGEST_MAX) {
+    NowGossipEntry d[GOSSIP_DIGEST_MAX];
+    for (int k = 0; k < GOSSIP_DIGEST_MAX; k++) d[k] = gossip(peer(100 + i + k).id, 2, 0);
+    inject(b.now, peer(0), PKT_ANNOUNCE, 0, d, sizeof(d));
+    b.drain();
+  }
+  CHECK_EQ(b.now.remoteCount(), GOSSIP_TABLE_SIZE);
+  NowGossipEntry far[] = { gossip(peer(200).id, 2, 0) };
+  inject(b.now, peer(0), PKT_ANNOUNCE, 0, far, sizeof(far));
+  b.drain();
+  CHECK_EQ(remoteHops(b.now, peer(200).id), 0);
+  NowGossipEntry closer[] = { gossip(peer(201).id, 1, 0) };
+  inject(b.now, peer(0), PKT_ANNOUNCE, 0, closer, sizeof(closer));
+  b.drain();
+  CHECK_EQ(remoteHops(b.now, peer(201).id), 2);
+  CHECK_EQ(b.now.remoteCount(), GOSSIP_TABLE_SIZE);
+}
+
+// Le statistiche di un amico restano quando esce dai vicini, e anche quando
+// la tabella si riempie di sconosciuti.
+TEST(link_stats_survive_prune) {
+  Bench b;
+  b.state.addFriend(peer(0).id);
+  b.announce(0, 2);
+  CHECK(b.now.sendFriendRequest(peer(0).id));
+  b.now.tick(b.radio.t);
+  NowPacketView v;
+  CHECK(mochiWireParse(b.radio.last, b.radio.lastLen, &v));
+  inject(b.now, peer(0), PKT_LINK_ACK, 0, &v.seq, 1);
+  b.drain();
+
+  b.radio.t += NEARBY_TIMEOUT_MS + 1;
+  b.drain();
+  CHECK_EQ(b.now.nearbyCount(), 0);
+  const NowLinkStats* l = b.now.linkStats(peer(0).id);
+  CHECK(l != nullptr);
+  CHECK_EQ(l->sent, 1);
+  CHECK_EQ(l->delivered, 1);
+  CHECK_EQ(l->received, 2); // L'annuncio e l'ack (che conta anche in delivered)
+
+  b.radio.t += 1000;
+  b.announce(100, 100 + 2 * LINK_TABLE_SIZE);
+  CHECK(b.now.linkStats(peer(0).id) != nullptr);
+  CHECK(b.now.linkStats(peer(1).id) == nullptr); // Non amico, il piu' vecchio
+  CHECK(b.now.linkStats(peer(100 + 2 * LINK_TABLE_SIZE - 1).id) != nullptr);
+
+  char buf[4096];
+  MochiWriter w(buf, sizeof(buf));
+  b.now.writeLinkReport(w);
+  CHECK(std::string(w.data(), w.length()).find("sparito da") != std::string::npos);
+
+  b.now.resetLinkStats();
+  CHECK(b.now.linkStats(peer(0).id) == nullptr);
+}
+
+TEST(garbage_rejected_in_callback) {
+  Bench b;
+  const uint8_t junk[] = { 0x3F, 1, 2 };
+  const Peer p = peer(1);
+  b.now.onRadioRecv(p.mac, -50, junk, sizeof(junk));
+  b.now.onRadioRecv(p.mac, -50, junk, 0);
+  CHECK_EQ(b.now.rxRejected(), 2);
+  b.drain();
+  CHECK_EQ(b.now.rxHandled(), 0);
+}
+
+// La radio su un altro thread manda raffiche da 300 Mochi mentre il loop gira:
+// ogni pacchetto o e' gestito o e' contato fra gli scartati, mai perso o
+// doppio, e la tabella dei vicini resta coerente.
+TEST(stress_threads_many_peers) {
+  Bench b;
+  const int PEERS = 300, N = 60000, BURST = 24;
+  std::atomic<bool> done(false);
+  std::thread radio([&] {
+    for (int i = 0; i < N; i += BURST) {
+      for (int k = i; k < i + BURST && k < N; k++) inject(b.now, peer(k % PEERS), PKT_ANNOUNCE);
+      std::this_thread::yield();
+    }
+    done = true;
+  });
+  auto t0 = std::chrono::steady_clock::now();
+  unsigned long ticks = 0;
+  while (!done) {
+    b.now.tick(b.radio.t);
+    ticks++;
+    std::this_thread::yield();
+  }
+  radio.join();
+  b.drain();
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+  CHECK_EQ(b.now.rxHandled() + b.now.rxDropped(), N);
+  CHECK(b.now.rxHandled() > 0);
+  CHECK_EQ(b.now.nearbyCount(), MAX_NEARBY);
+  for (int i = 0; i < b.now.nearbyCount(); i++) {
+    MochiId id = b.now.nearbyAt(i).id;
+    CHECK(id >= 0x100000 && id < 0x100000 + PEERS);
+  }
+  BENCH_REPORT("rx da %d peer: %d pacchetti, %lu gestiti, %lu scartati in %lu giri, %.0f ms",
+               PEERS, N, (unsigned long)b.now.rxHandled(), (unsigned long)b.now.rxDropped(), ticks, ms);
+}
@@ -0,0 +1,244 @@
+#include "mochi_test.h"
+#include "now_sim.h"
+#include <algorithm>
+
+// Due Mochi a pochi metri, senza perdite: si vedono entro il primo intervallo
+// degli annunci.
+TEST(two_nodes_discover) {
+  SimConfig cfg;
+  cfg.nodes = 2;
+  cfg.lossPct = 0;
+  cfg.friendsPerNode = 0;
+  NowSim sim(cfg);
+  sim.place(0, 0, 0);
+  sim.place(1, 5, 0);
+  sim.run(ANNOUNCE_MIN_MS + 500);
+  CHECK(sim.node(0).knows(sim.node(1)));
+  CHECK(sim.node(1).knows(sim.node(0)));
+  CHECK(sim.discovered() == 1.0f);
+}
+
+// Oltre la sensibilita' non arriva nulla.
+TEST(far_nodes_never_meet) {
+  SimConfig cfg;
+  cfg.nodes = 2;
+  cfg.friendsPerNode = 0;
+  NowSim sim(cfg);
+  sim.place(0, 0, 0);
+  sim.place(1, 500, 0);
+  sim.run(10000);
+  CHECK(!sim.node(0).knows(sim.node(1)));
+  CHECK_EQ(sim.node(1).received, 0);
+}
+
+// Orologi sfasati di ore e con deriva: i tempi di MochiNow sono tutti
+// relativi, quindi vicini e timeout non se ne accorgono. Un nodo che si
+// allontana sparisce entro NEARBY_TIMEOUT_MS.
+TEST(skewed_clocks_and_timeout) {
+  SimConfig cfg;
+  cfg.nodes = 10;
+  cfg.areaM = 20;
+  cfg.clockSpreadMs = 6UL * 3600 * 1000;
+  cfg.driftPpm = 200;
+  NowSim sim(cfg);
+  sim.run(60000);
+  CHECK(sim.discovered() == 1.0f);
+  CHECK(sim.node(0).now() != sim.node(1).now());
+
+  sim.place(9, 1000, 1000);
+  sim.run(NEARBY_TIMEOUT_MS + 5000);
+  for (int i = 0; i < 9; i++) CHECK(!sim.node(i).knows(sim.node(9)));
+  CHECK_EQ(sim.node(9).social->nearbyCount(), 0);
+}
+
+// Due amici vicini: prima o poi uno va a trovare l'altro, e torna dopo
+// VISIT_DURATION_MS. La visita segue l'orologio del nodo, non millis().
+TEST(friends_visit_and_return) {
+  SimConfig cfg;
+  cfg.nodes = 2;
+  cfg.friendsPerNode = 0;
+  cfg.clockSpreadMs = 3600UL * 1000;
+  NowSim sim(cfg);
+  sim.place(0, 0, 0);
+  sim.place(1, 3, 0);
+  sim.befriend(0, 1);
+  for (int m = 0; m < 60 && !sim.report().departures; m++) sim.run(60000);
+
+  SimReport r = sim.report();
+  CHECK(r.departures > 0);
+  CHECK(r.visitsAccepted > 0);
+  CHECK_EQ(r.visitsAccepted, r.departures);
+  SimNode& guest = sim.node(0).state.isAway ? sim.node(0) : sim.node(1);
+  SimNode& host  = &guest == &sim.node(0) ? sim.node(1) : sim.node(0);
+  CHECK(guest.state.isAway);
+  CHECK(host.state.isHostingGuest);
+  CHECK_EQ(host.state.guestId, guest.id);
+
+  sim.run(VISIT_DURATION_MS + 1000);
+  CHECK(!guest.state.isAway);
+  CHECK(!host.state.isHostingGuest);
+}
+
+// Raduno: 120 Mochi nella stessa stanza, tutti a portata di tutti. Ognuno
+// tiene (quasi) MAX_NEARBY vicini, la radio non registra mai piu' peer della cache e
+// le visite fra amici partono lo stesso.
+TEST(crowded_meetup_120_nodes) {
+  SimConfig cfg;
+  cfg.nodes = 120;
+  cfg.areaM = 15;
+  NowSim sim(cfg);
+  sim.run(3UL * 60 * 1000);
+  sim.printReport("raduno di 120 Mochi");
+
+  size_t peak = 0;
+  uint32_t refused = 0;
+  for (int i = 0; i < sim.size(); i++) {
+    CHECK(sim.node(i).social->nearbyCount() >= MAX_NEARBY - 4); // Qualcuno appena scaduto
+    peak = std::max(peak, sim.node(i).peakPeers);
+    refused += sim.node(i).refused;
+  }
+  CHECK(peak <= NOW_PEER_CACHE);
+  CHECK_EQ(refused, 0);
+  SimReport r = sim.report();
+  CHECK(r.visitsAccepted > 0);
+}
+
+// Vicinato fermo con il 15% di perdite: gli annunci lenti non devono far
+// sparire e ricomparire i vicini. Dopo il primo minuto la scoperta non scende
+// mai sotto il 98%, e a regime si annuncia meno che all'inizio.
+TEST(stable_neighbourhood_does_not_flap) {
+  SimConfig cfg;
+  cfg.nodes = 60;
+  cfg.areaM = 100;
+  cfg.lossPct = 15;
+  cfg.clockSpreadMs = 3600UL * 1000;
+  NowSim sim(cfg);
+  sim.run(60000);
+  uint32_t warmup = 0;
+  for (int i = 0; i < sim.size(); i++) warmup += sim.node(i).sentByType[PKT_ANNOUNCE];
+
+  float worst = 1.0f;
+  for (int s = 0; s < 60; s++) {
+    sim.run(5000);
+    worst = std::min(worst, sim.discovered());
+  }
+  uint32_t steady = 0;
+  for (int i = 0; i < sim.size(); i++) steady += sim.node(i).sentByType[PKT_ANNOUNCE];
+  steady -= warmup;
+  float steadyPerMin = steady / 5.0f / sim.size();
+  BENCH_REPORT("vicinato fermo, perdita 15%%: scoperta minima %.1f%%, %.1f annunci/nodo/min nel primo minuto, %.1f dopo",
+               worst * 100, (float)warmup / sim.size(), steadyPerMin);
+  CHECK(worst >= 0.98f);
+  CHECK(steadyPerMin < (float)warmup / sim.size());
+  CHECK(steadyPerMin < 12); // Il vecchio annuncio fisso ogni 5 s
+}
+
+// Radio pessima (35% di perdite, ack compresi) e tanti mittenti verso lo
+// stesso Mochi: ogni richiesta arriva al massimo una volta anche quando il
+// mittente ritrasmette, e quasi tutte arrivano.
+TEST(lossy_link_delivers_once) {
+  SimConfig cfg;
+  cfg.nodes = 12;
+  cfg.areaM = 10;
+  cfg.lossPct = 35;
+  cfg.friendsPerNode = 0;
+  NowSim sim(cfg);
+  sim.run(10000);
+  SimNode& target = sim.node(0);
+  for (int round = 0; round < 20; round++) {
+    for (int i = 1; i < sim.size(); i++) sim.node(i).social->sendFriendRequest(target.id);
+    sim.run(3000);
+  }
+  uint32_t sent = 0, delivered = 0, failed = 0;
+  for (int i = 1; i < sim.size(); i++) {
+    const NowTypeStats& t = sim.node(i).social->typeStat(PKT_FRIEND_REQ);
+    sent += t.sent;
+    delivered += t.delivered;
+    failed += t.failed;
+  }
+  const NowTypeStats& r = target.social->typeStat(PKT_FRIEND_REQ);
+  uint32_t handled = r.received - r.duplicates;
+  BENCH_REPORT("perdita 35%%: %u richieste, %u confermate, %u fallite, %u gestite, %u doppioni scartati",
+               sent, delivered, failed, handled, r.duplicates);
+  CHECK(sent >= 200);
+  CHECK(r.duplicates > 0);
+  CHECK(handled >= delivered);
+  CHECK(handled <= sent);
+  CHECK(delivered >= sent * 9 / 10);
+}
+
+// Dieci stanze in fila, 45 m l'una dall'altra: ogni Mochi sente le stanze
+// accanto (quelle a 90 m solo ogni tanto, col rumore). Col gossip sa anche di quelli a due e tre salti, con il numero di
+// salti giusto, per pochi byte in piu' negli annunci; chi se ne va sparisce
+// ovunque entro GOSSIP_TTL_MS.
+TEST(gossip_across_rooms) {
+  SimConfig cfg;
+  cfg.nodes = 10;
+  cfg.friendsPerNode = 0;
+  NowSim sim(cfg);
+  for (int i = 0; i < sim.size(); i++) sim.place(i, i * 45.0f, 0);
+  CHECK(sim.inRange(sim.node(0), sim.node(1)));
+  CHECK(!sim.inRange(sim.node(0), sim.node(2)));
+  sim.run(3UL * 60 * 1000);
+  sim.printReport("stanze in fila");
+
+  SimReport r = sim.report();
+  CHECK(r.farPairs > 0);
+  CHECK(r.presence >= 0.95f);
+  CHECK(sim.node(0).hopsTo(sim.node(2)) == 2 || sim.node(0).knows(sim.node(2)));
+  CHECK_EQ(sim.node(0).hopsTo(sim.node(3)), 3);
+  uint32_t announces = 0, gossip = 0;
+  for (int i = 0; i < sim.size(); i++) {
+    announces += sim.node(i).sentByType[PKT_ANNOUNCE];
+    gossip += sim.node(i).gossipBytes;
+    CHECK(sim.node(i).social->remoteCount() <= GOSSIP_TABLE_SIZE);
+  }
+  CHECK(gossip <= announces * GOSSIP_DIGEST_MAX * sizeof(NowGossipEntry));
+
+  sim.place(5, 5000, 5000);
+  sim.run(GOSSIP_TTL_MS + NEARBY_TIMEOUT_MS + 10000);
+  for (int i = 0; i < sim.size(); i++) {
+    if (i != 5) CHECK_EQ(sim.node(i).hopsTo(sim.node(5)), 0);
+  }
+}
+
+// Stesso seme, stessa simulazione.
+TEST(same_seed_same_run) {
+  SimConfig cfg;
+  cfg.nodes = 20;
+  cfg.areaM = 60;
+  cfg.clockSpreadMs = 100000;
+  SimReport a, b;
+  {
+    NowSim sim(cfg);
+    sim.run(60000);
+    a = sim.report();
+  }
+  {
+    NowSim sim(cfg);
+    sim.run(60000);
+    b = sim.report();
+  }
+  CHECK_EQ(a.pairs, b.pairs);
+  CHECK(a.discovered == b.discovered);
+  CHECK(a.pktPerNodeMin == b.pktPerNodeMin);
+  CHECK_EQ(a.t100, b.t100);
+}
+
+// Cento Mochi sparsi su 150 x 150 m con il 5% di perdite, dieci minuti.
+TEST(bench_hundred_nodes) {
+  SimConfig cfg;
+  cfg.clockSpreadMs = 24UL * 3600 * 1000;
+  NowSim sim(cfg);
+  sim.run(10UL * 60 * 1000);
+  sim.printReport("rete di 100 Mochi");
+
+  SimReport r = sim.report();
+  CHECK_EQ(r.nodes, 100);
+  CHECK(r.pairs > 1000);
+  CHECK(r.t90 >= 0 && r.t90 <= 5000);
+  CHECK(r.t99 >= 0 && r.t99 <= 180000); // Le coppie al limite della portata arrivano per ultime
+  CHECK(r.discovered >= 0.99f);
+  CHECK(r.visitsAsked > 0);
+  CHECK(r.visitSuccess >= 0.8f);
+}
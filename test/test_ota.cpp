@@ -0,0 +1,372 @@
+#include "ble_app.h"
+#include <mbedtls/sha256.h>
+#include <zlib.h>
+
+// ================================================================
+// AGGIORNAMENTO FIRMWARE DALLA CARATTERISTICA OTA
+// ----------------------------------------------------------------
+// L'app manda i pezzi come otaUpdate() in connect.js (finestra, ripartenza
+// dall'ultima conferma o dal buco segnalato, BEGIN di nuovo dopo una
+// disconnessione) e il Mochi li decomprime nella partizione ota_0 finta.
+// Il tempo e' quello dello shim: un giro senza risposte vale OTA_NAK_REPEAT_MS.
+// ================================================================
+
+#define APP_OTA_WINDOW     12   // Come OTA_WINDOW in connect.js
+#define APP_OTA_TIMEOUT_MS 2000 // Come OTA_TIMEOUT_MS
+#define OTA_SLOT_SIZE      (256 * 1024)
+
+struct OtaImage {
+  Bytes   raw;
+  Bytes   comp;
+  uint8_t sha[OTA_SHA_SIZE];
+};
+
+// Un'app finta: magic dell'immagine ESP32 e poi parole ripetute a caso, cosi'
+// zlib la porta a meno della meta' e i riferimenti scavalcano il dizionario da 32 KB.
+static OtaImage makeImage(size_t size, bool app = true) {
+  static const char* words[] = { "mochi", "feed", "pet", "sleep", "ble", "ota", "flash", "tinfl" };
+  OtaImage img;
+  img.raw.push_back(app ? ESP_IMAGE_HEADER_MAGIC : 0x00);
+  while (img.raw.size() < size) {
+    if (random(2) == 0) {
+      img.raw.push_back(random(256));
+    } else {
+      const char* w = words[random(8)];
+      img.raw.insert(img.raw.end(), w, w + strlen(w));
+    }
+  }
+  img.raw.resize(size);
+
+  uLongf n = compressBound(size);
+  img.comp.resize(n);
+  compress2(img.comp.data(), &n, img.raw.data(), size, 9);
+  img.comp.resize(n);
+
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts(&ctx, 0);
+  mbedtls_sha256_update(&ctx, img.raw.data(), img.raw.size());
+  mbedtls_sha256_finish(&ctx, img.sha);
+  mbedtls_sha256_free(&ctx);
+  return img;
+}
+
+static const esp_partition_t* makeSlots() {
+  const esp_partition_t* p = hostPartitionCreate("ota_0", ESP_PARTITION_SUBTYPE_APP_OTA_0, OTA_SLOT_SIZE);
+  hostPartitionCreate("ota_1", ESP_PARTITION_SUBTYPE_APP_OTA_1, OTA_SLOT_SIZE);
+  return p;
+}
+
+static bool slotHolds(const esp_partition_t* p, const Bytes& raw) {
+  return memcmp(hostPartitionData(p), raw.data(), raw.size()) == 0;
+}
+
+// Abbinamento come lo fa il telefono: legge il codice dal display del Mochi.
+static bool pair(BleApp& app) {
+  uint32_t shown = hostBlePairStart();
+  return shown && app.ble.pairingPasskey() == shown && hostBlePairFinish(app.ble.pairingPasskey());
+}
+
+struct OtaReply {
+  uint8_t  op = 0;
+  uint8_t  status = 0;
+  uint32_t offset = 0;
+};
+
+// Prima conferma arrivata sulla caratteristica OTA (le altre notify restano).
+static bool nextReply(BleApp& app, OtaReply* r) {
+  for (auto it = app.inbox.begin(); it != app.inbox.end(); ++it) {
+    if (it->chr != app.ota || it->data.size() < OTA_REPLY_SIZE) continue;
+    r->op = it->data[0] & ~PROTO_REPLY;
+    r->status = it->data[1];
+    r->offset = mochiTlvU32(it->data.data() + 2, 4);
+    app.inbox.erase(it);
+    return true;
+  }
+  return false;
+}
+
+static Bytes beginMsg(const OtaImage& img) {
+  Bytes m = { OTA_OP_BEGIN };
+  Bytes raw = BleApp::le(img.raw.size(), 4), comp = BleApp::le(img.comp.size(), 4);
+  m.insert(m.end(), raw.begin(), raw.end());
+  m.insert(m.end(), comp.begin(), comp.end());
+  m.insert(m.end(), img.sha, img.sha + OTA_SHA_SIZE);
+  return m;
+}
+
+static Bytes dataMsg(const OtaImage& img, size_t offset, size_t n) {
+  Bytes m = { OTA_OP_DATA };
+  Bytes off = BleApp::le(offset, 4);
+  m.insert(m.end(), off.begin(), off.end());
+  m.insert(m.end(), img.comp.begin() + offset, img.comp.begin() + offset + n);
+  return m;
+}
+
+static OtaReply request(BleApp& app, const Bytes& msg) {
+  OtaReply r;
+  r.op = 0xFF;
+  CHECK(app.write(app.ota, msg));
+  app.run();
+  CHECK(nextReply(app, &r));
+  return r;
+}
+
+// Link dell'app: pezzi persi in write senza risposta, conferme perse e cadute
+// della connessione ogni tanti pezzi.
+struct OtaLink {
+  uint16_t mtu = BLE_MTU;
+  int      writeLossPct = 0;
+  int      replyLossPct = 0;
+  unsigned dropEvery = 0;   // Disconnessione ogni tanti DATA (0 = mai)
+};
+
+struct OtaRun {
+  bool     ok = false;
+  unsigned writes = 0;
+  unsigned naks = 0;
+  unsigned timeouts = 0;
+  unsigned resumes = 0;
+  unsigned long ms = 0;
+};
+
+// otaUpdate() di connect.js, con i timeout fatti avanzando l'orologio.
+static OtaRun sendImage(BleApp& app, const OtaImage& img, const OtaLink& link) {
+  OtaRun run;
+  unsigned long t0 = millis();
+  size_t chunk = (link.mtu - 3 < 512 ? link.mtu - 3 : 512) - OTA_DATA_HEADER;
+  size_t total = img.comp.size();
+  size_t acked = 0, sent = 0;
+  bool begun = false;
+
+  while (run.resumes < 50) {
+    if (!begun) {
+      OtaReply r = request(app, beginMsg(img));
+      if (r.op != OTA_OP_BEGIN || r.status != OTA_OK) return run;
+      acked = sent = r.offset;
+      begun = true;
+    }
+    if (acked >= total) break;
+
+    while (sent < total && sent - acked < APP_OTA_WINDOW * chunk) {
+      size_t n = chunk < total - sent ? chunk : total - sent;
+      if (random(100) >= link.writeLossPct) CHECK(app.write(app.ota, dataMsg(img, sent, n)));
+      sent += n;
+      run.writes++;
+      if (link.dropEvery && run.writes % link.dropEvery == 0) break;
+    }
+    if (link.dropEvery && run.writes % link.dropEvery == 0) {
+      // I pezzi gia' in coda il Mochi li consuma anche dopo la caduta
+      hostBleDisconnect();
+      app.run();
+      app.inbox.clear();
+      hostBleConnect(link.mtu);
+      begun = false;
+      run.resumes++;
+      continue;
+    }
+
+    OtaReply r;
+    bool got = false;
+    for (unsigned long waited = 0; !got && waited < APP_OTA_TIMEOUT_MS; waited += OTA_NAK_REPEAT_MS) {
+      app.run();
+      while (!got && nextReply(app, &r)) got = random(100) >= link.replyLossPct;
+      if (!got) hostAdvanceMillis(OTA_NAK_REPEAT_MS);
+    }
+    if (!got) {
+      run.timeouts++;
+      sent = acked; // Conferma persa: si rimanda dall'ultima
+      continue;
+    }
+    if (r.op != OTA_OP_DATA) continue;
+    if (r.status == OTA_BAD_OFFSET) {
+      run.naks++;
+      acked = sent = r.offset;
+      continue;
+    }
+    if (r.status != OTA_OK) return run;
+    if (r.offset > acked) acked = r.offset;
+    if (sent < acked) sent = acked;
+  }
+
+  OtaReply r = request(app, { OTA_OP_END });
+  run.ok = r.op == OTA_OP_END && r.status == OTA_OK;
+  run.ms = millis() - t0;
+  return run;
+}
+
+// Senza abbinamento la caratteristica rifiuta le write; il codice sul display
+// e' quello che il telefono deve digitare, e uno sbagliato non apre nulla.
+TEST(ota_requires_pairing) {
+  BleApp app(BLE_MTU);
+  makeSlots();
+  OtaImage img = makeImage(4096);
+
+  CHECK(!app.write(app.ota, beginMsg(img)));
+  app.run();
+  OtaReply r;
+  CHECK(!nextReply(app, &r));
+  CHECK_EQ(app.ble.pairingPasskey(), 0);
+  CHECK(app.hello()); // I comandi invece restano aperti
+
+  uint32_t shown = hostBlePairStart();
+  CHECK(shown >= 100000 && shown <= 999999);
+  CHECK_EQ(app.ble.pairingPasskey(), shown);
+  CHECK(!hostBlePairFinish(shown + 1));
+  CHECK_EQ(app.ble.pairingPasskey(), 0);
+  CHECK(!app.write(app.ota, beginMsg(img)));
+
+  CHECK(pair(app));
+  CHECK_EQ(app.ble.pairingPasskey(), 0);
+  r = request(app, beginMsg(img));
+  CHECK_EQ(r.op, OTA_OP_BEGIN);
+  CHECK_EQ(r.status, OTA_OK);
+}
+
+// Immagine intera in ordine: partizione identica, boot cambiato, riavvio dopo
+// OTA_RESTART_DELAY_MS.
+TEST(ota_full_image) {
+  BleApp app(BLE_MTU);
+  const esp_partition_t* slot = makeSlots();
+  CHECK(pair(app));
+  OtaImage img = makeImage(100 * 1024);
+  unsigned restarts = ESP.restarts;
+
+  OtaRun run = sendImage(app, img, OtaLink());
+  CHECK(run.ok);
+  CHECK_EQ(run.naks, 0);
+  CHECK_EQ(run.timeouts, 0);
+  CHECK(slotHolds(slot, img.raw));
+  CHECK(esp_ota_get_boot_partition() == slot);
+  CHECK_EQ(hostOtaOpenHandles(), 0);
+
+  app.run();
+  CHECK_EQ(ESP.restarts, restarts);
+  hostAdvanceMillis(OTA_RESTART_DELAY_MS);
+  app.run();
+  CHECK(ESP.restarts > restarts); // Sul PC restart() torna: il loop riprova
+}
+
+// La connessione cade ogni pochi pezzi, con altri ancora in coda: dopo ogni
+// riconnessione (gia' abbinata, niente codice) BEGIN riprende dall'offset.
+TEST(ota_resume_after_disconnects) {
+  for (uint16_t mtu : { 23, 185, 512 }) {
+    BleApp app(mtu);
+    const esp_partition_t* slot = makeSlots();
+    CHECK(pair(app));
+    OtaImage img = makeImage(64 * 1024);
+
+    OtaLink link;
+    link.mtu = mtu;
+    link.dropEvery = img.comp.size() / (mtu - 3 - OTA_DATA_HEADER) / 5; // Circa 5 cadute
+    OtaRun run = sendImage(app, img, link);
+    CHECK(run.ok);
+    CHECK(run.resumes >= 3);
+    CHECK_EQ(app.ble.pairingPasskey(), 0);
+    CHECK(slotHolds(slot, img.raw));
+    CHECK(esp_ota_get_boot_partition() == slot);
+    BENCH_REPORT("ota mtu %u: %u byte compressi, %u pezzi, %u riprese", mtu, (unsigned)img.comp.size(),
+                 run.writes, run.resumes);
+  }
+}
+
+// Un BAD_OFFSET perso non lascia la app ferma fino al suo timeout: il Mochi lo
+// ripete ogni OTA_NAK_REPEAT_MS finche' il buco resta aperto, al massimo
+// OTA_NAK_REPEATS volte.
+TEST(ota_bad_offset_repeated) {
+  BleApp app(185);
+  makeSlots();
+  CHECK(pair(app));
+  OtaImage img = makeImage(32 * 1024);
+  size_t chunk = 185 - 3 - OTA_DATA_HEADER;
+  CHECK_EQ(request(app, beginMsg(img)).status, OTA_OK);
+
+  app.write(app.ota, dataMsg(img, 0, chunk));
+  app.write(app.ota, dataMsg(img, 2 * chunk, chunk)); // Il secondo pezzo si perde
+  app.write(app.ota, dataMsg(img, 3 * chunk, chunk));
+  app.run();
+  OtaReply r;
+  CHECK(nextReply(app, &r));
+  CHECK_EQ(r.status, OTA_BAD_OFFSET);
+  CHECK_EQ(r.offset, chunk);
+  CHECK(!nextReply(app, &r)); // Un solo NAK per i pezzi in volo
+
+  unsigned repeats = 0;
+  for (int i = 0; i < OTA_NAK_REPEATS + 3; i++) {
+    app.run();
+    CHECK(!nextReply(app, &r)); // Non prima del tempo
+    hostAdvanceMillis(OTA_NAK_REPEAT_MS);
+    app.run();
+    if (nextReply(app, &r)) {
+      CHECK_EQ(r.status, OTA_BAD_OFFSET);
+      CHECK_EQ(r.offset, chunk);
+      repeats++;
+    }
+  }
+  CHECK_EQ(repeats, OTA_NAK_REPEATS - 1);
+
+  // Il pezzo giusto chiude il buco: niente piu' NAK
+  app.write(app.ota, dataMsg(img, chunk, chunk));
+  app.run();
+  hostAdvanceMillis(OTA_NAK_REPEAT_MS);
+  app.run();
+  CHECK(!nextReply(app, &r));
+
+  // ...e il resto va avanti da li'
+  for (size_t off = 2 * chunk; off < img.comp.size(); off += chunk) {
+    app.write(app.ota, dataMsg(img, off, std::min(chunk, img.comp.size() - off)));
+    app.run();
+  }
+  while (nextReply(app, &r)) CHECK_EQ(r.status, OTA_OK);
+  CHECK_EQ(request(app, { OTA_OP_END }).status, OTA_OK);
+}
+
+// Pezzi e conferme persi a caso, piu' qualche caduta: l'immagine arriva
+// comunque intera. I timeout rimasti sono conferme OK perse (nessun buco da
+// segnalare), che la app recupera ripartendo dall'ultima.
+TEST(ota_lossy_link) {
+  BleApp app(185);
+  const esp_partition_t* slot = makeSlots();
+  CHECK(pair(app));
+  OtaImage img = makeImage(64 * 1024);
+
+  OtaLink link;
+  link.mtu = 185;
+  link.writeLossPct = 5;
+  link.replyLossPct = 20;
+  link.dropEvery = 150;
+  OtaRun run = sendImage(app, img, link);
+  CHECK(run.ok);
+  CHECK(run.naks > 0);
+  CHECK(slotHolds(slot, img.raw));
+  BENCH_REPORT("ota con perdite: %u pezzi per %u, %u NAK, %u timeout, %u riprese, %lu ms simulati",
+               run.writes, (unsigned)((img.comp.size() + 176) / 177), run.naks, run.timeouts, run.resumes, run.ms);
+}
+
+// Hash diverso: END rifiuta, la partizione di boot resta quella di prima e la
+// sessione e' chiusa.
+TEST(ota_hash_mismatch) {
+  BleApp app(BLE_MTU);
+  makeSlots();
+  CHECK(pair(app));
+  OtaImage img = makeImage(20 * 1024);
+  img.sha[0] ^= 1;
+
+  OtaRun run = sendImage(app, img, OtaLink());
+  CHECK(!run.ok);
+  CHECK(esp_ota_get_boot_partition() == nullptr);
+  CHECK_EQ(hostOtaOpenHandles(), 0);
+  OtaReply r = request(app, { OTA_OP_END });
+  CHECK_EQ(r.status, OTA_NO_SESSION);
+}
+
+// Hash giusto ma non e' un'app: esp_ota_end la scarta.
+TEST(ota_not_an_app) {
+  BleApp app(BLE_MTU);
+  makeSlots();
+  CHECK(pair(app));
+  OtaImage img = makeImage(8 * 1024, false);
+  CHECK(!sendImage(app, img, OtaLink()).ok);
+  CHECK(esp_ota_get_boot_partition() == nullptr);
+  CHECK_EQ(hostOtaOpenHandles(), 0);
+}
@@ -0,0 +1,252 @@
+#include "mochi_test.h"
+#include "MochiProto.h"
+#include "MochiState.h"
+#include <chrono>
+
+struct Tlv {
+  uint8_t        tag;
+  const uint8_t* val;
+  uint8_t        len;
+};
+
+static int readAll(const char* data, size_t n, uint8_t* type, uint8_t* reqId, Tlv* out, int max) {
+  MochiTlvReader r;
+  if (!mochiProtoParse((const uint8_t*)data, n, type, reqId, &r)) return -1;
+  int count = 0;
+  Tlv t;
+  while (count < max && r.next(&t.tag, &t.val, &t.len)) out[count++] = t;
+  return count;
+}
+
+TEST(frame_round_trip) {
+  char buf[128];
+  MochiWriter w(buf, sizeof(buf));
+  MochiFrame f(w, PT_GET_STATE | PROTO_REPLY, 42);
+  f.u8(TAG_HUNGER, 80);
+  f.u16(TAG_INTERVAL, 1000);
+  f.u32(TAG_CAPS, 0xA1B2C3D4);
+  f.id(TAG_SELF_ID, 0xABCDEF);
+  f.str(TAG_FIRMWARE, "v5");
+  f.end();
+  CHECK(!w.overflowed());
+  CHECK_EQ(w.length(), PROTO_HEADER_SIZE + 3 + 4 + 6 + 5 + 4);
+
+  uint8_t type, reqId;
+  Tlv t[8] = {};
+  CHECK_EQ(readAll(w.data(), w.length(), &type, &reqId, t, 8), 5);
+  CHECK_EQ(type, PT_GET_STATE | PROTO_REPLY);
+  CHECK_EQ(reqId, 42);
+  CHECK_EQ(t[0].tag, TAG_HUNGER);
+  CHECK_EQ(t[0].val[0], 80);
+  CHECK_EQ(mochiTlvU32(t[1].val, t[1].len), 1000);
+  CHECK_EQ(mochiTlvU32(t[2].val, t[2].len), 0xA1B2C3D4);
+  CHECK_EQ(mochiTlvU32(t[3].val, t[3].len), 0xABCDEF);
+  CHECK_EQ(t[4].len, 2);
+  CHECK(memcmp(t[4].val, "v5", 2) == 0);
+}
+
+TEST(empty_frame) {
+  char buf[16];
+  MochiWriter w(buf, sizeof(buf));
+  MochiFrame f(w, PT_GET_FRIENDS | PROTO_REPLY, 7);
+  f.end();
+  uint8_t type, reqId;
+  Tlv t[1] = {};
+  CHECK_EQ(readAll(w.data(), w.length(), &type, &reqId, t, 1), 0);
+  CHECK_EQ(reqId, 7);
+}
+
+// Un TLV che non ci sta non viene scritto: il frame resta valido, con i soli
+// TLV interi, e il writer segna l'overflow senza avanzare su byte vecchi.
+TEST(overflow_skips_whole_tlv) {
+  char buf[PROTO_HEADER_SIZE + 8 + 1];
+  memset(buf, 0xEE, sizeof(buf));
+  MochiWriter w(buf, sizeof(buf));
+  MochiFrame f(w, PT_GET_NEARBY | PROTO_REPLY, 1);
+  f.u32(TAG_ANNOUNCES, 1);           // 6 byte: ci sta
+  size_t before = w.length();
+  f.u32(TAG_RECEIVED, 2);            // 6 byte: ne restano 2
+  CHECK(w.overflowed());
+  CHECK_EQ(w.length(), before);
+  f.u8(TAG_AWAY, 1);                 // 3 byte: ancora troppo
+  CHECK_EQ(w.length(), before);
+  f.end();
+
+  uint8_t type, reqId;
+  Tlv t[4] = {};
+  CHECK_EQ(readAll(w.data(), w.length(), &type, &reqId, t, 4), 1);
+  CHECK_EQ(t[0].tag, TAG_ANNOUNCES);
+}
+
+TEST(long_string_is_clamped) {
+  char s[400];
+  memset(s, 'a', sizeof(s) - 1);
+  s[sizeof(s) - 1] = '\0';
+  char buf[512];
+  MochiWriter w(buf, sizeof(buf));
+  MochiFrame f(w, PT_HELLO | PROTO_REPLY, 1);
+  f.str(TAG_FIRMWARE, s);
+  f.end();
+  uint8_t type, reqId;
+  Tlv t[1] = {};
+  CHECK_EQ(readAll(w.data(), w.length(), &type, &reqId, t, 1), 1);
+  CHECK_EQ(t[0].len, 255);
+}
+
+TEST(parse_rejects_bad_frames) {
+  uint8_t type, reqId;
+  MochiTlvReader r;
+  const uint8_t shortHdr[] = { PROTO_MAGIC, 1, 2, 0 };
+  CHECK(!mochiProtoParse(shortHdr, sizeof(shortHdr), &type, &reqId, &r));
+  const uint8_t badMagic[] = { 'g', 'e', 't', 0, 0 };
+  CHECK(!mochiProtoParse(badMagic, sizeof(badMagic), &type, &reqId, &r));
+  const uint8_t truncated[] = { PROTO_MAGIC, 1, 2, 4, 0, TAG_HUNGER, 1 };
+  CHECK(!mochiProtoParse(truncated, sizeof(truncated), &type, &reqId, &r));
+}
+
+// Un TLV che dichiara piu' byte di quelli rimasti chiude la lettura.
+TEST(reader_stops_at_truncated_tlv) {
+  const uint8_t frame[] = { PROTO_MAGIC, 1, 2, 6, 0, TAG_HUNGER, 1, 50, TAG_HAPPY, 9, 1 };
+  uint8_t type, reqId;
+  Tlv t[4] = {};
+  CHECK_EQ(readAll((const char*)frame, sizeof(frame), &type, &reqId, t, 4), 1);
+}
+
+// Con CAP_BATCH piu' frame stanno uno dietro l'altro nello stesso buffer.
+TEST(batched_frames) {
+  char buf[64];
+  MochiWriter w(buf, sizeof(buf));
+  for (uint8_t i = 1; i <= 3; i++) {
+    MochiFrame f(w, PT_GET_DEBUG | PROTO_REPLY, i);
+    f.u8(TAG_CHANNEL, i);
+    f.end();
+  }
+  const uint8_t* p = (const uint8_t*)w.data();
+  size_t left = w.length();
+  for (uint8_t i = 1; i <= 3; i++) {
+    uint8_t type, reqId;
+    MochiTlvReader r;
+    CHECK(mochiProtoParse(p, left, &type, &reqId, &r));
+    CHECK_EQ(reqId, i);
+    size_t n = PROTO_HEADER_SIZE + r.n;
+    p += n;
+    left -= n;
+  }
+  CHECK_EQ(left, 0);
+}
+
+TEST(put_le) {
+  uint8_t b[4] = { 0 };
+  mochiTlvPutLe(b, 0x11223344, 3);
+  CHECK_EQ(b[0], 0x44);
+  CHECK_EQ(b[2], 0x22);
+  CHECK_EQ(b[3], 0);
+  CHECK_EQ(mochiTlvU32(b, 3), 0x223344);
+}
+
+// TAG_INTERVAL e' u16: un valore piu' grande si satura invece di troncarsi
+// (70000 ms diventerebbe 4464).
+TEST(u16_saturates) {
+  uint8_t b[4];
+  mochiTlvPutLe(b, 70000, 4);
+  CHECK_EQ(mochiTlvU16(b, 4), 0xFFFF);
+  mochiTlvPutLe(b, 1000, 4);
+  CHECK_EQ(mochiTlvU16(b, 4), 1000);
+  CHECK_EQ(mochiTlvU16(b, 2), 1000);
+  CHECK_EQ(mochiTlvU16(b, 0), 0);
+}
+
+// ================================================================
+// BENCHMARK
+// ----------------------------------------------------------------
+// Le stesse risposte (get_state e get_friends con 40 amici) nei due formati:
+// JSON come le manda il comando di testo, TLV come le manda il frame (che
+// nello stato porta anche l'eta'). Byte sul
+// filo, costo della codifica sul Mochi e della lettura dall'altra parte
+// (ArduinoJson per il JSON, MochiTlvReader per i frame).
+// ================================================================
+
+struct ProtoBench {
+  size_t bytes[2];
+  double encodeNs[2], parseNs[2];
+};
+
+template <class F> static double nsPer(int n, F fn) {
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+}
+
+// Legge il frame come farebbe la app: ogni TLV, valori interi decodificati.
+static int parseTlv(const char* data, size_t n, uint32_t* sum) {
+  uint8_t type, reqId, tag, len;
+  const uint8_t* val;
+  MochiTlvReader r;
+  if (!mochiProtoParse((const uint8_t*)data, n, &type, &reqId, &r)) return -1;
+  int count = 0;
+  while (r.next(&tag, &val, &len)) {
+    *sum += mochiTlvU32(val, len);
+    count++;
+  }
+  return count;
+}
+
+template <class J, class T>
+static ProtoBench benchReply(uint8_t type, J writeJson, T writeTlv, int jsonCount, int tlvCount) {
+  const int N = 20000;
+  static char json[2048], bin[2048];
+  ProtoBench b;
+  MochiWriter jw(json, sizeof(json)), bw(bin, sizeof(bin));
+
+  b.encodeNs[0] = nsPer(N, [&] { jw.reset(); writeJson(jw); });
+  b.encodeNs[1] = nsPer(N, [&] {
+    bw.reset();
+    MochiFrame f(bw, type | PROTO_REPLY, 1);
+    writeTlv(f);
+    f.end();
+  });
+  CHECK(!jw.overflowed());
+  CHECK(!bw.overflowed());
+  b.bytes[0] = jw.length();
+  b.bytes[1] = bw.length();
+
+  int jsonFields = 0, tlvFields = 0;
+  uint32_t sum = 0;
+  StaticJsonDocument<4096> doc;
+  b.parseNs[0] = nsPer(N, [&] {
+    deserializeJson(doc, json, jw.length());
+    jsonFields = doc.is<JsonArray>() ? doc.as<JsonArrayConst>().size() : doc.as<JsonObjectConst>().size();
+  });
+  b.parseNs[1] = nsPer(N, [&] { tlvFields = parseTlv(bin, bw.length(), &sum); });
+  CHECK_EQ(jsonFields, jsonCount);
+  CHECK_EQ(tlvFields, tlvCount);
+  CHECK(b.bytes[1] < b.bytes[0]);
+  return b;
+}
+
+static void report(const char* what, const ProtoBench& b) {
+  BENCH_REPORT("%s: JSON %u B, %.0f ns codifica, %.0f ns lettura | TLV %u B, %.0f ns codifica, %.0f ns lettura",
+               what, (unsigned)b.bytes[0], b.encodeNs[0], b.parseNs[0],
+               (unsigned)b.bytes[1], b.encodeNs[1], b.parseNs[1]);
+}
+
+TEST(bench_state_and_friends_replies) {
+  MochiState s;
+  s.begin();
+  s.hunger = 73;
+  s.happy = 58;
+  s.statStr = 12;
+  s.statSpd = 40;
+  s.statInt = 7;
+  s.statChr = 99;
+  for (int i = 0; i < 40; i++) CHECK(s.addFriend(0x100000 + i * 0x3A7));
+
+  ProtoBench st = benchReply(PT_GET_STATE,
+                             [&](MochiWriter& w) { s.writeStateJson(w); },
+                             [&](MochiFrame& f) { s.writeStateTlv(f); }, 6, STATE_FIELD_COUNT);
+  ProtoBench fr = benchReply(PT_GET_FRIENDS,
+                             [&](MochiWriter& w) { s.writeFriendsJson(w); },
+                             [&](MochiFrame& f) { s.writeFriendsTlv(f); }, 40, 40);
+  report("get_state", st);
+  report("get_friends (40)", fr);
+}
@@ -0,0 +1,73 @@
+#include "mochi_test.h"
+#include "MochiRing.h"
+#include <thread>
+
+TEST(fifo_order_and_full) {
+  MochiRing<int, 4> r;
+  CHECK(r.front() == nullptr);
+  for (int i = 0; i < 4; i++) CHECK(r.push(i));
+  CHECK(!r.push(99));
+  CHECK_EQ(r.dropped(), 1);
+  CHECK_EQ(r.size(), 4);
+  for (int i = 0; i < 4; i++) {
+    CHECK(r.front() != nullptr);
+    CHECK_EQ(*r.front(), i);
+    r.pop();
+  }
+  CHECK(r.front() == nullptr);
+  CHECK_EQ(r.highWater(), 4);
+}
+
+// head/tail sono uint8_t: devono girare oltre 255 senza perdere il conto.
+TEST(counters_wrap) {
+  MochiRing<int, 8> r;
+  int next = 0, expect = 0;
+  for (int round = 0; round < 1000; round++) {
+    for (int k = 0; k < 5; k++) CHECK(r.push(next++));
+    for (int k = 0; k < 5; k++) {
+      CHECK_EQ(*r.front(), expect++);
+      r.pop();
+    }
+    CHECK_EQ(r.size(), 0);
+  }
+  CHECK_EQ(r.highWater(), 5);
+  CHECK_EQ(r.dropped(), 0);
+}
+
+TEST(fill_in_place) {
+  struct Big { char data[64]; size_t len; };
+  MochiRing<Big, 2> r;
+  Big* s = r.beginPush();
+  CHECK(s != nullptr);
+  s->len = 3;
+  memcpy(s->data, "abc", 3);
+  CHECK(r.front() == nullptr); // non ancora pubblicato
+  r.endPush();
+  CHECK(r.front() != nullptr);
+  CHECK_EQ(r.front()->len, 3);
+}
+
+// Un produttore e un consumatore su thread diversi: niente persi ne' doppi.
+TEST(spsc_threads) {
+  static MochiRing<uint32_t, 16> r;
+  const uint32_t N = 200000;
+  std::thread producer([] {
+    for (uint32_t i = 0; i < N;) {
+      if (r.push(i)) i++;
+      else std::this_thread::yield(); // con un solo core lo spin non lascia girare l'altro
+    }
+  });
+  uint32_t expect = 0;
+  while (expect < N) {
+    uint32_t* v = r.front();
+    if (!v) {
+      std::this_thread::yield();
+      continue;
+    }
+    CHECK_EQ(*v, expect);
+    expect++;
+    r.pop();
+  }
+  producer.join();
+  CHECK(r.front() == nullptr);
+}
@@ -0,0 +1,139 @@
+#include "mochi_test.h"
+#include "MochiState.h"
+
+// Il calendario di una volta (getExpectedStage con gmtime), come riferimento.
+static uint8_t legacyStage(time_t t) {
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  int day = tm.tm_wday, hour = tm.tm_hour;
+  if (day == 6 || day == 0) return EGG;
+  if (day == 5 && hour >= 18) return EGG;
+  if (day == 1 && hour < 10) return EGG;
+  if (day == 1 || (day == 2 && hour < 18)) return BABY;
+  if (day == 2 || day == 3 || (day == 4 && hour < 18)) return ADULT;
+  if (day == 4 || (day == 5 && hour < 18)) return ELDER;
+  return EGG;
+}
+
+// Dieci anni a passi di 7 minuti e 13 secondi (non allineati a nessun confine):
+// il calendario di default coincide con quello vecchio.
+TEST(default_matches_legacy_over_years) {
+  MochiSchedule s;
+  const time_t from = DEFAULT_UNIX_TIME - 2L * 365 * 86400;
+  const time_t to   = DEFAULT_UNIX_TIME + 8L * 365 * 86400;
+  long mismatches = 0;
+  for (time_t t = from; t < to; t += 7 * 60 + 13) {
+    if (s.stageAt(t) != legacyStage(t)) mismatches++;
+  }
+  CHECK_EQ(mismatches, 0);
+}
+
+// Ogni transizione annunciata e' un vero cambio di stadio, e tra un confine e
+// il successivo lo stadio resta fermo.
+TEST(next_transition_is_exact) {
+  MochiSchedule s;
+  time_t t = DEFAULT_UNIX_TIME;
+  for (int i = 0; i < 3 * 52 * 4; i++) {     // Tre anni di transizioni
+    time_t next = s.nextTransition(t);
+    CHECK(next > t);
+    CHECK(next - t <= SECONDS_PER_WEEK);
+    CHECK_EQ(s.stageAt(next - 1), s.stageAt(t));
+    CHECK(s.stageAt(next) != s.stageAt(next - 1));
+    CHECK_EQ(legacyStage(next), s.stageAt(next));
+    t = next;
+  }
+}
+
+// 1700000000 = Martedi' 14/11/2023 22:13:20 UTC: adulto, prossimo confine
+// Giovedi' 16/11 alle 18:00 (anziano).
+TEST(default_unix_time) {
+  MochiSchedule s;
+  CHECK_EQ(s.stageAt(DEFAULT_UNIX_TIME), ADULT);
+  CHECK_EQ(s.nextTransition(DEFAULT_UNIX_TIME), 1700157600L);
+  CHECK_EQ(s.stageAt(1700157600L), ELDER);
+}
+
+// Confini di settimana: Domenica 00:00 e' dentro la voce che ha fatto il giro
+// (uovo dal Venerdi' sera), un secondo prima e' ancora Sabato.
+TEST(week_boundaries) {
+  MochiSchedule s;
+  const time_t sunday = 1699747200L; // Dom 12/11/2023 00:00 UTC
+  CHECK_EQ(s.stageAt(sunday), EGG);
+  CHECK_EQ(s.stageAt(sunday - 1), EGG);
+  CHECK_EQ(s.nextTransition(sunday - 1), sunday + 1 * 86400 + 10 * 3600);
+  CHECK_EQ(s.nextTransition(sunday), sunday + 1 * 86400 + 10 * 3600);
+  // Esattamente sul confine: la voce nuova vale gia', il prossimo e' quello dopo
+  time_t hatch = sunday + 1 * 86400 + 10 * 3600;
+  CHECK_EQ(s.stageAt(hatch), BABY);
+  CHECK_EQ(s.stageAt(hatch - 1), EGG);
+  CHECK_EQ(s.nextTransition(hatch), sunday + 2 * 86400 + 18 * 3600);
+  // L'ultima voce della settimana rimanda alla prima della settimana dopo
+  time_t death = sunday + 5 * 86400 + 18 * 3600;
+  CHECK_EQ(s.nextTransition(death), sunday + 7 * 86400 + 1 * 86400 + 10 * 3600);
+}
+
+// Calendario che attraversa la mezzanotte di Sabato: prima voce dopo l'inizio
+// della settimana, ultima a Sabato sera.
+TEST(custom_schedule_wraps) {
+  MochiSchedule s;
+  s.entries[0] = { 60, BABY };                   // Dom 01:00
+  s.entries[1] = { MINUTES_PER_WEEK - 60, EGG }; // Sab 23:00
+  s.count = 2;
+  CHECK(s.isValid());
+  const time_t sunday = 1699747200L;
+  CHECK_EQ(s.stageAt(sunday), EGG);
+  CHECK_EQ(s.stageAt(sunday + 3600), BABY);
+  CHECK_EQ(s.nextTransition(sunday - 1), sunday + 3600);
+  CHECK_EQ(s.nextTransition(sunday - 3600), sunday + 3600);
+  CHECK_EQ(s.nextTransition(sunday - 3601), sunday - 3600);
+}
+
+TEST(validation) {
+  MochiSchedule s;
+  s.count = 0;
+  CHECK(!s.isValid());
+  s.setDefault();
+  s.entries[1].startMin = s.entries[0].startMin;      // Non crescente
+  CHECK(!s.isValid());
+  s.setDefault();
+  s.entries[1].stage = BABY;                          // Due voci uguali di fila
+  CHECK(!s.isValid());
+  s.setDefault();
+  s.entries[3].stage = BABY;                          // Uguale alla prima (giro)
+  CHECK(!s.isValid());
+  s.setDefault();
+  s.entries[2].stage = 7;
+  CHECK(!s.isValid());
+}
+
+TEST(from_json) {
+  MochiSchedule s;
+  StaticJsonDocument<256> doc;
+  CHECK(!deserializeJson(doc, "[[60,1],[600,2]]"));
+  CHECK(s.fromJson(doc.as<JsonVariantConst>()));
+  CHECK_EQ(s.count, 2);
+  CHECK_EQ(s.entries[1].startMin, 600);
+  CHECK_EQ(s.entries[1].stage, ADULT);
+
+  MochiSchedule before = s;
+  const char* bad[] = { "[]", "{}", "[[60,1],[30,2]]", "[[60,1],[600,1]]", "[[60,9]]", "[[10080,1]]", "[[\"1\",1]]" };
+  for (const char* j : bad) {
+    CHECK(!deserializeJson(doc, j));
+    CHECK(!s.fromJson(doc.as<JsonVariantConst>()));
+    CHECK(s == before); // Tabella non valida: resta quella di prima
+  }
+}
+
+TEST(write_round_trip) {
+  MochiSchedule s;
+  char buf[128];
+  MochiWriter w(buf, sizeof(buf));
+  s.write(w);
+  CHECK(strcmp(w.data(), "[[2040,1],[3960,2],[6840,3],[8280,0]]") == 0);
+  StaticJsonDocument<256> doc;
+  CHECK(!deserializeJson(doc, w.data()));
+  MochiSchedule t;
+  t.count = 0;
+  CHECK(t.fromJson(doc.as<JsonVariantConst>()));
+  CHECK(t == s);
+}
@@ -0,0 +1,170 @@
+#include "mochi_test.h"
+#include "MochiSettings.h"
+#include "MochiState.h"
+#include <chrono>
+#include <string>
+
+static uint8_t patch(MochiSettings& s, const char* json) {
+  StaticJsonDocument<1024> doc;
+  deserializeJson(doc, json, strlen(json));
+  return s.patch(doc.as<JsonObjectConst>());
+}
+
+TEST(known_fields) {
+  MochiSettings s;
+  s.brightness = 100;
+  CHECK_EQ(patch(s, "{\"brightness\":300,\"bgTop\":\"#ff0000\"}"),
+           SETTINGS_CHANGED_BRIGHTNESS | SETTINGS_CHANGED_COLORS);
+  CHECK_EQ(s.brightness, 255);
+  CHECK_EQ(s.bgTop, 0xF800);
+  CHECK_EQ(patch(s, "{\"brightness\":255,\"bgTop\":\"#ff0000\"}"), 0);
+  CHECK_EQ(patch(s, "{\"timezone\":\"Europe/Rome\"}"), SETTINGS_CHANGED_TIMEZONE);
+  CHECK(strcmp(s.timezone, "Europe/Rome") == 0);
+  CHECK_EQ(patch(s, "{\"schedule\":{}}"), 0);
+}
+
+TEST(spill_merge) {
+  MochiSettings s;
+  CHECK_EQ(patch(s, "{\"theme\":\"dark\"}"), SETTINGS_CHANGED_SPILL);
+  CHECK(strcmp(s.spill, "{\"theme\":\"dark\"}") == 0);
+  CHECK_EQ(patch(s, "{\"lang\":\"it\"}"), SETTINGS_CHANGED_SPILL);
+  CHECK(strcmp(s.spill, "{\"theme\":\"dark\",\"lang\":\"it\"}") == 0);
+  CHECK_EQ(patch(s, "{\"theme\":\"light\"}"), SETTINGS_CHANGED_SPILL);
+  CHECK(strcmp(s.spill, "{\"theme\":\"light\",\"lang\":\"it\"}") == 0);
+}
+
+// Il parser non deve lavorare in zero-copy sullo spill: una patch uguale non
+// e' un cambiamento, e una patch scartata lascia lo spill intatto.
+TEST(spill_survives_parsing) {
+  MochiSettings s;
+  patch(s, "{\"theme\":\"dark\",\"lang\":\"it\"}");
+  std::string before = s.spill;
+
+  CHECK_EQ(patch(s, "{\"theme\":\"dark\"}"), 0);
+  CHECK(before == s.spill);
+
+  std::string big = "{\"huge\":\"" + std::string(SETTINGS_SPILL_SIZE, 'x') + "\"}";
+  CHECK_EQ(patch(s, big.c_str()), 0);
+  CHECK(before == s.spill);
+}
+
+TEST(write_fields) {
+  MochiSettings s;
+  patch(s, "{\"theme\":\"dark\",\"timezone\":\"UTC\"}");
+  char buf[512];
+  MochiWriter w(buf, sizeof(buf));
+  w.beginObject();
+  s.writeFields(w);
+  w.endObject();
+  StaticJsonDocument<1024> doc;
+  CHECK(!deserializeJson(doc, w.data(), w.length()));
+  CHECK(strcmp(doc["theme"] | "", "dark") == 0);
+  CHECK(strcmp(doc["timezone"] | "", "UTC") == 0);
+  CHECK_EQ(doc["brightness"].as<int>(), 255);
+}
+
+TEST(save_load_round_trip) {
+  Preferences prefs;
+  prefs.begin("mochi");
+  MochiSettings s;
+  patch(s, "{\"brightness\":10,\"theme\":\"dark\"}");
+  s.save(prefs);
+  MochiSettings t;
+  CHECK(t.load(prefs));
+  CHECK_EQ(t.brightness, 10);
+  CHECK(strcmp(t.spill, s.spill) == 0);
+}
+
+// ================================================================
+// BENCHMARK
+// ----------------------------------------------------------------
+// Il percorso di prima: set_json portava l'intero blob delle impostazioni,
+// che veniva copiato in una String, salvato cosi' com'era e ri-parsato da
+// capo per applicare luminosita' e colori. Contro la patch tipizzata di
+// saveSettings, con la stessa modifica (la luminosita') mandata sia come
+// blob completo sia come patch di un solo campo.
+// ================================================================
+
+struct OldSettings {
+  Preferences prefs;
+  String   blob = "{}";
+  int      brightness = 255;
+  uint16_t bgTop = 0, bgBottom = 0;
+  bool     colorsUpdated = false;
+  size_t   written = 0;
+
+  void save(const String& json) {
+    blob = json;
+    prefs.begin("mochi-data", false);
+    written += prefs.putString("settings", blob);
+    prefs.end();
+    apply();
+  }
+  void apply() {
+    StaticJsonDocument<512> doc;
+    if (deserializeJson(doc, blob)) return;
+    if (doc.containsKey("brightness")) brightness = doc["brightness"].as<int>();
+    if (doc.containsKey("bgTop") && doc.containsKey("bgBottom")) {
+      uint16_t top = hexToRGB565(doc["bgTop"].as<const char*>());
+      uint16_t bottom = hexToRGB565(doc["bgBottom"].as<const char*>());
+      if (bgTop != top || bgBottom != bottom) {
+        bgTop = top;
+        bgBottom = bottom;
+        colorsUpdated = true;
+      }
+    }
+  }
+};
+
+static const char* fullSettings(char* buf, size_t size, int brightness) {
+  snprintf(buf, size,
+           "{\"brightness\":%d,\"bgTop\":\"#102030\",\"bgBottom\":\"#405060\","
+           "\"timezone\":\"Europe/Rome\",\"theme\":\"dark\",\"lang\":\"it\"}", brightness);
+  return buf;
+}
+
+template <class F> static double nsPer(int n, F fn) {
+  auto t0 = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+}
+
+TEST(bench_patch_vs_full_json) {
+  const int N = 20000;
+  char json[256];
+
+  OldSettings old;
+  double oldNs = nsPer(N, [&] {
+    for (int i = 0; i < N; i++) old.save(fullSettings(json, sizeof(json), i % 256));
+  });
+  CHECK_EQ(old.brightness, (N - 1) % 256);
+
+  Preferences flash;
+  Preferences::hostShareNext(flash);
+  MochiState s;
+  s.begin();
+  double fullNs = nsPer(N, [&] {
+    for (int i = 0; i < N; i++) {
+      const char* j = fullSettings(json, sizeof(json), i % 256);
+      s.saveSettings(j, strlen(j));
+    }
+  });
+  CHECK_EQ(s.settings.brightness, (N - 1) % 256);
+  CHECK(strcmp(s.settings.timezone, "Europe/Rome") == 0);
+  double patchNs = nsPer(N, [&] {
+    for (int i = 0; i < N; i++) {
+      int n = snprintf(json, sizeof(json), "{\"brightness\":%d}", i % 256);
+      s.saveSettings(json, n);
+    }
+  });
+  CHECK_EQ(s.settings.brightness, (N - 1) % 256);
+  CHECK(strstr(s.settings.spill, "\"theme\":\"dark\"") != nullptr); // La patch non tocca il resto
+
+  flash.begin("mochi-data", true);
+  size_t cfgBytes = flash.getBytesLength("cfg");
+  flash.end();
+  CHECK(cfgBytes > 0);
+  CHECK(patchNs < oldNs);
+  BENCH_REPORT("set_json: blob completo %.0f ns, %u B salvati | struct: blob %.0f ns, patch %.0f ns, %u B salvati",
+               oldNs, (unsigned)(old.written / N), fullNs, patchNs, (unsigned)cfgBytes);
+}
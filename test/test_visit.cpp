@@ -0,0 +1,137 @@
+#include "mochi_test.h"
+#include "MochiState.h"
+#include "MochiWire.h"
+#include <chrono>
+#include <esp_partition.h>
+
+#define HOME  0xA00001
+#define GUEST 0xB00002
+
+struct Pair {
+  MochiState guest, host;
+  Pair() {
+    hostPartitionsClear();
+    guest.begin();
+    host.begin();
+    guest.currentAge = ELDER;
+    guest.settings.bgTop = 0x1234;
+    guest.settings.bgBottom = 0xBEEF;
+  }
+};
+
+TEST(record_round_trip) {
+  Pair p;
+  uint8_t buf[NOW_WIRE_PAYLOAD_MAX];
+  size_t n = p.guest.writeVisitRecord(buf, sizeof(buf));
+  CHECK_EQ(n, sizeof(NowVisitRecord));
+  CHECK_EQ(buf[0], VISIT_RECORD_VERSION);
+  CHECK_EQ(buf[1], sizeof(NowVisitRecord));
+  CHECK_EQ(p.guest.writeVisitRecord(buf, sizeof(NowVisitRecord) - 1), 0);
+
+  CHECK(p.host.receiveGuest(GUEST, buf, n, VISIT_DURATION_MS));
+  CHECK(p.host.isHostingGuest);
+  CHECK_EQ(p.host.guestId, GUEST);
+  CHECK_EQ(p.host.guestAge, ELDER);
+  CHECK_EQ(p.host.guestBgTop, 0x1234);
+  CHECK_EQ(p.host.guestBgBottom, 0xBEEF);
+
+  // Occupato: la seconda visita si rifiuta
+  CHECK(!p.host.receiveGuest(HOME, buf, n, VISIT_DURATION_MS));
+  CHECK_EQ(p.host.guestId, GUEST);
+}
+
+// Un mittente piu' nuovo manda campi in coda che non conosciamo: si legge il
+// prefisso. Uno piu' vecchio ne manda meno: i mancanti restano a zero.
+TEST(record_sizes_forward_and_back) {
+  Pair p;
+  uint8_t buf[NOW_WIRE_PAYLOAD_MAX];
+  size_t n = p.guest.writeVisitRecord(buf, sizeof(buf));
+  buf[1] = n + 8;
+  memset(buf + n, 0x55, 8);
+  CHECK(p.host.receiveGuest(GUEST, buf, n + 8, VISIT_DURATION_MS));
+  CHECK_EQ(p.host.guestBgBottom, 0xBEEF);
+  p.host.guestLeaves();
+
+  buf[1] = VISIT_RECORD_MIN_SIZE;
+  CHECK(p.host.receiveGuest(GUEST, buf, VISIT_RECORD_MIN_SIZE, VISIT_DURATION_MS));
+  CHECK_EQ(p.host.guestAge, ELDER);
+  CHECK_EQ(p.host.guestBgTop, 0x1234);
+}
+
+TEST(record_rejects_bad_input) {
+  Pair p;
+  uint8_t buf[NOW_WIRE_PAYLOAD_MAX];
+  size_t n = p.guest.writeVisitRecord(buf, sizeof(buf));
+  CHECK(!p.host.receiveGuest(GUEST, buf, n - 1, VISIT_DURATION_MS));           // Troncato
+  CHECK(!p.host.receiveGuest(GUEST, buf, VISIT_RECORD_MIN_SIZE - 1, VISIT_DURATION_MS));
+  buf[1] = VISIT_RECORD_MIN_SIZE - 1;
+  CHECK(!p.host.receiveGuest(GUEST, buf, n, VISIT_DURATION_MS));               // size falso
+  buf[1] = n;
+  buf[0] = VISIT_RECORD_VERSION + 1;
+  CHECK(!p.host.receiveGuest(GUEST, buf, n, VISIT_DURATION_MS));               // Versione futura
+  buf[0] = VISIT_RECORD_VERSION;
+  buf[2] = 200;                                                                // Eta' senza senso
+  CHECK(p.host.receiveGuest(GUEST, buf, n, VISIT_DURATION_MS));
+  CHECK_EQ(p.host.guestAge, ADULT);
+  CHECK(!p.host.receiveGuest(GUEST, buf, 0, VISIT_DURATION_MS));
+}
+
+// I Mochi v1 mandano ancora il JSON: si decodifica, con i default per i campi
+// che mancano.
+TEST(json_visit_compat) {
+  Pair p;
+  String json = p.guest.getVisitPayloadJson(GUEST);
+  CHECK(json.length() < 200);
+  CHECK(p.host.receiveGuest(GUEST, (const uint8_t*)json.c_str(), json.length(), VISIT_DURATION_MS));
+  CHECK_EQ(p.host.guestAge, ELDER);
+  CHECK_EQ(p.host.guestBgTop, 0x1234);
+  CHECK_EQ(p.host.guestBgBottom, 0xBEEF);
+  p.host.guestLeaves();
+
+  const char minimal[] = "{\"id\":\"MOCHI-B00002\"}";
+  CHECK(p.host.receiveGuest(GUEST, (const uint8_t*)minimal, strlen(minimal), VISIT_DURATION_MS));
+  CHECK_EQ(p.host.guestAge, ADULT);
+  CHECK_EQ(p.host.guestBgTop, K_BG_TOP);
+  p.host.guestLeaves();
+
+  const char broken[] = "{\"age\":2,";
+  CHECK(!p.host.receiveGuest(GUEST, (const uint8_t*)broken, strlen(broken), VISIT_DURATION_MS));
+}
+
+// Costo di codifica e decodifica: record binario contro JSON v1.
+TEST(bench_record_vs_json) {
+  Pair p;
+  const int N = 20000;
+  uint8_t buf[NOW_WIRE_PAYLOAD_MAX];
+  size_t n = 0;
+  String json;
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < N; i++) n += p.guest.writeVisitRecord(buf, sizeof(buf));
+  auto t1 = std::chrono::steady_clock::now();
+  for (int i = 0; i < N; i++) json = p.guest.getVisitPayloadJson(GUEST);
+  auto t2 = std::chrono::steady_clock::now();
+  CHECK_EQ(n, (size_t)N * sizeof(NowVisitRecord));
+
+  size_t rn = sizeof(NowVisitRecord);
+  int ok = 0;
+  auto t3 = std::chrono::steady_clock::now();
+  for (int i = 0; i < N; i++) {
+    ok += p.host.receiveGuest(GUEST, buf, rn, VISIT_DURATION_MS);
+    p.host.guestLeaves();
+  }
+  auto t4 = std::chrono::steady_clock::now();
+  for (int i = 0; i < N; i++) {
+    ok += p.host.receiveGuest(GUEST, (const uint8_t*)json.c_str(), json.length(), VISIT_DURATION_MS);
+    p.host.guestLeaves();
+  }
+  auto t5 = std::chrono::steady_clock::now();
+  CHECK_EQ(ok, 2 * N);
+
+  auto ns = [&](std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+    return std::chrono::duration<double, std::nano>(b - a).count() / N;
+  };
+  BENCH_REPORT("visita record %u B: codifica %.0f ns, decodifica %.0f ns", (unsigned)rn, ns(t0, t1), ns(t3, t4));
+  BENCH_REPORT("visita JSON %u B: codifica %.0f ns, decodifica %.0f ns", (unsigned)json.length(), ns(t1, t2),
+               ns(t4, t5));
+}
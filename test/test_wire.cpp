@@ -0,0 +1,167 @@
+#include "mochi_test.h"
+#include "MochiWire.h"
+#include "MochiRing.h"
+#include "MochiNow.h"
+#include "now_sim.h"
+#include <chrono>
+
+#define SENDER 0x12ABCD
+
+TEST(v3_round_trip_all_types) {
+  uint8_t out[NOW_WIRE_MAX];
+  const uint8_t payload[] = { 1, 2, 3, 4, 5 };
+  for (uint8_t type = 0; type < PKT_TYPE_COUNT; type++) {
+    size_t n = mochiWireEncode(out, type, SENDER, 77, payload, sizeof(payload));
+    bool reliable = mochiWireReliable(type);
+    CHECK_EQ(n, NOW_WIRE_HEADER_SIZE + (reliable ? 1 : 0) + sizeof(payload));
+    CHECK(mochiWireCheck(out, n));
+
+    NowPacketView v;
+    CHECK(mochiWireParse(out, n, &v));
+    CHECK_EQ(v.type, type);
+    CHECK_EQ(v.version, NOW_WIRE_VERSION);
+    CHECK_EQ(v.sender, SENDER);
+    CHECK_EQ(v.hasSeq, reliable);
+    if (reliable) CHECK_EQ(v.seq, 77);
+    CHECK_EQ(v.payloadLen, sizeof(payload));
+    CHECK(memcmp(v.payload, payload, sizeof(payload)) == 0);
+  }
+}
+
+TEST(announce_is_four_bytes) {
+  uint8_t out[NOW_WIRE_MAX];
+  CHECK_EQ(mochiWireEncode(out, PKT_ANNOUNCE, SENDER, 0, nullptr, 0), 4);
+  NowPacketView v;
+  CHECK(mochiWireParse(out, 4, &v));
+  CHECK_EQ(v.payloadLen, 0);
+}
+
+TEST(payload_limit) {
+  uint8_t out[NOW_WIRE_MAX];
+  uint8_t big[NOW_WIRE_MAX] = { 0 };
+  CHECK_EQ(mochiWireEncode(out, PKT_VISIT, SENDER, 1, big, NOW_WIRE_PAYLOAD_MAX), NOW_WIRE_MAX);
+  CHECK_EQ(mochiWireEncode(out, PKT_VISIT, SENDER, 1, big, NOW_WIRE_PAYLOAD_MAX + 1), 0);
+}
+
+TEST(check_rejects_garbage) {
+  const uint8_t unknownVersion[] = { 0x57, 0, 0, 0, 0 };
+  CHECK(!mochiWireCheck(unknownVersion, sizeof(unknownVersion)));
+  const uint8_t badType[] = { (NOW_WIRE_VERSION << 4) | 0x0F, 0, 0, 0, 0 };
+  CHECK(!mochiWireCheck(badType, sizeof(badType)));
+  const uint8_t noSeq[] = { (NOW_WIRE_VERSION << 4) | PKT_VISIT, 1, 2, 3 };
+  CHECK(!mochiWireCheck(noSeq, sizeof(noSeq)));
+  CHECK(!mochiWireCheck(noSeq, 0));
+  const uint8_t shortV1[] = { PKT_VISIT, 0, 'M' };
+  CHECK(!mochiWireCheck(shortV1, sizeof(shortV1)));
+  // La v1 non ha ack: un PKT_LINK_ACK v1 non ha nemmeno il seq da leggere
+  MochiPacket ackV1 = {};
+  ackV1.type = PKT_LINK_ACK;
+  strcpy(ackV1.id, "MOCHI-12ABCD");
+  CHECK(!mochiWireCheck((const uint8_t*)&ackV1, sizeof(ackV1)));
+  NowPacketView v;
+  CHECK(!mochiWireParse((const uint8_t*)&ackV1, sizeof(ackV1), &v));
+}
+
+// La v2 non aveva il seq: si decodifica senza e non va confermata.
+TEST(v2_without_seq) {
+  const uint8_t visit[] = { (NOW_WIRE_VERSION_V2 << 4) | PKT_VISIT, 0xCD, 0xAB, 0x12, 1, 17, 2 };
+  NowPacketView v;
+  CHECK(mochiWireParse(visit, sizeof(visit), &v));
+  CHECK_EQ(v.version, 2);
+  CHECK_EQ(v.type, PKT_VISIT);
+  CHECK_EQ(v.sender, SENDER);
+  CHECK(!v.hasSeq);
+  CHECK_EQ(v.payloadLen, 3);
+  CHECK_EQ(v.payload[0], 1);
+
+  const uint8_t announce[] = { (NOW_WIRE_VERSION_V2 << 4) | PKT_ANNOUNCE, 0xCD, 0xAB, 0x12 };
+  CHECK(mochiWireParse(announce, sizeof(announce), &v));
+  CHECK_EQ(v.payloadLen, 0);
+
+  // PKT_LINK_ACK e' nato con la v3
+  const uint8_t ack[] = { (NOW_WIRE_VERSION_V2 << 4) | PKT_LINK_ACK, 0xCD, 0xAB, 0x12, 5 };
+  CHECK(!mochiWireCheck(ack, sizeof(ack)));
+}
+
+// I Mochi non aggiornati parlano ancora v1: si decodifica e si sa produrre.
+TEST(v1_legacy) {
+  uint8_t out[NOW_WIRE_MAX];
+  const char json[] = "{\"age\":2}";
+  size_t n = mochiWireEncode(out, PKT_VISIT, SENDER, 0, json, strlen(json), true);
+  CHECK_EQ(n, sizeof(MochiPacket));
+  NowPacketView v;
+  CHECK(mochiWireParse(out, n, &v));
+  CHECK_EQ(v.version, 1);
+  CHECK_EQ(v.sender, SENDER);
+  CHECK(!v.hasSeq);
+  CHECK_EQ(v.payloadLen, strlen(json));
+  CHECK(memcmp(v.payload, json, v.payloadLen) == 0);
+
+  const uint8_t ok = 1;
+  n = mochiWireEncode(out, PKT_VISIT_ACK, SENDER, 0, &ok, 1, true);
+  CHECK(mochiWireParse(out, n, &v));
+  CHECK_EQ(v.type, PKT_VISIT_ACK);
+  CHECK_EQ(v.payloadLen, 1);
+  CHECK_EQ(v.payload[0], 1);
+
+  // Id non valido: il pacchetto si scarta.
+  ((MochiPacket*)out)->id[0] = 'X';
+  CHECK(!mochiWireParse(out, n, &v));
+}
+
+// Tempo in aria con il modello del simulatore (1 Mbps, intestazioni 802.11).
+static unsigned airUs(size_t len) { return (len + SIM_FRAME_OVERHEAD) * 8 * 1000 / SIM_BITRATE_KBPS; }
+
+// Byte e tempo in aria di ogni tipo in v1 e v3, e costo della callback di
+// ricezione (controllo + copia nella coda, come MochiNow::onRadioRecv) e del
+// parse sul loop.
+TEST(bench_airtime_and_rx_cost) {
+  NowVisitRecord rec = {};
+  rec.version = VISIT_RECORD_VERSION;
+  rec.size = sizeof(rec);
+  const uint8_t ok = 1, seq = 9;
+  const char* names[PKT_TYPE_COUNT] = { "annuncio", "visita", "ack visita", "richiesta", "accetta",
+                                        "rimuovi", "fine visita", "ack link" };
+  uint8_t v1[NOW_WIRE_MAX], v3[NOW_WIRE_MAX];
+  size_t total1 = 0, total3 = 0;
+  for (uint8_t type = 0; type < PKT_TYPE_COUNT; type++) {
+    const void* p = nullptr;
+    size_t n = 0;
+    if (type == PKT_VISIT) { p = &rec; n = sizeof(rec); }
+    if (type == PKT_VISIT_ACK) { p = &ok; n = 1; }
+    if (type == PKT_LINK_ACK) { p = &seq; n = 1; }
+    size_t n3 = mochiWireEncode(v3, type, SENDER, 1, p, n);
+    size_t n1 = type == PKT_LINK_ACK ? 0 : mochiWireEncode(v1, type, SENDER, 0, p, n, true);
+    CHECK(n3 > 0 && n3 < 32);
+    if (type == PKT_ANNOUNCE) CHECK(n3 < 16);
+    total1 += n1;
+    total3 += n3;
+    BENCH_REPORT("%-12s v1 %3u B %4u us | v3 %2u B %3u us", names[type], (unsigned)n1, n1 ? airUs(n1) : 0,
+                 (unsigned)n3, airUs(n3));
+  }
+  CHECK(total3 * 5 < total1);
+
+  static MochiRing<NowRxSlot, NOW_RX_QUEUE_LEN> q;
+  const uint8_t mac[6] = { 2, 0, 0, 0, 0, 1 };
+  const int N = 200000;
+  for (int legacy = 1; legacy >= 0; legacy--) {
+    size_t n = mochiWireEncode(v3, PKT_ANNOUNCE, SENDER, 0, nullptr, 0, legacy);
+    uint32_t sum = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < N; i++) {
+      if (!mochiWireCheck(v3, n)) continue;
+      NowRxSlot* s = q.beginPush();
+      memcpy(s->mac, mac, 6);
+      s->len = n < sizeof(s->data) ? n : sizeof(s->data);
+      memcpy(s->data, v3, s->len);
+      q.endPush();
+      NowRxSlot* f = q.front();
+      NowPacketView v;
+      if (mochiWireParse(f->data, f->len, &v)) sum += v.sender;
+      q.pop();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / N;
+    CHECK_EQ(sum, (uint32_t)(SENDER * (uint32_t)N));
+    BENCH_REPORT("rx annuncio %s (%u B): %.0f ns tra callback e parse", legacy ? "v1" : "v3", (unsigned)n, ns);
+  }
+}
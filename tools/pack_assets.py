@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+# Genera il pack degli asset (bin/assets.bin) da flashare nella partizione
+# "assets" (vedi src/Mochi_mouse_v5/partitions.csv e MochiAssets.h).
+#
+#   python3 tools/pack_assets.py --out bin/assets.bin
+#
+# Solo libreria standard: gli sprite sono rasterizzati qui con le stesse
+# forme che MochiView disegnava a runtime, i colori vengono letti da Settings.h.
+
+import argparse
+import math
+import os
+import re
+import struct
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SETTINGS_H = os.path.join(ROOT, "src", "Mochi_mouse_v5", "Settings.h")
+
+MAGIC = b"MAS1"
+HEADER = struct.Struct("<4sHHI")   # magic, count, reserved, totalSize
+ENTRY = struct.Struct("<HBBHHII")  # id, format, reserved, w, h, offset, size
+
+# ID e formati: tenere allineato con MochiAssets.h
+ASSET_EGG_0 = 1
+ASSET_EASE_BG = 16
+FMT_RGB565_SWAPPED = 1
+FMT_U16_TABLE = 2
+
+TRANSPARENT = 0xF81F  # Colore chiave di pushRotateZoom in MochiView::drawEgg
+BG_ROWS = 172         # Righe dello sfondo (altezza del display)
+
+
+def read_colors():
+    colors = {}
+    with open(SETTINGS_H, encoding="utf-8") as f:
+        for m in re.finditer(r"#define\s+(K_\w+)\s+(0x[0-9A-Fa-f]+)", f.read()):
+            colors[m.group(1)] = int(m.group(2), 16)
+    return colors
+
+
+class Canvas:
+    def __init__(self, w, h, fill):
+        self.w, self.h = w, h
+        self.px = [fill] * (w * h)
+
+    def set(self, x, y, c):
+        if 0 <= x < self.w and 0 <= y < self.h:
+            self.px[y * self.w + x] = c
+
+    def fill_ellipse(self, cx, cy, rx, ry, c):
+        for y in range(cy - ry, cy + ry + 1):
+            for x in range(cx - rx, cx + rx + 1):
+                if ((x - cx) / rx) ** 2 + ((y - cy) / ry) ** 2 <= 1.0:
+                    self.set(x, y, c)
+
+    def fill_circle(self, cx, cy, r, c):
+        self.fill_ellipse(cx, cy, r, r, c)
+
+    def line(self, x0, y0, x1, y1, c):
+        dx, dy = abs(x1 - x0), -abs(y1 - y0)
+        sx, sy = (1 if x0 < x1 else -1), (1 if y0 < y1 else -1)
+        err = dx + dy
+        while True:
+            self.set(x0, y0, c)
+            if x0 == x1 and y0 == y1:
+                break
+            e2 = 2 * err
+            if e2 >= dy:
+                err += dy
+                x0 += sx
+            if e2 <= dx:
+                err += dx
+                y0 += sy
+
+    def rgb565_swapped(self):
+        # LGFX_Sprite a 16 bit tiene i pixel in big endian
+        return b"".join(struct.pack(">H", c) for c in self.px)
+
+
+def egg_sprite(colors, stage):
+    """Uovo come in MochiView::drawEgg: stage 0 = intero, 1..3 = crepe."""
+    rx, ry = 35, 45
+    w, h = rx * 2 + 10, ry * 2 + 10
+    scx, scy = w // 2, h // 2
+    cv = Canvas(w, h, TRANSPARENT)
+    cv.fill_ellipse(scx, scy, rx, ry, colors["K_WHITE"])
+    for dx, dy, r in ((-15, 10, 5), (12, -15, 7), (18, 20, 3), (-8, -25, 4)):
+        cv.fill_circle(scx + dx, scy + dy, r, colors["K_PROG_BG"])
+
+    top = scy - ry + 5
+    crack = [
+        ((scx, top), (scx - 8, top + 15)),
+        ((scx - 8, top + 15), (scx + 8, top + 30)),
+        ((scx + 8, top + 30), (scx - 4, top + 45)),
+    ]
+    for (x0, y0), (x1, y1) in crack[:stage]:
+        cv.line(x0, y0, x1, y1, colors["K_WRINKLE"])
+        cv.line(x0 + 1, y0, x1 + 1, y1, colors["K_WRINKLE"])  # Per spessore
+    return w, h, cv.rgb565_swapped()
+
+
+def ease_table():
+    out = []
+    for i in range(BG_ROWS):
+        ratio = i / (BG_ROWS - 1)
+        out.append(round((1.0 - math.cos(ratio * math.pi)) / 2.0 * 65535))
+    return struct.pack("<%dH" % BG_ROWS, *out)
+
+
+def build():
+    colors = read_colors()
+    assets = []
+    for stage in range(4):
+        w, h, data = egg_sprite(colors, stage)
+        assets.append((ASSET_EGG_0 + stage, FMT_RGB565_SWAPPED, w, h, data))
+    assets.append((ASSET_EASE_BG, FMT_U16_TABLE, BG_ROWS, 1, ease_table()))
+
+    offset = HEADER.size + ENTRY.size * len(assets)
+    table, blobs = [], []
+    for aid, fmt, w, h, data in assets:
+        offset = (offset + 3) & ~3
+        table.append(ENTRY.pack(aid, fmt, 0, w, h, offset, len(data)))
+        blobs.append((offset, data))
+        offset += len(data)
+
+    pack = bytearray(offset)
+    pack[0:HEADER.size] = HEADER.pack(MAGIC, len(assets), 0, offset)
+    pos = HEADER.size
+    for t in table:
+        pack[pos:pos + ENTRY.size] = t
+        pos += ENTRY.size
+    for off, data in blobs:
+        pack[off:off + len(data)] = data
+    return bytes(pack), len(assets)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Genera il pack degli asset del Mochi")
+    ap.add_argument("--out", default=os.path.join(ROOT, "bin", "assets.bin"))
+    args = ap.parse_args()
+
+    pack, count = build()
+    os.makedirs(os.path.dirname(os.path.abspath(args.out)), exist_ok=True)
+    with open(args.out, "wb") as f:
+        f.write(pack)
+    print("%d asset, %d byte -> %s" % (count, len(pack), args.out))
+
+
+if __name__ == "__main__":
+    main()
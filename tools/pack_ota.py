@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+# Genera l'immagine compressa per l'aggiornamento firmware via BLE
+# (bin/firmware.ota, vedi src/Mochi_mouse_v5/MochiOta.h e otaUpdate() in connect.js).
+#
+#   python3 tools/pack_ota.py --app bin/Mochi_mouse_v5.ino.bin --out bin/firmware.ota
+#
+# Solo libreria standard. Formato: header da 44 byte seguito dallo stream zlib
+# dell'immagine dell'app; lo SHA-256 e' quello dell'immagine decompressa, che
+# il device ricalcola mentre scrive la partizione.
+
+import argparse
+import hashlib
+import os
+import struct
+import zlib
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+MAGIC = b"MOTA"
+HEADER = struct.Struct("<4sII32s")  # magic, rawSize, compSize, sha256
+APP_SLOT_SIZE = 0x1C0000            # Slot ota_0/ota_1 di partitions.csv
+
+
+def pack(app):
+    comp = zlib.compress(app, 9)
+    digest = hashlib.sha256(app).digest()
+    return HEADER.pack(MAGIC, len(app), len(comp), digest) + comp, len(comp)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Genera l'immagine OTA compressa del Mochi")
+    ap.add_argument("--app", default=os.path.join(ROOT, "bin", "Mochi_mouse_v5.ino.bin"))
+    ap.add_argument("--out", default=os.path.join(ROOT, "bin", "firmware.ota"))
+    args = ap.parse_args()
+
+    with open(args.app, "rb") as f:
+        app = f.read()
+    if len(app) > APP_SLOT_SIZE:
+        raise SystemExit("app di %d byte: non entra nello slot OTA (%d)" % (len(app), APP_SLOT_SIZE))
+
+    image, comp = pack(app)
+    os.makedirs(os.path.dirname(os.path.abspath(args.out)), exist_ok=True)
+    with open(args.out, "wb") as f:
+        f.write(image)
+    print("%d byte -> %d compressi (%.0f%%) -> %s" % (len(app), comp, 100.0 * comp / max(len(app), 1), args.out))
+
+
+if __name__ == "__main__":
+    main()